@@ -5,8 +5,10 @@
 #include "CompileSpin.h"
 #include "textconvert.h"
 #include "preprocess.h"
+#include "CompilerContext.h"
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <vector>
 #include <map>
@@ -77,10 +79,12 @@ struct AL_DistRec
 class AL_Object
     {
 public:
-    AL_Object (const char *psFile, const char *psPath);             // Constructor
+    AL_Object (const char *psFile, const char *psPath,
+        const char *psSourceKey);                                   // Constructor
     ~AL_Object () {}                                                // Destructor
     const std::string *File (void) const { return &m_sFile; }       // Get source file name
     const std::string *Path (void) const { return &m_sPath; }       // Get path to source file
+    const std::string *SourceKey (void) const { return &m_sSourceKey; } // Get source cache key
     void *PreProc (void) const { return m_ppstate; }                // Pre-processor define state
     void Restart (void);                                            // Restart compilation
     void AddLine (AL_Type at, int posn, int addr, int caddr);       // Add location of a source line
@@ -96,12 +100,13 @@ public:
     int DistillAddr (int addr);                                     // Translate distilled address
     void PlaceLines (const AL_Object *pobj, int nOffset);           // Place source lines at addresses
     void ListVariables (const std::string *psName, int &addr) const;// List variable locations
-    void Output (const unsigned char *pBinary, int nSize,
-        const struct CompilerData *pcd);                            // Output listing
+    const AL_Object *Output (const unsigned char *pBinary, int nSize,
+        const struct CompilerData *pcd);                            // Output listing, NULL or object not reloaded
     
 private:
     std::string m_sFile;                                            // Source file of object
     std::string m_sPath;                                            // Path of source file
+    std::string m_sSourceKey;                                       // Source cache key the object was compiled under
     int m_posnLast;                                                 // Position of last source line
     void *m_ppstate;                                                // Preprocessor state
     std::map<int, AL_SourceLine> m_lines;                           // Source lines for the object
@@ -115,43 +120,99 @@ private:
     bool m_bFixup;                                                  // True if distillation fixup required
     };
 
-// Global data:
-static bool g_bSelected = false;                    // Annotated output requested
-static bool g_bEnable = false;                      // Collection of data enabled
-static AL_Object * g_alobj = NULL;                  // Current object
-static const char *g_pSource = NULL;                // Pointer to source in compiler
-static std::map<int, AL_Object *> g_alheap;         // Object heap
-static std::map<int, AL_Object *> g_objs;           // Objects on obj_data
-static const AL_Object *g_pobjFile = NULL;          // Object of currently loaded source file
-static char *g_pFileSrc = NULL;                     // Source code loaded from file
-static struct preprocess *g_preprocessor = NULL;    // File preprocessor data
-static std::string g_sListFile;                     // Name of list file (or "-" for stdout)
-static FILE *g_pfilList = NULL;                     // List output file stream
+// Annotation data, kept in the CompilerContext:
+struct AL_Data
+    {
+    AL_Data ()
+        : bSelected (false), bEnable (false), alobj (NULL), pSource (NULL),
+        pobjFile (NULL), pFileSrc (NULL), preprocessor (NULL), pfilList (NULL)
+        {}
+    bool bSelected;                             // Annotated output requested
+    bool bEnable;                               // Collection of data enabled
+    AL_Object * alobj;                          // Current object
+    const char *pSource;                        // Pointer to source in compiler
+    std::map<int, AL_Object *> alheap;          // Object heap
+    std::map<int, AL_Object *> objs;            // Objects on obj_data
+    const AL_Object *pobjFile;                  // Object of currently loaded source file
+    char *pFileSrc;                             // Source code loaded from file
+    struct preprocess *preprocessor;            // File preprocessor data
+    std::string sListFile;                      // Name of list file (or "-" for stdout)
+    FILE *pfilList;                             // List output file stream
+    std::string sListing;                       // Listing for the compiler's PrintFunc, when there is no stream
+    };
+
+// Write to the listing
+static void AL_Printf (AL_Data *pal, const char *psFormat, ...)
+    {
+    va_list args;
+    va_start (args, psFormat);
+    if ( pal->pfilList != NULL )
+        {
+        vfprintf (pal->pfilList, psFormat, args);
+        }
+    else
+        {
+        char sText[256];
+        va_list argsCopy;
+        va_copy (argsCopy, args);
+        int nLength = vsnprintf (sText, sizeof (sText), psFormat, argsCopy);
+        va_end (argsCopy);
+        if ( nLength < (int) sizeof (sText) )
+            {
+            pal->sListing += sText;
+            }
+        else
+            {
+            std::vector<char> text (nLength + 1);
+            vsnprintf (&text[0], nLength + 1, psFormat, args);
+            pal->sListing += &text[0];
+            }
+        }
+    va_end (args);
+    }
+
+// Create annotation data for a CompilerContext
+AL_Data *AL_CreateData (void)
+    {
+    return new AL_Data;
+    }
+
+// Delete annotation data of a CompilerContext
+void AL_DeleteData (AL_Data *pal)
+    {
+    if ( ( pal->alobj != NULL ) && ( ! pal->alobj->GetOnHeap () ) ) delete pal->alobj;
+    std::map<int, AL_Object *>::iterator it;
+    for (it = pal->alheap.begin (); it != pal->alheap.end (); ++it)
+        delete it->second;
+    if (pal->pFileSrc != NULL) delete [] pal->pFileSrc;
+    delete pal;
+    }
 
 // Global functions:
 // Request collection of annotation data
 void AL_Request (AL_Mode mode, const char *psName)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     const char *psExt;
     switch (mode)
         {
         case amConsole:
-            g_sListFile = "-";
-            g_bSelected = true;
+            pal->sListFile = "-";
+            pal->bSelected = true;
             break;
         case amOutput:
             psExt = strrchr (psName, '.');
-            if ( psExt ) g_sListFile = std::string (psName, psExt - psName);
-            else g_sListFile = psName;
-            g_sListFile += ".lst";
-            g_bSelected = true;
+            if ( psExt ) pal->sListFile = std::string (psName, psExt - psName);
+            else pal->sListFile = psName;
+            pal->sListFile += ".lst";
+            pal->bSelected = true;
             break;
         case amFile:
-            g_sListFile = psName;
-            g_bSelected = true;
+            pal->sListFile = psName;
+            pal->bSelected = true;
             break;
         default:
-            g_bSelected = false;
+            pal->bSelected = false;
             break;
         }
     }
@@ -159,85 +220,98 @@ void AL_Request (AL_Mode mode, const char *psName)
 // Enable collection of annotation data
 void AL_Enable (bool bEnable)
     {
-    if (bEnable) g_bEnable = g_bSelected;
-    else g_bEnable = false;
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if (bEnable) pal->bEnable = pal->bSelected;
+    else pal->bEnable = false;
+    }
+
+// Test whether an annotated listing was requested
+bool AL_Selected (void)
+    {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    return pal->bSelected;
     }
 
 // Open annotation data for a given object
-void AL_OpenObject (const char *psFile, const struct CompilerData *pcd, struct preprocess *preproc)
+void AL_OpenObject (const char *psFile, const struct CompilerData *pcd, struct preprocess *preproc, const char *psSourceKey)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pal->bEnable )
         {
-        g_preprocessor = preproc;
-        if (( g_alobj == NULL ) || ( *g_alobj->File () != psFile ))
-            {
-            if ( ( g_alobj != NULL ) && ( ! g_alobj->GetOnHeap () ) ) delete g_alobj;
-            g_alobj = new AL_Object (psFile, pcd->current_file_path);
-            }
-        g_pSource = pcd->source;
+        pal->preprocessor = preproc;
+        // Always start afresh, sub-objects reused from the heap are not opened
+        // so the first pass of a parent object may still be current
+        if ( ( pal->alobj != NULL ) && ( ! pal->alobj->GetOnHeap () ) ) delete pal->alobj;
+        pal->alobj = new AL_Object (psFile, pcd->current_file_path, psSourceKey);
+        pal->pSource = pcd->source;
         }
     }
 
 // Associate a code line with an address
 void AL_AddLine (AL_Type at, int posn, int addr, int caddr)
     {
-    if ( ( g_bEnable ) && ( g_alobj != NULL ) )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->bEnable ) && ( pal->alobj != NULL ) )
         {
         // Find beginning of line
         while (posn > 0)
             {
-            if ( g_pSource[posn - 1] == '\r' ) break;
+            if ( pal->pSource[posn - 1] == '\r' ) break;
             --posn;
             }
         // Add it
-        g_alobj->AddLine (at, posn, addr, caddr);
+        pal->alobj->AddLine (at, posn, addr, caddr);
         }
     }
 
 // Set a data type for a given address
 void AL_SetType (AL_Type at, int addr)
     {
-    if ( ( g_bEnable ) && ( g_alobj != NULL ) )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->bEnable ) && ( pal->alobj != NULL ) )
         {
-        g_alobj->SetType (at, addr);
+        pal->alobj->SetType (at, addr);
         }
     }
 
 // Save Code Symbols
 void AL_Routine (int posn)
     {
-    if ( ( g_bEnable ) && ( g_alobj != NULL ) )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->bEnable ) && ( pal->alobj != NULL ) )
         {
         // Find beginning of line
         while (posn > 0)
             {
-            if ( g_pSource[posn - 1] == '\r' ) break;
+            if ( pal->pSource[posn - 1] == '\r' ) break;
             --posn;
             }
         // Add it
-        g_alobj->AddRoutine (posn);
+        pal->alobj->AddRoutine (posn);
         }
     }
 
 // Add an Object Variable
 void AL_Variable (const char *psName, int nSize, int nCount)
     {
-    if ( ( g_bEnable ) && ( g_alobj != NULL ) )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->bEnable ) && ( pal->alobj != NULL ) )
         {
-        g_alobj->AddVariable (psName, nSize, nCount);
+        pal->alobj->AddVariable (psName, nSize, nCount);
         }
     }
 
 // Add a Sub-Object reference
 void AL_SubObject (int posn, const char *psName, const char *psObject, int nCount)
     {
-    if ( ( g_bEnable ) && ( g_alobj != NULL ) )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->bEnable ) && ( pal->alobj != NULL ) )
         {
         std::string sFile = psObject;
         sFile += ".spin";
         AL_Object *pobj = NULL;
         std::map<int, AL_Object *>::iterator it;
-        for (it = g_alheap.begin (); it != g_alheap.end (); ++it)
+        for (it = pal->alheap.begin (); it != pal->alheap.end (); ++it)
             {
             if ( *(it->second->File ()) == sFile )
                 {
@@ -245,167 +319,142 @@ void AL_SubObject (int posn, const char *psName, const char *psObject, int nCoun
                 break;
                 }
             }
-        if ( pobj != NULL ) g_alobj->AddSubObject (posn, psName, pobj, nCount);
+        if ( pobj != NULL ) pal->alobj->AddSubObject (posn, psName, pobj, nCount);
         }
     }
 
 // Add current object to heap
 void AL_AddToHeap (int nHeap)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pal->bEnable )
         {
-        g_alobj->SetOnHeap(true);
-        g_alheap[nHeap] = g_alobj;
+        pal->alobj->SetOnHeap(true);
+        pal->alheap[nHeap] = pal->alobj;
         }
     }
 
 // Restore object from heap
 void AL_CopyFromHeap (int nHeap, int nIndex)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pal->bEnable )
         {
-        g_objs[nIndex] = g_alheap[nHeap];
+        pal->objs[nIndex] = pal->alheap[nHeap];
         }
     }
 
 // Include object
 void AL_Include (int nIndex, int nOffset, int nSize)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pal->bEnable )
         {
-        g_alobj->Include (g_objs[nIndex], nOffset);
+        pal->alobj->Include (pal->objs[nIndex], nOffset);
         }
     }
 
 // Define a distillation block
 void AL_Distill (int start, int length, int reloc)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pal->bEnable )
         {
-        g_alobj->AddDistill (start, start + length, reloc - start);
+        pal->alobj->AddDistill (start, start + length, reloc - start);
         }
     }
 
 // Free all allocated memory
 void AL_Reset (void)
     {
-    if ( ( g_alobj != NULL ) && ( ! g_alobj->GetOnHeap () ) ) delete g_alobj;
-    g_alobj = NULL;
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( ( pal->alobj != NULL ) && ( ! pal->alobj->GetOnHeap () ) ) delete pal->alobj;
+    pal->alobj = NULL;
     std::map<int, AL_Object *>::iterator it;
-    for (it = g_alheap.begin (); it != g_alheap.end (); ++it)
+    for (it = pal->alheap.begin (); it != pal->alheap.end (); ++it)
         delete it->second;
-    g_alheap.clear ();
-    g_objs.clear ();
-    g_bSelected = false;
-    g_bEnable = false;
-    g_pSource = NULL;
-    g_pobjFile = NULL;
-    if (g_pFileSrc != NULL) free (g_pFileSrc);
-    g_pFileSrc = NULL;
-    g_preprocessor = NULL;
-    g_sListFile.clear ();
-    g_pfilList = NULL;
+    pal->alheap.clear ();
+    pal->objs.clear ();
+    pal->bSelected = false;
+    pal->bEnable = false;
+    pal->pSource = NULL;
+    pal->pobjFile = NULL;
+    if (pal->pFileSrc != NULL) delete [] pal->pFileSrc;
+    pal->pFileSrc = NULL;
+    pal->preprocessor = NULL;
+    pal->sListFile.clear ();
+    pal->pfilList = NULL;
+    pal->sListing.clear ();
     }
 
 // Output the annotated listing
-void AL_Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd)
+bool AL_Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd, std::string &sFailedSource)
     {
-    if ( g_bEnable )
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    const AL_Object *pobjFailed = NULL;
+    if ( pal->bEnable )
         {
-        if ( g_sListFile == "-" )
+        if ( ( pal->sListFile == "-" ) && ( g_pCompilerContext->pPrintFunc != NULL ) )
             {
-            g_pfilList = stdout;
-            g_alobj->Output (pBinary, nSize, pcd);
+            pobjFailed = pal->alobj->Output (pBinary, nSize, pcd);
+            if ( pobjFailed == NULL )
+                g_pCompilerContext->pPrintFunc (g_pCompilerContext->pUserData, coListing, pal->sListing.c_str ());
+            }
+        else if ( pal->sListFile == "-" )
+            {
+            pal->pfilList = stdout;
+            pobjFailed = pal->alobj->Output (pBinary, nSize, pcd);
             }
         else
             {
-            g_pfilList = fopen (g_sListFile.c_str (), "w");
-            if ( g_pfilList != NULL )
+            pal->pfilList = fopen (pal->sListFile.c_str (), "w");
+            if ( pal->pfilList != NULL )
                 {
-                g_alobj->Output (pBinary, nSize, pcd);
-                fclose (g_pfilList);
+                pobjFailed = pal->alobj->Output (pBinary, nSize, pcd);
+                fclose (pal->pfilList);
+                // No partial listings
+                if ( pobjFailed != NULL ) remove (pal->sListFile.c_str ());
                 }
             }
         }
+    if ( pobjFailed != NULL ) sFailedSource = *pobjFailed->Path ();
     AL_Reset ();
+    return pobjFailed == NULL;
     }
 
 // Load source file - Unfortunately GetPASCIISource has a fixed destination,
-// so we have to duplicate the functionality here
+// so the compiler gives us our own copy, as it converted it
 static bool AL_LoadSource (const AL_Object *pobj)
     {
-    if ( pobj == g_pobjFile ) return true;
-    g_pobjFile = NULL;
-    if ( g_pFileSrc != NULL )
-        {
-        free (g_pFileSrc);
-        g_pFileSrc = NULL;
-        }
-    // read in file to temp buffer and convert to PASCII
-    FILE *pfil = fopen (pobj->Path ()->c_str (), "r");
-    if ( pfil == NULL ) return false;
-    fseek (pfil, 0, SEEK_END);
-    int nLength = ftell (pfil);
-    fseek (pfil, 0, SEEK_SET);
-    char *praw = (char *) malloc (nLength + 1);
-    if ( praw == NULL )
-        {
-        fclose (pfil);
-        return false;
-        }
-    int nRead = fread (praw, 1, nLength, pfil);
-    fclose (pfil);
-    if ( nRead != nLength )
-        {
-        free (praw);
-        return false;
-        }
-    praw[nLength] = '\0';
-    char *psrc = praw;
-    if ( pobj->PreProc () )
-        {
-        memoryfile mfile;
-        mfile.buffer = praw;
-        mfile.length = nLength;
-        mfile.readoffset = 0;
-        pp_restore_define_state (g_preprocessor, pobj->PreProc ());
-        pp_push_file_struct (g_preprocessor, &mfile, pobj->File ()->c_str ());
-        pp_run (g_preprocessor);
-        psrc = pp_finish (g_preprocessor);
-        nLength = (int) strlen (psrc);
-        if (nLength > 0)
-            {
-            free (praw);
-            praw = NULL;
-            }
-        else
-            {
-            free (psrc);
-            psrc = praw;
-            }
-        }
-    bool bResult = false;
-    g_pFileSrc = (char *) calloc (nLength + 1, 1);
-    if ( g_pFileSrc != NULL )
-        bResult = UnicodeToPASCII(psrc, nLength, g_pFileSrc, g_preprocessor != NULL);
-    free (psrc);
-    if (bResult)
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    if ( pobj == pal->pobjFile ) return true;
+    pal->pobjFile = NULL;
+    if ( pal->pFileSrc != NULL )
         {
-        g_pobjFile = pobj;
-        fprintf (g_pfilList, "                       File \"%s\"\n", pobj->File ()->c_str ());
+        delete [] pal->pFileSrc;
+        pal->pFileSrc = NULL;
         }
-    return bResult;
+    // preprocessed with the defines it was compiled with, if any
+    if ( pobj->PreProc () ) pp_restore_define_state (pal->preprocessor, pobj->PreProc ());
+    bool bResult = true;
+    pal->pFileSrc = GetListingSource (pobj->SourceKey ()->c_str (), pobj->Path ()->c_str (), pobj->File ()->c_str (),
+        ( pobj->PreProc () ? pal->preprocessor : NULL ), pal->preprocessor != NULL, &bResult);
+    if ( pal->pFileSrc == NULL ) return false;
+    pal->pobjFile = pobj;
+    AL_Printf (pal, "                       File \"%s\"\n", pobj->File ()->c_str ());
+    return true;
     }
 
 // Print a line of source code
 static void AL_Print (int iCh)
     {
-    while ((g_pFileSrc[iCh] != '\r') && (g_pFileSrc[iCh] != '\0'))
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
+    while ((pal->pFileSrc[iCh] != '\r') && (pal->pFileSrc[iCh] != '\0'))
         {
-        fprintf (g_pfilList, "%c", g_pFileSrc[iCh]);
+        AL_Printf (pal, "%c", pal->pFileSrc[iCh]);
         ++iCh;
         }
-    fprintf (g_pfilList, "\n");
+    AL_Printf (pal, "\n");
     }
 
 // Get a little-endian word from a byte array
@@ -456,13 +505,14 @@ static unsigned int AL_BLong (const unsigned char *pdata)
 // Get an address from a byte array
 unsigned int AL_Address (const unsigned char *pdata, bool bSigned, bool &bWord)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     unsigned int ll;
     unsigned char bl = pdata[0];
     if ( bl & 0x80 )
         {
         ll = bl;
         ll = ( ll << 8 ) | pdata[1];
-        fprintf (g_pfilList, " %02X %02X", bl, pdata[1]);
+        AL_Printf (pal, " %02X %02X", bl, pdata[1]);
         if ( bSigned )
             {
             if ( ! (bl & 0x40) ) ll &= 0x3FFF;
@@ -475,7 +525,7 @@ unsigned int AL_Address (const unsigned char *pdata, bool bSigned, bool &bWord)
         }
     else
         {
-        fprintf (g_pfilList, " %02X", bl);
+        AL_Printf (pal, " %02X", bl);
         ll = bl;
         if (( bSigned ) && ( bl & 0x40 )) ll |= 0xFFC0;
         bWord = false;
@@ -489,6 +539,7 @@ unsigned int AL_Address (const unsigned char *pdata, bool bSigned, bool &bWord)
 // from http://forums.parallax.com/discussion/111684/spin-bytecode
 static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     struct ByteCode
         {
         const char *psName;
@@ -768,7 +819,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
     while (addr < addrNext )
         {
         unsigned char bc = pBinary[addr];
-        fprintf (g_pfilList, "%04X     %02X", addr, bc);
+        AL_Printf (pal, "%04X     %02X", addr, bc);
         std::string sArgs = "";
         int nCol = 11;
         char sAddr[12];
@@ -781,12 +832,12 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
                 break;
             case ByteCode::op_Obj_Call_Pair:
                 bl = pBinary[++addr];
-                fprintf (g_pfilList, " %02X", bl);
+                AL_Printf (pal, " %02X", bl);
                 nCol += 3;
                 sprintf (sAddr, ", $%02X", bl);
                 sArgs += sAddr;
                 bl = pBinary[++addr];
-                fprintf (g_pfilList, " %02X", bl);
+                AL_Printf (pal, " %02X", bl);
                 nCol += 3;
                 sprintf (sAddr, ", $%02X", bl);
                 sArgs += sAddr;
@@ -796,14 +847,14 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
                 ll = 2 << ( bl & 0x1F );
                 if ( bl & 0x20 ) --ll;
                 if ( bl & 0x40 ) ll = ~ll;
-                fprintf (g_pfilList, " %02X", bl);
+                AL_Printf (pal, " %02X", bl);
                 nCol += 3;
                 sprintf (sAddr, ", $%08X", ll);
                 sArgs += sAddr;
                 break;
             case ByteCode::op_Byte_Literal:
                 bl = pBinary[++addr];
-                fprintf (g_pfilList, " %02X", bl);
+                AL_Printf (pal, " %02X", bl);
                 nCol += 3;
                 sprintf (sAddr, ", $%02X", bl);
                 sArgs += sAddr;
@@ -811,7 +862,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
             case ByteCode::op_Word_Literal:
                 ll = AL_BWord (&pBinary[++addr]);
                 ++addr;
-                fprintf (g_pfilList, " %04X", ll);
+                AL_Printf (pal, " %04X", ll);
                 nCol += 5;
                 sprintf (sAddr, ", $%04X", ll);
                 sArgs += sAddr;
@@ -819,7 +870,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
             case ByteCode::op_Near_Long_Literal:
                 ll = AL_BInt24 (&pBinary[++addr]);
                 addr += 2;
-                fprintf (g_pfilList, " %06X", ll);
+                AL_Printf (pal, " %06X", ll);
                 nCol += 7;
                 sprintf (sAddr, ", $%06X", ll);
                 sArgs += sAddr;
@@ -827,7 +878,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
             case ByteCode::op_Long_Literal:
                 ll = AL_BLong (&pBinary[++addr]);
                 addr += 3;
-                fprintf (g_pfilList, " %08X", ll);
+                AL_Printf (pal, " %08X", ll);
                 nCol += 9;
                 sprintf (sAddr, ", $%08X", ll);
                 sArgs += sAddr;
@@ -858,7 +909,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
                 // Deliberately falls through to next case
             case ByteCode::op_Effect:
                 bl = pBinary[++addr];
-                fprintf (g_pfilList, " %02X", bl);
+                AL_Printf (pal, " %02X", bl);
                 nCol += 3;
                 if ( bl & 0x40 )
                     {
@@ -921,10 +972,10 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
             }
         while (nCol < 22)
             {
-            fprintf (g_pfilList, " ");
+            AL_Printf (pal, " ");
             ++nCol;
             }
-        fprintf (g_pfilList, " ; %s%s\n", codes[bc].psName, sArgs.c_str ());
+        AL_Printf (pal, " ; %s%s\n", codes[bc].psName, sArgs.c_str ());
         ++addr;
         }
     }
@@ -932,6 +983,7 @@ static void AL_ByteCode (const unsigned char *pBinary, int addr, int addrNext)
 // List a section of binary data
 static void AL_Dump (const unsigned char *pBinary, AL_Type at, int addr, int addrNext, int caddr)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     if ( at == atSpinCode )
         {
         AL_ByteCode (pBinary, addr, addrNext);
@@ -940,9 +992,9 @@ static void AL_Dump (const unsigned char *pBinary, AL_Type at, int addr, int add
     if ( addr < addrNext )
         {
         if ((caddr >= 0) && (caddr < 0x800) && ((caddr & 0x03) == 0))
-            fprintf (g_pfilList, "%04X %03X", addr, caddr >> 2);
+            AL_Printf (pal, "%04X %03X", addr, caddr >> 2);
         else
-            fprintf (g_pfilList, "%04X    ", addr);
+            AL_Printf (pal, "%04X    ", addr);
         }
     int nByte = 0;
     while (addr < addrNext)
@@ -951,32 +1003,32 @@ static void AL_Dump (const unsigned char *pBinary, AL_Type at, int addr, int add
         if (( at == atWord ) && ( addr + 2 > addrNext )) at = atByte;
         if ( at == atLong )
             {
-            fprintf (g_pfilList, " %08X", AL_Long (&pBinary[addr]));
+            AL_Printf (pal, " %08X", AL_Long (&pBinary[addr]));
             addr += 4;
             if ( caddr >= 0 ) caddr += 4;
             }
         else if ( at == atWord )
             {
-            fprintf (g_pfilList, " %04X", AL_Word (&pBinary[addr]));
+            AL_Printf (pal, " %04X", AL_Word (&pBinary[addr]));
             addr += 2;
             if ( caddr >= 0 ) caddr += 2;
             }
         else
             {
-            fprintf (g_pfilList, " %02X", pBinary[addr]);
+            AL_Printf (pal, " %02X", pBinary[addr]);
             ++addr;
             if ( caddr >= 0 ) ++caddr;
             }
         if (( ++nByte >= 16 ) && (addr < addrNext))
             {
             if ((caddr >= 0) && (caddr < 0x800) && ((caddr & 0x03) == 0))
-                fprintf (g_pfilList, "\n%04X %03X", addr, caddr >> 2);
+                AL_Printf (pal, "\n%04X %03X", addr, caddr >> 2);
             else
-                fprintf (g_pfilList, "\n%04X    ", addr);
+                AL_Printf (pal, "\n%04X    ", addr);
             nByte = 0;
             }
         }
-    fprintf (g_pfilList, "\n");
+    AL_Printf (pal, "\n");
     }
 
 // AL_SourceLine Methods:
@@ -1037,12 +1089,14 @@ int AL_Point::GetLine (int index) const
 // AL_Object Methods:
 
 // Constructor
-AL_Object::AL_Object (const char *psFile, const char *psPath)
+AL_Object::AL_Object (const char *psFile, const char *psPath, const char *psSourceKey)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     m_sFile = psFile;
     m_sPath = psPath;
+    m_sSourceKey = psSourceKey;
     m_bOnHeap = false;
-    if (g_preprocessor) m_ppstate = pp_get_define_state(g_preprocessor);
+    if (pal->preprocessor) m_ppstate = pp_get_define_state(pal->preprocessor);
     else m_ppstate = NULL;
     m_bFixup = false;
     }
@@ -1121,10 +1175,11 @@ void AL_Object::PlaceLines (const AL_Object *pobj, int nOffset)
 // Output variable locations
 void AL_Object::ListVariables (const std::string *psName, int &addr) const
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     if ( m_variables[0].size () + m_variables[1].size () + m_variables[2].size () > 0 )
         {
         const char *psSize[] = { "byte", "word", "long" };
-        fprintf (g_pfilList, "                       Variables for %s (%s)\n", psName->c_str (), m_sFile.c_str ());
+        AL_Printf (pal, "                       Variables for %s (%s)\n", psName->c_str (), m_sFile.c_str ());
         addr = ( addr + 3 ) & 0xFFFC;
         int addrBase = addr;
         std::vector<std::pair<std::string, int> >::const_iterator it;
@@ -1132,10 +1187,10 @@ void AL_Object::ListVariables (const std::string *psName, int &addr) const
             {
             for (it = m_variables[iSize].begin (); it != m_variables[iSize].end (); ++it)
                 {
-                fprintf (g_pfilList, "%04X     %04X          %s %s", addr, addr - addrBase, psSize[iSize],
+                AL_Printf (pal, "%04X     %04X          %s %s", addr, addr - addrBase, psSize[iSize],
                     it->first.c_str ());
-                if ( it->second > 1 ) fprintf (g_pfilList, "[%d]\n", it->second);
-                else fprintf (g_pfilList, "\n");
+                if ( it->second > 1 ) AL_Printf (pal, "[%d]\n", it->second);
+                else AL_Printf (pal, "\n");
                 addr += ( it->second ) << iSize;
                 }
             }
@@ -1170,8 +1225,9 @@ void AL_Object::ListVariables (const std::string *psName, int &addr) const
     }
 
 // Output the annotated listing
-void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd)
+const AL_Object *AL_Object::Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd)
     {
+    AL_Data *pal = g_pCompilerContext->pAnnotateData;
     std::vector<int>adlist;
     std::map<int, AL_Point>::iterator it;
     const int iShift = 0x10;
@@ -1183,7 +1239,7 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
     std::sort (adlist.begin (), adlist.end ());
     int addr = 0;
     unsigned int iFreq = *((unsigned int *)(&pBinary[addr]));
-    fprintf (g_pfilList, "%04X     %08X      Frequency %d Hz\n", 0, iFreq, iFreq);
+    AL_Printf (pal, "%04X     %08X      Frequency %d Hz\n", 0, iFreq, iFreq);
     addr += 4;
     unsigned char bclk = pBinary[addr];
     std::string sClock = "Clock mode: ";
@@ -1202,15 +1258,15 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
         {
         sClock = ( bclk & 0x01 ) ? "RCSlow" : "RCFast";
         }
-    fprintf (g_pfilList, "%04X     %02X            %s\n", addr, bclk, sClock.c_str ());
+    AL_Printf (pal, "%04X     %02X            %s\n", addr, bclk, sClock.c_str ());
     ++addr;
-    fprintf (g_pfilList, "%04X     %02X            Check Sum\n", addr, pBinary[addr]);
+    AL_Printf (pal, "%04X     %02X            Check Sum\n", addr, pBinary[addr]);
     ++addr;
     static const char *psTop[] = { "Base of Program", "Base of Variables", "Base of Stack",
                                    "Initial Program Counter", "Initial Stack Pointer" };
     for (int i = 0; i < 5; ++i)
         {
-        fprintf (g_pfilList, "%04X     %04X          %s\n", addr, AL_Word(&pBinary[addr]), psTop[i]);
+        AL_Printf (pal, "%04X     %04X          %s\n", addr, AL_Word(&pBinary[addr]), psTop[i]);
         addr += 2;
         }
     size_t iPoint = 0;
@@ -1230,7 +1286,8 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
             char sCog[4];
             AL_Point &point = m_points[addr - iShift];
             const AL_Object *pobj = point.Object ();
-            AL_LoadSource (pobj);
+            // The listing can't go on without the source
+            if ( ! AL_LoadSource (pobj) ) return pobj;
             int nLine = point.Sort ();
             if ( nLine > 0 )
                 {
@@ -1256,9 +1313,9 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
                     at = line.Type ();
                     caddr = line.CogAddr ();
                     if (( at >= atDAT ) && ( caddr >= 0 ) && ( caddr < 0x800 ) && ((caddr & 0x03) == 0))
-                        fprintf (g_pfilList, "%04X %03X               ", addr, caddr >> 2);
+                        AL_Printf (pal, "%04X %03X               ", addr, caddr >> 2);
                     else
-                        fprintf (g_pfilList, "%04X                   ", addr);
+                        AL_Printf (pal, "%04X                   ", addr);
                     AL_Print (posn);
                     }
                 posn = order[nLine - 1];
@@ -1273,29 +1330,29 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
                     {
                     case atPASM:
                     case atLong:
-                        fprintf (g_pfilList, "%04X %s %08X      ", addr, sCog, AL_Long (&pBinary[addr]));
+                        AL_Printf (pal, "%04X %s %08X      ", addr, sCog, AL_Long (&pBinary[addr]));
                         addr += 4;
                         if (caddr >= 0) caddr += 4;
                         break;
                     case atSpinObj:
-                        fprintf (g_pfilList, "%04X %s %04X %04X     ", addr, sCog, AL_Word (&pBinary[addr]),
+                        AL_Printf (pal, "%04X %s %04X %04X     ", addr, sCog, AL_Word (&pBinary[addr]),
                             AL_Word (&pBinary[addr+2]));
                         addr += 4;
                         if (caddr >= 0) caddr += 4;
                         at = atWord;
                         break;
                     case atWord:
-                        fprintf (g_pfilList, "%04X %s %04X          ", addr, sCog, AL_Word (&pBinary[addr]));
+                        AL_Printf (pal, "%04X %s %04X          ", addr, sCog, AL_Word (&pBinary[addr]));
                         addr += 2;
                         if (caddr >= 0) caddr += 2;
                         break;
                     case atByte:
-                        fprintf (g_pfilList, "%04X %s %02X            ", addr, sCog, pBinary[addr]);
+                        AL_Printf (pal, "%04X %s %02X            ", addr, sCog, pBinary[addr]);
                         ++addr;
                         if (caddr >= 0) ++caddr;
                         break;
                     default:
-                        fprintf (g_pfilList, "%04X %s               ", addr, sCog);
+                        AL_Printf (pal, "%04X %s               ", addr, sCog);
                         break;
                     }
                 AL_Print (posn);
@@ -1313,13 +1370,13 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
                 }
             else
                 {
-                fprintf (g_pfilList, "%04X     %04X %04X     Link to Next Object\n",
+                AL_Printf (pal, "%04X     %04X %04X     Link to Next Object\n",
                     addr, AL_Word (&pBinary[addr]), AL_Word (&pBinary[addr+2]));
                 addr += 4;
                 std::vector<int>::const_iterator it;
                 for (it = pobj->m_routines.begin (); it != pobj->m_routines.end (); ++it)
                     {
-                    fprintf (g_pfilList, "%04X     %04X %04X     Link to ",
+                    AL_Printf (pal, "%04X     %04X %04X     Link to ",
                         addr, AL_Word (&pBinary[addr]), AL_Word (&pBinary[addr+2]));
                     AL_Print (*it);
                     addr += 4;
@@ -1337,9 +1394,10 @@ void AL_Object::Output (const unsigned char *pBinary, int nSize, const struct Co
     std::string sName = "TOP";
     ListVariables (&sName, addr);
     addr = ( addr + 3 ) & 0xFFFC;
-    fprintf (g_pfilList, "%04X                   Reserved 8 bytes.\n", addr);
+    AL_Printf (pal, "%04X                   Reserved 8 bytes.\n", addr);
     addr = AL_Word(&pBinary[10]);
-    fprintf (g_pfilList, "%04X                   Base of stack.\n", addr);
+    AL_Printf (pal, "%04X                   Base of stack.\n", addr);
     addr += pcd->stack_requirement;
-    fprintf (g_pfilList, "%04X                   Top of stack.\n", addr);
+    AL_Printf (pal, "%04X                   Top of stack.\n", addr);
+    return NULL;
     }
@@ -3,18 +3,26 @@
 #ifndef H_ANNOTATE
 #define H_ANNOTATE
 
+#include <string>
+
 // Destinations for listing
 enum AL_Mode {amNone, amConsole, amOutput, amFile};
 
 // Annotation types
 enum AL_Type {atSpinCode, atSpinObj, atDAT, atByte, atWord, atLong, atPASM};
 
+// Annotation data of a CompilerContext
+struct AL_Data;
+AL_Data *AL_CreateData (void);
+void AL_DeleteData (AL_Data *pal);
 // Request collection of annotation data
 void AL_Request (AL_Mode, const char *psFile);
 // Enable annotated listing
 void AL_Enable (bool bEnable);
-// Open collection of data for an object
-void AL_OpenObject (const char *psFile, const struct CompilerData *pcd, struct preprocess *preproc);
+// Test whether an annotated listing was requested
+bool AL_Selected (void);
+// Open collection of data for an object, with the key its source was cached under for the listing (or "")
+void AL_OpenObject (const char *psFile, const struct CompilerData *pcd, struct preprocess *preproc, const char *psSourceKey);
 // Save Routine entry locations
 void AL_Routine (int posn);
 // Associate a code line with an address
@@ -33,7 +41,7 @@ void AL_Variable (const char *psName, int nSize, int nCount);
 void AL_SubObject (int posn, const char *psName, const char *psObject, int nCount);
 // Enter an Object Distillation Record
 void AL_Distill (int start, int length, int reloc);
-// Output the annotated listing
-void AL_Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd);
+// Output the annotated listing, false (with the file in sFailedSource) if a source can't be reloaded for it
+bool AL_Output (const unsigned char *pBinary, int nSize, const struct CompilerData *pcd, std::string &sFailedSource);
 
 #endif
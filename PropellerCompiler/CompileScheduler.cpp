@@ -0,0 +1,254 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// CompileScheduler.cpp
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "CompileScheduler.h"
+#include "CompilerContext.h"
+#include "UnusedMethodUtils.h"
+
+// the scheduler (and worker number) of the current thread, if it is a worker
+static thread_local CompileScheduler* s_pWorkerScheduler = 0;
+static thread_local int s_nWorker = -1;
+
+ScheduledObject::ScheduledObject()
+    : pFilename(0)
+    , pDefineState(0)
+    , pDefines(0)
+    , nDepth(0)
+    , ppAncestorPaths(0)
+    , nAncestors(0)
+    , state(Queued)
+    , nHeapObjects(0)
+    , pHeapObjects(0)
+    , pHeapRecords(0)
+    , nLogEntries(0)
+    , pLog(0)
+    , nUnusedMethods(0)
+    , pUnusedMethods(0)
+    , pUnusedMethodEntries(0)
+{
+}
+
+ScheduledObject::~ScheduledObject()
+{
+    delete [] pFilename;
+    delete [] pDefineState;
+    pp_free_defines(pDefines);
+    delete [] ppAncestorPaths;
+    for (int i = 0; i < nHeapObjects; i++)
+    {
+        delete [] pHeapObjects[i].ObjFilename;
+        delete [] pHeapObjects[i].Obj;
+        delete [] pHeapObjects[i].ObjDefineState;
+        pp_free_defines(pHeapRecords[i].pDefinesAdded);
+        delete pHeapRecords[i].pLinkInfo;
+    }
+    delete [] pHeapObjects;
+    delete [] pHeapRecords;
+    for (int i = 0; i < nLogEntries; i++)
+    {
+        delete [] pLog[i].pFilename;
+        free(pLog[i].pDefineState);
+        free(pLog[i].pUsedDefines);
+        free(pLog[i].pFilesLoaded);
+    }
+    delete [] pLog;
+    delete [] pUnusedMethods;
+    DeleteUnusedMethodEntries(pUnusedMethodEntries);
+}
+
+CompileScheduler::CompileScheduler(CompilerContext* pMainContext, int nThreads, CreateWorkerContextFunc pCreateWorkerContextFunc,
+                                   CompileScheduledObjectFunc pCompileFunc, DeleteWorkerContextFunc pDeleteWorkerContextFunc)
+    : m_pMainContext(pMainContext)
+    , m_nThreads(nThreads)
+    , m_pCreateWorkerContextFunc(pCreateWorkerContextFunc)
+    , m_pCompileFunc(pCompileFunc)
+    , m_pDeleteWorkerContextFunc(pDeleteWorkerContextFunc)
+    , m_nWorkersStarted(0)
+    , m_bShutdown(false)
+    , m_queues(nThreads + 1)
+{
+    for (int i = 0; i < nThreads; i++)
+    {
+        m_threads.push_back(std::thread(&CompileScheduler::WorkerThread, this, i));
+    }
+
+    // the workers set up their contexts from the main context, so wait for them before it carries on
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_nWorkersStarted < nThreads)
+    {
+        m_workerStarted.wait(lock);
+    }
+}
+
+CompileScheduler::~CompileScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bShutdown = true;
+    }
+    m_workAvailable.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i].join();
+    }
+
+    std::map<std::string, ScheduledObject*>::iterator it;
+    for (it = m_objects.begin(); it != m_objects.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+void CompileScheduler::Request(const char* pFilename, const char* pDefineState, void* pDefines, int nDepth, char** ppAncestorPaths, int nAncestors)
+{
+    std::string key = std::string(pFilename) + '\0' + pDefineState;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_objects.find(key) != m_objects.end())
+    {
+        return;
+    }
+
+    ScheduledObject* pObject = new ScheduledObject();
+    pObject->pFilename = new char[strlen(pFilename)+1];
+    strcpy(pObject->pFilename, pFilename);
+    pObject->pDefineState = new char[strlen(pDefineState)+1];
+    strcpy(pObject->pDefineState, pDefineState);
+    pObject->pDefines = pp_duplicate_defines(pDefines);
+    pObject->nDepth = nDepth;
+    pObject->ppAncestorPaths = new char*[nAncestors];
+    memcpy(pObject->ppAncestorPaths, ppAncestorPaths, nAncestors * sizeof(char*));
+    pObject->nAncestors = nAncestors;
+    m_objects[key] = pObject;
+
+    // workers queue their own requests, so they are usually compiled close to the object needing them
+    m_queues[s_pWorkerScheduler == this ? s_nWorker : m_nThreads].push_back(pObject);
+    m_workAvailable.notify_one();
+}
+
+ScheduledObject* CompileScheduler::Get(const char* pFilename, const char* pDefineState)
+{
+    std::string key = std::string(pFilename) + '\0' + pDefineState;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::map<std::string, ScheduledObject*>::iterator it = m_objects.find(key);
+    if (it == m_objects.end())
+    {
+        return 0;
+    }
+
+    ScheduledObject* pObject = it->second;
+    if (pObject->state == ScheduledObject::Queued)
+    {
+        // no worker got to it yet, it is quicker for the caller to compile it
+        pObject->state = ScheduledObject::Claimed;
+        return 0;
+    }
+
+    // only compiles outside the workers wait, a worker waiting on another could deadlock
+    if (pObject->state == ScheduledObject::Compiling && s_pWorkerScheduler != this)
+    {
+        while (pObject->state == ScheduledObject::Compiling)
+        {
+            m_objectDone.wait(lock);
+        }
+    }
+
+    return (pObject->state == ScheduledObject::Compiled) ? pObject : 0;
+}
+
+// the next queued object for a worker, newest from its own queue or else oldest from another queue
+// (called with the mutex locked)
+ScheduledObject* CompileScheduler::NextObject(int nWorker)
+{
+    std::deque<ScheduledObject*>& ownQueue = m_queues[nWorker];
+    while (!ownQueue.empty())
+    {
+        ScheduledObject* pObject = ownQueue.back();
+        ownQueue.pop_back();
+        if (pObject->state == ScheduledObject::Queued)
+        {
+            return pObject;
+        }
+    }
+
+    for (int i = 1; i <= m_nThreads; i++)
+    {
+        std::deque<ScheduledObject*>& queue = m_queues[(nWorker + i) % (m_nThreads + 1)];
+        while (!queue.empty())
+        {
+            ScheduledObject* pObject = queue.front();
+            queue.pop_front();
+            if (pObject->state == ScheduledObject::Queued)
+            {
+                return pObject;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void CompileScheduler::WorkerThread(int nWorker)
+{
+    s_pWorkerScheduler = this;
+    s_nWorker = nWorker;
+    CompilerContext* pContext = m_pCreateWorkerContextFunc(m_pMainContext, this);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_nWorkersStarted++;
+    m_workerStarted.notify_one();
+    while (!m_bShutdown)
+    {
+        ScheduledObject* pObject = NextObject(nWorker);
+        if (pObject == 0)
+        {
+            m_workAvailable.wait(lock);
+            continue;
+        }
+
+        pObject->state = ScheduledObject::Compiling;
+        lock.unlock();
+        bool bCompiled = m_pCompileFunc(pContext, pObject);
+        lock.lock();
+        pObject->state = bCompiled ? ScheduledObject::Compiled : ScheduledObject::Failed;
+        m_objectDone.notify_all();
+    }
+    lock.unlock();
+
+    m_pDeleteWorkerContextFunc(pContext);
+    s_pWorkerScheduler = 0;
+    s_nWorker = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
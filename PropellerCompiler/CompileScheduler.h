@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// CompileScheduler.h
+//
+
+#ifndef _COMPILESCHEDULER_H_
+#define _COMPILESCHEDULER_H_
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "PropellerCompiler.h"
+#include "objectheap.h"
+
+struct CompilerContext;
+struct CompileLogEntry;
+struct HeapObjectRecord;
+struct UnusedMethodEntries;
+
+// a sub-object handed to the scheduler, keyed by its filename and the define state it is compiled with
+struct ScheduledObject
+{
+    enum State
+    {
+        Queued,     // waiting for a worker
+        Claimed,    // taken back by a compile that needed it before a worker got to it
+        Compiling,  // being compiled by a worker
+        Compiled,   // compiled, the results below are set
+        Failed      // didn't compile, it is compiled again in order to report the errors
+    };
+
+    ScheduledObject();
+    ~ScheduledObject();
+
+    char*                   pFilename;
+    char*                   pDefineState;
+    void*                   pDefines;               // copy of the defines to compile it with
+    int                     nDepth;                 // object nesting level it was requested at
+    char**                  ppAncestorPaths;        // full paths of the objects that requested it, parent first
+    int                     nAncestors;
+    State                   state;
+
+    // results of the compile, taken over from the worker's context
+    int                     nHeapObjects;           // heap entries of the object and its sub-objects, the object itself last
+    ObjHeap*                pHeapObjects;
+    HeapObjectRecord*       pHeapRecords;           // log entry and method_unused[] indices are relative to this compile
+    int                     nLogEntries;
+    CompileLogEntry*        pLog;
+    int                     nUnusedMethods;
+    char*                   pUnusedMethods;         // method_unused[] entries
+    UnusedMethodEntries*    pUnusedMethodEntries;   // pubcon lists and cognew/coginit uses (first pass of unused method elimination)
+};
+
+typedef CompilerContext* (*CreateWorkerContextFunc)(CompilerContext* pMainContext, class CompileScheduler* pScheduler);
+typedef bool (*CompileScheduledObjectFunc)(CompilerContext* pWorkerContext, ScheduledObject* pObject);
+typedef void (*DeleteWorkerContextFunc)(CompilerContext* pWorkerContext);
+
+//
+// Compiles sub-objects on a pool of worker threads, each with its own CompilerContext.
+// Each worker has a queue of the sub-objects requested by the objects it compiles, and takes work
+// from the other queues when its own is empty. Every filename & define state is compiled only once,
+// the compile that needs the result takes it over in order, so the output doesn't depend on timing.
+//
+class CompileScheduler
+{
+public:
+    CompileScheduler(CompilerContext* pMainContext, int nThreads, CreateWorkerContextFunc pCreateWorkerContextFunc,
+                     CompileScheduledObjectFunc pCompileFunc, DeleteWorkerContextFunc pDeleteWorkerContextFunc);
+    ~CompileScheduler();
+
+    // queues compiling a sub-object, unless it was already requested with the same define state
+    void Request(const char* pFilename, const char* pDefineState, void* pDefines, int nDepth, char** ppAncestorPaths, int nAncestors);
+
+    // returns the sub-object if it was compiled, waiting for it when called from outside the workers,
+    // or 0 if the caller has to compile it itself
+    ScheduledObject* Get(const char* pFilename, const char* pDefineState);
+
+private:
+    void WorkerThread(int nWorker);
+    ScheduledObject* NextObject(int nWorker);
+
+    CompilerContext*                            m_pMainContext;
+    int                                         m_nThreads;
+    CreateWorkerContextFunc                     m_pCreateWorkerContextFunc;
+    CompileScheduledObjectFunc                  m_pCompileFunc;
+    DeleteWorkerContextFunc                     m_pDeleteWorkerContextFunc;
+
+    std::mutex                                  m_mutex;
+    std::condition_variable                     m_workAvailable;
+    std::condition_variable                     m_objectDone;
+    std::condition_variable                     m_workerStarted;
+    int                                         m_nWorkersStarted;
+    bool                                        m_bShutdown;
+    std::map<std::string, ScheduledObject*>     m_objects;
+    std::vector<std::deque<ScheduledObject*> >  m_queues;   // one per worker, the last one for requests from outside the workers
+    std::vector<std::thread>                    m_threads;
+};
+
+#endif // _COMPILESCHEDULER_H_
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
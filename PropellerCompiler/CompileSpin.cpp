@@ -12,6 +12,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include "CompileSpin.h"
 #include "PropellerCompiler.h"
@@ -20,294 +26,1791 @@
 #include "preprocess.h"
 #include "Utilities.h"
 #include "Annotate.h"
+#include "CompilerContext.h"
+#include "UnusedMethodUtils.h"
+#include "CompileScheduler.h"
+#include "ObjectCache.h"
 
 #define ObjFileStackLimit   16
 #define ListLimit           2000000
 #define DocLimit            2000000
 
-static struct preprocess s_preprocessor;
-CompilerData* s_pCompilerData = 0;
-static int  s_nObjStackPtr = 0;
-static bool s_bFinalCompile;
+class ObjectNode : public HeirarchyNode
+{
+public:
+    char* m_pFullPath;
+
+    ObjectNode()
+        : m_pFullPath(0)
+    {
+    }
+};
+
+static void ReserveCompileLog(int nEntries)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->nCompileLogEntries + nEntries > pContext->nCompileLogLimit)
+    {
+        while (pContext->nCompileLogEntries + nEntries > pContext->nCompileLogLimit)
+        {
+            pContext->nCompileLogLimit = pContext->nCompileLogLimit ? pContext->nCompileLogLimit * 2 : 64;
+        }
+        CompileLogEntry* pNewLog = new CompileLogEntry[pContext->nCompileLogLimit];
+        if (pContext->pCompileLog)
+        {
+            memcpy(pNewLog, pContext->pCompileLog, pContext->nCompileLogEntries * sizeof(CompileLogEntry));
+            delete [] pContext->pCompileLog;
+        }
+        pContext->pCompileLog = pNewLog;
+    }
+}
+
+static int AddCompileLogEntry(const char* pFilename, char* pFullPath, int nDepth)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    char* pFilenameCopy = new char[strlen(pFilename)+1];
+    strcpy(pFilenameCopy, pFilename);
+
+    ReserveCompileLog(1);
+
+    CompileLogEntry* pEntry = &pContext->pCompileLog[pContext->nCompileLogEntries];
+    pEntry->pFilename = pFilenameCopy;
+    pEntry->pFullPath = pFullPath;
+    pEntry->pDefineState = 0;
+    pEntry->pUsedDefines = 0;
+    pEntry->pFilesLoaded = 0;
+    pEntry->nDepth = nDepth;
+    return pContext->nCompileLogEntries++;
+}
+
+// log define states (and used define lists) are malloc()ed, like the ones the preprocessor returns
+static char* CopyDefineState(const char* pDefineState)
+{
+    char* pCopy = (char*)malloc(strlen(pDefineState)+1);
+    strcpy(pCopy, pDefineState);
+    return pCopy;
+}
+
+// adds the names of a used define list (or the preprocessor's lookups), one per line
+static void AddNameLines(const char* pLines, std::set<std::string>& names)
+{
+    while (*pLines != 0)
+    {
+        const char* pEnd = strchr(pLines, '\n');
+        if (pEnd == 0)
+        {
+            pEnd = pLines + strlen(pLines);
+        }
+        names.insert(std::string(pLines, pEnd - pLines));
+        pLines = (*pEnd != 0) ? pEnd + 1 : pEnd;
+    }
+}
+
+// gives the names as a sorted list, one per line, malloc()ed like a define state
+static char* JoinNameLines(const std::set<std::string>& names)
+{
+    std::string lines;
+    for (std::set<std::string>::const_iterator it = names.begin(); it != names.end(); it++)
+    {
+        lines += *it + '\n';
+    }
+    return CopyDefineState(lines.c_str());
+}
+
+static void CleanupCompileLog()
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    for (int i = 0; i < pContext->nCompileLogEntries; i++)
+    {
+        delete [] pContext->pCompileLog[i].pFilename;
+        free(pContext->pCompileLog[i].pDefineState);
+        free(pContext->pCompileLog[i].pUsedDefines);
+        free(pContext->pCompileLog[i].pFilesLoaded);
+    }
+    delete [] pContext->pCompileLog;
+    pContext->pCompileLog = 0;
+    pContext->nCompileLogEntries = 0;
+    pContext->nCompileLogLimit = 0;
+
+    for (int i = 0; i < MaxObjInHeap; i++)
+    {
+        pp_free_defines(pContext->heapObjectRecords[i].pDefinesAdded);
+        pContext->heapObjectRecords[i].pDefinesAdded = 0;
+        delete pContext->heapObjectRecords[i].pLinkInfo;
+        pContext->heapObjectRecords[i].pLinkInfo = 0;
+    }
+}
+
+static void DeleteLinkHeap()
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    LinkHeap* pLinkHeap = pContext->pLinkHeap;
+    if (pLinkHeap == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < pLinkHeap->nObjHeapIndex; i++)
+    {
+        delete [] pLinkHeap->objHeap[i].ObjFilename;
+        delete [] pLinkHeap->objHeap[i].Obj;
+        delete [] pLinkHeap->objHeap[i].ObjDefineState;
+        pp_free_defines(pLinkHeap->records[i].pDefinesAdded);
+        delete pLinkHeap->records[i].pLinkInfo;
+    }
+    delete pLinkHeap;
+    pContext->pLinkHeap = 0;
+}
+
+// prints to stdout, or with the PrintFunc given to SetCompilerOutput()
+static void PrintOutput(CompilerOutputKind eKind, const char* pFormat, ...)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    va_list args;
+    va_start(args, pFormat);
+    if (pContext->pPrintFunc == 0)
+    {
+        vprintf(pFormat, args);
+    }
+    else
+    {
+        char text[1024];
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int nLength = vsnprintf(text, sizeof(text), pFormat, argsCopy);
+        va_end(argsCopy);
+        if (nLength < (int)sizeof(text))
+        {
+            pContext->pPrintFunc(pContext->pUserData, eKind, text);
+        }
+        else
+        {
+            char* pText = new char[nLength + 1];
+            vsnprintf(pText, nLength + 1, pFormat, args);
+            pContext->pPrintFunc(pContext->pUserData, eKind, pText);
+            delete [] pText;
+        }
+    }
+    va_end(args);
+}
+
+static void ReportDiagnostic(bool bWarning, const char* pFilename, int nLine, int nColumn, const char* pMessage,
+                             const char* pLine = 0, const char* pItem = 0)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->pDiagnosticFunc != 0)
+    {
+        CompilerDiagnostic diagnostic;
+        diagnostic.bWarning = bWarning;
+        diagnostic.pFilename = pFilename;
+        diagnostic.nLine = nLine;
+        diagnostic.nColumn = nColumn;
+        diagnostic.pMessage = pMessage;
+        diagnostic.pLine = pLine;
+        diagnostic.pItem = pItem;
+        pContext->pDiagnosticFunc(pContext->pUserData, &diagnostic);
+    }
+}
+
+static void PrintObjectTreeEntry(const char* pFilename, int nDepth)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (nDepth > 0 && (!pContext->compilerConfig.bQuiet || pContext->compilerConfig.bFileTreeOutputOnly))
+    {
+        // only do this if UME is off or if it's the final compile when UME is on
+        if (!pContext->compilerConfig.bUnusedMethodElimination || pContext->pCompilerData->bFinalCompile)
+        {
+            char spaces[] = "                              \0";
+            PrintOutput(coMessage, "%s|-%s\n", &spaces[32-(nDepth<<1)], pFilename);
+        }
+    }
+}
+
+// prints an error with pFormat (which has the message as its only argument) and reports it
+// errors in a scheduler worker aren't reported, the object is compiled again by the compile needing it to report them
+static void ReportCompileError(const char* pFilename, const char* pMessage, const char* pFormat)
+{
+    if (!g_pCompilerContext->bWorker)
+    {
+        PrintOutput(coMessage, pFormat, pMessage);
+        ReportDiagnostic(false, pFilename, 0, 0, pMessage);
+    }
+}
+
+// reports an error as "<filename> : error : <message>"
+static void PrintCompileError(const char* pFilename, const char* pFormat, ...)
+{
+    if (!g_pCompilerContext->bWorker)
+    {
+        char message[1024];
+        va_list args;
+        va_start(args, pFormat);
+        vsnprintf(message, sizeof(message), pFormat, args);
+        va_end(args);
+        PrintOutput(coMessage, "%s : error : %s\n", pFilename, message);
+        ReportDiagnostic(false, pFilename, 0, 0, message);
+    }
+}
+
+// the preprocessor's messages go to stderr, unless there is a PrintFunc
+static void PreprocessorMessage(const char* level, const char* filename, int linenum, const char* msg)
+{
+    if (g_pCompilerContext->pPrintFunc == 0)
+    {
+        fprintf(stderr, "%s:%d: %s: %s\n", filename, linenum, level, msg);
+    }
+    else
+    {
+        PrintOutput(coPreprocessor, "%s:%d: %s: %s\n", filename, linenum, level, msg);
+    }
+    ReportDiagnostic(strcmp(level, "error") != 0, filename, linenum, 0, msg);
+}
+
+// Loads a file with the LoadFileFunc given to InitCompiler(), noting its full path for the log entry of the
+// object being compiled when objects are kept
+static char* LoadObjectFile(const char* pFilename, int* pnLength, char** ppFilePath)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    char* pBuffer = pContext->pLoadFileFunc(pFilename, pnLength, ppFilePath);
+    if (pBuffer != 0 && pContext->compilerConfig.bKeepObjects && *ppFilePath != 0)
+    {
+        if (pContext->pFilesLoaded == 0)
+        {
+            pContext->pFilesLoaded = new flexbuf;
+            flexbuf_init(pContext->pFilesLoaded, 1024);
+        }
+        flexbuf_addstr(pContext->pFilesLoaded, *ppFilePath);
+        flexbuf_addchar(pContext->pFilesLoaded, '\n');
+    }
+    return pBuffer;
+}
+
+// adds the files loaded since the last call to the log entry of the object that loaded them
+static void TakeFilesLoaded(int nLogEntry)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->pFilesLoaded == 0 || flexbuf_curlen(pContext->pFilesLoaded) == 0)
+    {
+        return;
+    }
+    CompileLogEntry* pEntry = &pContext->pCompileLog[nLogEntry];
+    std::set<std::string> files;
+    if (pEntry->pFilesLoaded != 0)
+    {
+        AddNameLines(pEntry->pFilesLoaded, files);
+    }
+    flexbuf_addchar(pContext->pFilesLoaded, 0);
+    AddNameLines(flexbuf_peek(pContext->pFilesLoaded), files);
+    flexbuf_clear(pContext->pFilesLoaded);
+    free(pEntry->pFilesLoaded);
+    pEntry->pFilesLoaded = JoinNameLines(files);
+}
+
+// the preprocessor's output function for LoadPASCIISource
+static void WritePreprocessedText(void* pData, const char* pText, size_t nLength)
+{
+    ((PASCIIWriter*)pData)->AddUtf8(pText, (int)nLength);
+}
+
+// a source converted to PASCII during a compile, with everything else converting it did
+struct CachedSource
+{
+    char*       pFullPath;      // as the LoadFileFunc returned it
+    std::string source;         // the PASCII
+    int         nEndComment;    // the comment nesting the preprocessor was left at
+    void*       pDefines;       // the defines it added, from pp_copy_defines_since (or 0)
+    std::string messages;       // the preprocessor's messages, as pp_repeat_messages takes them
+    std::string usedDefines;    // the names it looked up in the defines, one per line (when objects are kept)
+    std::string filesLoaded;    // the full paths LoadObjectFile noted for it, one per line
+};
+
+// the sources converted during a compile, by full path, name, conversion and define state, so the second read
+// of a parent object, the final pass of unused method elimination and the annotated listing don't load and
+// convert them again
+struct SourceCache
+{
+    std::map<std::string, CachedSource> sources;
+    std::map<std::string, char*> fullPaths;     // of the names the compiler has loaded
+};
+
+static void ForgetSourceCache(CompilerContext* pContext)
+{
+    if (pContext->pSourceCache != 0)
+    {
+        std::map<std::string, CachedSource>::iterator it;
+        for (it = pContext->pSourceCache->sources.begin(); it != pContext->pSourceCache->sources.end(); it++)
+        {
+            pp_free_defines(it->second.pDefines);
+        }
+        delete pContext->pSourceCache;
+        pContext->pSourceCache = 0;
+    }
+}
+
+// the cache key of a source, with the current define state and comment nesting when it's preprocessed
+static std::string SourceCacheKey(const char* pFullPath, const char* pFilename, struct preprocess* pPreprocessor, bool bForceUTF8)
+{
+    std::string key = pFullPath;
+    key += '\n';
+    key += pFilename;
+    key += bForceUTF8 ? "\nutf8" : "\n";
+    if (pPreprocessor != 0)
+    {
+        char comment[32];
+        sprintf(comment, "\npp %d\n", pPreprocessor->incomment);
+        key += comment;
+        char* pState = pp_get_define_state_string(pPreprocessor);
+        key += pState;
+        free(pState);
+    }
+    return key;
+}
+
+// repeats what converting a cached source did, returning a copy of its PASCII
+static char* RepeatCachedSource(const CachedSource& cached, struct preprocess* pPreprocessor, char** ppFullPath, char** ppUsedDefines)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    *ppFullPath = cached.pFullPath;
+    if (pPreprocessor != 0)
+    {
+        pp_repeat_messages(pPreprocessor, cached.messages.data(), cached.messages.size());
+        pp_apply_defines(pPreprocessor, cached.pDefines);
+        pPreprocessor->incomment = cached.nEndComment;
+        if (ppUsedDefines != 0)
+        {
+            free(*ppUsedDefines);
+            *ppUsedDefines = CopyDefineState(cached.usedDefines.c_str());
+        }
+    }
+    if (!cached.filesLoaded.empty())
+    {
+        if (pContext->pFilesLoaded == 0)
+        {
+            pContext->pFilesLoaded = new flexbuf;
+            flexbuf_init(pContext->pFilesLoaded, 1024);
+        }
+        flexbuf_addmem(pContext->pFilesLoaded, cached.filesLoaded.data(), cached.filesLoaded.size());
+    }
+    char* pPASCIIBuffer = new char[cached.source.size()+1];
+    memcpy(pPASCIIBuffer, cached.source.c_str(), cached.source.size()+1);
+    return pPASCIIBuffer;
+}
+
+// Loads a source with pLoadFunc and converts it to PASCII, preprocessing it (as pFilename) when given the
+// preprocessor, and returns it for the caller to delete [], or 0 if it couldn't be loaded or bConverted is
+// cleared (its encoding wasn't recognized). A source already converted the same way during the compile is
+// taken from the context's SourceCache instead, repeating the messages, defines and comment nesting
+// preprocessing it gave. pFullPath is what pLoadName loads, or 0 if it's only known once loaded.
+// When ppUsedDefines is given it is set to the names the source looked up in the defines, and when pKey is
+// given it is set to the key the source is cached under (or left empty if it isn't).
+static char* LoadPASCIISource(LoadFileFunc pLoadFunc, const char* pLoadName, const char* pFullPath, const char* pFilename,
+                              struct preprocess* pPreprocessor, bool bForceUTF8, char** ppFullPath, char** ppUsedDefines,
+                              bool& bConverted, std::string* pKey = 0)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->pSourceCache == 0)
+    {
+        pContext->pSourceCache = new SourceCache;
+    }
+    SourceCache* pCache = pContext->pSourceCache;
+    bConverted = true;
+
+    std::map<std::string, CachedSource>::iterator cached;
+    if (pFullPath == 0)
+    {
+        std::map<std::string, char*>::iterator it = pCache->fullPaths.find(pLoadName);
+        pFullPath = (it != pCache->fullPaths.end()) ? it->second : 0;
+    }
+    if (pFullPath != 0)
+    {
+        cached = pCache->sources.find(SourceCacheKey(pFullPath, pFilename, pPreprocessor, bForceUTF8));
+        if (cached != pCache->sources.end())
+        {
+            if (pKey != 0)
+            {
+                *pKey = cached->first;
+            }
+            return RepeatCachedSource(cached->second, pPreprocessor, ppFullPath, ppUsedDefines);
+        }
+    }
+
+    int nLength = 0;
+    char* pRawBuffer = pLoadFunc(pLoadName, &nLength, ppFullPath);
+    if (pRawBuffer == 0)
+    {
+        return 0;
+    }
+    std::string key;
+    if (*ppFullPath != 0)
+    {
+        pCache->fullPaths[pLoadName] = *ppFullPath;
+        key = SourceCacheKey(*ppFullPath, pFilename, pPreprocessor, bForceUTF8);
+    }
+    size_t nFilesLoaded = pContext->pFilesLoaded ? flexbuf_curlen(pContext->pFilesLoaded) : 0;
+    bool bErrorFound = pPreprocessor != 0 && pPreprocessor->errorfound;
+    CachedSource entry;
+    entry.pDefines = 0;
+    entry.nEndComment = 0;
+
+    char* pPASCIIBuffer = 0;
+    if (pPreprocessor != 0)
+    {
+        void* pState = pp_get_define_state(pPreprocessor);
+        struct flexbuf messages;
+        struct flexbuf lookups;
+        flexbuf_init(&messages, 256);
+        pPreprocessor->messages = &messages;
+        if (pContext->compilerConfig.bKeepObjects)
+        {
+            flexbuf_init(&lookups, 4096);
+            pPreprocessor->lookups = &lookups;
+        }
+        // a file with nothing to preprocess is converted straight from the raw buffer, otherwise the
+        // preprocessor's output is converted as it comes
+        int nPlainMode = pp_check_plain(pPreprocessor, pRawBuffer, nLength);
+        if (nPlainMode == MODE_LATIN1)
+        {
+            pPASCIIBuffer = new char[nLength+1];
+            Latin1ToPASCII(pRawBuffer, nLength, pPASCIIBuffer);
+        }
+        else if (nPlainMode == MODE_UTF8)
+        {
+            pPASCIIBuffer = new char[nLength+1];
+            UnicodeToPASCII(pRawBuffer, nLength, pPASCIIBuffer, true);
+        }
+        else
+        {
+            memoryfile mfile;
+            mfile.buffer = pRawBuffer;
+            mfile.length = nLength;
+            mfile.readoffset = 0;
+            PASCIIWriter writer(nLength);
+            pPreprocessor->outputfunc = WritePreprocessedText;
+            pPreprocessor->outputdata = &writer;
+            pp_push_file_struct(pPreprocessor, &mfile, pFilename);
+            pp_run(pPreprocessor);
+            pPreprocessor->outputfunc = 0;
+            pPreprocessor->outputdata = 0;
+            pPASCIIBuffer = writer.Finish();
+        }
+        pPreprocessor->messages = 0;
+        entry.messages.assign(flexbuf_peek(&messages), flexbuf_curlen(&messages));
+        flexbuf_delete(&messages);
+        if (pPreprocessor->lookups != 0)
+        {
+            pPreprocessor->lookups = 0;
+            flexbuf_addchar(&lookups, 0);
+            std::set<std::string> names;
+            AddNameLines(flexbuf_peek(&lookups), names);
+            flexbuf_delete(&lookups);
+            char* pUsedDefines = JoinNameLines(names);
+            entry.usedDefines = pUsedDefines;
+            free(pUsedDefines);
+        }
+        if (ppUsedDefines != 0)
+        {
+            free(*ppUsedDefines);
+            *ppUsedDefines = CopyDefineState(entry.usedDefines.c_str());
+        }
+        entry.pDefines = pp_copy_defines_since(pPreprocessor, pState);
+        entry.nEndComment = pPreprocessor->incomment;
+        bErrorFound = bErrorFound || pPreprocessor->errorfound;
+    }
+    else
+    {
+        pPASCIIBuffer = new char[nLength+1];
+        bConverted = UnicodeToPASCII(pRawBuffer, nLength, pPASCIIBuffer, bForceUTF8);
+    }
+    pContext->pFreeFileBufferFunc(pRawBuffer);
+    if (!bConverted)
+    {
+        delete [] pPASCIIBuffer;
+        return 0;
+    }
+
+    // a source that gave a preprocessor error isn't kept, as the compile is failing anyway
+    if (!key.empty() && !bErrorFound)
+    {
+        entry.pFullPath = *ppFullPath;
+        entry.source = pPASCIIBuffer;
+        if (pContext->pFilesLoaded != 0)
+        {
+            entry.filesLoaded.assign(flexbuf_peek(pContext->pFilesLoaded) + nFilesLoaded,
+                                     flexbuf_curlen(pContext->pFilesLoaded) - nFilesLoaded);
+        }
+        cached = pCache->sources.find(key);
+        if (cached != pCache->sources.end())
+        {
+            pp_free_defines(cached->second.pDefines);
+        }
+        pCache->sources[key] = entry;
+        if (pKey != 0)
+        {
+            *pKey = key;
+        }
+    }
+    else
+    {
+        pp_free_defines(entry.pDefines);
+    }
+    return pPASCIIBuffer;
+}
+
+// when ppUsedDefines is given and objects are kept, it is set to the names the source looked up in the defines
+static bool GetPASCIISource(char* pFilename, char** ppUsedDefines = 0)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    // read in file (or take it from the source cache) converted to PASCII, and assign to pContext->pCompilerData->source
+    bool bUsePreprocessor = pContext->compilerConfig.bUsePreprocessor;
+    bool bConverted = true;
+    std::string sourceKey;
+    char* pPASCIIBuffer = LoadPASCIISource(LoadObjectFile, pFilename, 0, pFilename,
+                                           bUsePreprocessor ? &pContext->preprocessor : 0, bUsePreprocessor,
+                                           &pContext->pCompilerData->current_file_path,
+                                           pContext->compilerConfig.bKeepObjects ? ppUsedDefines : 0, bConverted,
+                                           AL_Selected() ? &sourceKey : 0);
+    if (!bConverted)
+    {
+        ReportCompileError(pFilename, "Unrecognized text encoding format!", "%s\n");
+        return false;
+    }
+    if (pPASCIIBuffer == 0)
+    {
+        pContext->pCompilerData->source = NULL;
+        return false;
+    }
+
+    // clean up any previous buffer
+    if (pContext->pCompilerData->source)
+    {
+        delete [] pContext->pCompilerData->source;
+    }
+
+    pContext->pCompilerData->source = pPASCIIBuffer;
+
+    AL_OpenObject (pFilename, pContext->pCompilerData,
+        (bUsePreprocessor ? &pContext->preprocessor : NULL), sourceKey.c_str());
+
+    return true;
+}
+
+char* GetListingSource(const char* pSourceKey, const char* pFullPath, const char* pFilename, struct preprocess* pPreprocessor,
+                       bool bForceUTF8, bool* pbConverted)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    *pbConverted = true;
+
+    // the define state and comment nesting have moved on since the compile, so the source is found by the key it
+    // was compiled under; nothing converting it did needs repeating for the listing
+    if (*pSourceKey != 0 && pContext->pSourceCache != 0)
+    {
+        std::map<std::string, CachedSource>::iterator cached = pContext->pSourceCache->sources.find(pSourceKey);
+        if (cached != pContext->pSourceCache->sources.end())
+        {
+            char* pPASCIIBuffer = new char[cached->second.source.size()+1];
+            memcpy(pPASCIIBuffer, cached->second.source.c_str(), cached->second.source.size()+1);
+            return pPASCIIBuffer;
+        }
+    }
+
+    char* pLoadedPath = 0;
+    return LoadPASCIISource(pContext->pLoadFileFunc, pFullPath, pFullPath, pFilename, pPreprocessor, bForceUTF8,
+                            &pLoadedPath, 0, *pbConverted);
+}
+
+static void CleanupMemory(bool bUnusedMethodData = true)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    delete pContext->pScheduler;
+    pContext->pScheduler = 0;
+
+    delete pContext->objectHeirarchy.m_pRoot;
+    pContext->objectHeirarchy.m_pRoot = 0;
+
+    if ( pContext->pCompilerData )
+    {
+        delete [] pContext->pCompilerData->list;
+        delete [] pContext->pCompilerData->doc;
+        delete [] pContext->pCompilerData->obj;
+        delete [] pContext->pCompilerData->source;
+    }
+    CleanObjectHeap();
+    CleanupCompileLog();
+    if (bUnusedMethodData)
+    {
+        CleanUpUnusedMethodData();
+        DeleteLinkHeap();
+    }
+    Cleanup();
+    if (pContext->pCompileResultBuffer != 0)
+    {
+        delete [] pContext->pCompileResultBuffer;
+        pContext->pCompileResultBuffer = 0;
+    }
+}
+
+void PrintError(const char* pFilename, const char* pErrorString)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->bWorker)
+    {
+        return;
+    }
+    int lineNumber = 1;
+    int column = 1;
+    int offsetToStartOfLine = -1;
+    int offsetToEndOfLine = -1;
+    int offendingItemStart = 0;
+    int offendingItemEnd = 0;
+
+    GetErrorInfo(lineNumber, column, offsetToStartOfLine, offsetToEndOfLine, offendingItemStart, offendingItemEnd);
+
+    PrintOutput(coMessage, "%s(%d:%d) : error : %s\n", pFilename, lineNumber, column, pErrorString);
+
+    if ( offendingItemStart == offendingItemEnd && pContext->pCompilerData->source[offendingItemStart] == 0 )
+    {
+        PrintOutput(coMessage, "Line:\nEnd Of File\nOffending Item: N/A\n");
+        ReportDiagnostic(false, pFilename, lineNumber, column, pErrorString);
+    }
+    else
+    {
+        char* errorLine = 0;
+        char* errorItem = 0;
+
+        if (offendingItemEnd - offendingItemStart > 0)
+        {
+            errorLine = new char[(offsetToEndOfLine - offsetToStartOfLine) + 1];
+            strncpy(errorLine, &pContext->pCompilerData->source[offsetToStartOfLine], offsetToEndOfLine - offsetToStartOfLine);
+            errorLine[offsetToEndOfLine - offsetToStartOfLine] = 0;
+        }
+
+        if (offendingItemEnd - offendingItemStart > 0)
+        {
+            errorItem = new char[(offendingItemEnd - offendingItemStart) + 1];
+            strncpy(errorItem, &pContext->pCompilerData->source[offendingItemStart], offendingItemEnd - offendingItemStart);
+            errorItem[offendingItemEnd - offendingItemStart] = 0;
+        }
+
+        PrintOutput(coMessage, "Line:\n%s\nOffending Item: %s\n", errorLine ? errorLine : "N/A", errorItem ? errorItem : "N/A");
+        ReportDiagnostic(false, pFilename, lineNumber, column, pErrorString, errorLine, errorItem);
+
+        delete [] errorLine;
+        delete [] errorItem;
+    }
+}
+
+static bool CheckForCircularReference(ObjectNode* pObjectNode)
+{
+    ObjectNode* pCurrentNode = pObjectNode;
+    while (pCurrentNode->m_pParent)
+    {
+        ObjectNode* pParent = (ObjectNode*)(pCurrentNode->m_pParent);
+        if (strcmp(pObjectNode->m_pFullPath, pParent->m_pFullPath) == 0)
+        {
+            return true;
+        }
+        pCurrentNode = pParent;
+    }
+
+    return false;
+}
+
+// Repeats the tree output, object names, log entries, unused methods and defines of a compile
+// (logged in pLog) in place of compiling the object again
+static bool ReplayCompiledObject(char* pFilename, int nLogEntry, int& nCompileIndex, ObjectNode* pParentNode,
+                                 const CompileLogEntry* pLog, int nLogEntries, const char* pUnusedMethods, int nUnusedMethods, void* pDefinesAdded)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    int nDepthOffset = pContext->pCompileLog[nLogEntry].nDepth - pLog[0].nDepth;
+
+    // compile it normally if it would now exceed the nesting limit or form a circular reference, to get the error
+    for (int i = 0; i < nLogEntries; i++)
+    {
+        if (pLog[i].nDepth + nDepthOffset >= ObjFileStackLimit)
+        {
+            return false;
+        }
+        for (ObjectNode* pNode = pParentNode; pNode != 0; pNode = (ObjectNode*)(pNode->m_pParent))
+        {
+            if (strcmp(pLog[i].pFullPath, pNode->m_pFullPath) == 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    pContext->pCompileLog[nLogEntry].pFullPath = pLog[0].pFullPath;
+    if (pLog[0].pUsedDefines != 0)
+    {
+        pContext->pCompileLog[nLogEntry].pUsedDefines = CopyDefineState(pLog[0].pUsedDefines);
+    }
+    if (pLog[0].pFilesLoaded != 0)
+    {
+        pContext->pCompileLog[nLogEntry].pFilesLoaded = CopyDefineState(pLog[0].pFilesLoaded);
+    }
+    if (!pContext->pCompilerData->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination)
+    {
+        AddObjectName(pFilename, nCompileIndex);
+    }
+    for (int i = 1; i < nLogEntries; i++)
+    {
+        nCompileIndex++;
+        int nDepth = pLog[i].nDepth + nDepthOffset;
+        PrintObjectTreeEntry(pLog[i].pFilename, nDepth);
+        if (!pContext->pCompilerData->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination)
+        {
+            AddObjectName(pLog[i].pFilename, nCompileIndex);
+        }
+        int nEntry = AddCompileLogEntry(pLog[i].pFilename, pLog[i].pFullPath, nDepth);
+        if (pLog[i].pDefineState != 0)
+        {
+            // the same define state as then, it started from the same one
+            pContext->pCompileLog[nEntry].pDefineState = CopyDefineState(pLog[i].pDefineState);
+        }
+        if (pLog[i].pUsedDefines != 0)
+        {
+            pContext->pCompileLog[nEntry].pUsedDefines = CopyDefineState(pLog[i].pUsedDefines);
+        }
+        if (pLog[i].pFilesLoaded != 0)
+        {
+            pContext->pCompileLog[nEntry].pFilesLoaded = CopyDefineState(pLog[i].pFilesLoaded);
+        }
+    }
+
+    // the unused methods of the skipped compile are reported again
+    for (int i = 0; i < nUnusedMethods && pContext->pCompilerData->unused_methods < (32 * file_limit); i++)
+    {
+        strcpy(&(pContext->pCompilerData->method_unused[symbol_limit * pContext->pCompilerData->unused_methods]),
+               &pUnusedMethods[symbol_limit * i]);
+        pContext->pCompilerData->unused_methods++;
+    }
+
+    if (pContext->compilerConfig.bUsePreprocessor)
+    {
+        pp_apply_defines(&pContext->preprocessor, pDefinesAdded);
+    }
+
+    return true;
+}
+
+// Reuses the heap entry of an object already compiled with the same define state instead of
+// compiling it again
+static bool ReuseCompiledObject(char* pFilename, int nLogEntry, int& nCompileIndex, ObjectNode* pParentNode)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    int nObjIdx = IndexOfCompiledObjectInHeap(pFilename, pContext->pCompileLog[nLogEntry].pDefineState);
+    if (nObjIdx == -1)
+    {
+        return false;
+    }
+    HeapObjectRecord* pRecord = &pContext->heapObjectRecords[nObjIdx];
+
+    // the replay adds to the log it reads from, so make room first
+    ReserveCompileLog(pRecord->nLogEntries);
+    return ReplayCompiledObject(pFilename, nLogEntry, nCompileIndex, pParentNode,
+                                &pContext->pCompileLog[pRecord->nFirstLogEntry], pRecord->nLogEntries,
+                                &pContext->pCompilerData->method_unused[symbol_limit * pRecord->nFirstUnusedMethod], pRecord->nUnusedMethods,
+                                pRecord->pDefinesAdded);
+}
+
+// Takes over an object the scheduler compiled in another context, adding its heap entries to ours
+static bool AdoptScheduledObject(char* pFilename, int nLogEntry, int& nCompileIndex, ObjectNode* pParentNode, ScheduledObject* pObject)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+
+    // our heap must not already hold any of its objects compiled with another define state (or differently),
+    // compiling it here would use those, and there must be room for the rest
+    int nNewHeapObjects = 0;
+    for (int i = 0; i < pObject->nHeapObjects; i++)
+    {
+        int nObjIdx = IndexOfObjectInHeap(pObject->pHeapObjects[i].ObjFilename);
+        if (nObjIdx == -1)
+        {
+            nNewHeapObjects++;
+        }
+        else if (strcmp(pContext->objHeap[nObjIdx].ObjDefineState, pObject->pHeapObjects[i].ObjDefineState) != 0 ||
+                 pContext->objHeap[nObjIdx].ObjSize != pObject->pHeapObjects[i].ObjSize ||
+                 memcmp(pContext->objHeap[nObjIdx].Obj, pObject->pHeapObjects[i].Obj, pObject->pHeapObjects[i].ObjSize) != 0)
+        {
+            return false;
+        }
+    }
+    int nFirstUnusedMethod = pContext->pCompilerData->unused_methods;
+    if (pContext->nObjHeapIndex + nNewHeapObjects > MaxObjInHeap || nFirstUnusedMethod + pObject->nUnusedMethods > (32 * file_limit))
+    {
+        return false;
+    }
+
+    HeapObjectRecord* pRootRecord = &pObject->pHeapRecords[pObject->nHeapObjects - 1];
+    if (!ReplayCompiledObject(pFilename, nLogEntry, nCompileIndex, pParentNode, pObject->pLog, pObject->nLogEntries,
+                              pObject->pUnusedMethods, pObject->nUnusedMethods, pRootRecord->pDefinesAdded))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < pObject->nHeapObjects; i++)
+    {
+        ObjHeap* pHeapObject = &pObject->pHeapObjects[i];
+        if (IndexOfObjectInHeap(pHeapObject->ObjFilename) == -1)
+        {
+            AddObjectBinaryToHeap(pHeapObject->ObjFilename, pHeapObject->Obj, pHeapObject->ObjSize, pHeapObject->ObjDefineState);
+            HeapObjectRecord* pRecord = &pContext->heapObjectRecords[IndexOfObjectInHeap(pHeapObject->ObjFilename)];
+            *pRecord = pObject->pHeapRecords[i];
+            pRecord->nFirstLogEntry += nLogEntry;
+            pRecord->nFirstUnusedMethod += nFirstUnusedMethod;
+            pRecord->pDefinesAdded = pp_duplicate_defines(pObject->pHeapRecords[i].pDefinesAdded);
+            if (pObject->pHeapRecords[i].pLinkInfo)
+            {
+                pRecord->pLinkInfo = new ObjectLinkInfo(*pObject->pHeapRecords[i].pLinkInfo);
+            }
+        }
+    }
+
+    if (pObject->pUnusedMethodEntries)
+    {
+        ImportUnusedMethodEntries(pObject->pUnusedMethodEntries);
+    }
+
+    return true;
+}
 
-static CompilerConfig s_compilerConfig;
-static LoadFileFunc s_pLoadFileFunc = 0;
-static FreeFileBufferFunc s_pFreeFileBufferFunc = 0;
-static unsigned char* s_pCompileResultBuffer = 0;
+// an object kept from an earlier compile with a context
+struct KeptObject
+{
+    ScheduledObject*        pObject;
+    bool                    bUsedDefinesKnown;
+    std::set<std::string>   usedDefines;        // names it and its sub-objects looked up in the defines
+    bool                    bFilesKnown;
+    std::set<std::string>   files;              // full paths of the files it and its sub-objects loaded
+};
 
-static Heirarchy s_objectHeirarchy;
+// the objects kept, keyed like the scheduler's
+struct KeptObjects
+{
+    std::map<std::string, KeptObject> objects;
+};
 
-class ObjectNode : public HeirarchyNode
+static char* NewString(const char* pString)
 {
-public:
-    char* m_pFullPath;
+    char* pCopy = new char[strlen(pString)+1];
+    strcpy(pCopy, pString);
+    return pCopy;
+}
 
-    ObjectNode()
-        : m_pFullPath(0)
+static void CopyHeapObject(ObjHeap* pTo, const ObjHeap* pFrom, const char* pDefineState)
+{
+    pTo->ObjFilename = NewString(pFrom->ObjFilename);
+    pTo->ObjSize = pFrom->ObjSize;
+    pTo->Obj = new char[pFrom->ObjSize];
+    memcpy(pTo->Obj, pFrom->Obj, pFrom->ObjSize);
+    pTo->ObjDefineState = NewString(pDefineState);
+}
+
+static void CopyLogEntry(CompileLogEntry* pTo, const CompileLogEntry* pFrom, const char* pDefineState)
+{
+    *pTo = *pFrom;
+    pTo->pFilename = NewString(pFrom->pFilename);
+    pTo->pDefineState = CopyDefineState(pDefineState);
+    pTo->pUsedDefines = pFrom->pUsedDefines ? CopyDefineState(pFrom->pUsedDefines) : 0;
+    pTo->pFilesLoaded = pFrom->pFilesLoaded ? CopyDefineState(pFrom->pFilesLoaded) : 0;
+}
+
+// Gives a define state of a kept object, which ends with the define state the object started with (pOldBase),
+// as it would be starting with pNewBase instead.  Returns false if it doesn't end with pOldBase.
+static bool RebaseDefineState(const char* pDefineState, const char* pOldBase, const char* pNewBase, std::string& result)
+{
+    size_t nLength = strlen(pDefineState);
+    size_t nOldBaseLength = strlen(pOldBase);
+    if (nLength < nOldBaseLength || strcmp(&pDefineState[nLength - nOldBaseLength], pOldBase) != 0 ||
+        (nLength > nOldBaseLength && pDefineState[nLength - nOldBaseLength - 1] != '\n'))
     {
+        return false;
     }
-};
+    result.assign(pDefineState, nLength - nOldBaseLength);
+    result += pNewBase;
+    return true;
+}
 
-static bool GetPASCIISource(char* pFilename)
+// adds the lines of a define state to a map of name to definition, the first line of each name counting
+// (a define state is newest first)
+static void ParseDefineLines(const char* pLines, std::map<std::string, std::string>& defines)
 {
-    // read in file to temp buffer, convert to PASCII, and assign to s_pCompilerData->source
-    int nLength = 0;
-    char* pRawBuffer = s_pLoadFileFunc(pFilename, &nLength, &s_pCompilerData->current_file_path);
-    if (pRawBuffer)
+    while (*pLines != 0)
     {
-        char* pBuffer = 0;
-        if (s_compilerConfig.bUsePreprocessor)
+        const char* pEnd = strchr(pLines, '\n');
+        if (pEnd == 0)
         {
-            memoryfile mfile;
-            mfile.buffer = pRawBuffer;
-            mfile.length = nLength;
-            mfile.readoffset = 0;
-            pp_push_file_struct(&s_preprocessor, &mfile, pFilename);
-            pp_run(&s_preprocessor);
-            pBuffer = pp_finish(&s_preprocessor);
-            nLength = (int)strlen(pBuffer);
-            if (nLength == 0)
+            pEnd = pLines + strlen(pLines);
+        }
+        const char* pEquals = (const char*)memchr(pLines, '=', pEnd - pLines);
+        std::string name(pLines, (pEquals ? pEquals : pEnd) - pLines);
+        if (defines.find(name) == defines.end())
+        {
+            // an #undef is the same as not defined
+            defines[name] = pEquals ? std::string(pEquals, pEnd - pEquals) : std::string();
+        }
+        pLines = (*pEnd != 0) ? pEnd + 1 : pEnd;
+    }
+}
+
+// Checks that every name looked up has the same definition in both define states
+static bool SameUsedDefines(const char* pDefineState1, const char* pDefineState2, const std::set<std::string>& usedDefines)
+{
+    std::map<std::string, std::string> defines1;
+    std::map<std::string, std::string> defines2;
+    ParseDefineLines(pDefineState1, defines1);
+    ParseDefineLines(pDefineState2, defines2);
+
+    std::map<std::string, std::string>::iterator it;
+    for (it = defines1.begin(); it != defines1.end(); it++)
+    {
+        std::map<std::string, std::string>::iterator other = defines2.find(it->first);
+        if (it->second != (other != defines2.end() ? other->second : std::string()) && usedDefines.count(it->first))
+        {
+            return false;
+        }
+    }
+    for (it = defines2.begin(); it != defines2.end(); it++)
+    {
+        if (defines1.find(it->first) == defines1.end() && !it->second.empty() && usedDefines.count(it->first))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies a kept object for a compile that starts it with another define state, or returns 0 if it can't be
+static ScheduledObject* RebaseKeptObject(const ScheduledObject* pObject, const char* pDefineState)
+{
+    std::vector<std::string> logStates(pObject->nLogEntries);
+    std::vector<std::string> heapStates(pObject->nHeapObjects);
+    for (int i = 0; i < pObject->nLogEntries; i++)
+    {
+        if (!RebaseDefineState(pObject->pLog[i].pDefineState, pObject->pDefineState, pDefineState, logStates[i]))
+        {
+            return 0;
+        }
+    }
+    for (int i = 0; i < pObject->nHeapObjects; i++)
+    {
+        if (!RebaseDefineState(pObject->pHeapObjects[i].ObjDefineState, pObject->pDefineState, pDefineState, heapStates[i]))
+        {
+            return 0;
+        }
+    }
+
+    ScheduledObject* pCopy = new ScheduledObject();
+    pCopy->pFilename = NewString(pObject->pFilename);
+    pCopy->pDefineState = NewString(pDefineState);
+    pCopy->state = ScheduledObject::Compiled;
+    pCopy->nLogEntries = pObject->nLogEntries;
+    pCopy->pLog = new CompileLogEntry[pCopy->nLogEntries];
+    for (int i = 0; i < pCopy->nLogEntries; i++)
+    {
+        CopyLogEntry(&pCopy->pLog[i], &pObject->pLog[i], logStates[i].c_str());
+    }
+    pCopy->nHeapObjects = pObject->nHeapObjects;
+    pCopy->pHeapObjects = new ObjHeap[pCopy->nHeapObjects];
+    pCopy->pHeapRecords = new HeapObjectRecord[pCopy->nHeapObjects];
+    for (int i = 0; i < pCopy->nHeapObjects; i++)
+    {
+        CopyHeapObject(&pCopy->pHeapObjects[i], &pObject->pHeapObjects[i], heapStates[i].c_str());
+        pCopy->pHeapRecords[i] = pObject->pHeapRecords[i];
+        pCopy->pHeapRecords[i].pDefinesAdded = pp_duplicate_defines(pObject->pHeapRecords[i].pDefinesAdded);
+    }
+    return pCopy;
+}
+
+// Returns the object kept with this define state, or else one kept with another define state that differs
+// only in defines it (and its sub-objects) never looked up, as it would be compiled with this one
+static ScheduledObject* FindKeptObject(const char* pFilename, const char* pDefineState)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->pKeptObjects == 0)
+    {
+        return 0;
+    }
+    std::map<std::string, KeptObject>& objects = pContext->pKeptObjects->objects;
+    std::string key = std::string(pFilename) + '\0' + pDefineState;
+    std::map<std::string, KeptObject>::iterator it = objects.find(key);
+    if (it != objects.end())
+    {
+        return it->second.pObject;
+    }
+
+    std::string prefix = std::string(pFilename) + '\0';
+    for (it = objects.lower_bound(prefix); it != objects.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++)
+    {
+        if (it->second.bUsedDefinesKnown && SameUsedDefines(it->second.pObject->pDefineState, pDefineState, it->second.usedDefines))
+        {
+            ScheduledObject* pObject = RebaseKeptObject(it->second.pObject, pDefineState);
+            if (pObject != 0)
             {
-                free(pBuffer);
-                pBuffer = 0;
+                KeptObject kept = it->second;
+                kept.pObject = pObject;
+                objects[key] = kept;
+                return pObject;
             }
-            s_pFreeFileBufferFunc(pRawBuffer);
         }
-        else
+    }
+    return 0;
+}
+
+// Keeps every object in the heap, with the heap entries and log of its sub-objects, for later compiles with
+// the context to take over like a scheduled object.  Objects that used a heap entry compiled with another
+// define state than they asked for (so that compiling them again could give something else) aren't kept.
+static void KeepCompiledObjects()
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    if (pContext->pKeptObjects == 0)
+    {
+        pContext->pKeptObjects = new KeptObjects;
+    }
+
+    for (int i = 0; i < pContext->nObjHeapIndex; i++)
+    {
+        HeapObjectRecord* pRecord = &pContext->heapObjectRecords[i];
+        const CompileLogEntry* pLog = &pContext->pCompileLog[pRecord->nFirstLogEntry];
+
+        // the heap entries it used, the object itself last
+        std::vector<int> heapIndices;
+        bool bKeep = true;
+        for (int j = 1; j < pRecord->nLogEntries && bKeep; j++)
+        {
+            int nObjIdx = IndexOfObjectInHeap(pLog[j].pFilename);
+            if (nObjIdx == -1 || pLog[j].pDefineState == 0 || strcmp(pContext->objHeap[nObjIdx].ObjDefineState, pLog[j].pDefineState) != 0)
+            {
+                bKeep = false;
+            }
+            else if (nObjIdx != i && std::find(heapIndices.begin(), heapIndices.end(), nObjIdx) == heapIndices.end())
+            {
+                heapIndices.push_back(nObjIdx);
+            }
+        }
+        if (!bKeep)
         {
-            pBuffer = pRawBuffer;
+            continue;
         }
+        heapIndices.push_back(i);
 
-        char* pPASCIIBuffer = new char[nLength+1];
-        memset(pPASCIIBuffer, 0, nLength + 1);
-        if (!UnicodeToPASCII(pBuffer, nLength, pPASCIIBuffer, s_compilerConfig.bUsePreprocessor))
+        KeptObject kept;
+        kept.bUsedDefinesKnown = true;
+        for (int j = 0; j < pRecord->nLogEntries && kept.bUsedDefinesKnown; j++)
+        {
+            if (pLog[j].pUsedDefines == 0)
+            {
+                kept.bUsedDefinesKnown = false;
+            }
+            else
+            {
+                AddNameLines(pLog[j].pUsedDefines, kept.usedDefines);
+            }
+        }
+        kept.bFilesKnown = true;
+        for (int j = 0; j < pRecord->nLogEntries && kept.bFilesKnown; j++)
         {
-            printf("Unrecognized text encoding format!\n");
-            delete [] pPASCIIBuffer;
-            if (s_compilerConfig.bUsePreprocessor)
+            if (pLog[j].pFilesLoaded == 0)
             {
-                free(pBuffer);
+                kept.bFilesKnown = false;
             }
             else
             {
-                s_pFreeFileBufferFunc(pRawBuffer);
+                AddNameLines(pLog[j].pFilesLoaded, kept.files);
+            }
+        }
+
+        ScheduledObject* pObject = new ScheduledObject();
+        pObject->pFilename = NewString(pContext->objHeap[i].ObjFilename);
+        pObject->pDefineState = NewString(pContext->objHeap[i].ObjDefineState);
+        pObject->state = ScheduledObject::Compiled;
+
+        pObject->nLogEntries = pRecord->nLogEntries;
+        pObject->pLog = new CompileLogEntry[pObject->nLogEntries];
+        for (int j = 0; j < pObject->nLogEntries; j++)
+        {
+            CopyLogEntry(&pObject->pLog[j], &pLog[j], pLog[j].pDefineState);
+        }
+
+        pObject->nHeapObjects = (int)heapIndices.size();
+        pObject->pHeapObjects = new ObjHeap[pObject->nHeapObjects];
+        pObject->pHeapRecords = new HeapObjectRecord[pObject->nHeapObjects];
+        for (int k = 0; k < pObject->nHeapObjects; k++)
+        {
+            const ObjHeap* pHeapObject = &pContext->objHeap[heapIndices[k]];
+            CopyHeapObject(&pObject->pHeapObjects[k], pHeapObject, pHeapObject->ObjDefineState);
+
+            // its log entries are where it first appears under the object, followed by its own sub-objects
+            int nFirst = 0;
+            while (_stricmp(pLog[nFirst].pFilename, pHeapObject->ObjFilename) != 0)
+            {
+                nFirst++;
+            }
+            int nLast = nFirst + 1;
+            while (nLast < pRecord->nLogEntries && pLog[nLast].nDepth > pLog[nFirst].nDepth)
+            {
+                nLast++;
+            }
+            HeapObjectRecord* pKeptRecord = &pObject->pHeapRecords[k];
+            memset(pKeptRecord, 0, sizeof(HeapObjectRecord));
+            pKeptRecord->nFirstLogEntry = nFirst;
+            pKeptRecord->nLogEntries = nLast - nFirst;
+            pKeptRecord->pDefinesAdded = pp_duplicate_defines(pContext->heapObjectRecords[heapIndices[k]].pDefinesAdded);
+        }
+
+        kept.pObject = pObject;
+        std::string key = std::string(pObject->pFilename) + '\0' + pObject->pDefineState;
+        std::map<std::string, KeptObject>::iterator it = pContext->pKeptObjects->objects.find(key);
+        if (it != pContext->pKeptObjects->objects.end())
+        {
+            delete it->second.pObject;
+        }
+        pContext->pKeptObjects->objects[key] = kept;
+    }
+}
+
+// Asks the scheduler to compile the sub-objects of an object, with the define state they start with
+static void RequestSubObjects(char* filenames, int numObjects, ObjectNode* pObjectNode)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    char* pDefineState = 0;
+    void* pDefines = 0;
+    if (pContext->compilerConfig.bUsePreprocessor)
+    {
+        pDefineState = pp_get_define_state_string(&pContext->preprocessor);
+        pDefines = pp_copy_defines_since(&pContext->preprocessor, 0);
+    }
+    else
+    {
+        pDefineState = (char*)calloc(1, 1);
+    }
+
+    int nAncestors = 0;
+    for (ObjectNode* pNode = pObjectNode; pNode != 0; pNode = (ObjectNode*)(pNode->m_pParent))
+    {
+        nAncestors++;
+    }
+    char** ppAncestorPaths = new char*[nAncestors];
+    nAncestors = 0;
+    for (ObjectNode* pNode = pObjectNode; pNode != 0; pNode = (ObjectNode*)(pNode->m_pParent))
+    {
+        ppAncestorPaths[nAncestors++] = pNode->m_pFullPath;
+    }
+
+    for (int i = 0; i < numObjects; i++)
+    {
+        if (IndexOfCompiledObjectInHeap(&filenames[i<<8], pDefineState) == -1 && FindKeptObject(&filenames[i<<8], pDefineState) == 0)
+        {
+            pContext->pScheduler->Request(&filenames[i<<8], pDefineState, pDefines, pContext->nObjStackPtr, ppAncestorPaths, nAncestors);
+        }
+    }
+
+    delete [] ppAncestorPaths;
+    pp_free_defines(pDefines);
+    free(pDefineState);
+}
+
+// Loads the files of the DAT block FILE directives into dat_data for Compile2()
+static bool LoadDatFiles(char* pFilename)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    int p = 0;
+    for (int i = 0; i < pContext->pCompilerData->dat_files; i++)
+    {
+        // Get DAT's Files
+
+        // Get name information
+        char filename[256];
+        strcpy(&filename[0], &(pContext->pCompilerData->dat_filenames[i<<8]));
+
+        // Load file and add to dat_data buffer
+        pContext->pCompilerData->dat_lengths[i] = -1;
+        char* pFilePath = 0;
+        char* pBuffer = LoadObjectFile(&filename[0], &pContext->pCompilerData->dat_lengths[i], &pFilePath);
+
+        if (pContext->pCompilerData->dat_lengths[i] == -1)
+        {
+            pContext->pCompilerData->dat_lengths[i] = 0;
+            char message[300];
+            snprintf(message, sizeof(message), "Cannot find/open dat file: %s", &filename[0]);
+            ReportCompileError(pFilename, message, "%s \n");
+            return false;
+        }
+        if (p + pContext->pCompilerData->dat_lengths[i] > data_limit)
+        {
+            PrintCompileError(pFilename, "DAT files exceed 128k.");
+            return false;
+        }
+        memcpy(&(pContext->pCompilerData->dat_data[p]), pBuffer, pContext->pCompilerData->dat_lengths[i]);
+        pContext->pFreeFileBufferFunc(pBuffer);
+        pContext->pCompilerData->dat_offsets[i] = p;
+        p += pContext->pCompilerData->dat_lengths[i];
+    }
+    return true;
+}
+
+// Moves the heap of the first pass of unused method elimination aside for the final pass to link from
+static void KeepHeapForLinking()
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    DeleteLinkHeap();
+    pContext->pLinkHeap = new LinkHeap;
+    for (int i = 0; i < pContext->nObjHeapIndex; i++)
+    {
+        pContext->pLinkHeap->objHeap[i] = pContext->objHeap[i];
+        pContext->pLinkHeap->records[i] = pContext->heapObjectRecords[i];
+        memset(&pContext->objHeap[i], 0, sizeof(ObjHeap));
+        memset(&pContext->heapObjectRecords[i], 0, sizeof(HeapObjectRecord));
+    }
+    pContext->pLinkHeap->nObjHeapIndex = pContext->nObjHeapIndex;
+    pContext->nObjHeapIndex = 0;
+}
+
+static int IndexOfObjectInLinkHeap(const char* pFilename)
+{
+    LinkHeap* pLinkHeap = g_pCompilerContext->pLinkHeap;
+    for (int i = pLinkHeap->nObjHeapIndex - 1; i >= 0; i--)
+    {
+        if (_stricmp(pLinkHeap->objHeap[i].ObjFilename, pFilename) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the pubcon list that follows the code and checksum of a heap object
+static const unsigned char* GetHeapPubConList(const ObjHeap* pHeapObject, int& nPubConListSize)
+{
+    const unsigned char* pObj = (const unsigned char*)pHeapObject->Obj;
+    int nOffset = 4 + (pObj[2] | (pObj[3] << 8)) + 1;
+    nPubConListSize = pHeapObject->ObjSize - nOffset;
+    return &pObj[nOffset];
+}
+
+// Counts the PUBs in a pubcon list, where each name is followed by the parameter count of a PUB (0-15)
+// or by the type (16 or 17) and long value of a CON
+static int CountPubs(const unsigned char* pPubConList, int nPubConListSize)
+{
+    int nPubs = 0;
+    int i = 0;
+    while (i < nPubConListSize)
+    {
+        while (i < nPubConListSize && pPubConList[i] >= 18)
+        {
+            i++;
+        }
+        if (i < nPubConListSize && pPubConList[i] < 16)
+        {
+            nPubs++;
+            i++;
+        }
+        else
+        {
+            i += 5;
+        }
+    }
+    return nPubs;
+}
+
+// Returns the link heap index of an object that the final pass of unused method elimination can link
+// from its first pass binary, or -1 when it has to be compiled.  None of its methods or sub-objects may
+// be eliminated, nor any PUB of its sub-objects, as the calls into them would be renumbered.
+static int IndexOfLinkableObject(char* pFilename, const char* pDefineState)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    LinkHeap* pLinkHeap = pContext->pLinkHeap;
+    if (pLinkHeap == 0)
+    {
+        return -1;
+    }
+    int nLinkIdx = IndexOfObjectInLinkHeap(pFilename);
+    if (nLinkIdx == -1 || pLinkHeap->records[nLinkIdx].pLinkInfo == 0 ||
+        strcmp(pLinkHeap->objHeap[nLinkIdx].ObjDefineState, pDefineState) != 0)
+    {
+        return -1;
+    }
+    ObjectLinkInfo* pLinkInfo = pLinkHeap->records[nLinkIdx].pLinkInfo;
+
+    char name[256];
+    strcpy(name, pFilename);
+    char* pExtension = strstr(name, ".spin");
+    if (pExtension != 0)
+    {
+        *pExtension = 0;
+    }
+    int nMethods = ((const unsigned char*)pLinkHeap->objHeap[nLinkIdx].Obj)[4 + 2] - 1;
+    for (int i = 0; i < nMethods; i++)
+    {
+        if (!IsMethodUsed(name, i))
+        {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < pLinkInfo->nObjFiles; i++)
+    {
+        strcpy(name, &pLinkInfo->objFilenames[i<<8]);
+        if (!IsObjectUsed(name))
+        {
+            return -1;
+        }
+        int nSubIdx = IndexOfObjectInLinkHeap(name);
+        if (nSubIdx == -1)
+        {
+            return -1;
+        }
+        int nPubConListSize = 0;
+        const unsigned char* pPubConList = GetHeapPubConList(&pLinkHeap->objHeap[nSubIdx], nPubConListSize);
+        int nPubs = CountPubs(pPubConList, nPubConListSize);
+        pExtension = strstr(name, ".spin");
+        if (pExtension != 0)
+        {
+            *pExtension = 0;
+        }
+        for (int j = 0; j < nPubs; j++)
+        {
+            if (!IsMethodUsed(name, j))
+            {
+                return -1;
             }
+        }
+    }
+
+    return nLinkIdx;
+}
+
+// Links an object from its first pass binary with its sub-objects as this pass compiled them
+static bool LinkObject(int nLinkIdx, char* filenames)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    ObjHeap* pHeapObject = &pContext->pLinkHeap->objHeap[nLinkIdx];
+    ObjectLinkInfo* pLinkInfo = pContext->pLinkHeap->records[nLinkIdx].pLinkInfo;
+
+    // its code was compiled against the pubcon lists of its sub-objects, which must not have changed
+    for (int i = 0; i < pLinkInfo->nObjFiles; i++)
+    {
+        int nObjIdx = IndexOfObjectInHeap(&filenames[i<<8]);
+        int nSubIdx = IndexOfObjectInLinkHeap(&filenames[i<<8]);
+        if (nObjIdx == -1 || nSubIdx == -1)
+        {
+            return false;
+        }
+        int nPubConListSize = 0;
+        const unsigned char* pPubConList = GetHeapPubConList(&pContext->objHeap[nObjIdx], nPubConListSize);
+        int nFirstPubConListSize = 0;
+        const unsigned char* pFirstPubConList = GetHeapPubConList(&pContext->pLinkHeap->objHeap[nSubIdx], nFirstPubConListSize);
+        if (nPubConListSize != nFirstPubConListSize || memcmp(pPubConList, pFirstPubConList, nPubConListSize) != 0)
+        {
             return false;
         }
+    }
+
+    pContext->pCompilerData->obj_files = pLinkInfo->nObjFiles;
+    if (!CopyObjectsFromHeap(pContext->pCompilerData, filenames))
+    {
+        return false;
+    }
+
+    // the own code comes before the sub-objects, and its VAR size is where the first sub-object's VARs start
+    const unsigned char* pObj = (const unsigned char*)pHeapObject->Obj;
+    const unsigned char* pOwnObj = &pObj[4];
+    int nOwnObjSize = pOwnObj[0] | (pOwnObj[1] << 8);
+    int nObjStart = pOwnObj[2] << 2;
+    int nVarSize = (pOwnObj[3] > 0) ? (pOwnObj[nObjStart + 2] | (pOwnObj[nObjStart + 3] << 8)) : (pObj[0] | (pObj[1] << 8));
+    int nPubConListSize = 0;
+    const unsigned char* pPubConList = GetHeapPubConList(pHeapObject, nPubConListSize);
+    if (Relink(pOwnObj, nOwnObjSize, pLinkInfo->indexFiles, nVarSize, pPubConList, nPubConListSize) != 0)
+    {
+        return false;
+    }
+    pContext->pCompilerData->stack_requirement = pLinkInfo->nStackRequirement;
+    return true;
+}
+
+// The object cache is used for sub-objects, except with unused method elimination or an annotated listing,
+// which keep data of every object they compile
+static bool UseObjectCache(ObjectNode* pParentNode)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    return pContext->compilerConfig.pCacheDir != 0 && pParentNode != 0 &&
+           !pContext->compilerConfig.bUnusedMethodElimination && !AL_Selected() && !pContext->bScanOnly;
+}
 
-        // clean up any previous buffer
-        if (s_pCompilerData->source)
+static void GetObjectCacheOptions(ObjectCacheHeader* pHeader)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    memset(pHeader, 0, sizeof(ObjectCacheHeader));
+    pHeader->nDATonly = pContext->compilerConfig.bDATonly ? 1 : 0;
+    pHeader->nEepromSize = pContext->compilerConfig.eeprom_size;
+}
+
+// Takes an object from the cache, when its sub-objects (now in the heap) and DAT files are the ones it was compiled with
+static bool LinkCachedObject(const CachedObject* pObject, char* filenames)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    const ObjectCacheHeader* pHeader = pObject->pHeader;
+    for (int i = 0; i < pHeader->nObjFiles; i++)
+    {
+        int nObjIdx = IndexOfObjectInHeap(&filenames[i<<8]);
+        if (nObjIdx == -1 || HashObjectCacheData(pContext->objHeap[nObjIdx].Obj, pContext->objHeap[nObjIdx].ObjSize) != pObject->pObjFiles[i].hash)
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < pHeader->nDatFiles; i++)
+    {
+        int nLength = -1;
+        char* pFilePath = 0;
+        char* pBuffer = LoadObjectFile(pObject->pDatFiles[i].name, &nLength, &pFilePath);
+        bool bSame = (nLength != -1) && HashObjectCacheData(pBuffer, nLength) == pObject->pDatFiles[i].hash;
+        pContext->pFreeFileBufferFunc(pBuffer);
+        if (!bSame)
         {
-            delete [] s_pCompilerData->source;
+            return false;
         }
+    }
+    if (pHeader->nObjSize > pContext->pCompilerData->obj_limit)
+    {
+        return false;
+    }
+
+    memcpy(pContext->pCompilerData->obj, pObject->pObj, pHeader->nObjSize);
+    pContext->pCompilerData->obj_ptr = pHeader->nObjSize;
+    pContext->pCompilerData->psize = pHeader->nPSize;
+    pContext->pCompilerData->vsize = pHeader->nVSize;
+    pContext->pCompilerData->stack_requirement = pHeader->nStackRequirement;
+    return true;
+}
+
+// Writes the object just compiled to the cache, with the sub-objects and DAT files it was compiled with
+static void AddCompiledObjectToCache(char* filenames, int numObjects)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    CompilerData* pCompilerData = pContext->pCompilerData;
+    CachedObjectFile* pFiles = new CachedObjectFile[numObjects + pCompilerData->dat_files];
+    memset(pFiles, 0, (numObjects + pCompilerData->dat_files) * sizeof(CachedObjectFile));
+    for (int i = 0; i < numObjects; i++)
+    {
+        int nObjIdx = IndexOfObjectInHeap(&filenames[i<<8]);
+        strcpy(pFiles[i].name, &filenames[i<<8]);
+        pFiles[i].hash = HashObjectCacheData(pContext->objHeap[nObjIdx].Obj, pContext->objHeap[nObjIdx].ObjSize);
+    }
+    for (int i = 0; i < pCompilerData->dat_files; i++)
+    {
+        strcpy(pFiles[numObjects + i].name, &(pCompilerData->dat_filenames[i<<8]));
+        pFiles[numObjects + i].hash = HashObjectCacheData(&(pCompilerData->dat_data[pCompilerData->dat_offsets[i]]), pCompilerData->dat_lengths[i]);
+    }
 
-        s_pCompilerData->source = pPASCIIBuffer;
+    ObjectCacheHeader header;
+    GetObjectCacheOptions(&header);
+    header.nObjFiles = numObjects;
+    header.nDatFiles = pCompilerData->dat_files;
+    header.nObjSize = pCompilerData->obj_ptr;
+    header.nPSize = pCompilerData->psize;
+    header.nVSize = pCompilerData->vsize;
+    header.nStackRequirement = pCompilerData->stack_requirement;
+
+    CachedObject object;
+    memset(&object, 0, sizeof(object));
+    object.pHeader = &header;
+    object.pObjFiles = pFiles;
+    object.pDatFiles = &pFiles[numObjects];
+    object.pObj = pCompilerData->obj;
+    object.pSource = pCompilerData->source;
+    AddObjectToCache(pContext->compilerConfig.pCacheDir, &object);
+
+    delete [] pFiles;
+}
+
+// Adds the object just compiled to the heap, with the record of its compile
+static bool SaveObjectInHeap(char* pFilename, int nLogEntry, int nUnusedMethods, void* definestate, char* filenames, int numObjects)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    TakeFilesLoaded(nLogEntry);
 
-        if (s_compilerConfig.bUsePreprocessor)
+    // save this object in the heap
+    bool bNewHeapObject = (IndexOfObjectInHeap(pFilename) == -1);
+    if (!AddObjectToHeap(pFilename, pContext->pCompilerData, pContext->pCompileLog[nLogEntry].pDefineState))
+    {
+        PrintCompileError(pFilename, "Object Heap Overflow.");
+        return false;
+    }
+    if (bNewHeapObject)
+    {
+        HeapObjectRecord* pRecord = &pContext->heapObjectRecords[IndexOfObjectInHeap(pFilename)];
+        pRecord->nFirstLogEntry = nLogEntry;
+        pRecord->nLogEntries = pContext->nCompileLogEntries - nLogEntry;
+        pRecord->nFirstUnusedMethod = nUnusedMethods;
+        pRecord->nUnusedMethods = pContext->pCompilerData->unused_methods - nUnusedMethods;
+        if (pContext->compilerConfig.bUsePreprocessor)
         {
-            free(pBuffer);
+            pRecord->pDefinesAdded = pp_copy_defines_since(&pContext->preprocessor, definestate);
         }
-        else
+        if (!pContext->pCompilerData->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination)
         {
-            s_pFreeFileBufferFunc(pRawBuffer);
+            pRecord->pLinkInfo = new ObjectLinkInfo;
+            pRecord->pLinkInfo->pFullPath = pContext->pCompileLog[nLogEntry].pFullPath;
+            pRecord->pLinkInfo->nStackRequirement = pContext->pCompilerData->stack_requirement;
+            pRecord->pLinkInfo->nObjFiles = numObjects;
+            memcpy(pRecord->pLinkInfo->objFilenames, filenames, numObjects << 8);
+            memcpy(pRecord->pLinkInfo->indexFiles, pContext->pCompilerData->obj_index_files, sizeof(pRecord->pLinkInfo->indexFiles));
         }
-        AL_OpenObject (pFilename, s_pCompilerData,
-            (s_compilerConfig.bUsePreprocessor ? &s_preprocessor : NULL));
-    }
-    else
-    {
-        s_pCompilerData->source = NULL;
-        return false;
     }
+    pContext->nObjStackPtr--;
 
     return true;
 }
 
-static void CleanupMemory(bool bUnusedMethodData = true)
+static bool CompileRecursively(char* pFilename, int& nCompileIndex, ObjectNode* pParentNode)
 {
-    delete s_objectHeirarchy.m_pRoot;
-    s_objectHeirarchy.m_pRoot = 0;
-
-    if ( s_pCompilerData )
-    {
-        delete [] s_pCompilerData->list;
-        delete [] s_pCompilerData->doc;
-        delete [] s_pCompilerData->obj;
-        delete [] s_pCompilerData->source;
-    }
-    CleanObjectHeap();
-    if (bUnusedMethodData)
+    CompilerContext* pContext = g_pCompilerContext;
+    nCompileIndex++;
+    PrintObjectTreeEntry(pFilename, pContext->nObjStackPtr);
+    int nLogEntry = AddCompileLogEntry(pFilename, 0, pContext->nObjStackPtr);
+    int nUnusedMethods = pContext->pCompilerData->unused_methods;
+    if (pContext->pFilesLoaded != 0)
     {
-        CleanUpUnusedMethodData();
+        // anything left was loaded by a compile that failed
+        flexbuf_clear(pContext->pFilesLoaded);
     }
-    Cleanup();
-    if (s_pCompileResultBuffer != 0)
+    pContext->nObjStackPtr++;
+    if (pContext->nObjStackPtr > ObjFileStackLimit)
     {
-        delete [] s_pCompileResultBuffer;
-        s_pCompileResultBuffer = 0;
+        PrintCompileError(pFilename, "Object nesting exceeds limit of %d levels.", ObjFileStackLimit);
+        return false;
     }
-}
-
-void PrintError(const char* pFilename, const char* pErrorString)
-{
-    int lineNumber = 1;
-    int column = 1;
-    int offsetToStartOfLine = -1;
-    int offsetToEndOfLine = -1;
-    int offendingItemStart = 0;
-    int offendingItemEnd = 0;
-
-    GetErrorInfo(lineNumber, column, offsetToStartOfLine, offsetToEndOfLine, offendingItemStart, offendingItemEnd);
 
-    printf("%s(%d:%d) : error : %s\n", pFilename, lineNumber, column, pErrorString);
-
-    if ( offendingItemStart == offendingItemEnd && s_pCompilerData->source[offendingItemStart] == 0 )
+    void *definestate = 0;
+    if (pContext->compilerConfig.bUsePreprocessor)
     {
-        printf("Line:\nEnd Of File\nOffending Item: N/A\n");
+        definestate = pp_get_define_state(&pContext->preprocessor);
+        pContext->pCompileLog[nLogEntry].pDefineState = pp_get_define_state_string(&pContext->preprocessor);
     }
     else
     {
-        char* errorLine = 0;
-        char* errorItem = 0;
+        pContext->pCompileLog[nLogEntry].pDefineState = (char*)calloc(1, 1);
+    }
 
-        if (offendingItemEnd - offendingItemStart > 0)
-        {
-            errorLine = new char[(offsetToEndOfLine - offsetToStartOfLine) + 1];
-            strncpy(errorLine, &s_pCompilerData->source[offsetToStartOfLine], offsetToEndOfLine - offsetToStartOfLine);
-            errorLine[offsetToEndOfLine - offsetToStartOfLine] = 0;
-        }
+    // sub-objects already compiled with the same define state are taken from the heap as they are
+    if (pParentNode != 0 && ReuseCompiledObject(pFilename, nLogEntry, nCompileIndex, pParentNode))
+    {
+        pContext->nObjStackPtr--;
+        return true;
+    }
 
-        if (offendingItemEnd - offendingItemStart > 0)
+    // or kept from an earlier compile with the context (the annotated listing needs to see them compiled)
+    if (pParentNode != 0 && pContext->pKeptObjects != 0 && !AL_Selected())
+    {
+        ScheduledObject* pObject = FindKeptObject(pFilename, pContext->pCompileLog[nLogEntry].pDefineState);
+        if (pObject != 0 && AdoptScheduledObject(pFilename, nLogEntry, nCompileIndex, pParentNode, pObject))
         {
-            errorItem = new char[(offendingItemEnd - offendingItemStart) + 1];
-            strncpy(errorItem, &s_pCompilerData->source[offendingItemStart], offendingItemEnd - offendingItemStart);
-            errorItem[offendingItemEnd - offendingItemStart] = 0;
+            pContext->nObjStackPtr--;
+            return true;
         }
-
-        printf("Line:\n%s\nOffending Item: %s\n", errorLine ? errorLine : "N/A", errorItem ? errorItem : "N/A");
-
-        delete [] errorLine;
-        delete [] errorItem;
     }
-}
 
-static bool CheckForCircularReference(ObjectNode* pObjectNode)
-{
-    ObjectNode* pCurrentNode = pObjectNode;
-    while (pCurrentNode->m_pParent)
+    // as are ones another thread compiled with the same define state
+    if (pParentNode != 0 && pContext->pScheduler != 0)
     {
-        ObjectNode* pParent = (ObjectNode*)(pCurrentNode->m_pParent);
-        if (strcmp(pObjectNode->m_pFullPath, pParent->m_pFullPath) == 0)
+        ScheduledObject* pObject = pContext->pScheduler->Get(pFilename, pContext->pCompileLog[nLogEntry].pDefineState);
+        if (pObject != 0 && AdoptScheduledObject(pFilename, nLogEntry, nCompileIndex, pParentNode, pObject))
         {
+            pContext->nObjStackPtr--;
             return true;
         }
-        pCurrentNode = pParent;
     }
 
-    return false;
-}
+    // in the final pass of unused method elimination, objects that lose none of their code are linked
+    // from their first pass binary instead of being compiled again
+    int nLinkIdx = (pParentNode != 0) ? IndexOfLinkableObject(pFilename, pContext->pCompileLog[nLogEntry].pDefineState) : -1;
+    ObjectLinkInfo* pLinkInfo = (nLinkIdx != -1) ? pContext->pLinkHeap->records[nLinkIdx].pLinkInfo : 0;
 
-static bool CompileRecursively(char* pFilename, int& nCompileIndex, ObjectNode* pParentNode)
-{
-    nCompileIndex++;
-    if (s_nObjStackPtr > 0 && (!s_compilerConfig.bQuiet || s_compilerConfig.bFileTreeOutputOnly))
+    if (pLinkInfo != 0)
     {
-        // only do this if UME is off or if it's the final compile when UME is on
-        if (!s_compilerConfig.bUnusedMethodElimination || s_pCompilerData->bFinalCompile)
-        {
-            char spaces[] = "                              \0";
-            printf("%s|-%s\n", &spaces[32-(s_nObjStackPtr<<1)], pFilename);
-        }
+        pContext->pCompilerData->current_file_path = pLinkInfo->pFullPath;
     }
-    s_nObjStackPtr++;
-    if (s_nObjStackPtr > ObjFileStackLimit)
+    else if (!GetPASCIISource(pFilename, &pContext->pCompileLog[nLogEntry].pUsedDefines))
     {
-        printf("%s : error : Object nesting exceeds limit of %d levels.\n", pFilename, ObjFileStackLimit);
+        PrintCompileError(pFilename, "Can not find/open file.");
         return false;
     }
+    TakeFilesLoaded(nLogEntry);
 
-    void *definestate = 0;
-    if (s_compilerConfig.bUsePreprocessor)
+    // when only scanning, the defines it makes are put back after its sub-objects instead of preprocessing it again
+    void* pScanDefinesAdded = 0;
+    if (pContext->bScanOnly && pContext->compilerConfig.bUsePreprocessor)
     {
-        definestate = pp_get_define_state(&s_preprocessor);
+        pScanDefinesAdded = pp_copy_defines_since(&pContext->preprocessor, definestate);
     }
-    if (!GetPASCIISource(pFilename))
+
+    // an object in the cache only has its sub-objects compiled, to check they are the ones it was compiled with
+    CachedObject* pCachedObject = 0;
+    if (pLinkInfo == 0 && UseObjectCache(pParentNode))
     {
-        printf("%s : error : Can not find/open file.\n", pFilename);
-        return false;
+        ObjectCacheHeader options;
+        GetObjectCacheOptions(&options);
+        pCachedObject = FindCachedObject(pContext->compilerConfig.pCacheDir, &options, pContext->pCompilerData->source);
     }
+    pContext->pCompileLog[nLogEntry].pFullPath = pContext->pCompilerData->current_file_path;
 
-    if (!s_pCompilerData->bFinalCompile  && s_compilerConfig.bUnusedMethodElimination)
+    if (!pContext->pCompilerData->bFinalCompile  && pContext->compilerConfig.bUnusedMethodElimination)
     {
         AddObjectName(pFilename, nCompileIndex);
     }
 
-    strcpy(s_pCompilerData->current_filename, pFilename);
-    char* pExtension = strstr(s_pCompilerData->current_filename, ".spin");
+    strcpy(pContext->pCompilerData->current_filename, pFilename);
+    char* pExtension = strstr(pContext->pCompilerData->current_filename, ".spin");
     if (pExtension != 0)
     {
         *pExtension = 0;
     }
 
     ObjectNode* pObjectNode = new ObjectNode();
-    pObjectNode->m_pFullPath = s_pCompilerData->current_file_path;
+    pObjectNode->m_pFullPath = pContext->pCompilerData->current_file_path;
     pObjectNode->m_pParent = pParentNode;
-    s_objectHeirarchy.AddNode(pObjectNode, pParentNode);
+    pContext->objectHeirarchy.AddNode(pObjectNode, pParentNode);
     if (CheckForCircularReference(pObjectNode))
     {
-        printf("%s : error : Illegal Circular Reference\n", pFilename);
+        PrintCompileError(pFilename, "Illegal Circular Reference");
+        ReleaseCachedObject(pCachedObject);
         return false;
     }
 
-    // first pass on object
-    const char* pErrorString = Compile1();
-    if (pErrorString != 0)
+    const char* pErrorString = 0;
+    char filenames[file_limit*256];
+    int numObjects = 0;
+    if (pLinkInfo != 0)
     {
-        PrintError(pFilename, pErrorString);
-        return false;
+        // its sub-objects see the defines it makes, as they would after preprocessing it
+        if (pContext->compilerConfig.bUsePreprocessor)
+        {
+            pp_apply_defines(&pContext->preprocessor, pContext->pLinkHeap->records[nLinkIdx].pDefinesAdded);
+        }
+        numObjects = pLinkInfo->nObjFiles;
+        memcpy(filenames, pLinkInfo->objFilenames, numObjects << 8);
     }
-
-    if (s_pCompilerData->obj_files > 0)
+    else if (pCachedObject != 0)
+    {
+        numObjects = pCachedObject->pHeader->nObjFiles;
+        for (int i = 0; i < numObjects; i++)
+        {
+            strcpy(&filenames[i<<8], pCachedObject->pObjFiles[i].name);
+        }
+    }
+    else
     {
-        char filenames[file_limit*256];
+        // first pass on object
+        pErrorString = Compile1();
+        if (pErrorString != 0)
+        {
+            PrintError(pFilename, pErrorString);
+            return false;
+        }
 
-        int numObjects = s_pCompilerData->obj_files;
+        numObjects = pContext->pCompilerData->obj_files;
         for (int i = 0; i < numObjects; i++)
         {
             // copy the obj filename appending .spin if it doesn't have it.
-            strcpy(&filenames[i<<8], &(s_pCompilerData->obj_filenames[i<<8]));
+            strcpy(&filenames[i<<8], &(pContext->pCompilerData->obj_filenames[i<<8]));
             if (strstr(&filenames[i<<8], ".spin") == NULL)
             {
                 strcat(&filenames[i<<8], ".spin");
             }
         }
+    }
+
+    // when only scanning, the parent isn't compiled again after its sub-objects, so its DAT files are kept
+    // from its first pass (the sub-objects' first passes replace them)
+    std::string scanDatFilenames;
+    int nScanDatFiles = 0;
+    if (pContext->bScanOnly)
+    {
+        nScanDatFiles = pContext->pCompilerData->dat_files;
+        scanDatFilenames.assign(pContext->pCompilerData->dat_filenames, nScanDatFiles << 8);
+    }
+
+    if (numObjects > 0)
+    {
+        if (pContext->pScheduler != 0)
+        {
+            RequestSubObjects(filenames, numObjects, pObjectNode);
+        }
 
         for (int i = 0; i < numObjects; i++)
         {
             if (!CompileRecursively(&filenames[i<<8], nCompileIndex, pObjectNode))
             {
+                ReleaseCachedObject(pCachedObject);
+                pp_free_defines(pScanDefinesAdded);
                 return false;
             }
         }
+    }
+
+    if (pContext->bScanOnly)
+    {
+        // the first pass found its sub-objects and DAT files, which is all -t & -f need
+        if (pContext->compilerConfig.bUsePreprocessor)
+        {
+            pp_restore_define_state(&pContext->preprocessor, definestate);
+            pp_apply_defines(&pContext->preprocessor, pScanDefinesAdded);
+            pp_free_defines(pScanDefinesAdded);
+        }
+        pContext->pCompilerData->dat_files = nScanDatFiles;
+        memcpy(pContext->pCompilerData->dat_filenames, scanDatFilenames.data(), scanDatFilenames.size());
+        if (!LoadDatFiles(pFilename))
+        {
+            return false;
+        }
+        return SaveObjectInHeap(pFilename, nLogEntry, nUnusedMethods, definestate, filenames, numObjects);
+    }
+
+    bool bLinked = false;
+    if (pLinkInfo != 0)
+    {
+        if (pContext->compilerConfig.bUsePreprocessor)
+        {
+            // undo any defines in sub-objects, keeping its own
+            pp_restore_define_state(&pContext->preprocessor, definestate);
+            pp_apply_defines(&pContext->preprocessor, pContext->pLinkHeap->records[nLinkIdx].pDefinesAdded);
+        }
+        bLinked = LinkObject(nLinkIdx, filenames);
+    }
 
+    // when linking fails it is compiled after all
+    if (!bLinked && (pLinkInfo != 0 || numObjects > 0))
+    {
         // redo first pass on parent object
-        if (s_compilerConfig.bUsePreprocessor)
+        if (pContext->compilerConfig.bUsePreprocessor)
         {
             // undo any defines in sub-objects
-            pp_restore_define_state(&s_preprocessor, definestate);
+            pp_restore_define_state(&pContext->preprocessor, definestate);
         }
         if (!GetPASCIISource(pFilename))
         {
-            printf("%s : error : Can not find/open file.\n", pFilename);
+            PrintCompileError(pFilename, "Can not find/open file.");
+            ReleaseCachedObject(pCachedObject);
             return false;
         }
 
-        strcpy(s_pCompilerData->current_filename, pFilename);
-        pExtension = strstr(s_pCompilerData->current_filename, ".spin");
+        strcpy(pContext->pCompilerData->current_filename, pFilename);
+        pExtension = strstr(pContext->pCompilerData->current_filename, ".spin");
         if (pExtension != 0)
         {
             *pExtension = 0;
         }
+    }
+
+    bool bCached = (pCachedObject != 0);
+    if (bCached)
+    {
+        bLinked = LinkCachedObject(pCachedObject, filenames);
+        ReleaseCachedObject(pCachedObject);
+        pCachedObject = 0;
+    }
+
+    if (!bLinked && (pLinkInfo != 0 || bCached || numObjects > 0))
+    {
         pErrorString = Compile1();
         if (pErrorString != 0)
         {
@@ -315,94 +1818,236 @@ static bool CompileRecursively(char* pFilename, int& nCompileIndex, ObjectNode*
             return false;
         }
 
-        if (!CopyObjectsFromHeap(s_pCompilerData, filenames))
+        if (!CopyObjectsFromHeap(pContext->pCompilerData, filenames))
         {
-            printf("%s : error : Object files exceed 128k.\n", pFilename);
+            PrintCompileError(pFilename, "Object files exceed 128k.");
             return false;
         }
     }
 
-    // load all DAT files
-    if (s_pCompilerData->dat_files > 0)
+    if (!bLinked)
     {
-        int p = 0;
-        for (int i = 0; i < s_pCompilerData->dat_files; i++)
+        // load all DAT files
+        if (!LoadDatFiles(pFilename))
         {
-            // Get DAT's Files
-
-            // Get name information
-            char filename[256];
-            strcpy(&filename[0], &(s_pCompilerData->dat_filenames[i<<8]));
-
-            // Load file and add to dat_data buffer
-            s_pCompilerData->dat_lengths[i] = -1;
-            char* pFilePath = 0;
-            char* pBuffer = s_pLoadFileFunc(&filename[0], &s_pCompilerData->dat_lengths[i], &pFilePath);
-
-            if (s_pCompilerData->dat_lengths[i] == -1)
-            {
-                s_pCompilerData->dat_lengths[i] = 0;
-                printf("Cannot find/open dat file: %s \n", &filename[0]);
-                return false;
-            }
-            if (p + s_pCompilerData->dat_lengths[i] > data_limit)
-            {
-                printf("%s : error : DAT files exceed 128k.\n", pFilename);
-                return false;
-            }
-            memcpy(&(s_pCompilerData->dat_data[p]), pBuffer, s_pCompilerData->dat_lengths[i]);
-            s_pFreeFileBufferFunc(pBuffer);
-            s_pCompilerData->dat_offsets[i] = p;
-            p += s_pCompilerData->dat_lengths[i];
+            return false;
         }
-    }
 
-    // second pass of object
-    pErrorString = Compile2();
-    if (pErrorString != 0)
-    {
-        PrintError(pFilename, pErrorString);
-        return false;
+        // second pass of object
+        pErrorString = Compile2();
+        if (pErrorString != 0)
+        {
+            PrintError(pFilename, pErrorString);
+            return false;
+        }
     }
 
     // only do this check if UME is off or if it's the final compile when UME is on
-    if (!s_compilerConfig.bUnusedMethodElimination || s_pCompilerData->bFinalCompile)
+    if (!pContext->compilerConfig.bUnusedMethodElimination || pContext->pCompilerData->bFinalCompile)
     {
         // Check to make sure object fits into 32k (or eeprom size if specified as larger than 32k)
-        unsigned int i = 0x10 + s_pCompilerData->psize + s_pCompilerData->vsize + (s_pCompilerData->stack_requirement << 2);
-        if ((s_pCompilerData->compile_mode == 0) && (i > s_pCompilerData->eeprom_size))
+        unsigned int i = 0x10 + pContext->pCompilerData->psize + pContext->pCompilerData->vsize + (pContext->pCompilerData->stack_requirement << 2);
+        if ((pContext->pCompilerData->compile_mode == 0) && (i > pContext->pCompilerData->eeprom_size))
         {
-            printf("%s : error : Object exceeds runtime memory limit by %d longs.\n", pFilename, (i - s_pCompilerData->eeprom_size) >> 2);
+            PrintCompileError(pFilename, "Object exceeds runtime memory limit by %d longs.", (i - pContext->pCompilerData->eeprom_size) >> 2);
             return false;
         }
     }
 
-    // save this object in the heap
-    if (!AddObjectToHeap(pFilename, s_pCompilerData))
+    if (!bLinked && UseObjectCache(pParentNode))
+    {
+        AddCompiledObjectToCache(filenames, numObjects);
+    }
+
+    return SaveObjectInHeap(pFilename, nLogEntry, nUnusedMethods, definestate, filenames, numObjects);
+}
+
+static void InitCompilerData(const char* pFilename)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    pContext->pCompilerData = InitStruct();
+    pContext->pCompilerData->bUnusedMethodElimination = pContext->compilerConfig.bUnusedMethodElimination;
+    pContext->pCompilerData->bFinalCompile = pContext->bFinalCompile;
+    AL_Enable (!pContext->bScanOnly && (pContext->bFinalCompile | (! pContext->compilerConfig.bUnusedMethodElimination)));
+
+    pContext->pCompilerData->list = new char[ListLimit];
+    pContext->pCompilerData->list_limit = ListLimit;
+    memset(pContext->pCompilerData->list, 0, ListLimit);
+
+    if (pContext->compilerConfig.bDocMode && !pContext->compilerConfig.bDATonly)
+    {
+        pContext->pCompilerData->doc = new char[DocLimit];
+        pContext->pCompilerData->doc_limit = DocLimit;
+        memset(pContext->pCompilerData->doc, 0, DocLimit);
+    }
+    else
+    {
+        pContext->pCompilerData->doc = 0;
+        pContext->pCompilerData->doc_limit = 0;
+    }
+    pContext->pCompilerData->bDATonly = pContext->compilerConfig.bDATonly;
+    pContext->pCompilerData->bBinary = pContext->compilerConfig.bBinary;
+    pContext->pCompilerData->eeprom_size = pContext->compilerConfig.eeprom_size;
+
+    // allocate space for obj based on eeprom size command line option
+    pContext->pCompilerData->obj_limit = pContext->compilerConfig.eeprom_size > min_obj_limit ? pContext->compilerConfig.eeprom_size : min_obj_limit;
+    pContext->pCompilerData->obj = new unsigned char[pContext->pCompilerData->obj_limit];
+
+    // copy filename into obj_title, and chop off the .spin
+    strcpy(pContext->pCompilerData->obj_title, pFilename);
+    char* pExtension = strstr(&pContext->pCompilerData->obj_title[0], ".spin");
+    if (pExtension != 0)
+    {
+        *pExtension = 0;
+    }
+}
+
+static void WorkerPreprocessorMessage(const char* level, const char* filename, int linenum, const char* msg)
+{
+    // the object is compiled again by the compile needing it, which reports the message
+    g_pCompilerContext->bPreprocessorMessages = true;
+}
+
+// Sets up the context of a scheduler worker thread, a silent copy of the main one for the current pass
+static CompilerContext* CreateWorkerContext(CompilerContext* pMainContext, CompileScheduler* pScheduler)
+{
+    CompilerContext* pContext = new CompilerContext;
+    SetCompilerContext(pContext);
+
+    pContext->compilerConfig = pMainContext->compilerConfig;
+    pContext->compilerConfig.bQuiet = true;
+    pContext->compilerConfig.bFileTreeOutputOnly = false;
+    pContext->compilerConfig.bVerbose = false;
+    pContext->pLoadFileFunc = pMainContext->pLoadFileFunc;
+    pContext->pFreeFileBufferFunc = pMainContext->pFreeFileBufferFunc;
+    pContext->bFinalCompile = pMainContext->bFinalCompile;
+    pContext->bWorker = true;
+    pContext->bScanOnly = pMainContext->bScanOnly;
+    pContext->pUserData = pMainContext->pUserData;
+    pContext->pScheduler = pScheduler;
+
+    pp_init(&pContext->preprocessor, pContext->compilerConfig.bAlternatePreprocessorMode);
+    pp_setFileFunctions(&pContext->preprocessor, LoadObjectFile, pContext->pFreeFileBufferFunc);
+    pp_setcomments(&pContext->preprocessor, "\'", "{", "}");
+    pContext->preprocessor.messagefunc = WorkerPreprocessorMessage;
+    pContext->preprocessor.errorexit = pMainContext->preprocessor.errorexit;
+
+    // the final pass only reads the unused method data, so it is shared with the main context
+    if (pContext->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination)
+    {
+        DeleteUnusedMethodData(pContext->pUnusedMethodData);
+        pContext->pUnusedMethodData = pMainContext->pUnusedMethodData;
+        pContext->pLinkHeap = pMainContext->pLinkHeap;
+    }
+
+    InitCompilerData(pMainContext->pCompilerData->obj_title);
+    return pContext;
+}
+
+static void DeleteWorkerContext(CompilerContext* pContext)
+{
+    SetCompilerContext(pContext);
+    pContext->pScheduler = 0;
+    bool bSharedUnusedMethodData = pContext->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination;
+    CleanupMemory(!bSharedUnusedMethodData);
+    if (bSharedUnusedMethodData)
+    {
+        pContext->pUnusedMethodData = 0;
+        pContext->pLinkHeap = 0;
+    }
+    pp_clear_define_state(&pContext->preprocessor);
+    ForgetSourceCache(pContext);
+    SetCompilerContext(0);
+    delete pContext;
+}
+
+// Compiles a sub-object on a scheduler worker thread, the same way CompileRecursively would have
+// where it was requested, and moves the results into the scheduled object
+static bool CompileScheduledObject(CompilerContext* pContext, ScheduledObject* pObject)
+{
+    // start from a clean heap, log and preprocessor holding the defines the object is compiled with
+    delete pContext->objectHeirarchy.m_pRoot;
+    pContext->objectHeirarchy.m_pRoot = 0;
+    CleanObjectHeap();
+    CleanupCompileLog();
+    pContext->pCompilerData->unused_methods = 0;
+    bool bUnusedMethodFirstPass = !pContext->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination;
+    if (bUnusedMethodFirstPass)
+    {
+        CleanUpUnusedMethodData();
+        InitUnusedMethodData();
+    }
+    pContext->bPreprocessorMessages = false;
+    if (pContext->compilerConfig.bUsePreprocessor)
+    {
+        pp_clear_define_state(&pContext->preprocessor);
+        pp_apply_defines(&pContext->preprocessor, pObject->pDefines);
+    }
+
+    // the objects that requested it, for the circular reference check
+    ObjectNode* pParentNode = 0;
+    for (int i = pObject->nAncestors - 1; i >= 0; i--)
+    {
+        ObjectNode* pNode = new ObjectNode();
+        pNode->m_pFullPath = pObject->ppAncestorPaths[i];
+        pNode->m_pParent = pParentNode;
+        pContext->objectHeirarchy.AddNode(pNode, pParentNode);
+        pParentNode = pNode;
+    }
+
+    int nCompileIndex = 0;
+    pContext->nObjStackPtr = pObject->nDepth;
+    if (!CompileRecursively(pObject->pFilename, nCompileIndex, pParentNode) || pContext->bPreprocessorMessages)
     {
-        printf("%s : error : Object Heap Overflow.\n", pFilename);
         return false;
     }
-    s_nObjStackPtr--;
+
+    pObject->nHeapObjects = pContext->nObjHeapIndex;
+    pObject->pHeapObjects = new ObjHeap[pContext->nObjHeapIndex];
+    pObject->pHeapRecords = new HeapObjectRecord[pContext->nObjHeapIndex];
+    for (int i = 0; i < pContext->nObjHeapIndex; i++)
+    {
+        pObject->pHeapObjects[i] = pContext->objHeap[i];
+        pObject->pHeapRecords[i] = pContext->heapObjectRecords[i];
+        memset(&pContext->objHeap[i], 0, sizeof(ObjHeap));
+        memset(&pContext->heapObjectRecords[i], 0, sizeof(HeapObjectRecord));
+    }
+    pContext->nObjHeapIndex = 0;
+
+    pObject->nLogEntries = pContext->nCompileLogEntries;
+    pObject->pLog = pContext->pCompileLog;
+    pContext->pCompileLog = 0;
+    pContext->nCompileLogEntries = 0;
+    pContext->nCompileLogLimit = 0;
+
+    pObject->nUnusedMethods = pContext->pCompilerData->unused_methods;
+    pObject->pUnusedMethods = new char[symbol_limit * pObject->nUnusedMethods];
+    memcpy(pObject->pUnusedMethods, pContext->pCompilerData->method_unused, symbol_limit * pObject->nUnusedMethods);
+
+    if (bUnusedMethodFirstPass)
+    {
+        pObject->pUnusedMethodEntries = ExportUnusedMethodEntries();
+    }
 
     return true;
 }
 
 static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
 {
-    if (!s_compilerConfig.bDATonly)
+    CompilerContext* pContext = g_pCompilerContext;
+    if (!pContext->compilerConfig.bDATonly)
     {
-        unsigned int varsize = s_pCompilerData->vsize;                                                // variable size (in bytes)
-        unsigned int codsize = s_pCompilerData->psize;                                                // code size (in bytes)
-        unsigned int pubaddr = *((unsigned short*)&(s_pCompilerData->obj[8]));                        // address of first public method
-        unsigned int publocs = *((unsigned short*)&(s_pCompilerData->obj[10]));                       // number of stack variables (locals), in bytes, for the first public method
+        unsigned int varsize = pContext->pCompilerData->vsize;                                                // variable size (in bytes)
+        unsigned int codsize = pContext->pCompilerData->psize;                                                // code size (in bytes)
+        unsigned int pubaddr = *((unsigned short*)&(pContext->pCompilerData->obj[8]));                        // address of first public method
+        unsigned int publocs = *((unsigned short*)&(pContext->pCompilerData->obj[10]));                       // number of stack variables (locals), in bytes, for the first public method
         unsigned int pbase = 0x0010;                                                                  // base of object code
         unsigned int vbase = pbase + codsize;                                                         // variable base = object base + code size
         unsigned int dbase = vbase + varsize + 8;                                                     // data base = variable base + variable size + 8
         unsigned int pcurr = pbase + pubaddr;                                                         // Current program start = object base + public address (first public method)
-        unsigned int dcurr = dbase + 4 + (s_pCompilerData->first_pub_parameters << 2) + publocs;      // current data stack pointer = data base + 4 + FirstParams*4 + publocs
+        unsigned int dcurr = dbase + 4 + (pContext->pCompilerData->first_pub_parameters << 2) + publocs;      // current data stack pointer = data base + 4 + FirstParams*4 + publocs
 
-        if (s_compilerConfig.bBinary)
+        if (pContext->compilerConfig.bBinary)
         {
            // reset ram
            *ppBuffer = new unsigned char[vbase];
@@ -411,15 +2056,17 @@ static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
         }
         else
         {
-           if (vbase + 8 > s_compilerConfig.eeprom_size)
+           if (vbase + 8 > pContext->compilerConfig.eeprom_size)
            {
-              printf("ERROR: eeprom size exceeded by %d longs.\n", (vbase + 8 - s_compilerConfig.eeprom_size) >> 2);
+              char message[64];
+              snprintf(message, sizeof(message), "eeprom size exceeded by %d longs.", (vbase + 8 - pContext->compilerConfig.eeprom_size) >> 2);
+              ReportCompileError(0, message, "ERROR: %s\n");
               return false;
            }
            // reset ram
-           *ppBuffer = new unsigned char[s_compilerConfig.eeprom_size];
-           memset(*ppBuffer, 0, s_compilerConfig.eeprom_size);
-           bufferSize = s_compilerConfig.eeprom_size;
+           *ppBuffer = new unsigned char[pContext->compilerConfig.eeprom_size];
+           memset(*ppBuffer, 0, pContext->compilerConfig.eeprom_size);
+           bufferSize = pContext->compilerConfig.eeprom_size;
            (*ppBuffer)[dbase-8] = 0xFF;
            (*ppBuffer)[dbase-7] = 0xFF;
            (*ppBuffer)[dbase-6] = 0xF9;
@@ -431,8 +2078,8 @@ static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
         }
 
         // set clock frequency and clock mode
-        *((int*)&((*ppBuffer)[0])) = s_pCompilerData->clkfreq;
-        (*ppBuffer)[4] = s_pCompilerData->clkmode;
+        *((int*)&((*ppBuffer)[0])) = pContext->pCompilerData->clkfreq;
+        (*ppBuffer)[4] = pContext->pCompilerData->clkmode;
 
         // set interpreter parameters
         ((unsigned short*)&((*ppBuffer)[4]))[1] = (unsigned short)pbase;         // always 0x0010
@@ -442,7 +2089,7 @@ static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
         ((unsigned short*)&((*ppBuffer)[4]))[5] = (unsigned short)dcurr;
 
         // set code
-        memcpy(&((*ppBuffer)[pbase]), &(s_pCompilerData->obj[4]), codsize);
+        memcpy(&((*ppBuffer)[pbase]), &(pContext->pCompilerData->obj[4]), codsize);
 
         // install ram checksum byte
         unsigned char sum = 0;
@@ -454,15 +2101,15 @@ static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
     }
     else
     {
-        unsigned int objsize = *((unsigned short*)&(s_pCompilerData->obj[4]));
-        if (s_pCompilerData->psize > 65535)
+        unsigned int objsize = *((unsigned short*)&(pContext->pCompilerData->obj[4]));
+        if (pContext->pCompilerData->psize > 65535)
         {
-            objsize = s_pCompilerData->psize;
+            objsize = pContext->pCompilerData->psize;
         }
-        unsigned int size = objsize - 4 - (s_pCompilerData->obj[7] * 4);
+        unsigned int size = objsize - 4 - (pContext->pCompilerData->obj[7] * 4);
         *ppBuffer = new unsigned char[size];
         bufferSize = size;
-        memcpy(&((*ppBuffer)[0]), &(s_pCompilerData->obj[8 + (s_pCompilerData->obj[7] * 4)]), size);
+        memcpy(&((*ppBuffer)[0]), &(pContext->pCompilerData->obj[8 + (pContext->pCompilerData->obj[7] * 4)]), size);
     }
 
     return true;
@@ -470,55 +2117,56 @@ static bool ComposeRAM(unsigned char** ppBuffer, int& bufferSize)
 
 static void DumpSymbols()
 {
-    for (int i = 0; i < s_pCompilerData->info_count; i++)
+    CompilerContext* pContext = g_pCompilerContext;
+    for (int i = 0; i < pContext->pCompilerData->info_count; i++)
     {
         char szTemp[256];
         szTemp[0] = '*';
         szTemp[1] = 0;
         int length = 0;
         int start = 0;
-        if (s_pCompilerData->info_type[i] == info_pub || s_pCompilerData->info_type[i] == info_pri)
+        if (pContext->pCompilerData->info_type[i] == info_pub || pContext->pCompilerData->info_type[i] == info_pri)
         {
-            length = s_pCompilerData->info_data3[i] - s_pCompilerData->info_data2[i];
-            start = s_pCompilerData->info_data2[i];
+            length = pContext->pCompilerData->info_data3[i] - pContext->pCompilerData->info_data2[i];
+            start = pContext->pCompilerData->info_data2[i];
         }
-        else if (s_pCompilerData->info_type[i] != info_dat && s_pCompilerData->info_type[i] != info_dat_symbol)
+        else if (pContext->pCompilerData->info_type[i] != info_dat && pContext->pCompilerData->info_type[i] != info_dat_symbol)
         {
-            length = s_pCompilerData->info_finish[i] - s_pCompilerData->info_start[i];
-            start = s_pCompilerData->info_start[i];
+            length = pContext->pCompilerData->info_finish[i] - pContext->pCompilerData->info_start[i];
+            start = pContext->pCompilerData->info_start[i];
         }
 
         if (length > 0 && length < 256)
         {
-            strncpy(szTemp, &s_pCompilerData->source[start], length);
+            strncpy(szTemp, &pContext->pCompilerData->source[start], length);
             szTemp[length] = 0;
         }
 
-        switch(s_pCompilerData->info_type[i])
+        switch(pContext->pCompilerData->info_type[i])
         {
             case info_con:
-                printf("CON, %s, %d\n", szTemp, s_pCompilerData->info_data0[i]);
+                PrintOutput(coSymbols, "CON, %s, %d\n", szTemp, pContext->pCompilerData->info_data0[i]);
                 break;
             case info_con_float:
-                printf("CONF, %s, %f\n", szTemp, *((float*)&(s_pCompilerData->info_data0[i])));
+                PrintOutput(coSymbols, "CONF, %s, %f\n", szTemp, *((float*)&(pContext->pCompilerData->info_data0[i])));
                 break;
             case info_pub_param:
                 {
                     char szTemp2[256];
                     szTemp2[0] = '*';
                     szTemp2[1] = 0;
-                    length = s_pCompilerData->info_data3[i] - s_pCompilerData->info_data2[i];
-                    start = s_pCompilerData->info_data2[i];
+                    length = pContext->pCompilerData->info_data3[i] - pContext->pCompilerData->info_data2[i];
+                    start = pContext->pCompilerData->info_data2[i];
                     if (length > 0 && length < 256)
                     {
-                        strncpy(szTemp2, &s_pCompilerData->source[start], length);
+                        strncpy(szTemp2, &pContext->pCompilerData->source[start], length);
                         szTemp2[length] = 0;
                     }
-                    printf("PARAM, %s, %s, %d, %d\n", szTemp2, szTemp, s_pCompilerData->info_data0[i], s_pCompilerData->info_data1[i]);
+                    PrintOutput(coSymbols, "PARAM, %s, %s, %d, %d\n", szTemp2, szTemp, pContext->pCompilerData->info_data0[i], pContext->pCompilerData->info_data1[i]);
                 }
                 break;
             case info_pub:
-                printf("PUB, %s, %d, %d\n", szTemp, s_pCompilerData->info_data4[i] & 0xFFFF, s_pCompilerData->info_data4[i] >> 16);
+                PrintOutput(coSymbols, "PUB, %s, %d, %d\n", szTemp, pContext->pCompilerData->info_data4[i] & 0xFFFF, pContext->pCompilerData->info_data4[i] >> 16);
                 break;
         }
     }
@@ -526,46 +2174,48 @@ static void DumpSymbols()
 
 static void DumpList()
 {
+    CompilerContext* pContext = g_pCompilerContext;
     size_t listOffset = 0;
-    while (listOffset < s_pCompilerData->list_length)
+    while (listOffset < pContext->pCompilerData->list_length)
     {
-        char* pTemp = strstr(&(s_pCompilerData->list[listOffset]), "\r");
+        char* pTemp = strstr(&(pContext->pCompilerData->list[listOffset]), "\r");
         if (pTemp)
         {
             *pTemp = 0;
         }
-        printf("%s\n", &(s_pCompilerData->list[listOffset]));
+        PrintOutput(coMessage, "%s\n", &(pContext->pCompilerData->list[listOffset]));
         if (pTemp)
         {
             *pTemp = 0x0D;
-            listOffset += (pTemp - &(s_pCompilerData->list[listOffset])) + 1;
+            listOffset += (pTemp - &(pContext->pCompilerData->list[listOffset])) + 1;
         }
         else
         {
-            listOffset += strlen(&(s_pCompilerData->list[listOffset]));
+            listOffset += strlen(&(pContext->pCompilerData->list[listOffset]));
         }
     }
 }
 
 static void DumpDoc()
 {
+    CompilerContext* pContext = g_pCompilerContext;
     size_t docOffset = 0;
-    while (docOffset < s_pCompilerData->doc_length)
+    while (docOffset < pContext->pCompilerData->doc_length)
     {
-        char* pTemp = strstr(&(s_pCompilerData->doc[docOffset]), "\r");
+        char* pTemp = strstr(&(pContext->pCompilerData->doc[docOffset]), "\r");
         if (pTemp)
         {
             *pTemp = 0;
         }
-        printf("%s\n", &(s_pCompilerData->doc[docOffset]));
+        PrintOutput(coMessage, "%s\n", &(pContext->pCompilerData->doc[docOffset]));
         if (pTemp)
         {
             *pTemp = 0x0D;
-            docOffset += (pTemp - &(s_pCompilerData->doc[docOffset])) + 1;
+            docOffset += (pTemp - &(pContext->pCompilerData->doc[docOffset])) + 1;
         }
         else
         {
-            docOffset += strlen(&(s_pCompilerData->doc[docOffset]));
+            docOffset += strlen(&(pContext->pCompilerData->doc[docOffset]));
         }
     }
 }
@@ -574,181 +2224,265 @@ static void DumpDoc()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void InitCompiler(CompilerConfig* pCompilerConfig, LoadFileFunc pLoadFileFunc, FreeFileBufferFunc pFreeFileBufferFunc)
+CompilerContext* InitCompiler(CompilerConfig* pCompilerConfig, LoadFileFunc pLoadFileFunc, FreeFileBufferFunc pFreeFileBufferFunc)
 {
-    s_nObjStackPtr = 0;
-    s_pCompilerData = 0;
-    s_bFinalCompile = false;
-    s_pCompileResultBuffer = 0;
+    CompilerContext* pContext = new CompilerContext;
+    SetCompilerContext(pContext);
 
     if (pCompilerConfig)
     {
-        s_compilerConfig = *pCompilerConfig;
+        pContext->compilerConfig = *pCompilerConfig;
     }
 
-    s_pLoadFileFunc = pLoadFileFunc;
-    s_pFreeFileBufferFunc = pFreeFileBufferFunc;
+    pContext->pLoadFileFunc = pLoadFileFunc;
+    pContext->pFreeFileBufferFunc = pFreeFileBufferFunc;
+
+    pp_init(&pContext->preprocessor, pContext->compilerConfig.bAlternatePreprocessorMode);
+    pp_setFileFunctions(&pContext->preprocessor, LoadObjectFile, pFreeFileBufferFunc);
+    pp_setcomments(&pContext->preprocessor, "\'", "{", "}");
 
-    pp_setFileFunctions(pLoadFileFunc, pFreeFileBufferFunc);
-    pp_init(&s_preprocessor, s_compilerConfig.bAlternatePreprocessorMode);
-    pp_setcomments(&s_preprocessor, "\'", "{", "}");
+    return pContext;
 }
 
-void SetDefine(const char* pName, const char* pValue)
+void SetDefine(CompilerContext* pContext, const char* pName, const char* pValue)
 {
-    pp_define(&s_preprocessor, pName, pValue);
+    pp_define(&pContext->preprocessor, pName, pValue);
 }
 
-unsigned char* CompileSpin(char* pFilename, int* pnResultLength)
+void ClearDefines(CompilerContext* pContext)
 {
-    *pnResultLength = 0;
+    pp_clear_define_state(&pContext->preprocessor);
+}
+
+void SetCompilerOutput(CompilerContext* pContext, PrintFunc pPrintFunc, DiagnosticFunc pDiagnosticFunc, void* pUserData)
+{
+    pContext->pPrintFunc = pPrintFunc;
+    pContext->pDiagnosticFunc = pDiagnosticFunc;
+    pContext->pUserData = pUserData;
+    pContext->preprocessor.messagefunc = PreprocessorMessage;
+    pContext->preprocessor.errorexit = false;
+}
+
+void* GetCompilerUserData()
+{
+    return g_pCompilerContext->pUserData;
+}
 
-    if (s_compilerConfig.bFileTreeOutputOnly)
+void ForgetKeptObjects(CompilerContext* pContext)
+{
+    if (pContext->pKeptObjects != 0)
     {
-        printf("%s\n", pFilename);
+        std::map<std::string, KeptObject>::iterator it;
+        for (it = pContext->pKeptObjects->objects.begin(); it != pContext->pKeptObjects->objects.end(); it++)
+        {
+            delete it->second.pObject;
+        }
+        delete pContext->pKeptObjects;
+        pContext->pKeptObjects = 0;
     }
+}
 
-    if (s_compilerConfig.bUnusedMethodElimination)
+void ForgetKeptObjectsUsing(CompilerContext* pContext, const char* pFullPath)
+{
+    if (pContext->pKeptObjects != 0)
     {
-        InitUnusedMethodData();
+        std::map<std::string, KeptObject>& objects = pContext->pKeptObjects->objects;
+        std::map<std::string, KeptObject>::iterator it = objects.begin();
+        while (it != objects.end())
+        {
+            if (!it->second.bFilesKnown || it->second.files.count(pFullPath) != 0)
+            {
+                delete it->second.pObject;
+                objects.erase(it++);
+            }
+            else
+            {
+                it++;
+            }
+        }
     }
+}
 
-    int nOriginalSize = 0;
+char* GetFilesLoaded(CompilerContext* pContext)
+{
+    std::set<std::string> files;
+    for (int i = 0; i < pContext->nCompileLogEntries; i++)
+    {
+        if (pContext->pCompileLog[i].pFilesLoaded != 0)
+        {
+            AddNameLines(pContext->pCompileLog[i].pFilesLoaded, files);
+        }
+    }
+    return JoinNameLines(files);
+}
 
-restart_compile:
-    s_pCompilerData = InitStruct();
-    s_pCompilerData->bUnusedMethodElimination = s_compilerConfig.bUnusedMethodElimination;
-    s_pCompilerData->bFinalCompile = s_bFinalCompile;
-    AL_Enable (s_bFinalCompile | (! s_compilerConfig.bUnusedMethodElimination));
+unsigned char* CompileSpin(CompilerContext* pContext, char* pFilename, int* pnResultLength)
+{
+    SetCompilerContext(pContext);
+    *pnResultLength = 0;
+    *pnResultLength = 0;
 
-    s_pCompilerData->list = new char[ListLimit];
-    s_pCompilerData->list_limit = ListLimit;
-    memset(s_pCompilerData->list, 0, ListLimit);
+    // anything left from compiling with the context before goes, except for its defines and kept objects
+    if (pContext->pCompilerData != 0)
+    {
+        CleanupMemory();
+        pContext->bFinalCompile = false;
+        pContext->nObjStackPtr = 0;
+    }
+    ForgetSourceCache(pContext);
 
-    if (s_compilerConfig.bDocMode && !s_compilerConfig.bDATonly)
+    if (pContext->compilerConfig.bFileTreeOutputOnly)
     {
-        s_pCompilerData->doc = new char[DocLimit];
-        s_pCompilerData->doc_limit = DocLimit;
-        memset(s_pCompilerData->doc, 0, DocLimit);
+        PrintOutput(coMessage, "%s\n", pFilename);
     }
-    else
+
+    // the object tree and file list only need the objects scanned, which leaves no symbols or listing to put out
+    pContext->bScanOnly = pContext->compilerConfig.bFileTreeOutputOnly || pContext->compilerConfig.bFileListOutputOnly;
+
+    if (pContext->compilerConfig.bUnusedMethodElimination)
     {
-        s_pCompilerData->doc = 0;
-        s_pCompilerData->doc_limit = 0;
+        InitUnusedMethodData();
     }
-    s_pCompilerData->bDATonly = s_compilerConfig.bDATonly;
-    s_pCompilerData->bBinary = s_compilerConfig.bBinary;
-    s_pCompilerData->eeprom_size = s_compilerConfig.eeprom_size;
 
-    // allocate space for obj based on eeprom size command line option
-    s_pCompilerData->obj_limit = s_compilerConfig.eeprom_size > min_obj_limit ? s_compilerConfig.eeprom_size : min_obj_limit;
-    s_pCompilerData->obj = new unsigned char[s_pCompilerData->obj_limit];
+    int nOriginalSize = 0;
 
-    // copy filename into obj_title, and chop off the .spin
-    strcpy(s_pCompilerData->obj_title, pFilename);
-    char* pExtension = strstr(&s_pCompilerData->obj_title[0], ".spin");
-    if (pExtension != 0)
+restart_compile:
+    InitCompilerData(pFilename);
+    if (pContext->compilerConfig.nThreads > 1 && !AL_Selected())
     {
-        *pExtension = 0;
+        pContext->pScheduler = new CompileScheduler(pContext, pContext->compilerConfig.nThreads,
+                                                    CreateWorkerContext, CompileScheduledObject, DeleteWorkerContext);
     }
 
     int nCompileIndex = 0;
-    if (!CompileRecursively(pFilename, nCompileIndex, 0))
+    // the images compiled before (or the first pass) may have left the preprocessor inside a comment
+    pp_reset_state(&pContext->preprocessor);
+    if (!CompileRecursively(pFilename, nCompileIndex, 0) || pContext->preprocessor.errorfound)
     {
         return 0;
     }
 
-    if (!s_compilerConfig.bQuiet)
+    if (!pContext->compilerConfig.bQuiet)
     {
         // only do this if UME is off or if it's the final compile when UME is on
-        if (!s_compilerConfig.bUnusedMethodElimination || s_bFinalCompile)
+        if (!pContext->compilerConfig.bUnusedMethodElimination || pContext->bFinalCompile)
         {
-            printf("Done.\n");
+            PrintOutput(coMessage, "Done.\n");
         }
     }
 
-    if (!s_compilerConfig.bFileTreeOutputOnly && !s_compilerConfig.bFileListOutputOnly && !s_compilerConfig.bDumpSymbols)
+    if (!pContext->compilerConfig.bFileTreeOutputOnly && !pContext->compilerConfig.bFileListOutputOnly && !pContext->compilerConfig.bDumpSymbols)
     {
-        if (!s_bFinalCompile && s_compilerConfig.bUnusedMethodElimination)
+        if (!pContext->bFinalCompile && pContext->compilerConfig.bUnusedMethodElimination)
         {
-            nOriginalSize = s_pCompilerData->psize;
-            FindUnusedMethods(s_pCompilerData);
-            s_bFinalCompile = true;
+            // the final pass compiles every object that loses a method or sub-object from source again, along
+            // with its ancestors, and only links the rest from this pass's heap. Removing the methods from the
+            // compiled images instead would move DAT addresses that are encoded in the bytecode and data
+            // without relocation records, so -u still costs close to a second compile of most trees.
+            nOriginalSize = pContext->pCompilerData->psize;
+            FindUnusedMethods(pContext->pCompilerData);
+            pContext->bFinalCompile = true;
+            if (!AL_Selected() && !pContext->compilerConfig.bDATonly)
+            {
+                KeepHeapForLinking();
+            }
             CleanupMemory(false);
             goto restart_compile;
         }
         int bufferSize = 0;
-        if (!ComposeRAM(&s_pCompileResultBuffer, bufferSize))
+        if (!ComposeRAM(&pContext->pCompileResultBuffer, bufferSize))
         {
             return 0;
         }
 
-        if (!s_compilerConfig.bQuiet)
+        if (!pContext->compilerConfig.bQuiet)
         {
-            if (s_compilerConfig.bUnusedMethodElimination)
+            if (pContext->compilerConfig.bUnusedMethodElimination)
             {
-                printf("Unused Method Elimination:\n");
-                if ((nOriginalSize - s_pCompilerData->psize) > 0)
+                PrintOutput(coMessage, "Unused Method Elimination:\n");
+                if ((nOriginalSize - pContext->pCompilerData->psize) > 0)
                 {
-                    if (s_compilerConfig.bVerbose)
+                    if (pContext->compilerConfig.bVerbose)
                     {
-                        if (s_pCompilerData->unused_obj_files)
+                        if (pContext->pCompilerData->unused_obj_files)
                         {
-                            printf("Unused Objects:\n");
-                            for(int i = 0; i < s_pCompilerData->unused_obj_files; i++)
+                            PrintOutput(coMessage, "Unused Objects:\n");
+                            for(int i = 0; i < pContext->pCompilerData->unused_obj_files; i++)
                             {
-                                printf("%s\n", &(s_pCompilerData->obj_unused[i<<8]));
+                                PrintOutput(coMessage, "%s\n", &(pContext->pCompilerData->obj_unused[i<<8]));
                             }
                         }
-                        if (s_pCompilerData->unused_methods)
+                        if (pContext->pCompilerData->unused_methods)
                         {
-                            printf("Unused Methods:\n");
-                            for(int i = 0; i < s_pCompilerData->unused_methods; i++)
+                            PrintOutput(coMessage, "Unused Methods:\n");
+                            for(int i = 0; i < pContext->pCompilerData->unused_methods; i++)
                             {
-                                printf("%s\n", &(s_pCompilerData->method_unused[i*symbol_limit]));
+                                PrintOutput(coMessage, "%s\n", &(pContext->pCompilerData->method_unused[i*symbol_limit]));
                             }
                         }
-                        if (s_pCompilerData->unused_methods || s_pCompilerData->unused_obj_files)
+                        if (pContext->pCompilerData->unused_methods || pContext->pCompilerData->unused_obj_files)
                         {
-                            printf("---------------\n");
+                            PrintOutput(coMessage, "---------------\n");
                         }
                     }
-                    printf("%5d methods removed\n%5d objects removed\n%5d bytes saved\n", s_pCompilerData->unused_methods, s_pCompilerData->unused_obj_files,  nOriginalSize - s_pCompilerData->psize );
+                    PrintOutput(coMessage, "%5d methods removed\n%5d objects removed\n%5d bytes saved\n", pContext->pCompilerData->unused_methods, pContext->pCompilerData->unused_obj_files,  nOriginalSize - pContext->pCompilerData->psize );
                 }
                 else
                 {
-                    printf("Nothing removed.\n");
+                    PrintOutput(coMessage, "Nothing removed.\n");
                 }
-                printf("--------------------------\n");
+                PrintOutput(coMessage, "--------------------------\n");
             }
-            printf("Program size is %d bytes\n", bufferSize);
+            PrintOutput(coMessage, "Program size is %d bytes\n", bufferSize);
+        }
+        // the listing reads each source again, which fails the compile if one can't be
+        std::string failedSource;
+        if (!AL_Output(pContext->pCompileResultBuffer, bufferSize, pContext->pCompilerData, failedSource))
+        {
+            PrintCompileError(failedSource.c_str(), "cannot reload source for listing");
+            return 0;
         }
         *pnResultLength = bufferSize;
-        AL_Output (s_pCompileResultBuffer, bufferSize, s_pCompilerData);
+    }
+    else
+    {
+        // there is no image, but an empty one tells the caller it succeeded
+        pContext->pCompileResultBuffer = new unsigned char[1];
     }
 
-    if (s_compilerConfig.bDumpSymbols)
+    if ((pContext->compilerConfig.bDumpSymbols || pContext->compilerConfig.bSymbolsWithImage) && !pContext->bScanOnly)
     {
         DumpSymbols();
     }
 
-    if (s_compilerConfig.bVerbose && !s_compilerConfig.bQuiet && !s_compilerConfig.bDATonly)
+    if (pContext->compilerConfig.bVerbose && !pContext->compilerConfig.bQuiet && !pContext->compilerConfig.bDATonly)
     {
         DumpList();
     }
 
-    if (s_compilerConfig.bDocMode && s_compilerConfig.bVerbose && !s_compilerConfig.bQuiet && !s_compilerConfig.bDATonly)
+    if (pContext->compilerConfig.bDocMode && pContext->compilerConfig.bVerbose && !pContext->compilerConfig.bQuiet && !pContext->compilerConfig.bDATonly)
     {
         DumpDoc();
     }
 
-    return s_pCompileResultBuffer;
+    if (pContext->compilerConfig.bKeepObjects && !pContext->compilerConfig.bUnusedMethodElimination && !AL_Selected() && !pContext->bScanOnly)
+    {
+        KeepCompiledObjects();
+    }
+
+    ForgetSourceCache(pContext);
+    return pContext->pCompileResultBuffer;
 }
 
-void ShutdownCompiler()
+void ShutdownCompiler(CompilerContext* pContext)
 {
-    pp_clear_define_state(&s_preprocessor);
+    SetCompilerContext(pContext);
+    pp_clear_define_state(&pContext->preprocessor);
     CleanupMemory();
+    ForgetKeptObjects(pContext);
+    ForgetSourceCache(pContext);
+    SetCompilerContext(0);
+    delete pContext;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -14,6 +14,30 @@
 typedef char* (*LoadFileFunc)(const char* pFilename, int* pnLength, char** ppFilePath);
 typedef void (*FreeFileBufferFunc)(char* pBuffer);
 
+// what the compiler is printing, for a PrintFunc (see SetCompilerOutput())
+enum CompilerOutputKind
+{
+    coMessage,      // progress, the object tree & everything else printed to stdout
+    coListing,      // the annotated listing, when it goes to the console
+    coSymbols,      // the symbols of bDumpSymbols & bSymbolsWithImage
+    coPreprocessor  // the preprocessor's errors & warnings, printed to stderr
+};
+
+// an error (or preprocessor message) the compiler reports, for a DiagnosticFunc
+struct CompilerDiagnostic
+{
+    bool        bWarning;   // a preprocessor #warning, #info or other message that isn't an error
+    const char* pFilename;  // the object (or preprocessed file) it is in, or 0
+    int         nLine;      // 1 based line & column, or 0 when not known
+    int         nColumn;
+    const char* pMessage;
+    const char* pLine;      // the source line and the offending item in it, or 0 when not known
+    const char* pItem;
+};
+
+typedef void (*PrintFunc)(void* pUserData, CompilerOutputKind eKind, const char* pText);
+typedef void (*DiagnosticFunc)(void* pUserData, const CompilerDiagnostic* pDiagnostic);
+
 struct CompilerConfig
 {
     CompilerConfig()
@@ -29,11 +53,17 @@ struct CompilerConfig
         , bDATonly(false)
         , bBinary(true)
         , eeprom_size(32768)
+        , nThreads(1)
+        , pCacheDir(0)
+        , bKeepObjects(false)
+        , bSymbolsWithImage(false)
     {
     }
 
     bool bVerbose;
     bool bQuiet;
+    // bFileTreeOutputOnly and bFileListOutputOnly only scan the objects for their sub-objects and files, so they
+    // put out nothing else: no symbols for bDumpSymbols or bSymbolsWithImage, and no annotated listing
     bool bFileTreeOutputOnly;
     bool bFileListOutputOnly;
     bool bDumpSymbols;
@@ -44,13 +74,43 @@ struct CompilerConfig
     bool bDATonly;
     bool bBinary;
     unsigned int eeprom_size;
+    int nThreads;   // threads used to compile sub-objects in parallel
+    const char* pCacheDir;  // directory of the object cache (see ObjectCache.h), or 0 for none
+    bool bKeepObjects;      // keep the objects compiled for later CompileSpin() calls with the same context (batch mode)
+    bool bSymbolsWithImage; // print the symbols as bDumpSymbols does, but after compiling the image as usual
 };
 
 
-void InitCompiler(CompilerConfig* pCompilerConfig, LoadFileFunc pLoadFileFunc, FreeFileBufferFunc pFreeFileBufferFunc);
-void SetDefine(const char* pName, const char* pValue);
-unsigned char* CompileSpin(char* pFilename, int* pnResultLength);
-void ShutdownCompiler();
+// all of the state of a compilation, see CompilerContext.h
+struct CompilerContext;
+
+// each call to InitCompiler() returns a new context, independent of any others, to be passed to
+// the other functions and finally released by ShutdownCompiler()
+// a context can compile any number of files in turn, the defines set stay until ClearDefines()
+CompilerContext* InitCompiler(CompilerConfig* pCompilerConfig, LoadFileFunc pLoadFileFunc, FreeFileBufferFunc pFreeFileBufferFunc);
+void SetDefine(CompilerContext* pContext, const char* pName, const char* pValue);
+void ClearDefines(CompilerContext* pContext);
+// returns the image, or 0 if the compile failed (the image is empty for bFileTreeOutputOnly, bFileListOutputOnly & bDumpSymbols)
+unsigned char* CompileSpin(CompilerContext* pContext, char* pFilename, int* pnResultLength);
+void ShutdownCompiler(CompilerContext* pContext);
+
+// the compiler prints to stdout (and the preprocessor to stderr) until given a PrintFunc, which then gets all of
+// its output instead, and a DiagnosticFunc, which also gets each error & warning reported; pUserData is passed to
+// both and returned by GetCompilerUserData(), for the LoadFileFunc & FreeFileBufferFunc of the context (these are
+// called from scheduler worker threads too, the print & diagnostic functions only from the thread compiling)
+// after this an #error under the alternate preprocessor rules fails the compile, instead of exiting
+void SetCompilerOutput(CompilerContext* pContext, PrintFunc pPrintFunc, DiagnosticFunc pDiagnosticFunc, void* pUserData);
+void* GetCompilerUserData();
+
+// objects kept with bKeepObjects are reused by filename and define state, so they must be forgotten
+// whenever a filename could now load a different file (and the full paths LoadFile returned must stay valid
+// until then)
+void ForgetKeptObjects(CompilerContext* pContext);
+// forgets just the kept objects that loaded a file (by the full path LoadFile returned for it), when it has changed
+void ForgetKeptObjectsUsing(CompilerContext* pContext, const char* pFullPath);
+// with bKeepObjects, the full paths of the files loaded for the objects of the last CompileSpin(), including the
+// ones kept from earlier compiles, one per line (malloc()ed for the caller to free())
+char* GetFilesLoaded(CompilerContext* pContext);
 
 #endif // _COMPILESPIN_H_
 
@@ -0,0 +1,96 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// CompilerContext.cpp
+//
+
+#include <string.h>
+
+#include "CompilerContext.h"
+#include "PropellerCompilerInternal.h"
+#include "UnusedMethodUtils.h"
+#include "Annotate.h"
+
+thread_local CompilerContext* g_pCompilerContext = 0;
+
+CompilerContext::CompilerContext()
+    : pLoadFileFunc(0)
+    , pFreeFileBufferFunc(0)
+    , pCompilerData(0)
+    , nObjStackPtr(0)
+    , bFinalCompile(false)
+    , pCompileResultBuffer(0)
+    , pCompileLog(0)
+    , nCompileLogEntries(0)
+    , nCompileLogLimit(0)
+    , pScheduler(0)
+    , bWorker(false)
+    , bPreprocessorMessages(false)
+    , pLinkHeap(0)
+    , pKeptObjects(0)
+    , pFilesLoaded(0)
+    , pSourceCache(0)
+    , bScanOnly(false)
+    , pPrintFunc(0)
+    , pDiagnosticFunc(0)
+    , pUserData(0)
+    , pSymbolEngine(0)
+    , pElementizer(0)
+    , pPrintDestination(0)
+    , printLimit(0)
+    , blockColumn(0)
+    , bHasPost(false)
+    , nObjHeapIndex(0)
+{
+    memset(&preprocessor, 0, sizeof(preprocessor));
+    memset(heapObjectRecords, 0, sizeof(heapObjectRecords));
+    memset(objHeap, 0, sizeof(objHeap));
+    pUnusedMethodData = CreateUnusedMethodData();
+    pAnnotateData = AL_CreateData();
+}
+
+CompilerContext::~CompilerContext()
+{
+    pp_free(&preprocessor);
+    DeleteUnusedMethodData(pUnusedMethodData);
+    AL_DeleteData(pAnnotateData);
+    if (pFilesLoaded != 0)
+    {
+        flexbuf_delete(pFilesLoaded);
+        delete pFilesLoaded;
+    }
+}
+
+void SetCompilerContext(CompilerContext* pContext)
+{
+    g_pCompilerContext = pContext;
+    g_pCompilerData = pContext ? (CompilerDataInternal*)pContext->pCompilerData : 0;
+    g_pSymbolEngine = pContext ? pContext->pSymbolEngine : 0;
+    g_pElementizer = pContext ? pContext->pElementizer : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,166 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// CompilerContext.h
+//
+
+#ifndef _COMPILERCONTEXT_H_
+#define _COMPILERCONTEXT_H_
+
+#include "CompileSpin.h"
+#include "PropellerCompiler.h"
+#include "preprocess.h"
+#include "objectheap.h"
+#include "Utilities.h"
+
+class Elementizer;
+class SymbolEngine;
+class CompileScheduler;
+struct UnusedMethodData;
+struct AL_Data;
+struct KeptObjects;
+struct SourceCache;
+
+// every object compiled (or reused from the heap) is logged in order, so that reusing
+// an object can repeat what compiling its sub-objects did
+struct CompileLogEntry
+{
+    char*   pFilename;      // filename as referenced in the OBJ block
+    char*   pFullPath;      // full path of the object source (as current_file_path)
+    char*   pDefineState;   // preprocessor define state the object was compiled with
+    char*   pUsedDefines;   // names the object's own source looked up in the defines, one per line (only kept objects need it)
+    char*   pFilesLoaded;   // full paths of the files the object's own compile loaded, one per line (only kept objects need it)
+    int     nDepth;         // object nesting level
+};
+
+// what the final pass of unused method elimination needs to link an object again from its
+// first pass binary, when none of its own code is eliminated
+struct ObjectLinkInfo
+{
+    char*           pFullPath;                      // full path of the object source
+    int             nStackRequirement;
+    int             nObjFiles;
+    char            objFilenames[file_limit*256];   // sub-object filenames, as compiled
+    unsigned char   indexFiles[256];                // obj file of each entry in the object index
+};
+
+// per heap entry record of the compile that produced it
+struct HeapObjectRecord
+{
+    int             nFirstLogEntry;     // log entry of the object itself
+    int             nLogEntries;        // number of log entries for the object and all its sub-objects
+    int             nFirstUnusedMethod; // first method_unused[] entry reported by the object or its sub-objects
+    int             nUnusedMethods;     // number of method_unused[] entries reported
+    void*           pDefinesAdded;      // defines the object left behind in the preprocessor
+    ObjectLinkInfo* pLinkInfo;          // set in the first pass of unused method elimination
+};
+
+// the heap of the first pass of unused method elimination, kept for the final pass
+struct LinkHeap
+{
+    ObjHeap                 objHeap[MaxObjInHeap];
+    HeapObjectRecord        records[MaxObjInHeap];
+    int                     nObjHeapIndex;
+};
+
+//
+// All of the state of a compilation.
+// Each thread compiles with the context bound to it by SetCompilerContext(), so several
+// independent compilations can run at once on different threads.
+//
+struct CompilerContext
+{
+    CompilerContext();
+    ~CompilerContext();
+
+    // used by CompileSpin.cpp
+    CompilerConfig          compilerConfig;
+    LoadFileFunc            pLoadFileFunc;
+    FreeFileBufferFunc      pFreeFileBufferFunc;
+    struct preprocess       preprocessor;
+    CompilerData*           pCompilerData;
+    int                     nObjStackPtr;
+    bool                    bFinalCompile;
+    unsigned char*          pCompileResultBuffer;
+    Heirarchy               objectHeirarchy;
+    CompileLogEntry*        pCompileLog;
+    int                     nCompileLogEntries;
+    int                     nCompileLogLimit;
+    HeapObjectRecord        heapObjectRecords[MaxObjInHeap];
+    CompileScheduler*       pScheduler;                 // compiles sub-objects in parallel (when more than one thread is used)
+    bool                    bWorker;                    // context of a scheduler worker thread
+    bool                    bPreprocessorMessages;      // the preprocessor reported something (in a worker)
+    LinkHeap*               pLinkHeap;                  // first pass heap, when objects can be linked instead of compiled again
+    KeptObjects*            pKeptObjects;               // objects of earlier compiles with this context (batch mode)
+    struct flexbuf*         pFilesLoaded;               // paths loaded for the object being compiled, until its log entry takes them
+    SourceCache*            pSourceCache;               // sources converted to PASCII during the compile
+    bool                    bScanOnly;                  // objects are only scanned for their sub-objects and files (-t & -f)
+    PrintFunc               pPrintFunc;                 // prints the output instead of stdout, when set by SetCompilerOutput()
+    DiagnosticFunc          pDiagnosticFunc;            // also gets each error & warning, when set
+    void*                   pUserData;                  // for both, and the LoadFileFunc & FreeFileBufferFunc
+
+    // used by PropellerCompiler.cpp (and the rest of the compiler through g_pSymbolEngine & g_pElementizer)
+    SymbolEngine*           pSymbolEngine;
+    Elementizer*            pElementizer;
+
+    // used by Utilities.cpp
+    char*                   pPrintDestination;
+    int                     printLimit;
+
+    // used by InstructionBlockCompiler.cpp
+    int                     blockColumn;
+    bool                    bHasPost;
+
+    // used by DistillObjects.cpp
+    unsigned char           rebuildBuffer[min_obj_limit];
+
+    // used by objectheap.cpp
+    ObjHeap                 objHeap[MaxObjInHeap];
+    int                     nObjHeapIndex;
+
+    // used by UnusedMethodUtils.cpp
+    UnusedMethodData*       pUnusedMethodData;
+
+    // used by Annotate.cpp
+    AL_Data*                pAnnotateData;
+};
+
+// the context bound to the current thread
+extern thread_local CompilerContext* g_pCompilerContext;
+
+// binds a context (and its g_pCompilerData, g_pSymbolEngine & g_pElementizer) to the current thread
+void SetCompilerContext(CompilerContext* pContext);
+
+// the source of an object for the annotated listing, for the caller to delete []: taken from the compile's source
+// cache by the key it was compiled under (pSourceKey, from AL_OpenObject), or else loaded by its full path and
+// converted as the compile converted it; returns 0 if it couldn't be loaded or *pbConverted is cleared
+char* GetListingSource(const char* pSourceKey, const char* pFullPath, const char* pFilename, struct preprocess* pPreprocessor,
+                       bool bForceUTF8, bool* pbConverted);
+
+#endif // _COMPILERCONTEXT_H_
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
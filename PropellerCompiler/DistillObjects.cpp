@@ -18,6 +18,7 @@
 #include <math.h>
 #include "Utilities.h"
 #include "PropellerCompilerInternal.h"
+#include "CompilerContext.h"
 #include "SymbolEngine.h"
 #include "Elementizer.h"
 #include "ErrorStrings.h"
@@ -232,7 +233,6 @@ void DistillEliminate()
     }
 }
 
-static unsigned char s_rebuildBuffer[min_obj_limit];
 void DistillRebuild()
 {
     int disPtr = 0;
@@ -242,7 +242,7 @@ void DistillRebuild()
         // copy the object from obj into the rebuild buffer
         unsigned char* pObj = &(g_pCompilerData->obj[g_pCompilerData->dis[disPtr + 1]]);
         unsigned short objLength = *((unsigned short*)pObj);
-        memcpy(&(s_rebuildBuffer[rebuildPtr]), pObj, (size_t)objLength);
+        memcpy(&(g_pCompilerContext->rebuildBuffer[rebuildPtr]), pObj, (size_t)objLength);
         AL_Distill (g_pCompilerData->dis[disPtr + 1], objLength, rebuildPtr);
 
         // fixup the distiller record
@@ -256,7 +256,7 @@ void DistillRebuild()
 
     // copy the rebuilt data back into obj
     g_pCompilerData->obj_ptr = rebuildPtr;
-    memcpy(&g_pCompilerData->obj[0], &s_rebuildBuffer[0], (size_t)rebuildPtr);
+    memcpy(&g_pCompilerData->obj[0], &g_pCompilerContext->rebuildBuffer[0], (size_t)rebuildPtr);
 }
 
 void DistillReconnect(int disPtr = 0)
@@ -58,48 +58,91 @@ void Elementizer::SetFromSymbolEntry()
     }
 }
 
-// public
+// makes room for one more entry at the end of an array
+template <typename T> static void Grow(T*& pArray, int nCount, int& nLimit)
+{
+    if (nCount < nLimit)
+    {
+        return;
+    }
+    nLimit = (nLimit > 0) ? nLimit * 2 : 256;
+    T* pNewArray = new T[nLimit];
+    if (pArray)
+    {
+        memcpy(pNewArray, pArray, nCount * sizeof(T));
+        delete [] pArray;
+    }
+    pArray = pNewArray;
+}
 
-// reset to start of source
-void Elementizer::Reset()
+static void DeleteTokenizedSource(TokenizedSource* pTokens)
 {
-    m_sourceOffset = 0;
-    m_sourceFlags = 0;
+    if (pTokens)
+    {
+        delete [] pTokens->pSource;
+        delete [] pTokens->pTokens;
+        delete [] pTokens->pSymbolText;
+        delete [] pTokens->pDocs;
+        delete [] pTokens->pDocText;
+        delete [] pTokens->pBlocks;
+        delete [] pTokens->pLineEnds;
+        delete [] pTokens->pLineTabs;
+        delete pTokens;
+    }
 }
 
-// get the next element in source, returns true no error, bEof will be set to true if eof is hit
-bool Elementizer::GetNext(bool& bEof)
+// begin the doc comment of the element being read (or continue it, if it already has one)
+static void StartDoc(TokenizedSource* pTokens, Token& token, int offset)
 {
-    // update back data
-    m_backOffsets[m_backIndex&0x03] = m_sourceOffset;
-    m_backFlags[m_backIndex&0x03] = m_sourceFlags;
-    m_backIndex++;
+    if (token.doc == -1)
+    {
+        Grow(pTokens->pDocs, pTokens->nDocs, pTokens->nDocLimit);
+        token.doc = pTokens->nDocs++;
+        pTokens->pDocs[token.doc].offset = offset;
+        pTokens->pDocs[token.doc].text = pTokens->nDocTextLength;
+        pTokens->pDocs[token.doc].length = 0;
+    }
+}
+
+static void AddDocChar(TokenizedSource* pTokens, char theChar)
+{
+    Grow(pTokens->pDocText, pTokens->nDocTextLength, pTokens->nDocTextLimit);
+    pTokens->pDocText[pTokens->nDocTextLength++] = theChar;
+    pTokens->pDocs[pTokens->nDocs - 1].length++;
+}
+
+// read the element at sourceOffset into a new token, sourceFlags carries the state of a string between elements
+void Elementizer::ReadToken(TokenizedSource* pTokens, int& sourceOffset, unsigned char& sourceFlags)
+{
+    Token token;
+    token.readOffset = sourceOffset;
+    token.symbol = -1;
+    token.doc = -1;
+    token.bLast = false;
 
     // default to type_undefined
-    m_type = 0;
-    m_value = 0;
-    m_value_2 = 0;
-    m_asm = -1;
-    m_opType = -1;
-    m_pSymbolEntry = 0;
+    int type = 0;
+    int value = 0;
 
     // no error, and not end of file
     int error = error_none;
-    bEof = false;
+    bool bEof = false;
     bool bDocComment = false;
     int constantBase = 0;
 
     // setup source and symbol pointers
-    char* pSource = m_pCompilerData->source;
-    int sourceStart = m_sourceOffset;
+    char* pSource = pTokens->pSource;
+    int sourceStart = sourceOffset;
 
-    m_currentSymbol[0] = 0;
+    char symbol[symbol_limit+2];
+    symbol[0] = 0;
+    SymbolTableEntry* pSymbolEntry = 0;
     int symbolOffset = 0;
     bool bConstantOverflow = false;
 
     for (;;)
     {
-        char currentChar = pSource[m_sourceOffset++];
+        char currentChar = pSource[sourceOffset++];
 
         // parse
         if (constantBase > 0)
@@ -116,7 +159,7 @@ bool Elementizer::GetNext(bool& bEof)
             if (!CheckDigit(currentChar, digitValue, (char)constantBase))
             {
                 char notUsed;
-                char nextChar = pSource[m_sourceOffset];
+                char nextChar = pSource[sourceOffset];
                 bool bNextCharDigit = CheckDigit(nextChar, notUsed, (char)constantBase);
 
                 if ((constantBase == 10 &&
@@ -125,11 +168,11 @@ bool Elementizer::GetNext(bool& bEof)
                 {
                     // handle float
                     bConstantOverflow = false;
-                    m_sourceOffset = sourceStart;
-                    if (GetFloat(pSource, m_sourceOffset, m_value))
+                    sourceOffset = sourceStart;
+                    if (GetFloat(pSource, sourceOffset, value))
                     {
-                        m_sourceOffset--; // back up to point at last digit
-                        m_type = type_con_float;
+                        sourceOffset--; // back up to point at last digit
+                        type = type_con_float;
                     }
                     else
                     {
@@ -139,8 +182,8 @@ bool Elementizer::GetNext(bool& bEof)
                 else
                 {
                     // done with this constant
-                    m_sourceOffset--; // back up to point at last digit
-                    m_type = type_con;
+                    sourceOffset--; // back up to point at last digit
+                    type = type_con;
                 }
                 constantBase = 0;
                 break;
@@ -148,38 +191,38 @@ bool Elementizer::GetNext(bool& bEof)
             else
             {
                 // multiply accumulate the constant
-                unsigned int oldValue = m_value;
-                m_value *= constantBase;
+                unsigned int oldValue = value;
+                value *= constantBase;
 
                 // check for overflow
-                if (((unsigned int)m_value / constantBase) != oldValue)
+                if (((unsigned int)value / constantBase) != oldValue)
                 {
                     bConstantOverflow = true;
                 }
 
-                m_value += digitValue;
+                value += digitValue;
             }
             continue;
         }
-        else if (m_sourceFlags != 0)
+        else if (sourceFlags != 0)
         {
             // old string? (continue parsing a string)
 
-            // for strings, m_sourceFlags will start out 0, and then cycle between 1 and 2 for
+            // for strings, sourceFlags will start out 0, and then cycle between 1 and 2 for
             // each character of the string, when it is 1, a type_comma is returned, when it is
             // 2 the next character is returned
 
             // return a comma element between each character of the string
-            if (m_sourceFlags == 1)
+            if (sourceFlags == 1)
             {
-                m_sourceFlags++;
-                m_sourceOffset--;
-                m_type = type_comma;
+                sourceFlags++;
+                sourceOffset--;
+                type = type_comma;
                 break;
             }
 
             // reset flag
-            m_sourceFlags = 0;
+            sourceFlags = 0;
 
             // check for errors
             if (currentChar == '\"')
@@ -189,7 +232,7 @@ bool Elementizer::GetNext(bool& bEof)
             }
             else if (currentChar == 0)
             {
-                m_sourceOffset--; // back up from eof
+                sourceOffset--; // back up from eof
                 error = error_eatq;
                 break;
             }
@@ -200,30 +243,30 @@ bool Elementizer::GetNext(bool& bEof)
             }
 
             // return the character
-            m_value = currentChar;
+            value = currentChar;
 
             // check the next character, if it's not a " then setup so the next
             // call returns a type_comma, if it is a ", then we are done with this string
             // and we leave the offset pointing after the "
-            currentChar = pSource[m_sourceOffset++];
+            currentChar = pSource[sourceOffset++];
             if (currentChar != '\"')
             {
-                m_sourceOffset--;
-                m_sourceFlags++;
+                sourceOffset--;
+                sourceFlags++;
             }
 
             // return the character constant
-            m_type = type_con;
+            type = type_con;
             break;
         }
         else if (currentChar == '\"')
         {
             // new string (start parsing a string)
 
-            // we got here because m_sourceFlags was 0 and the character is a "
+            // we got here because sourceFlags was 0 and the character is a "
 
             // get first character of string
-            currentChar = pSource[m_sourceOffset++];
+            currentChar = pSource[sourceOffset++];
 
             // check for errors
             if (currentChar == '\"')
@@ -233,7 +276,7 @@ bool Elementizer::GetNext(bool& bEof)
             }
             else if (currentChar == 0)
             {
-                m_sourceOffset--; // back up from eof
+                sourceOffset--; // back up from eof
                 error = error_eatq;
                 break;
             }
@@ -244,70 +287,70 @@ bool Elementizer::GetNext(bool& bEof)
             }
 
             // return the character in value
-            m_value = currentChar & 0x000000FF;
+            value = currentChar & 0x000000FF;
 
             // check the next character, it's it's not a " then setup so the next
             // call returns a type_comma, if it is a " then it means it's a one character
             // string and we leave the offset pointing after the "
-            currentChar = pSource[m_sourceOffset++];
+            currentChar = pSource[sourceOffset++];
             if (currentChar != '\"')
             {
-                m_sourceOffset--; // back up, so this character will be read after the type_comma
-                m_sourceFlags = 1; // cause the next call to return a type_comma
+                sourceOffset--; // back up, so this character will be read after the type_comma
+                sourceFlags = 1; // cause the next call to return a type_comma
             }
 
             // return the character constant
-            m_type = type_con;
+            type = type_con;
             break;
         }
         else if (currentChar == 0)
         {
             // eof
-            m_type = type_end;
+            type = type_end;
             bEof = true;
-            m_sourceOffset--;
-            sourceStart = m_sourceOffset;
+            sourceOffset--;
+            sourceStart = sourceOffset;
             break;
         }
         else if (currentChar == 13)
         {
             // eol
-            m_type = type_end;
+            type = type_end;
             break;
         }
         else if (currentChar <= ' ')
         {
             // space or tab?
-            sourceStart = m_sourceOffset;
+            sourceStart = sourceOffset;
             continue;
         }
         else if (currentChar == '\'')
         {
             // comment
             // read until end of line or file, handle doc comment
-            if (pSource[m_sourceOffset] == '\'')
+            if (pSource[sourceOffset] == '\'')
             {
-                m_sourceOffset++; // skip over second '
+                sourceOffset++; // skip over second '
                 bDocComment = true;
-                g_pCompilerData->doc_flag = true;
+                StartDoc(pTokens, token, sourceOffset - 2);
             }
             for (;;)
             {
-                currentChar = pSource[m_sourceOffset++];
+                currentChar = pSource[sourceOffset++];
                 if (currentChar == 0)
                 {
-                    m_sourceOffset--; // back up from eof
-                    m_type = type_end;
+                    sourceOffset--; // back up from eof
+                    type = type_end;
                     bEof = true;
                     break;
                 }
                 if (bDocComment)
                 {
-                    DocPrint(currentChar);
+                    AddDocChar(pTokens, currentChar);
                 }
                 if (currentChar == 13)
                 {
-                    m_type = type_end;
+                    type = type_end;
                     break;
                 }
             }
@@ -318,19 +361,19 @@ bool Elementizer::GetNext(bool& bEof)
             // brace comment
             // read the whole comment, handling doc comments as needed
             int braceCommentLevel = 1;
-            if (pSource[m_sourceOffset] == '{')
+            if (pSource[sourceOffset] == '{')
             {
-                m_sourceOffset++; // skip over second {
+                sourceOffset++; // skip over second {
                 bDocComment = true;
-                g_pCompilerData->doc_flag = true;
-                if (pSource[m_sourceOffset] == 13)
+                StartDoc(pTokens, token, sourceOffset - 2);
+                if (pSource[sourceOffset] == 13)
                 {
-                    m_sourceOffset++; // skip over end if present
+                    sourceOffset++; // skip over end if present
                 }
             }
             for (;;)
             {
-                currentChar = pSource[m_sourceOffset++];
+                currentChar = pSource[sourceOffset++];
                 if (currentChar == 0)
                 {
                     if (bDocComment)
@@ -341,8 +384,8 @@ bool Elementizer::GetNext(bool& bEof)
                     {
                         error = error_erb;
                     }
-                    m_sourceOffset--; // back up from eof
-                    sourceStart = m_sourceOffset;
+                    sourceOffset--; // back up from eof
+                    sourceStart = sourceOffset;
                     break;
                 }
                 else if (!bDocComment && currentChar == '{')
@@ -351,9 +394,9 @@ bool Elementizer::GetNext(bool& bEof)
                 }
                 else if (currentChar == '}')
                 {
-                    if (bDocComment && pSource[m_sourceOffset] == '}')
+                    if (bDocComment && pSource[sourceOffset] == '}')
                     {
-                        m_sourceOffset++; // skip over second }
+                        sourceOffset++; // skip over second }
                         break;
                     }
                     else if (!bDocComment)
@@ -367,12 +410,12 @@ bool Elementizer::GetNext(bool& bEof)
                 }
                 else if (bDocComment)
                 {
-                    DocPrint(currentChar);
+                    AddDocChar(pTokens, currentChar);
                 }
             }
             if (error == error_none)
             {
-                sourceStart = m_sourceOffset;
+                sourceStart = sourceOffset;
                 continue;
             }
             else
@@ -389,12 +432,12 @@ bool Elementizer::GetNext(bool& bEof)
         else if (currentChar == '%')
         {
             // binary
-            currentChar = pSource[m_sourceOffset++];
+            currentChar = pSource[sourceOffset++];
             char temp;
             if (currentChar == '%')
             {
                 // double binary
-                currentChar = pSource[m_sourceOffset++];
+                currentChar = pSource[sourceOffset++];
                 if (!CheckDigit(currentChar, temp, 4))
                 {
                     error = error_idbn;
@@ -411,23 +454,23 @@ bool Elementizer::GetNext(bool& bEof)
                 }
                 constantBase = 2;
             }
-            m_sourceOffset--; // back up to first digit
+            sourceOffset--; // back up to first digit
             // constantBase is now set, so loop back around to read in the constant
             continue;
         }
         else if (currentChar == '$')
         {
             // hex
-            currentChar = pSource[m_sourceOffset++];
+            currentChar = pSource[sourceOffset++];
             char temp;
             if (!CheckDigit(currentChar, temp, 16))
             {
-                m_sourceOffset--;
-                m_type = type_asm_org;
+                sourceOffset--;
+                type = type_asm_org;
                 break;
             }
             constantBase = 16;
-            m_sourceOffset--; // back up to first digit
+            sourceOffset--; // back up to first digit
             // constantBase is now set, so loop back around to read in the constant
             continue;
         }
@@ -435,7 +478,7 @@ bool Elementizer::GetNext(bool& bEof)
         {
             // dec
             constantBase = 10;
-            m_sourceOffset--; // back up to first digit
+            sourceOffset--; // back up to first digit
             // constantBase is now set, so loop back around to read in the constant
             continue;
         }
@@ -448,8 +491,8 @@ bool Elementizer::GetNext(bool& bEof)
                 // do word symbol
                 while(CheckWordChar(currentChar) && symbolOffset <= symbol_limit)
                 {
-                    m_currentSymbol[symbolOffset++] = currentChar;
-                    currentChar = Uppercase(pSource[m_sourceOffset++]);
+                    symbol[symbolOffset++] = currentChar;
+                    currentChar = Uppercase(pSource[sourceOffset++]);
                 }
                 if (symbolOffset > symbol_limit)
                 {
@@ -458,17 +501,16 @@ bool Elementizer::GetNext(bool& bEof)
                 else
                 {
                     // back up so we point at last char of symbol
-                    m_sourceOffset--;
+                    sourceOffset--;
                     // terminate symbol
-                    m_currentSymbol[symbolOffset] = 0;
-                    m_pSymbolEntry = m_pSymbolEngine->FindSymbol(m_currentSymbol);
+                    symbol[symbolOffset] = 0;
                 }
             }
             else
             {
                 // try non-word symbol (one or two char operators)
-                m_currentSymbol[symbolOffset++] = currentChar;
-                currentChar = pSource[m_sourceOffset++];
+                symbol[symbolOffset++] = currentChar;
+                currentChar = pSource[sourceOffset++];
 
                 bool bDoOneChar = false;
                 bool bDoTwoChar = false;
@@ -479,16 +521,16 @@ bool Elementizer::GetNext(bool& bEof)
                     // three char symbol
 
                     // assign second char into symbol
-                    m_currentSymbol[symbolOffset++] = currentChar;
+                    symbol[symbolOffset++] = currentChar;
 
                     // read third char into symbol
-                    m_currentSymbol[symbolOffset++] = pSource[m_sourceOffset++];
+                    symbol[symbolOffset++] = pSource[sourceOffset++];
 
                     // terminate symbol
-                    m_currentSymbol[symbolOffset] = 0;
+                    symbol[symbolOffset] = 0;
 
-                    m_pSymbolEntry = m_pSymbolEngine->FindSymbol(m_currentSymbol);
-                    if (m_pSymbolEntry == 0)
+                    pSymbolEntry = m_pSymbolEngine->FindSymbol(symbol);
+                    if (pSymbolEntry == 0)
                     {
                         bDoTwoChar = true;
                         symbolOffset--;
@@ -500,13 +542,13 @@ bool Elementizer::GetNext(bool& bEof)
                     // two char symbol
 
                     // back up so we point at last char of symbol
-                    m_sourceOffset--;
+                    sourceOffset--;
 
                     // terminate symbol
-                    m_currentSymbol[symbolOffset] = 0;
+                    symbol[symbolOffset] = 0;
 
-                    m_pSymbolEntry = m_pSymbolEngine->FindSymbol(m_currentSymbol);
-                    if (m_pSymbolEntry == 0)
+                    pSymbolEntry = m_pSymbolEngine->FindSymbol(symbol);
+                    if (pSymbolEntry == 0)
                     {
                         bDoOneChar = true;
                         symbolOffset--;
@@ -518,13 +560,13 @@ bool Elementizer::GetNext(bool& bEof)
                     // one char symbol
 
                     // back up so we point at last char of symbol
-                    m_sourceOffset--;
+                    sourceOffset--;
 
                     // terminate symbol
-                    m_currentSymbol[symbolOffset] = 0;
+                    symbol[symbolOffset] = 0;
 
-                    m_pSymbolEntry = m_pSymbolEngine->FindSymbol(m_currentSymbol);
-                    if (m_pSymbolEntry == 0)
+                    pSymbolEntry = m_pSymbolEngine->FindSymbol(symbol);
+                    if (pSymbolEntry == 0)
                     {
                         error = error_uc;
                     }
@@ -539,9 +581,287 @@ bool Elementizer::GetNext(bool& bEof)
         error = error_ce32b;
     }
 
+    token.start = sourceStart;
+    token.finish = sourceOffset;
+    token.type = type;
+    token.value = value;
+    token.error = (short)error;
+    token.bEof = bEof;
+
+    // the symbol is looked up as the element is gotten, the symbols change from pass to pass
+    if (symbolOffset > 0)
+    {
+        int length = (symbolOffset > symbol_limit + 1) ? symbol_limit + 1 : symbolOffset;
+        for (int i = 0; i <= length; i++)
+        {
+            Grow(pTokens->pSymbolText, pTokens->nSymbolTextLength, pTokens->nSymbolTextLimit);
+            pTokens->pSymbolText[pTokens->nSymbolTextLength++] = (i < length) ? symbol[i] : 0;
+        }
+        token.symbol = pTokens->nSymbolTextLength - (length + 1);
+    }
+
+    Grow(pTokens->pTokens, pTokens->nTokens, pTokens->nTokenLimit);
+    pTokens->pTokens[pTokens->nTokens++] = token;
+
+    // block headers go in the block directory, and so does anything GetNextBlock() must not skip over,
+    // the block words are reserved, so their symbols can be looked up already
+    int blockType = -2;
+    if (token.symbol != -1 && error == error_none)
+    {
+        pSymbolEntry = m_pSymbolEngine->FindSymbol(&(pTokens->pSymbolText[token.symbol]));
+        if (pSymbolEntry && pSymbolEntry->m_data.type == type_block)
+        {
+            blockType = pSymbolEntry->m_data.value;
+        }
+    }
+    if (error != error_none || bEof || token.doc != -1)
+    {
+        blockType = -1;
+    }
+    if (blockType != -2)
+    {
+        Grow(pTokens->pBlocks, pTokens->nBlocks, pTokens->nBlockLimit);
+        BlockEntry* pEntry = &(pTokens->pBlocks[pTokens->nBlocks++]);
+        pEntry->token = pTokens->nTokens - 1;
+        pEntry->blockType = blockType;
+        // as GetColumn() has it, which counts the second character of the source as being in the first column too
+        pEntry->bFirstColumn = (sourceStart <= 1 || pSource[sourceStart - 1] == 13);
+    }
+}
+
+// returns the index of the token read from sourceOffset
+int Elementizer::TokenAt(int sourceOffset)
+{
+    // the first one that ends after it, tokens end in source order
+    int low = 0;
+    int high = m_pTokens->nTokens - 1;
+    while (low < high)
+    {
+        int middle = (low + high) >> 1;
+        if (m_pTokens->pTokens[middle].finish > sourceOffset)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+// move on to the next block header of the type (or element that can't be skipped over) in the block directory
+const BlockEntry* Elementizer::SkipToBlock(int type)
+{
+    // find the first entry at or after the current token
+    int low = 0;
+    int high = m_pTokens->nBlocks;
+    while (low < high)
+    {
+        int middle = (low + high) >> 1;
+        if (m_pTokens->pBlocks[middle].token < m_tokenIndex)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (int i = low; i < m_pTokens->nBlocks; i++)
+    {
+        const BlockEntry* pEntry = &(m_pTokens->pBlocks[i]);
+        if (pEntry->blockType == type || pEntry->blockType == -1)
+        {
+            if (pEntry->token > m_tokenIndex)
+            {
+                m_tokenIndex = pEntry->token;
+                m_sourceOffset = m_pTokens->pTokens[m_tokenIndex].readOffset;
+            }
+            return pEntry;
+        }
+    }
+    return 0;
+}
+
+// returns the index of the line ending at or after sourceOffset
+int Elementizer::LineEndAtOrAfter(int sourceOffset)
+{
+    int low = 0;
+    int high = m_pTokens->nLineEnds;
+    while (low < high)
+    {
+        int middle = (low + high) >> 1;
+        if (m_pTokens->pLineEnds[middle] < sourceOffset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// public
+
+Elementizer::~Elementizer()
+{
+    for (int i = 0; i < tokenized_source_limit; i++)
+    {
+        DeleteTokenizedSource(m_pTokenizedSources[i]);
+    }
+}
+
+// read the current source into elements, if it hasn't been already
+// the last few sources are kept, so that compiling a parent object again after its sub-objects reuses its tokens
+void Elementizer::Tokenize()
+{
+    char* pSource = m_pCompilerData->source;
+    int nSourceLength = (int)strlen(pSource);
+    m_nTokenizeCount++;
+
+    int slot = 0;
+    for (int i = 0; i < tokenized_source_limit; i++)
+    {
+        TokenizedSource* pTokens = m_pTokenizedSources[i];
+        if (pTokens == 0)
+        {
+            slot = i;
+            break;
+        }
+        if (pTokens->nSourceLength == nSourceLength && memcmp(pTokens->pSource, pSource, nSourceLength) == 0)
+        {
+            pTokens->nLastUsed = m_nTokenizeCount;
+            m_pTokens = pTokens;
+            return;
+        }
+        if (pTokens->nLastUsed < m_pTokenizedSources[slot]->nLastUsed)
+        {
+            slot = i;
+        }
+    }
+
+    DeleteTokenizedSource(m_pTokenizedSources[slot]);
+    TokenizedSource* pTokens = new TokenizedSource;
+    memset(pTokens, 0, sizeof(TokenizedSource));
+    pTokens->pSource = new char[nSourceLength + 1];
+    memcpy(pTokens->pSource, pSource, nSourceLength + 1);
+    pTokens->nSourceLength = nSourceLength;
+    pTokens->nLastUsed = m_nTokenizeCount;
+    m_pTokenizedSources[slot] = pTokens;
+    m_pTokens = pTokens;
+
+    // index the lines, for GetColumn() and GetCurrentLineNumber()
+    for (int i = 0; i < nSourceLength; i++)
+    {
+        if (pSource[i] == 13)
+        {
+            pTokens->nLineEnds++;
+        }
+    }
+    pTokens->pLineEnds = new int[pTokens->nLineEnds + 1];
+    pTokens->pLineTabs = new int[pTokens->nLineEnds + 1];
+    int line = 0;
+    pTokens->pLineTabs[0] = -1;
+    for (int i = 0; i < nSourceLength; i++)
+    {
+        if (pSource[i] == 9 && pTokens->pLineTabs[line] == -1)
+        {
+            pTokens->pLineTabs[line] = i;
+        }
+        else if (pSource[i] == 13)
+        {
+            if (pTokens->pLineTabs[line] == -1)
+            {
+                pTokens->pLineTabs[line] = i;
+            }
+            pTokens->pLineEnds[line++] = i;
+            pTokens->pLineTabs[line] = -1;
+        }
+    }
+    // the last line ends with the source
+    pTokens->pLineEnds[line] = nSourceLength;
+    if (pTokens->pLineTabs[line] == -1)
+    {
+        pTokens->pLineTabs[line] = nSourceLength;
+    }
+
+    // read until an element would be read again (the end of the source)
+    int sourceOffset = 0;
+    unsigned char sourceFlags = 0;
+    for (;;)
+    {
+        int readOffset = sourceOffset;
+        unsigned char readFlags = sourceFlags;
+        ReadToken(pTokens, sourceOffset, sourceFlags);
+        if (sourceOffset == readOffset && sourceFlags == readFlags)
+        {
+            pTokens->pTokens[pTokens->nTokens - 1].bLast = true;
+            break;
+        }
+    }
+}
+
+// reset to start of source
+void Elementizer::Reset()
+{
+    m_sourceOffset = 0;
+    m_tokenIndex = 0;
+}
+
+// get the next element in source, returns true no error, bEof will be set to true if eof is hit
+bool Elementizer::GetNext(bool& bEof)
+{
+    // update back data
+    m_backOffsets[m_backIndex&0x03] = m_sourceOffset;
+    m_backTokens[m_backIndex&0x03] = m_tokenIndex;
+    m_backIndex++;
+
+    const Token* pToken = &(m_pTokens->pTokens[m_tokenIndex]);
+
+    // print its doc comment, unless reading resumed past the start of it
+    if (pToken->doc != -1 && m_pTokens->pDocs[pToken->doc].offset >= m_sourceOffset)
+    {
+        const TokenDoc* pDoc = &(m_pTokens->pDocs[pToken->doc]);
+        g_pCompilerData->doc_flag = true;
+        for (int i = 0; i < pDoc->length; i++)
+        {
+            DocPrint(m_pTokens->pDocText[pDoc->text + i]);
+        }
+    }
+
+    m_type = pToken->type;
+    m_value = pToken->value;
+    m_value_2 = 0;
+    m_asm = -1;
+    m_opType = -1;
+    m_pSymbolEntry = 0;
+    bEof = pToken->bEof;
+
+    if (pToken->symbol != -1)
+    {
+        strcpy(m_currentSymbol, &(m_pTokens->pSymbolText[pToken->symbol]));
+        if (pToken->error == error_none)
+        {
+            m_pSymbolEntry = m_pSymbolEngine->FindSymbol(m_currentSymbol);
+        }
+    }
+    else
+    {
+        m_currentSymbol[0] = 0;
+    }
+
     // update pointers
-    m_pCompilerData->source_start = sourceStart;
-    m_pCompilerData->source_finish = m_sourceOffset;
+    m_pCompilerData->source_start = pToken->start;
+    m_pCompilerData->source_finish = pToken->finish;
+    m_sourceOffset = pToken->finish;
+    if (!pToken->bLast)
+    {
+        m_tokenIndex++;
+    }
 
     // if we got a symbol, then set the type, value, etc.
     if (m_type == 0 && m_pSymbolEntry)
@@ -549,10 +869,10 @@ bool Elementizer::GetNext(bool& bEof)
         SetFromSymbolEntry();
     }
 
-    if (error != error_none)
+    if (pToken->error != error_none)
     {
         m_pCompilerData->error = true;
-        m_pCompilerData->error_msg = g_pErrorStrings[error];
+        m_pCompilerData->error_msg = g_pErrorStrings[pToken->error];
         return false;
     }
 
@@ -611,13 +931,15 @@ bool Elementizer::GetNextBlock(int type, bool& bEof)
     bool bFound = false;
     while(bFound == false)
     {
+        // the elements in between are skipped over, with nothing to get from them
+        const BlockEntry* pEntry = SkipToBlock(type);
         if (GetNext(bEof) == false || bEof == true)
         {
             break;
         }
         if (GetType() == type_block && GetValue() == type)
         {
-            if (GetColumn() != 1)
+            if (pEntry == 0 || !pEntry->bFirstColumn)
             {
                 m_pCompilerData->error = true;
                 m_pCompilerData->error_msg = g_pErrorStrings[error_bdmbifc];
@@ -633,7 +955,6 @@ bool Elementizer::GetNextBlock(int type, bool& bEof)
 // returns column of most recent Element gotten
 int Elementizer::GetColumn()
 {
-    char* pSource = m_pCompilerData->source;
     int sourceStart = m_pCompilerData->source_start;
     if (sourceStart == 0)
     {
@@ -641,29 +962,39 @@ int Elementizer::GetColumn()
         return 1;
     }
 
-    // back up until we hit a CR character
-    while(pSource[sourceStart] != 13 && sourceStart > 0)
+    // find the start of the line, an element on a CR counts as the start of the next line,
+    // and the first line is taken to start at 1 (as the scan back for a CR this replaces did)
+    int line = LineEndAtOrAfter(sourceStart);
+    int lineStart = 1;
+    int firstTab = m_pTokens->pLineTabs[line];
+    if (line < m_pTokens->nLineEnds && m_pTokens->pLineEnds[line] == sourceStart)
     {
-        sourceStart--;
+        lineStart = sourceStart + 1;
     }
-
-    // advance forward one, (off of the CR)
-    sourceStart++;
-
-    if (sourceStart == m_pCompilerData->source_start)
+    else if (line > 0 && m_pTokens->pLineEnds[line - 1] > 0)
+    {
+        lineStart = m_pTokens->pLineEnds[line - 1] + 1;
+    }
+    if (lineStart >= sourceStart)
     {
         // we are at the start of the line, so return 1
         return 1;
     }
 
-    // adjust source pointer to start of line
-    pSource += sourceStart;
-    // adjust sourceStart such that it is how many characters we backed up
-    sourceStart = m_pCompilerData->source_start - sourceStart;
+    // without tabs before it, its column is how far along the line it is
+    if (firstTab < lineStart)
+    {
+        firstTab = lineStart;
+    }
+    if (sourceStart <= firstTab)
+    {
+        return sourceStart - lineStart + 1;
+    }
 
-    // count the characters we backed up over, accounting for tabs (tabs are 8 chars)
-    int column = 0;
-    for (int i = 0; i < sourceStart; i++)
+    // count the characters from the first tab, accounting for tabs (tabs are 8 chars)
+    char* pSource = m_pCompilerData->source;
+    int column = firstTab - lineStart;
+    for (int i = firstTab; i < sourceStart; i++)
     {
         if (pSource[i] == 9)
         {
@@ -677,38 +1008,12 @@ int Elementizer::GetColumn()
 
 int Elementizer::GetCurrentLineNumber(int &offsetToStartOfLine, int& offsetToEndOfLine)
 {
-    int lineCount = 1;
-
-    char* pSource = m_pCompilerData->source;
-    int scanEnd = m_pCompilerData->source_start;
-    offsetToStartOfLine = -1;
-    while (scanEnd > 0)
-    {
-        if (pSource[--scanEnd] == 13)
-        {
-            if (offsetToStartOfLine == -1)
-            {
-                offsetToStartOfLine = scanEnd+1;
-            }
-            lineCount++;
-        }
-    }
-    if (offsetToStartOfLine == -1)
-    {
-        offsetToStartOfLine = 0;
-    }
-    scanEnd = m_pCompilerData->source_start;
-    while (pSource[scanEnd] != 0)
-    {
-        if (pSource[scanEnd] == 13 || pSource[scanEnd] == 0)
-        {
-            break;
-        }
-        scanEnd++;
-    }
-    offsetToEndOfLine = scanEnd;
+    // the lines before it end before source_start
+    int line = LineEndAtOrAfter(m_pCompilerData->source_start);
+    offsetToStartOfLine = (line > 0) ? m_pTokens->pLineEnds[line - 1] + 1 : 0;
+    offsetToEndOfLine = m_pTokens->pLineEnds[line];
 
-    return lineCount;
+    return line + 1;
 }
 
 // backup to the previous element
@@ -716,7 +1021,7 @@ void Elementizer::Backup()
 {
     m_backIndex--;
     m_sourceOffset = m_backOffsets[m_backIndex&0x03];
-    m_sourceFlags = m_backFlags[m_backIndex&0x03];
+    m_tokenIndex = m_backTokens[m_backIndex&0x03];
 }
 
 void Elementizer::ObjConToCon()
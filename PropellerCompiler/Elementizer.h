@@ -18,6 +18,64 @@ class SymbolEngine;
 class SymbolTableEntry;
 
 const int state_stack_limit = 32;
+const int tokenized_source_limit = 16;      // number of tokenized sources kept for reuse
+
+// an element as read from the source, before its symbol (if any) is looked up
+struct Token
+{
+    int             readOffset;     // source offset the element is read from
+    int             start;          // source_start of the element
+    int             finish;         // source_finish of the element, where the next one is read from
+    int             type;           // type of constants, string characters and ends, 0 for symbols
+    int             value;          // value of constants and string characters
+    int             symbol;         // offset of the symbol text in TokenizedSource::pSymbolText, or -1
+    int             doc;            // index of the doc comment read with the element, or -1
+    short           error;          // error reading the element, or error_none
+    bool            bEof;           // the element ends the source
+    bool            bLast;          // reading on from it gives the same element again
+};
+
+// a doc comment, printed whenever the element it was read with is gotten
+struct TokenDoc
+{
+    int             offset;         // source offset of the doc comment
+    int             text;           // offset of the text it prints in TokenizedSource::pDocText
+    int             length;
+};
+
+// an entry of the block directory, which lets GetNextBlock() go straight to the blocks it scans for
+struct BlockEntry
+{
+    int             token;          // index of the token
+    int             blockType;      // block type of a block header, or -1 for an element that can't be skipped over
+    bool            bFirstColumn;   // the block header starts in the first column
+};
+
+// a source read into elements once, for all the passes over it
+struct TokenizedSource
+{
+    char*           pSource;        // copy of the source, to recognize it again
+    int             nSourceLength;
+    Token*          pTokens;
+    int             nTokens;
+    int             nTokenLimit;
+    char*           pSymbolText;
+    int             nSymbolTextLength;
+    int             nSymbolTextLimit;
+    TokenDoc*       pDocs;
+    int             nDocs;
+    int             nDocLimit;
+    char*           pDocText;
+    int             nDocTextLength;
+    int             nDocTextLimit;
+    BlockEntry*     pBlocks;        // the block directory
+    int             nBlocks;
+    int             nBlockLimit;
+    int*            pLineEnds;      // offset of the CR ending each line
+    int*            pLineTabs;      // offset of the first tab in each line, or of its CR if it has none
+    int             nLineEnds;
+    unsigned int    nLastUsed;      // when it was last tokenized or reused, for replacing the oldest
+};
 
 class Elementizer
 {
@@ -25,7 +83,11 @@ class Elementizer
     SymbolEngine*           m_pSymbolEngine;
 
     int                     m_sourceOffset;
-    unsigned char           m_sourceFlags;
+    int                     m_tokenIndex;
+
+    TokenizedSource*        m_pTokenizedSources[tokenized_source_limit];
+    TokenizedSource*        m_pTokens;          // the tokenized current source
+    unsigned int            m_nTokenizeCount;
 
     SymbolTableEntry*       m_pSymbolEntry;
     int                     m_type;
@@ -37,27 +99,39 @@ class Elementizer
 
     unsigned char           m_backIndex;
     int                     m_backOffsets[4];
-    unsigned char           m_backFlags[4];
+    int                     m_backTokens[4];
 
     char                    m_currentSymbol[symbol_limit+2];
 
     void SetFromSymbolEntry();
+    void ReadToken(TokenizedSource* pTokens, int& sourceOffset, unsigned char& sourceFlags);
+    int  TokenAt(int sourceOffset);
+    const BlockEntry* SkipToBlock(int type);
+    int  LineEndAtOrAfter(int sourceOffset);
 
 public:
     Elementizer(CompilerDataInternal* pCompilerData, SymbolEngine* pSymbolEngine)
         : m_pCompilerData(pCompilerData)
         , m_pSymbolEngine(pSymbolEngine)
         , m_sourceOffset(0)
-        , m_sourceFlags(0)
+        , m_tokenIndex(0)
+        , m_pTokens(0)
+        , m_nTokenizeCount(0)
         , m_backIndex(0)
     {
         for(int i = 0; i < 4; i++)
         {
             m_backOffsets[i] = 0;
-            m_backFlags[0] = 0;
+            m_backTokens[i] = 0;
+        }
+        for (int i = 0; i < tokenized_source_limit; i++)
+        {
+            m_pTokenizedSources[i] = 0;
         }
     }
+    ~Elementizer();
 
+    void    Tokenize();                         // read the current source into elements, if it hasn't been already
     void    Reset();                            // reset to start of source
 
     bool    GetNext(bool& bEof);                // get the next element in source, returns true no error, bEof will be set to true if eof is hit
@@ -78,6 +152,7 @@ public:
     void    SetSourcePtr(int value)             // used to set the source pointer back to a previously saved value
     {
         m_sourceOffset = value;
+        m_tokenIndex = TokenAt(value);
     }
 
     int     GetType() { return m_type; }        // symbol's type
@@ -21,6 +21,7 @@
 #include "ErrorStrings.h"
 #include "CompileUtilities.h"
 #include "Annotate.h"
+#include "CompilerContext.h"
 
 //////////////////////////////////////////
 // declarations for internal functions
@@ -30,8 +31,6 @@ bool CompileBlock_IfOrIfNot(int column, int bIf);
 bool CompileBlock_Case(int column);
 bool CompileBlock_Repeat(int column);
 
-static int s_column = 0;
-
 //////////////////////////////////////////
 // exported functions
 //
@@ -75,8 +74,8 @@ bool CompileBlock(int column)
             break;
         }
 
-        s_column = g_pElementizer->GetColumn();
-        if (s_column <= column)
+        g_pCompilerContext->blockColumn = g_pElementizer->GetColumn();
+        if (g_pCompilerContext->blockColumn <= column)
         {
             break;
         }
@@ -84,28 +83,28 @@ bool CompileBlock(int column)
 
         if (g_pElementizer->GetType() == type_if)
         {
-            if (!CompileBlock_IfOrIfNot(s_column, true))
+            if (!CompileBlock_IfOrIfNot(g_pCompilerContext->blockColumn, true))
             {
                 return false;
             }
         }
         else if (g_pElementizer->GetType() == type_ifnot)
         {
-            if (!CompileBlock_IfOrIfNot(s_column, false))
+            if (!CompileBlock_IfOrIfNot(g_pCompilerContext->blockColumn, false))
             {
                 return false;
             }
         }
         else if (g_pElementizer->GetType() == type_case)
         {
-            if (!CompileBlock_Case(s_column))
+            if (!CompileBlock_Case(g_pCompilerContext->blockColumn))
             {
                 return false;
             }
         }
         else if (g_pElementizer->GetType() == type_repeat)
         {
-            if (!CompileBlock_Repeat(s_column))
+            if (!CompileBlock_Repeat(g_pCompilerContext->blockColumn))
             {
                 return false;
             }
@@ -208,8 +207,8 @@ bool CompileIfOrIfNot(int column, int param)
         {
             break;
         }
-        s_column = g_pElementizer->GetColumn();
-        if (s_column < column)
+        g_pCompilerContext->blockColumn = g_pElementizer->GetColumn();
+        if (g_pCompilerContext->blockColumn < column)
         {
             g_pElementizer->Backup();
             break;
@@ -307,9 +306,9 @@ bool CompileCase(int column, int param)
         {
             continue;
         }
-        s_column = g_pElementizer->GetColumn();
+        g_pCompilerContext->blockColumn = g_pElementizer->GetColumn();
         g_pElementizer->Backup();
-        if (s_column <= column)
+        if (g_pCompilerContext->blockColumn <= column)
         {
             break;
         }
@@ -364,7 +363,7 @@ bool CompileCase(int column, int param)
         {
             return false;
         }
-        if (!SkipBlock(s_column))
+        if (!SkipBlock(g_pCompilerContext->blockColumn))
         {
             return false;
         }
@@ -419,9 +418,9 @@ bool CompileCase(int column, int param)
         {
             continue;
         }
-        s_column = g_pElementizer->GetColumn();
+        g_pCompilerContext->blockColumn = g_pElementizer->GetColumn();
         g_pElementizer->Backup();
-        if (s_column <= column)
+        if (g_pCompilerContext->blockColumn <= column)
         {
             break;
         }
@@ -437,7 +436,7 @@ bool CompileCase(int column, int param)
             {
                 return false;
             }
-            if (!SkipBlock(s_column))
+            if (!SkipBlock(g_pCompilerContext->blockColumn))
             {
                 return false;
             }
@@ -462,7 +461,7 @@ bool CompileCase(int column, int param)
             {
                 return false;
             }
-            if (!CompileBlock(s_column))
+            if (!CompileBlock(g_pCompilerContext->blockColumn))
             {
                 return false;
             }
@@ -490,13 +489,12 @@ bool CompileBlock_Case(int column)
     return true;
 }
 
-static bool s_bHasPost = false;
 bool CompileRepeatPlain(int column, int param)
 {
     param = param; // stop warning
 
     BlockStack_Write(2, g_pCompilerData->obj_ptr); // set reverse address
-    if (!s_bHasPost)
+    if (!g_pCompilerContext->bHasPost)
     {
         BlockStack_Write(0, g_pCompilerData->obj_ptr); // set plain 'next' address
     }
@@ -512,8 +510,8 @@ bool CompileRepeatPlain(int column, int param)
     unsigned char byteCode = 0x04;
     if (!bEof)
     {
-        s_column = g_pElementizer->GetColumn();
-        if (s_column < column)
+        g_pCompilerContext->blockColumn = g_pElementizer->GetColumn();
+        if (g_pCompilerContext->blockColumn < column)
         {
             g_pElementizer->Backup();
         }
@@ -524,7 +522,7 @@ bool CompileRepeatPlain(int column, int param)
             if ((postType == type_while) ||
                 (postType == type_until))
             {
-                s_bHasPost = true;
+                g_pCompilerContext->bHasPost = true;
                 BlockStack_Write(0, g_pCompilerData->obj_ptr); // set post-while/until 'next' address
                 if (!CompileExpression()) // compile post-while/until expression
                 {
@@ -776,7 +774,7 @@ bool CompileBlock_Repeat(int column)
     {
         // repeat
         pCompileFunc = &CompileRepeatPlain;
-        s_bHasPost = false; // assume it doesn't have a post while or until (will be detected)
+        g_pCompilerContext->bHasPost = false; // assume it doesn't have a post while or until (will be detected)
     }
     else if (g_pElementizer->GetType() == type_while)
     {
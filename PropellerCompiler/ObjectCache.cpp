@@ -0,0 +1,236 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// ObjectCache.cpp
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "ObjectCache.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 1024
+#endif
+
+// entries written by any other build of the compiler are ignored
+static const char s_objectCacheVersion[] = "OpenSpin object cache 1 (" __DATE__ " " __TIME__ ")";
+
+// FNV-1a
+static unsigned long long HashData(unsigned long long hash, const void* pData, size_t nLength)
+{
+    const unsigned char* pBytes = (const unsigned char*)pData;
+    for (size_t i = 0; i < nLength; i++)
+    {
+        hash ^= pBytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+unsigned long long HashObjectCacheData(const void* pData, size_t nLength)
+{
+    return HashData(0xCBF29CE484222325ULL, pData, nLength);
+}
+
+static void GetCachePath(const char* pCacheDir, const ObjectCacheHeader* pHeader, const char* pSource, int nSourceLength, char* pPath)
+{
+    unsigned long long key = HashObjectCacheData(s_objectCacheVersion, sizeof(s_objectCacheVersion));
+    key = HashData(key, &pHeader->nDATonly, sizeof(pHeader->nDATonly));
+    key = HashData(key, &pHeader->nEepromSize, sizeof(pHeader->nEepromSize));
+    key = HashData(key, pSource, nSourceLength);
+    snprintf(pPath, PATH_MAX, "%s/%016llx.obj", pCacheDir, key);
+}
+
+static size_t GetEntrySize(const ObjectCacheHeader* pHeader)
+{
+    return sizeof(ObjectCacheHeader) + (pHeader->nObjFiles + pHeader->nDatFiles) * sizeof(CachedObjectFile) +
+           pHeader->nObjSize + pHeader->nSourceLength;
+}
+
+static void* MapFile(const char* pPath, size_t& nSize)
+{
+#ifdef WIN32
+    FILE* pFile = fopen(pPath, "rb");
+    if (pFile == 0)
+    {
+        return 0;
+    }
+    fseek(pFile, 0, SEEK_END);
+    long nLength = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+    char* pBuffer = 0;
+    if (nLength > 0)
+    {
+        pBuffer = new char[nLength];
+        if (fread(pBuffer, 1, nLength, pFile) != (size_t)nLength)
+        {
+            delete [] pBuffer;
+            pBuffer = 0;
+        }
+    }
+    fclose(pFile);
+    nSize = (size_t)nLength;
+    return pBuffer;
+#else
+    int file = open(pPath, O_RDONLY);
+    if (file == -1)
+    {
+        return 0;
+    }
+    struct stat fileStat;
+    void* pMapping = 0;
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        nSize = (size_t)fileStat.st_size;
+        pMapping = mmap(0, nSize, PROT_READ, MAP_PRIVATE, file, 0);
+        if (pMapping == MAP_FAILED)
+        {
+            pMapping = 0;
+        }
+    }
+    close(file);
+    return pMapping;
+#endif
+}
+
+static void UnmapFile(void* pMapping, size_t nSize)
+{
+#ifdef WIN32
+    delete [] (char*)pMapping;
+#else
+    munmap(pMapping, nSize);
+#endif
+}
+
+CachedObject* FindCachedObject(const char* pCacheDir, const ObjectCacheHeader* pHeader, const char* pSource)
+{
+    int nSourceLength = (int)strlen(pSource);
+    char path[PATH_MAX];
+    GetCachePath(pCacheDir, pHeader, pSource, nSourceLength, path);
+
+    size_t nSize = 0;
+    void* pMapping = MapFile(path, nSize);
+    if (pMapping == 0)
+    {
+        return 0;
+    }
+
+    // the entry must be complete, and for the same compiler, options and source (the name is only a hash of them)
+    const ObjectCacheHeader* pEntryHeader = (const ObjectCacheHeader*)pMapping;
+    const char* pEntrySource = 0;
+    bool bMatch = nSize >= sizeof(ObjectCacheHeader) &&
+                  strncmp(pEntryHeader->version, s_objectCacheVersion, sizeof(pEntryHeader->version)) == 0 &&
+                  pEntryHeader->nDATonly == pHeader->nDATonly &&
+                  pEntryHeader->nEepromSize == pHeader->nEepromSize &&
+                  pEntryHeader->nSourceLength == nSourceLength &&
+                  pEntryHeader->nObjFiles >= 0 && pEntryHeader->nDatFiles >= 0 && pEntryHeader->nObjSize >= 0 &&
+                  GetEntrySize(pEntryHeader) == nSize;
+    if (bMatch)
+    {
+        pEntrySource = (const char*)pMapping + nSize - nSourceLength;
+        bMatch = (memcmp(pEntrySource, pSource, nSourceLength) == 0);
+    }
+    if (!bMatch)
+    {
+        UnmapFile(pMapping, nSize);
+        return 0;
+    }
+
+    CachedObject* pObject = new CachedObject;
+    pObject->pHeader = pEntryHeader;
+    pObject->pObjFiles = (const CachedObjectFile*)(pEntryHeader + 1);
+    pObject->pDatFiles = pObject->pObjFiles + pEntryHeader->nObjFiles;
+    pObject->pObj = (const unsigned char*)(pObject->pDatFiles + pEntryHeader->nDatFiles);
+    pObject->pSource = pEntrySource;
+    pObject->pMapping = pMapping;
+    pObject->nMappingSize = nSize;
+    return pObject;
+}
+
+void ReleaseCachedObject(CachedObject* pObject)
+{
+    if (pObject != 0)
+    {
+        UnmapFile(pObject->pMapping, pObject->nMappingSize);
+        delete pObject;
+    }
+}
+
+bool AddObjectToCache(const char* pCacheDir, const CachedObject* pObject)
+{
+    ObjectCacheHeader header = *pObject->pHeader;
+    memset(header.version, 0, sizeof(header.version));
+    strcpy(header.version, s_objectCacheVersion);
+    header.nSourceLength = (int)strlen(pObject->pSource);
+
+    char path[PATH_MAX];
+    GetCachePath(pCacheDir, &header, pObject->pSource, header.nSourceLength, path);
+
+    // written under a name of its own and then renamed, so other compiles never see part of an entry
+    char tempPath[PATH_MAX + 32];
+#ifdef WIN32
+    snprintf(tempPath, sizeof(tempPath), "%s.%d.%p", path, _getpid(), (void*)&header);
+#else
+    snprintf(tempPath, sizeof(tempPath), "%s.%d.%p", path, (int)getpid(), (void*)&header);
+#endif
+    FILE* pFile = fopen(tempPath, "wb");
+    if (pFile == 0)
+    {
+        return false;
+    }
+    bool bWritten = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+                    fwrite(pObject->pObjFiles, sizeof(CachedObjectFile), header.nObjFiles, pFile) == (size_t)header.nObjFiles &&
+                    fwrite(pObject->pDatFiles, sizeof(CachedObjectFile), header.nDatFiles, pFile) == (size_t)header.nDatFiles &&
+                    fwrite(pObject->pObj, 1, header.nObjSize, pFile) == (size_t)header.nObjSize &&
+                    fwrite(pObject->pSource, 1, header.nSourceLength, pFile) == (size_t)header.nSourceLength;
+    bWritten = (fclose(pFile) == 0) && bWritten;
+#ifdef WIN32
+    // rename doesn't replace an existing file here, an entry already there is just as good
+    remove(path);
+#endif
+    if (!bWritten || rename(tempPath, path) != 0)
+    {
+        remove(tempPath);
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// ObjectCache.h
+//
+
+#ifndef _OBJECTCACHE_H_
+#define _OBJECTCACHE_H_
+
+#include <stddef.h>
+
+//
+// Compiled sub-objects kept in a directory on disk (CompilerConfig::pCacheDir), so that later compiles can
+// link them from there instead of compiling them again.  Each entry is a file named by a hash of the compiler
+// version, the options that change the object image and the preprocessed source.  It holds the object image
+// and the names and content hashes of the sub-objects and DAT files it was compiled with, which must still
+// match for it to be used.
+//
+
+// a sub-object or DAT file of a cached object, with the hash of the contents it was compiled with
+struct CachedObjectFile
+{
+    unsigned long long  hash;
+    char                name[256];
+};
+
+struct ObjectCacheHeader
+{
+    char                version[64];        // version of the compiler that wrote it
+    int                 nDATonly;           // options that change the object image
+    unsigned int        nEepromSize;
+    int                 nSourceLength;      // preprocessed source (follows the object image)
+    int                 nObjFiles;
+    int                 nDatFiles;
+    int                 nObjSize;
+    int                 nPSize;
+    int                 nVSize;
+    int                 nStackRequirement;
+};
+
+// an object in the cache, pointing into its mapped file
+struct CachedObject
+{
+    const ObjectCacheHeader*    pHeader;
+    const CachedObjectFile*     pObjFiles;
+    const CachedObjectFile*     pDatFiles;
+    const unsigned char*        pObj;
+    const char*                 pSource;
+    void*                       pMapping;
+    size_t                      nMappingSize;
+};
+
+unsigned long long HashObjectCacheData(const void* pData, size_t nLength);
+
+// returns the object compiled from the source with the options in pHeader (nDATonly and nEepromSize), or 0
+CachedObject* FindCachedObject(const char* pCacheDir, const ObjectCacheHeader* pHeader, const char* pSource);
+void ReleaseCachedObject(CachedObject* pObject);
+
+// writes an object to the cache, the version and source length are filled in
+bool AddObjectToCache(const char* pCacheDir, const CachedObject* pObject);
+
+#endif // _OBJECTCACHE_H_
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
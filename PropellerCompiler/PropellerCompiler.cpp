@@ -16,6 +16,7 @@
 #include <math.h>
 #include "Utilities.h"
 #include "PropellerCompilerInternal.h"
+#include "CompilerContext.h"
 #include "SymbolEngine.h"
 #include "Elementizer.h"
 #include "ErrorStrings.h"
@@ -49,10 +50,10 @@ bool CompileDoc();
 extern bool DistillObjects(); // in DistillObjects.cpp
 extern bool CompileTopBlock(); // in InstructionBlockCompiler.cpp
 
-// globals used by the compiler
-CompilerDataInternal* g_pCompilerData = 0;
-SymbolEngine* g_pSymbolEngine         = 0;
-Elementizer* g_pElementizer           = 0;
+// globals used by the compiler, bound to the CompilerContext of the current thread by SetCompilerContext()
+thread_local CompilerDataInternal* g_pCompilerData = 0;
+thread_local SymbolEngine* g_pSymbolEngine         = 0;
+thread_local Elementizer* g_pElementizer           = 0;
 
 //////////////////////////////////////////
 // exported functions
@@ -69,6 +70,10 @@ CompilerData* InitStruct()
     g_pSymbolEngine = new SymbolEngine;
     g_pElementizer = new Elementizer(g_pCompilerData, g_pSymbolEngine);
 
+    g_pCompilerContext->pCompilerData = g_pCompilerData;
+    g_pCompilerContext->pSymbolEngine = g_pSymbolEngine;
+    g_pCompilerContext->pElementizer = g_pElementizer;
+
     return g_pCompilerData;
 }
 
@@ -80,6 +85,10 @@ void Cleanup()
     g_pSymbolEngine = 0;
     delete g_pCompilerData;
     g_pCompilerData = 0;
+
+    g_pCompilerContext->pCompilerData = 0;
+    g_pCompilerContext->pSymbolEngine = 0;
+    g_pCompilerContext->pElementizer = 0;
 }
 
 // Usage:
@@ -111,8 +120,9 @@ void Cleanup()
 
 const char* Compile1()
 {
-    g_pElementizer->Reset();
     g_pSymbolEngine->Reset();
+    g_pElementizer->Tokenize();
+    g_pElementizer->Reset();
     g_pCompilerData->pubcon_list_size = 0;
     g_pCompilerData->list_length = 0;
     g_pCompilerData->doc_length = 0;
@@ -249,6 +259,46 @@ const char* Compile2()
     return 0;
 }
 
+// Links an object again with new sub-object binaries, without compiling its source.
+// pObj is the object's own code (everything before its sub-objects) from an earlier compile,
+// pIndexFiles the obj file of each entry in its object index, and the sub-objects are
+// loaded into obj_data as they are for Compile2()
+const char* Relink(const unsigned char* pObj, int nObjSize, const unsigned char* pIndexFiles, int nVarSize, const unsigned char* pPubConList, int nPubConListSize)
+{
+    g_pCompilerData->list_length = 0;
+    SetPrint(g_pCompilerData->list, g_pCompilerData->list_limit);
+
+    memcpy(g_pCompilerData->obj, pObj, nObjSize);
+    g_pCompilerData->obj_ptr = nObjSize;
+    g_pCompilerData->obj_start = pObj[2] << 2;
+    g_pCompilerData->obj_count = pObj[3];
+    for (int i = 0; i < g_pCompilerData->obj_count; i++)
+    {
+        // put back the file numbers CompileObjBlocks() replaces with offsets
+        *((int*)&(g_pCompilerData->obj[g_pCompilerData->obj_start + (i * 4)])) = pIndexFiles[i];
+    }
+    g_pCompilerData->var_byte = nVarSize;
+    g_pCompilerData->var_word = 0;
+    g_pCompilerData->var_long = 0;
+    memcpy(g_pCompilerData->pubcon_list, pPubConList, nPubConListSize);
+    g_pCompilerData->pubcon_list_size = nPubConListSize;
+
+    if (!CompileObjBlocks())
+    {
+        return g_pCompilerData->error_msg;
+    }
+    if (!DistillObjBlocks())
+    {
+        return g_pCompilerData->error_msg;
+    }
+    if (!CompileFinal())
+    {
+        return g_pCompilerData->error_msg;
+    }
+
+    return 0;
+}
+
 bool GetErrorInfo(int& lineNumber, int& column, int& offsetToStartOfLine, int& offsetToEndOfLine, int& offendingItemStart, int& offendingItemEnd)
 {
     if (g_pCompilerData && g_pCompilerData->error)
@@ -1529,6 +1579,7 @@ bool CompileObjBlocks()
     {
         // get file number from index
         int index = *((int*)pIndex);
+        g_pCompilerData->obj_index_files[i] = (unsigned char)index;
 
         // write objptr back to index
         *pIndex = (unsigned short)(objptr[index]);
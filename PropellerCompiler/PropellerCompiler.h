@@ -159,7 +159,9 @@ struct CompilerData
     int             unused_methods;                 // number of unused methods
     char            method_unused[32*file_limit*symbol_limit]; // hold names of unused methods
 
-    char*           current_file_path;              // full path of the current file being compiled (points to entries in s_filesAccessed[])
+    char*           current_file_path;              // full path of the current file being compiled (owned by the file loader, it stays valid for the whole compile)
+
+    unsigned char   obj_index_files[256];           // obj file of each entry in the object index (set by Compile2)
 };
 
 // public functions
@@ -167,6 +169,7 @@ extern CompilerData* InitStruct();
 extern void Cleanup();
 extern const char* Compile1();
 extern const char* Compile2();
+extern const char* Relink(const unsigned char* pObj, int nObjSize, const unsigned char* pIndexFiles, int nVarSize, const unsigned char* pPubConList, int nPubConListSize);
 extern bool GetErrorInfo(int& lineNumber, int& column, int& offsetToStartOfLine, int& offsetToEndOfLine, int& offendingItemStart, int& offendingItemEnd);
 
 #endif // _PROPELLER_COMPILER_H_
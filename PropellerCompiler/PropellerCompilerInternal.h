@@ -105,10 +105,10 @@ struct CompilerDataInternal : public CompilerData
 class Elementizer;
 class SymbolEngine;
 
-// shared globals
-extern Elementizer* g_pElementizer;
-extern CompilerDataInternal* g_pCompilerData;
-extern SymbolEngine* g_pSymbolEngine;
+// shared globals (per thread, see SetCompilerContext())
+extern thread_local Elementizer* g_pElementizer;
+extern thread_local CompilerDataInternal* g_pCompilerData;
+extern thread_local SymbolEngine* g_pSymbolEngine;
 
 #endif // _PROPELLER_COMPILER_INTERNAL_H_
 
@@ -304,123 +304,455 @@ SymbolTableEntry::SymbolTableEntry(const SymbolTableEntryDataTable& data)
     m_data.type = data.type;
     m_data.value = data.value;
     m_data.value_2 = 0;
-    size_t nameLength = strlen(data.name)+1;
-    m_data.name = new char[nameLength];
-    strcpy(m_data.name, data.name);
+    m_data.name = const_cast<char*>(data.name);
     m_data.operator_type_or_asm = data.operator_type_or_asm;
     m_data.dual = data.dual;
 }
 
-SymbolEngine::SymbolEngine()
+// Jenkins one-at-a-time hash of the uppercased name (the same as HashTable::GetStringHashUppercase), also giving its length
+static int GetSymbolHash(const char* pSymbolName, int& length)
 {
-    m_pSymbols = new HashTable(256);
-    m_pUserSymbols = new HashTable(8192);
-    m_pTempUserSymbols = new HashTable(1024);
-
-    // add symbols to hash table
-    int index = 0;
-    while (strcmp(symbols[index].name, "*END*") != 0)
+    const char* s = pSymbolName;
+    int hash = 0;
+    while (*s != 0)
     {
-        int hashKey = m_pSymbols->GetStringHashUppercase(symbols[index].name);
-        m_pSymbols->Insert(hashKey, new SymbolTableEntry(symbols[index]));
-        index++;
+        int c = *s;
+        c = c - (32 * (c >= 'a' && c <= 'z'));
+        hash += c;
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+        s++;
     }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    length = (int)(s - pSymbolName);
+    return hash;
 }
 
-SymbolEngine::~SymbolEngine()
+// compares a name with an uppercased name of the same length
+static bool MatchUppercase(const char* pUppercaseName, const char* pSymbolName, int length)
 {
-    delete m_pSymbols;
-    m_pSymbols = 0;
-    delete m_pUserSymbols;
-    m_pUserSymbols = 0;
-    delete m_pTempUserSymbols;
-    m_pTempUserSymbols = 0;
+    for (int i = 0; i < length; i++)
+    {
+        int c = pSymbolName[i];
+        c = c - (32 * (c >= 'a' && c <= 'z'));
+        if (c != pUppercaseName[i])
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-// looks for the given symbol in the symbol table and returns a pointer to the entry
-// if the symbol is not found, then it returns 0
-SymbolTableEntry* SymbolEngine::FindSymbol(const char* pSymbolName)
+// the predefined symbols, in a perfect hash table shared by all symbol engines
+//
+// the symbols are split into buckets by hash, and each bucket gets the displacement that moves all of its
+// symbols into free slots, so every symbol has a slot of its own and a lookup compares at most one name
+const int predefined_slot_bits = 9;
+const int predefined_slot_count = 1 << predefined_slot_bits;
+const int predefined_bucket_count = 128;
+
+class PredefinedSymbols
 {
-    int hashKey = m_pSymbols->GetStringHashUppercase(pSymbolName);
+    SymbolTableEntry*   m_pSlots[predefined_slot_count];
+    int                 m_slotHashes[predefined_slot_count];
+    unsigned int        m_displacements[predefined_bucket_count];
 
-    // look in automatic symbols
-    HashNode* pNode = m_pSymbols->FindFirst(hashKey);
-    while (pNode != 0)
+    static int Slot(int hashKey, unsigned int displacement)
     {
-        SymbolTableEntry* pSymbol = (SymbolTableEntry*)(pNode->pValue);
-        if (_stricmp(pSymbol->m_data.name, pSymbolName) == 0)
+        unsigned int mix = ((unsigned int)hashKey ^ (displacement * 0x9E3779B9)) * 0x85EBCA6B;
+        return (int)((mix ^ (mix >> 16)) >> (32 - predefined_slot_bits));
+    }
+
+public:
+    PredefinedSymbols();
+    ~PredefinedSymbols()
+    {
+        for (int i = 0; i < predefined_slot_count; i++)
+        {
+            delete m_pSlots[i];
+        }
+    }
+
+    SymbolTableEntry* Find(int hashKey, const char* pSymbolName)
+    {
+        int slot = Slot(hashKey, m_displacements[(unsigned int)hashKey % predefined_bucket_count]);
+        SymbolTableEntry* pSymbol = m_pSlots[slot];
+        if (pSymbol != 0 && m_slotHashes[slot] == hashKey && _stricmp(pSymbol->m_data.name, pSymbolName) == 0)
         {
             return pSymbol;
         }
+        return 0;
+    }
+};
 
-        pNode = m_pSymbols->FindNext(pNode);
+PredefinedSymbols::PredefinedSymbols()
+{
+    int numSymbols = 0;
+    while (strcmp(symbols[numSymbols].name, "*END*") != 0)
+    {
+        numSymbols++;
+    }
+    int* pHashKeys = new int[numSymbols];
+    int* pBucketSizes = new int[predefined_bucket_count];
+    for (int i = 0; i < predefined_bucket_count; i++)
+    {
+        pBucketSizes[i] = 0;
+        m_displacements[i] = 0;
+    }
+    for (int i = 0; i < predefined_slot_count; i++)
+    {
+        m_pSlots[i] = 0;
+        m_slotHashes[i] = 0;
+    }
+    for (int i = 0; i < numSymbols; i++)
+    {
+        int length;
+        pHashKeys[i] = GetSymbolHash(symbols[i].name, length);
+        pBucketSizes[(unsigned int)pHashKeys[i] % predefined_bucket_count]++;
     }
 
-    // didn't find it above, so look in user symbols
-    pNode = m_pUserSymbols->FindFirst(hashKey);
-    while (pNode != 0)
+    // place the biggest buckets first, while there are the most free slots
+    int* pSlots = new int[numSymbols];
+    for (int size = numSymbols; size > 0; size--)
     {
-        SymbolTableEntry* pSymbol = (SymbolTableEntry*)(pNode->pValue);
-        if (_stricmp(pSymbol->m_data.name, pSymbolName) == 0)
+        for (int bucket = 0; bucket < predefined_bucket_count; bucket++)
         {
-            return pSymbol;
+            if (pBucketSizes[bucket] != size)
+            {
+                continue;
+            }
+            for (unsigned int displacement = 0; ; displacement++)
+            {
+                int count = 0;
+                for (int i = 0; i < numSymbols; i++)
+                {
+                    if ((unsigned int)pHashKeys[i] % predefined_bucket_count != (unsigned int)bucket)
+                    {
+                        continue;
+                    }
+                    int slot = Slot(pHashKeys[i], displacement);
+                    bool bFree = (m_pSlots[slot] == 0);
+                    for (int j = 0; j < count && bFree; j++)
+                    {
+                        bFree = (pSlots[j] != slot);
+                    }
+                    if (!bFree)
+                    {
+                        break;
+                    }
+                    pSlots[count++] = slot;
+                }
+                if (count == size)
+                {
+                    m_displacements[bucket] = displacement;
+                    break;
+                }
+            }
+            int count = 0;
+            for (int i = 0; i < numSymbols; i++)
+            {
+                if ((unsigned int)pHashKeys[i] % predefined_bucket_count == (unsigned int)bucket)
+                {
+                    m_pSlots[pSlots[count]] = new SymbolTableEntry(symbols[i]);
+                    m_slotHashes[pSlots[count]] = pHashKeys[i];
+                    count++;
+                }
+            }
         }
+    }
+
+    delete [] pSlots;
+    delete [] pBucketSizes;
+    delete [] pHashKeys;
+}
+
+// built the first time a symbol engine is created, and only read after that
+static PredefinedSymbols* GetPredefinedSymbols()
+{
+    static PredefinedSymbols s_predefinedSymbols;
+    return &s_predefinedSymbols;
+}
+
+// a scope of user symbols
+//
+// the entries and their uppercased names are allocated from blocks that are kept when the scope is reset, and they
+// are found through an open addressing table whose slots only count as used in the generation they were filled in,
+// so resetting a scope is just starting a new generation
+const int symbol_entry_block_size = 1024;
+const int symbol_name_block_size = 16384;   // holds many names of up to symbol_limit+2 chars
 
-        pNode = m_pUserSymbols->FindNext(pNode);
+struct SymbolSlot
+{
+    SymbolTableEntry*   pSymbol;
+    int                 hashKey;
+    int                 length;
+    unsigned int        generation;
+};
+
+class SymbolScope
+{
+    SymbolSlot*         m_pSlots;
+    int                 m_nSlotMask;
+    int                 m_nSlotsUsed;
+    unsigned int        m_generation;
+
+    SymbolTableEntry**  m_pEntryBlocks;
+    int                 m_nEntryBlocks;
+    int                 m_nEntryBlockLimit;
+    int                 m_nEntries;         // entries used (across the blocks)
+
+    char**              m_pNameBlocks;
+    int                 m_nNameBlocks;
+    int                 m_nNameBlockLimit;
+    int                 m_nNameBlock;       // block the next name goes in
+    int                 m_nNameOffset;      // where it goes in that block
+
+    template <typename T> static void AddBlock(T**& pBlocks, int& nBlocks, int& nBlockLimit, T* pBlock)
+    {
+        if (nBlocks == nBlockLimit)
+        {
+            int nNewLimit = nBlockLimit * 2;
+            T** pNewBlocks = new T*[nNewLimit];
+            memcpy(pNewBlocks, pBlocks, nBlocks * sizeof(T*));
+            delete [] pBlocks;
+            pBlocks = pNewBlocks;
+            nBlockLimit = nNewLimit;
+        }
+        pBlocks[nBlocks++] = pBlock;
     }
 
-    // didn't find it above, so look in temp user symbols
-    pNode = m_pTempUserSymbols->FindFirst(hashKey);
-    while (pNode != 0)
+    // returns the slot of the name, or the empty slot where it would go
+    SymbolSlot* FindSlot(int hashKey, const char* pSymbolName, int length)
     {
-        SymbolTableEntry* pSymbol = (SymbolTableEntry*)(pNode->pValue);
-        if (_stricmp(pSymbol->m_data.name, pSymbolName) == 0)
+        int slot = hashKey & m_nSlotMask;
+        for (;;)
         {
-            return pSymbol;
+            SymbolSlot* pSlot = &m_pSlots[slot];
+            if (pSlot->generation != m_generation)
+            {
+                return pSlot;
+            }
+            if (pSlot->hashKey == hashKey && pSlot->length == length && MatchUppercase(pSlot->pSymbol->m_data.name, pSymbolName, length))
+            {
+                return pSlot;
+            }
+            slot = (slot + 1) & m_nSlotMask;
+        }
+    }
+
+    void GrowSlots();
+
+public:
+    SymbolScope(int nSlots);
+    ~SymbolScope();
+
+    SymbolTableEntry* Find(int hashKey, const char* pSymbolName, int length)
+    {
+        SymbolSlot* pSlot = FindSlot(hashKey, pSymbolName, length);
+        return (pSlot->generation == m_generation) ? pSlot->pSymbol : 0;
+    }
+
+    SymbolTableEntry* Add(int hashKey, const char* pSymbolName, int length);
+    void Reset();
+};
+
+SymbolScope::SymbolScope(int nSlots)
+{
+    m_pSlots = new SymbolSlot[nSlots];
+    for (int i = 0; i < nSlots; i++)
+    {
+        m_pSlots[i].generation = 0;
+    }
+    m_nSlotMask = nSlots - 1;
+    m_nSlotsUsed = 0;
+    m_generation = 1;
+
+    m_nEntryBlockLimit = 16;
+    m_pEntryBlocks = new SymbolTableEntry*[m_nEntryBlockLimit];
+    m_nEntryBlocks = 0;
+    m_nEntries = 0;
+
+    m_nNameBlockLimit = 16;
+    m_pNameBlocks = new char*[m_nNameBlockLimit];
+    m_nNameBlocks = 0;
+    m_nNameBlock = 0;
+    m_nNameOffset = 0;
+}
+
+SymbolScope::~SymbolScope()
+{
+    for (int i = 0; i < m_nEntryBlocks; i++)
+    {
+        delete [] m_pEntryBlocks[i];
+    }
+    delete [] m_pEntryBlocks;
+    for (int i = 0; i < m_nNameBlocks; i++)
+    {
+        delete [] m_pNameBlocks[i];
+    }
+    delete [] m_pNameBlocks;
+    delete [] m_pSlots;
+}
+
+// doubles the table once it is half full, moving over the slots of the current generation
+void SymbolScope::GrowSlots()
+{
+    SymbolSlot* pOldSlots = m_pSlots;
+    int nOldSlots = m_nSlotMask + 1;
+    int nSlots = nOldSlots * 2;
+
+    m_pSlots = new SymbolSlot[nSlots];
+    for (int i = 0; i < nSlots; i++)
+    {
+        m_pSlots[i].generation = 0;
+    }
+    m_nSlotMask = nSlots - 1;
+
+    for (int i = 0; i < nOldSlots; i++)
+    {
+        if (pOldSlots[i].generation == m_generation)
+        {
+            int slot = pOldSlots[i].hashKey & m_nSlotMask;
+            while (m_pSlots[slot].generation == m_generation)
+            {
+                slot = (slot + 1) & m_nSlotMask;
+            }
+            m_pSlots[slot] = pOldSlots[i];
         }
+    }
+    delete [] pOldSlots;
+}
+
+// the new entry replaces any entry of the same name, like the last one added was found first before
+SymbolTableEntry* SymbolScope::Add(int hashKey, const char* pSymbolName, int length)
+{
+    int entryBlock = m_nEntries / symbol_entry_block_size;
+    if (entryBlock == m_nEntryBlocks)
+    {
+        AddBlock(m_pEntryBlocks, m_nEntryBlocks, m_nEntryBlockLimit, new SymbolTableEntry[symbol_entry_block_size]);
+    }
+    SymbolTableEntry* pSymbol = &m_pEntryBlocks[entryBlock][m_nEntries % symbol_entry_block_size];
+    m_nEntries++;
+
+    if (m_nNameOffset + length + 1 > symbol_name_block_size)
+    {
+        m_nNameBlock++;
+        m_nNameOffset = 0;
+    }
+    if (m_nNameBlock == m_nNameBlocks)
+    {
+        AddBlock(m_pNameBlocks, m_nNameBlocks, m_nNameBlockLimit, new char[symbol_name_block_size]);
+    }
+    char* pName = &m_pNameBlocks[m_nNameBlock][m_nNameOffset];
+    m_nNameOffset += length + 1;
+    for (int i = 0; i < length; i++)
+    {
+        int c = pSymbolName[i];
+        pName[i] = (char)(c - (32 * (c >= 'a' && c <= 'z')));
+    }
+    pName[length] = 0;
+    pSymbol->m_data.name = pName;
+
+    SymbolSlot* pSlot = FindSlot(hashKey, pSymbolName, length);
+    if (pSlot->generation != m_generation)
+    {
+        pSlot->hashKey = hashKey;
+        pSlot->length = length;
+        pSlot->generation = m_generation;
+        m_nSlotsUsed++;
+    }
+    pSlot->pSymbol = pSymbol;
 
-        pNode = m_pTempUserSymbols->FindNext(pNode);
+    if (m_nSlotsUsed * 2 > m_nSlotMask + 1)
+    {
+        GrowSlots();
     }
+    return pSymbol;
+}
 
-    return 0;
+void SymbolScope::Reset()
+{
+    m_generation++;
+    if (m_generation == 0)
+    {
+        // the generations wrapped around, so the slots have to be cleared for real
+        for (int i = 0; i <= m_nSlotMask; i++)
+        {
+            m_pSlots[i].generation = 0;
+        }
+        m_generation = 1;
+    }
+    m_nSlotsUsed = 0;
+    m_nEntries = 0;
+    m_nNameBlock = 0;
+    m_nNameOffset = 0;
+}
+
+SymbolEngine::SymbolEngine()
+{
+    m_pSymbols = GetPredefinedSymbols();
+    m_pUserSymbols = new SymbolScope(8192);
+    m_pTempUserSymbols = new SymbolScope(1024);
+}
+
+SymbolEngine::~SymbolEngine()
+{
+    m_pSymbols = 0;
+    delete m_pUserSymbols;
+    m_pUserSymbols = 0;
+    delete m_pTempUserSymbols;
+    m_pTempUserSymbols = 0;
+}
+
+// looks for the given symbol in the symbol table and returns a pointer to the entry
+// if the symbol is not found, then it returns 0
+SymbolTableEntry* SymbolEngine::FindSymbol(const char* pSymbolName)
+{
+    int length;
+    int hashKey = GetSymbolHash(pSymbolName, length);
+
+    // look in automatic symbols
+    SymbolTableEntry* pSymbol = m_pSymbols->Find(hashKey, pSymbolName);
+    if (pSymbol != 0)
+    {
+        return pSymbol;
+    }
+
+    // didn't find it above, so look in user symbols
+    pSymbol = m_pUserSymbols->Find(hashKey, pSymbolName, length);
+    if (pSymbol != 0)
+    {
+        return pSymbol;
+    }
+
+    // didn't find it above, so look in temp user symbols
+    return m_pTempUserSymbols->Find(hashKey, pSymbolName, length);
 }
 
 void SymbolEngine::AddSymbol(const char* pSymbolName, symbol_Type type, int value, int value_2, bool bTemp)
 {
     PrintSymbol(pSymbolName, (unsigned char)type, value, value_2);
 
-    SymbolTableEntry* pSymbol = new SymbolTableEntry;
-    size_t nameLength = strlen(pSymbolName)+1;
-    pSymbol->m_data.name = new char[nameLength];
-    strcpy(pSymbol->m_data.name, pSymbolName);
+    int length;
+    int hashKey = GetSymbolHash(pSymbolName, length);
+    SymbolTableEntry* pSymbol = bTemp ? m_pTempUserSymbols->Add(hashKey, pSymbolName, length) : m_pUserSymbols->Add(hashKey, pSymbolName, length);
     pSymbol->m_data.type = type;
     pSymbol->m_data.value = value;
     pSymbol->m_data.value_2 = value_2;
     pSymbol->m_data.dual = false;
     pSymbol->m_data.operator_type_or_asm = 0;
-
-    if (bTemp)
-    {
-        int hashKey = m_pTempUserSymbols->GetStringHashUppercase(pSymbol->m_data.name);
-        m_pTempUserSymbols->Insert(hashKey, pSymbol);
-    }
-    else
-    {
-        int hashKey = m_pUserSymbols->GetStringHashUppercase(pSymbol->m_data.name);
-        m_pUserSymbols->Insert(hashKey, pSymbol);
-    }
 }
 
 void SymbolEngine::Reset(bool bTempsOnly)
 {
     if (!bTempsOnly)
     {
-        delete m_pUserSymbols;
-        m_pUserSymbols = new HashTable(8192);
+        m_pUserSymbols->Reset();
     }
 
-    delete m_pTempUserSymbols;
-    m_pTempUserSymbols = new HashTable(1024);
+    m_pTempUserSymbols->Reset();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
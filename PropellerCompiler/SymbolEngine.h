@@ -199,7 +199,8 @@ struct SymbolTableEntryData
     bool            dual;                   // indicates that this symbol is used by both PASM and spin
 };
 
-class SymbolTableEntry : public Hashable
+// the name is not owned by the entry, it points into the predefined table or a symbol scope's name arena
+class SymbolTableEntry
 {
 public:
     SymbolTableEntry()
@@ -207,18 +208,17 @@ public:
         m_data.name = 0;
     }
     SymbolTableEntry(const SymbolTableEntryDataTable& data);
-    ~SymbolTableEntry()
-    {
-        delete [] m_data.name;
-    }
     SymbolTableEntryData m_data;
 };
 
+class PredefinedSymbols;
+class SymbolScope;
+
 class SymbolEngine
 {
-    HashTable*  m_pSymbols;             // predefined symbols
-    HashTable*  m_pUserSymbols;         // any symbols defined during compiling
-    HashTable*  m_pTempUserSymbols;     // used for locals during CompileSubBlocks
+    PredefinedSymbols*  m_pSymbols;     // predefined symbols (shared by all symbol engines)
+    SymbolScope*        m_pUserSymbols;     // any symbols defined during compiling
+    SymbolScope*        m_pTempUserSymbols; // used for locals during CompileSubBlocks
 
 public:
     SymbolEngine();
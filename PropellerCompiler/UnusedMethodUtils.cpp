@@ -15,6 +15,7 @@
 #include <string.h>
 
 #include "PropellerCompiler.h"
+#include "CompilerContext.h"
 
 //
 // track object names based on "indent" or which child/parent level
@@ -27,36 +28,6 @@ struct ObjectNameEntry
     int nCompileIndex;
 };
 
-ObjectNameEntry s_objectNames[file_limit * file_limit];
-int s_nNumObjectNames = 0;
-
-void AddObjectName(char* pFilename, int nCompileIndex)
-{
-    strcpy(s_objectNames[s_nNumObjectNames].filename, pFilename);
-
-    // chop off the .spin extension
-    char* pExtension = strstr(s_objectNames[s_nNumObjectNames].filename, ".spin");
-    if (pExtension != 0)
-    {
-        *pExtension = 0;
-    }
-
-    s_objectNames[s_nNumObjectNames].nCompileIndex = nCompileIndex;
-    s_nNumObjectNames++;
-}
-
-int GetObjectName(int nCompileIndex)
-{
-    for (int i = 0; i < s_nNumObjectNames; i++)
-    {
-        if (s_objectNames[i].nCompileIndex == nCompileIndex)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
 //
 // track method usage by object
 //
@@ -99,15 +70,85 @@ struct ObjectEntry
     IndexEntry* pIndexTable;
     MethodUsage* pMethods;
 };
-  
-ObjectEntry s_objects[file_limit * file_limit];
-int s_nNumObjects;
+
+//
+// store pubcon list data so it can be used in the final compile
+// note: this is needed to allow removing a child object where the parent used only CONs from the child
+//
+
+struct ObjectPubConListEntry
+{
+    char filename[256];
+    unsigned char* pPubConList;
+    int nPubConListSize;
+};
+
+struct ObjectCogInitEntry
+{
+    char filename[256];
+    int nSubConstant;
+};
+
+// all of the unused method data of a compile, kept in the CompilerContext
+struct UnusedMethodData
+{
+    ObjectNameEntry         objectNames[file_limit * file_limit];
+    int                     nNumObjectNames;
+    ObjectEntry             objects[file_limit * file_limit];
+    int                     nNumObjects;
+    ObjectPubConListEntry   objectPubConLists[file_limit * file_limit];
+    int                     nNumObjectPubConLists;
+    ObjectCogInitEntry      objectCogInits[file_limit * file_limit];
+    int                     nNumObjectCogInits;
+};
+
+UnusedMethodData* CreateUnusedMethodData()
+{
+    UnusedMethodData* pData = new UnusedMethodData;
+    memset(pData, 0, sizeof(UnusedMethodData));
+    return pData;
+}
+
+void DeleteUnusedMethodData(UnusedMethodData* pData)
+{
+    delete pData;
+}
+
+void AddObjectName(char* pFilename, int nCompileIndex)
+{
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    strcpy(pData->objectNames[pData->nNumObjectNames].filename, pFilename);
+
+    // chop off the .spin extension
+    char* pExtension = strstr(pData->objectNames[pData->nNumObjectNames].filename, ".spin");
+    if (pExtension != 0)
+    {
+        *pExtension = 0;
+    }
+
+    pData->objectNames[pData->nNumObjectNames].nCompileIndex = nCompileIndex;
+    pData->nNumObjectNames++;
+}
+
+int GetObjectName(int nCompileIndex)
+{
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjectNames; i++)
+    {
+        if (pData->objectNames[i].nCompileIndex == nCompileIndex)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
 
 bool HaveObject(unsigned char* pObject)
 {
-    for (int i = 0; i < s_nNumObjects; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        if (s_objects[i].pObject == pObject)
+        if (pData->objects[i].pObject == pObject)
         {
             return true;
         }
@@ -118,11 +159,12 @@ bool HaveObject(unsigned char* pObject)
 
 ObjectEntry* GetObject(unsigned char* pObject)
 {
-    for (int i = 0; i < s_nNumObjects; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        if (s_objects[i].pObject == pObject)
+        if (pData->objects[i].pObject == pObject)
         {
-            return &s_objects[i];
+            return &pData->objects[i];
         }
     }
 
@@ -131,11 +173,12 @@ ObjectEntry* GetObject(unsigned char* pObject)
 
 ObjectEntry* GetObjectByName(char* pFilename)
 {
-    for (int i = 0; i < s_nNumObjects; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        if (strcmp(s_objectNames[s_objects[i].nObjectNameIndex].filename, pFilename) == 0)
+        if (strcmp(pData->objectNames[pData->objects[i].nObjectNameIndex].filename, pFilename) == 0)
         {
-            return &s_objects[i];
+            return &pData->objects[i];
         }
     }
 
@@ -144,23 +187,24 @@ ObjectEntry* GetObjectByName(char* pFilename)
 
 int AddObject(unsigned char* pObject, int nObjectNameIndex)
 {
-    s_objects[s_nNumObjects].pObject = pObject;
-    s_objects[s_nNumObjects].nObjectNameIndex = nObjectNameIndex;
-    s_objects[s_nNumObjects].nObjectMethodCount = pObject[2]-1;
-    s_objects[s_nNumObjects].nObjectSubObjectCount = pObject[3];
-    s_objects[s_nNumObjects].nObjectIndexCount = s_objects[s_nNumObjects].nObjectMethodCount + s_objects[s_nNumObjects].nObjectSubObjectCount;
-    s_objects[s_nNumObjects].pIndexTable = (IndexEntry *)&(pObject[4]);
-    s_objects[s_nNumObjects].pMethods = new MethodUsage[s_objects[s_nNumObjects].nObjectMethodCount];
-    for (int i = 0; i < s_objects[s_nNumObjects].nObjectMethodCount; i++)
-    {
-        s_objects[s_nNumObjects].pMethods[i].nCalled = 0;
-        s_objects[s_nNumObjects].pMethods[i].nCalls = 0;
-        s_objects[s_nNumObjects].pMethods[i].pCalls = 0;
-        s_objects[s_nNumObjects].pMethods[i].nCurrCall = 0;
-        s_objects[s_nNumObjects].pMethods[i].nNewIndex = 0;
-        s_objects[s_nNumObjects].pMethods[i].nLength = 0;
-    }
-    return s_nNumObjects++;
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    pData->objects[pData->nNumObjects].pObject = pObject;
+    pData->objects[pData->nNumObjects].nObjectNameIndex = nObjectNameIndex;
+    pData->objects[pData->nNumObjects].nObjectMethodCount = pObject[2]-1;
+    pData->objects[pData->nNumObjects].nObjectSubObjectCount = pObject[3];
+    pData->objects[pData->nNumObjects].nObjectIndexCount = pData->objects[pData->nNumObjects].nObjectMethodCount + pData->objects[pData->nNumObjects].nObjectSubObjectCount;
+    pData->objects[pData->nNumObjects].pIndexTable = (IndexEntry *)&(pObject[4]);
+    pData->objects[pData->nNumObjects].pMethods = new MethodUsage[pData->objects[pData->nNumObjects].nObjectMethodCount];
+    for (int i = 0; i < pData->objects[pData->nNumObjects].nObjectMethodCount; i++)
+    {
+        pData->objects[pData->nNumObjects].pMethods[i].nCalled = 0;
+        pData->objects[pData->nNumObjects].pMethods[i].nCalls = 0;
+        pData->objects[pData->nNumObjects].pMethods[i].pCalls = 0;
+        pData->objects[pData->nNumObjects].pMethods[i].nCurrCall = 0;
+        pData->objects[pData->nNumObjects].pMethods[i].nNewIndex = 0;
+        pData->objects[pData->nNumObjects].pMethods[i].nLength = 0;
+    }
+    return pData->nNumObjects++;
 }
 
 bool IsObjectUsed(char* pFilename)
@@ -201,28 +245,14 @@ bool IsMethodUsed(char* pFilename, int nMethod)
     return false;
 }
 
-//
-// store pubcon list data so it can be used in the final compile
-// note: this is needed to allow removing a child object where the parent used only CONs from the child
-//
-
-struct ObjectPubConListEntry
-{
-    char filename[256];
-    unsigned char* pPubConList;
-    int nPubConListSize;
-};
-
-ObjectPubConListEntry s_objectPubConLists[file_limit * file_limit];
-int s_nNumObjectPubConLists;
-
 ObjectPubConListEntry* GetObjectPubConListEntryByName(char* pFilename)
 {
-    for (int i = 0; i < s_nNumObjectPubConLists; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjectPubConLists; i++)
     {
-        if (strcmp(s_objectPubConLists[i].filename, pFilename) == 0)
+        if (strcmp(pData->objectPubConLists[i].filename, pFilename) == 0)
         {
-            return &s_objectPubConLists[i];
+            return &pData->objectPubConLists[i];
         }
     }
 
@@ -231,11 +261,12 @@ ObjectPubConListEntry* GetObjectPubConListEntryByName(char* pFilename)
 
 void AddObjectPubConList(char* pFilename, unsigned char* pPubConList, int nPubConListSize)
 {
-    strcpy(s_objectPubConLists[s_nNumObjectPubConLists].filename, pFilename);
-    s_objectPubConLists[s_nNumObjectPubConLists].pPubConList = new unsigned char[nPubConListSize];
-    s_objectPubConLists[s_nNumObjectPubConLists].nPubConListSize = nPubConListSize;
-    memcpy(s_objectPubConLists[s_nNumObjectPubConLists].pPubConList, pPubConList, s_objectPubConLists[s_nNumObjectPubConLists].nPubConListSize);
-    s_nNumObjectPubConLists++;
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    strcpy(pData->objectPubConLists[pData->nNumObjectPubConLists].filename, pFilename);
+    pData->objectPubConLists[pData->nNumObjectPubConLists].pPubConList = new unsigned char[nPubConListSize];
+    pData->objectPubConLists[pData->nNumObjectPubConLists].nPubConListSize = nPubConListSize;
+    memcpy(pData->objectPubConLists[pData->nNumObjectPubConLists].pPubConList, pPubConList, pData->objectPubConLists[pData->nNumObjectPubConLists].nPubConListSize);
+    pData->nNumObjectPubConLists++;
 }
 
 bool GetObjectPubConList(char* pFilename, unsigned char** ppPubConList, int* pnPubConListSize)
@@ -250,48 +281,101 @@ bool GetObjectPubConList(char* pFilename, unsigned char** ppPubConList, int* pnP
     return false;
 }
 
-struct ObjectCogInitEntry
-{
-    char filename[256];
-    int nSubConstant;
-};
-
-ObjectCogInitEntry s_objectCogInits[file_limit * file_limit];
-int s_nNumObjectCogInits;
-
 void AddCogNewOrInit(char* pFilename, int nSubConstant)
 {
-    if (s_nNumObjectCogInits > 0)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    if (pData->nNumObjectCogInits > 0)
     {
         // see if this combo already is in the array
-        for (int i = s_nNumObjectCogInits; i > 0; i--)
+        for (int i = pData->nNumObjectCogInits; i > 0; i--)
         {
-            if (s_objectCogInits[i-1].nSubConstant == nSubConstant && strcmp(s_objectCogInits[i-1].filename, pFilename) == 0)
+            if (pData->objectCogInits[i-1].nSubConstant == nSubConstant && strcmp(pData->objectCogInits[i-1].filename, pFilename) == 0)
             {
                 return;
             }
         }
     }
     // wasn't already there, so add it
-    strcpy(s_objectCogInits[s_nNumObjectCogInits].filename, pFilename);
-    s_objectCogInits[s_nNumObjectCogInits].nSubConstant = nSubConstant;
-    s_nNumObjectCogInits++;
+    strcpy(pData->objectCogInits[pData->nNumObjectCogInits].filename, pFilename);
+    pData->objectCogInits[pData->nNumObjectCogInits].nSubConstant = nSubConstant;
+    pData->nNumObjectCogInits++;
+}
+
+// pubcon lists and cognew/coginit uses recorded by a compile, so they can be added to another compile's data
+struct UnusedMethodEntries
+{
+    int                     nNumObjectPubConLists;
+    ObjectPubConListEntry*  pObjectPubConLists;
+    int                     nNumObjectCogInits;
+    ObjectCogInitEntry*     pObjectCogInits;
+};
+
+UnusedMethodEntries* ExportUnusedMethodEntries()
+{
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    UnusedMethodEntries* pEntries = new UnusedMethodEntries;
+    pEntries->nNumObjectPubConLists = pData->nNumObjectPubConLists;
+    pEntries->pObjectPubConLists = new ObjectPubConListEntry[pData->nNumObjectPubConLists];
+    for (int i = 0; i < pData->nNumObjectPubConLists; i++)
+    {
+        ObjectPubConListEntry* pEntry = &pEntries->pObjectPubConLists[i];
+        strcpy(pEntry->filename, pData->objectPubConLists[i].filename);
+        pEntry->nPubConListSize = pData->objectPubConLists[i].nPubConListSize;
+        pEntry->pPubConList = new unsigned char[pEntry->nPubConListSize];
+        memcpy(pEntry->pPubConList, pData->objectPubConLists[i].pPubConList, pEntry->nPubConListSize);
+    }
+    pEntries->nNumObjectCogInits = pData->nNumObjectCogInits;
+    pEntries->pObjectCogInits = new ObjectCogInitEntry[pData->nNumObjectCogInits];
+    memcpy(pEntries->pObjectCogInits, pData->objectCogInits, pData->nNumObjectCogInits * sizeof(ObjectCogInitEntry));
+    return pEntries;
+}
+
+void ImportUnusedMethodEntries(UnusedMethodEntries* pEntries)
+{
+    for (int i = 0; i < pEntries->nNumObjectPubConLists; i++)
+    {
+        // only the first list of an object is ever looked up
+        ObjectPubConListEntry* pEntry = &pEntries->pObjectPubConLists[i];
+        if (GetObjectPubConListEntryByName(pEntry->filename) == NULL)
+        {
+            AddObjectPubConList(pEntry->filename, pEntry->pPubConList, pEntry->nPubConListSize);
+        }
+    }
+    for (int i = 0; i < pEntries->nNumObjectCogInits; i++)
+    {
+        AddCogNewOrInit(pEntries->pObjectCogInits[i].filename, pEntries->pObjectCogInits[i].nSubConstant);
+    }
+}
+
+void DeleteUnusedMethodEntries(UnusedMethodEntries* pEntries)
+{
+    if (pEntries)
+    {
+        for (int i = 0; i < pEntries->nNumObjectPubConLists; i++)
+        {
+            delete [] pEntries->pObjectPubConLists[i].pPubConList;
+        }
+        delete [] pEntries->pObjectPubConLists;
+        delete [] pEntries->pObjectCogInits;
+        delete pEntries;
+    }
 }
 
 void MarkCalls(MethodUsage* pMethod, ObjectEntry* pObject);
 
 void CheckForCogNewOrInit(ObjectEntry* pObject)
 {
-    char* pObjectFilename = s_objectNames[pObject->nObjectNameIndex].filename;
-    for (int i = 0; i < s_nNumObjectCogInits; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    char* pObjectFilename = pData->objectNames[pObject->nObjectNameIndex].filename;
+    for (int i = 0; i < pData->nNumObjectCogInits; i++)
     {
-        if (strcmp(s_objectCogInits[i].filename, pObjectFilename) == 0)
+        if (strcmp(pData->objectCogInits[i].filename, pObjectFilename) == 0)
         {
             // don't do this if the object has no called methods already
             // in that case it means the cognew/coginit is never done, so it's safe to not mark the referred to method
             if (pObject->nMethodsCalled > 0)
             {
-                MarkCalls(&(pObject->pMethods[s_objectCogInits[i].nSubConstant - 1]), pObject);
+                MarkCalls(&(pObject->pMethods[pData->objectCogInits[i].nSubConstant - 1]), pObject);
             }
         }
     }
@@ -299,46 +383,48 @@ void CheckForCogNewOrInit(ObjectEntry* pObject)
 
 void CleanUpUnusedMethodData()
 {
-    for (int i = 0; i < s_nNumObjects; i++)
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        s_objects[i].pObject = 0;
-        s_objects[i].pIndexTable = 0;
+        pData->objects[i].pObject = 0;
+        pData->objects[i].pIndexTable = 0;
 
-        for (int j = 0; j < s_objects[s_nNumObjects].nObjectMethodCount; j++)
+        for (int j = 0; j < pData->objects[pData->nNumObjects].nObjectMethodCount; j++)
         {
-            if (s_objects[i].pMethods[j].pCalls)
+            if (pData->objects[i].pMethods[j].pCalls)
             {
-                delete [] s_objects[i].pMethods[j].pCalls;
-                s_objects[i].pMethods[j].pCalls = 0;
+                delete [] pData->objects[i].pMethods[j].pCalls;
+                pData->objects[i].pMethods[j].pCalls = 0;
             }
         }
-        delete [] s_objects[i].pMethods;
-        s_objects[i].pMethods = 0;
+        delete [] pData->objects[i].pMethods;
+        pData->objects[i].pMethods = 0;
     }
-    s_nNumObjects = 0;
-    s_nNumObjectNames = 0;
+    pData->nNumObjects = 0;
+    pData->nNumObjectNames = 0;
 
-    for (int i = 0; i < s_nNumObjectPubConLists; i++)
+    for (int i = 0; i < pData->nNumObjectPubConLists; i++)
     {
-        delete [] s_objectPubConLists[i].pPubConList;
-        s_objectPubConLists[i].pPubConList = 0;
+        delete [] pData->objectPubConLists[i].pPubConList;
+        pData->objectPubConLists[i].pPubConList = 0;
     }
-    s_nNumObjectPubConLists = 0;
+    pData->nNumObjectPubConLists = 0;
 
-    s_nNumObjectCogInits = 0;
+    pData->nNumObjectCogInits = 0;
 }
 
 void InitUnusedMethodData()
 {
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
     for (int i = 0; i < (file_limit * file_limit); i++)
     {
-        s_objectPubConLists[i].filename[0] = 0;
-        s_objectPubConLists[i].pPubConList = 0;
-        s_objectPubConLists[i].nPubConListSize = 0;
+        pData->objectPubConLists[i].filename[0] = 0;
+        pData->objectPubConLists[i].pPubConList = 0;
+        pData->objectPubConLists[i].nPubConListSize = 0;
     }
-    s_nNumObjectPubConLists = 0;
-    s_nNumObjectCogInits = 0;
-    s_nNumObjectNames = 0;
+    pData->nNumObjectPubConLists = 0;
+    pData->nNumObjectCogInits = 0;
+    pData->nNumObjectNames = 0;
 }
 
 void AdvanceCompileIndex(unsigned char* pObject, int& nCompileIndex)
@@ -358,6 +444,7 @@ void AdvanceCompileIndex(unsigned char* pObject, int& nCompileIndex)
 
 void BuildTables(unsigned char* pObject, int indent, int& nCompileIndex)
 {
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
 #ifdef RPE_DEBUG
 #define MAX_INDENT 32
     char s_indent[MAX_INDENT+1] = "                                ";
@@ -377,34 +464,34 @@ void BuildTables(unsigned char* pObject, int indent, int& nCompileIndex)
     int nObject = AddObject(pObject, nObjectName);
 
 #ifdef RPE_DEBUG
-    printf("%sObject Index Table: %s\n", &s_indent[MAX_INDENT-indent], s_objectNames[s_objects[nObject].nObjectNameIndex].filename);
+    printf("%sObject Index Table: %s\n", &s_indent[MAX_INDENT-indent], pData->objectNames[pData->objects[nObject].nObjectNameIndex].filename);
 #endif
-    for (int i = 0; i < s_objects[nObject].nObjectIndexCount; i++)
+    for (int i = 0; i < pData->objects[nObject].nObjectIndexCount; i++)
     {
-        if (s_objects[nObject].pIndexTable[i].offset >= nNextObjOffset)
+        if (pData->objects[nObject].pIndexTable[i].offset >= nNextObjOffset)
         {
 #ifdef RPE_DEBUG
-            printf("%s Object Offset: %04d  Vars Offset: %d\n", &s_indent[MAX_INDENT-indent], s_objects[nObject].pIndexTable[i].offset, s_objects[nObject].pIndexTable[i].vars);
+            printf("%s Object Offset: %04d  Vars Offset: %d\n", &s_indent[MAX_INDENT-indent], pData->objects[nObject].pIndexTable[i].offset, pData->objects[nObject].pIndexTable[i].vars);
 #endif
             // this skip logic here is to handle the case where there are multiple instances of the same object source included
             // either as an array of objects or as separately named objects
             bool bSkip = false;
             for (int j = 0; j < i; j++)
             {
-                if (s_objects[nObject].pIndexTable[i].offset == s_objects[nObject].pIndexTable[j].offset)
+                if (pData->objects[nObject].pIndexTable[i].offset == pData->objects[nObject].pIndexTable[j].offset)
                 {
                     bSkip = true;
                 }
             }
             if (!bSkip)
             {
-                BuildTables(&(pObject[s_objects[nObject].pIndexTable[i].offset]), indent + 1, nCompileIndex);
+                BuildTables(&(pObject[pData->objects[nObject].pIndexTable[i].offset]), indent + 1, nCompileIndex);
             }
         }
 #ifdef RPE_DEBUG
         else
         {
-            printf("%s Method Offset: %04d  Locals size: %d\n", &s_indent[MAX_INDENT-indent], s_objects[nObject].pIndexTable[i].offset, s_objects[nObject].pIndexTable[i].vars);
+            printf("%s Method Offset: %04d  Locals size: %d\n", &s_indent[MAX_INDENT-indent], pData->objects[nObject].pIndexTable[i].offset, pData->objects[nObject].pIndexTable[i].vars);
         }
 #endif
     }
@@ -939,34 +1026,35 @@ void MarkCalls(MethodUsage* pMethod, ObjectEntry* pObject)
 
 void FindUnusedMethods(CompilerData* pCompilerData)
 {
+    UnusedMethodData* pData = g_pCompilerContext->pUnusedMethodData;
     for (int i = 0; i < (file_limit * file_limit); i++)
     {
-        s_objects[i].pObject = 0;
-        s_objects[i].nObjectMethodCount = 0;
-        s_objects[i].nObjectSubObjectCount = 0;
-        s_objects[i].nObjectIndexCount = 0;
-        s_objects[i].nMethodsCalled = 0;
-        s_objects[i].nNewObjectIndex = 0;
-        s_objects[i].pIndexTable = 0;
-        s_objects[i].pMethods = 0;
+        pData->objects[i].pObject = 0;
+        pData->objects[i].nObjectMethodCount = 0;
+        pData->objects[i].nObjectSubObjectCount = 0;
+        pData->objects[i].nObjectIndexCount = 0;
+        pData->objects[i].nMethodsCalled = 0;
+        pData->objects[i].nNewObjectIndex = 0;
+        pData->objects[i].pIndexTable = 0;
+        pData->objects[i].pMethods = 0;
     }
-    s_nNumObjects = 0;
+    pData->nNumObjects = 0;
 
     int nCompileIndex = 0;
     BuildTables(&(pCompilerData->obj[4]), 0, nCompileIndex);
 
-    for (int i = 0; i < s_nNumObjects; i++)
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        ScanObjectMethods(&s_objects[i]);
+        ScanObjectMethods(&pData->objects[i]);
     }
 
-    ObjectEntry* pObject = &(s_objects[0]);
+    ObjectEntry* pObject = &(pData->objects[0]);
     MethodUsage* pMethod = &(pObject->pMethods[0]);
     MarkCalls(pMethod, pObject);
 
-    for (int i = 0; i < s_nNumObjects; i++)
+    for (int i = 0; i < pData->nNumObjects; i++)
     {
-        CheckForCogNewOrInit(&s_objects[i]);
+        CheckForCogNewOrInit(&pData->objects[i]);
     }
 }
 
@@ -13,6 +13,10 @@
 #define _UNUSEDMETHODUTILS_H_
 
 struct CompilerData;
+struct UnusedMethodData;
+
+UnusedMethodData* CreateUnusedMethodData();
+void DeleteUnusedMethodData(UnusedMethodData* pData);
 
 void AddObjectName(char* pFilename, int nCompileIndex);
 void FindUnusedMethods(CompilerData* pCompilerData);
@@ -26,6 +30,12 @@ bool GetObjectPubConList(char* pFilename, unsigned char** ppPubConList, int* pnP
 
 void AddCogNewOrInit(char* pFilename, int nSubConstant);
 
+struct UnusedMethodEntries;
+
+UnusedMethodEntries* ExportUnusedMethodEntries();
+void ImportUnusedMethodEntries(UnusedMethodEntries* pEntries);
+void DeleteUnusedMethodEntries(UnusedMethodEntries* pEntries);
+
 #endif // _UNUSEDMETHODUTILS_H_
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -18,26 +18,24 @@
 #include "SymbolEngine.h"
 #include "Elementizer.h"
 #include "ErrorStrings.h"
-
-char* pPrintDestination = 0;
-int printLimit = 0;
+#include "CompilerContext.h"
 
 void SetPrint(char* pDestination, int limit)
 {
-    pPrintDestination = pDestination;
-    printLimit = limit;
+    g_pCompilerContext->pPrintDestination = pDestination;
+    g_pCompilerContext->printLimit = limit;
     g_pCompilerData->print_length = 0;
 }
 
 bool PrintChr(char theChar)
 {
-    if (g_pCompilerData->print_length >= printLimit)
+    if (g_pCompilerData->print_length >= g_pCompilerContext->printLimit)
     {
         g_pCompilerData->error = true;
         g_pCompilerData->error_msg = g_pErrorStrings[error_litl];
         return false;
     }
-    pPrintDestination[g_pCompilerData->print_length++] = theChar;
+    g_pCompilerContext->pPrintDestination[g_pCompilerData->print_length++] = theChar;
     return true;
 }
 
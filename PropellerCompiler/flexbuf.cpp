@@ -26,17 +26,34 @@ size_t flexbuf_curlen(struct flexbuf *fb)
     return fb->len;
 }
 
+/*
+ * make room for newlen characters
+ * the space at least doubles each time (growing by at least growsize),
+ * so a large buffer isn't copied over and over as it grows
+ */
+static char *flexbuf_grow(struct flexbuf *fb, size_t newlen)
+{
+    char *newdata;
+    size_t newspace;
+
+    newspace = fb->space + (fb->space > fb->growsize ? fb->space : fb->growsize);
+    if (newspace < newlen) {
+        newspace = newlen + fb->growsize;
+    }
+    newdata = (char *)realloc(fb->data, newspace);
+    if (!newdata) return newdata;
+    fb->space = newspace;
+    fb->data = newdata;
+    return newdata;
+}
+
 /* add a single character to a buffer */
 char *flexbuf_addchar(struct flexbuf *fb, int c)
 {
     size_t newlen = fb->len + 1;
 
     if (newlen > fb->space) {
-        char *newdata;
-        newdata = (char *)realloc(fb->data, fb->space + fb->growsize);
-        if (!newdata) return newdata;
-        fb->space += fb->growsize;
-        fb->data = newdata;
+        if (!flexbuf_grow(fb, newlen)) return NULL;
     }
     fb->data[fb->len] = (char)c;
     fb->len = newlen;
@@ -49,16 +66,7 @@ char *flexbuf_addmem(struct flexbuf *fb, const char *buf, size_t N)
     size_t newlen = fb->len + N;
 
     if (newlen > fb->space) {
-        char *newdata;
-        size_t newspace;
-        newspace = fb->space + fb->growsize;
-        if (newspace < newlen) {
-            newspace = newlen + fb->growsize;
-        }
-        newdata = (char *)realloc(fb->data, newspace);
-        if (!newdata) return newdata;
-        fb->space = newspace;
-        fb->data = newdata;
+        if (!flexbuf_grow(fb, newlen)) return NULL;
     }
     memcpy(fb->data + fb->len, buf, N);
     fb->len = newlen;
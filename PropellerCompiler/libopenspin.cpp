@@ -0,0 +1,315 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// libopenspin.cpp
+//
+
+#include <string.h>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "libopenspin.h"
+#include "CompileSpin.h"
+#include "CompilerContext.h"
+#include "Annotate.h"
+
+// a diagnostic kept for openspin_get_diagnostics()
+struct SessionDiagnostic
+{
+    bool        bWarning;
+    bool        bFile;
+    bool        bLine;
+    std::string file;
+    int         nLine;
+    int         nColumn;
+    std::string message;
+    std::string line;
+    std::string item;
+};
+
+struct openspin_session
+{
+    CompilerContext*                pContext;
+    openspin_options                options;
+    openspin_read_func              pRead;
+    openspin_release_func           pRelease;
+    void*                           pUser;
+    std::vector<std::pair<std::string, std::string> > defines;
+
+    // the full paths given to the compiler, which has to be able to keep them for the life of the session
+    std::set<std::string>           fullPaths;
+    std::mutex                      fullPathsMutex;
+
+    // results of the last compile
+    std::vector<unsigned char>      image;
+    std::string                     listing;
+    std::string                     symbols;
+    std::string                     messages;
+    std::vector<SessionDiagnostic>  diagnostics;
+};
+
+// the LoadFileFunc & FreeFileBufferFunc of a session's context, which get the session from the context bound
+// to the thread (so they work in scheduler workers too)
+static char* LoadSessionFile(const char* pFilename, int* pnLength, char** ppFilePath)
+{
+    openspin_session* pSession = (openspin_session*)GetCompilerUserData();
+    int nLength = 0;
+    const char* pFullPath = 0;
+    const char* pContents = pSession->pRead(pSession->pUser, pFilename, &nLength, &pFullPath);
+    if (pContents == 0)
+    {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pSession->fullPathsMutex);
+        *ppFilePath = (char*)pSession->fullPaths.insert(pFullPath != 0 ? pFullPath : pFilename).first->c_str();
+    }
+    *pnLength = nLength;
+    if (nLength <= 0)
+    {
+        // as from the command line, an empty file has no buffer
+        *pnLength = 0;
+        pSession->pRelease(pSession->pUser, pContents);
+        return 0;
+    }
+    // the compiler only reads the buffer
+    return (char*)pContents;
+}
+
+static void FreeSessionFile(char* pBuffer)
+{
+    if (pBuffer != 0)
+    {
+        openspin_session* pSession = (openspin_session*)GetCompilerUserData();
+        pSession->pRelease(pSession->pUser, pBuffer);
+    }
+}
+
+static void PrintSessionOutput(void* pUserData, CompilerOutputKind eKind, const char* pText)
+{
+    openspin_session* pSession = (openspin_session*)pUserData;
+    switch (eKind)
+    {
+        case coListing:
+            pSession->listing += pText;
+            break;
+        case coSymbols:
+            pSession->symbols += pText;
+            break;
+        default:
+            pSession->messages += pText;
+            break;
+    }
+}
+
+static void AddSessionDiagnostic(void* pUserData, const CompilerDiagnostic* pDiagnostic)
+{
+    openspin_session* pSession = (openspin_session*)pUserData;
+    SessionDiagnostic diagnostic;
+    diagnostic.bWarning = pDiagnostic->bWarning;
+    diagnostic.bFile = (pDiagnostic->pFilename != 0);
+    diagnostic.bLine = (pDiagnostic->pLine != 0);
+    diagnostic.file = diagnostic.bFile ? pDiagnostic->pFilename : "";
+    diagnostic.nLine = pDiagnostic->nLine;
+    diagnostic.nColumn = pDiagnostic->nColumn;
+    diagnostic.message = pDiagnostic->pMessage;
+    diagnostic.line = diagnostic.bLine ? pDiagnostic->pLine : "";
+    diagnostic.item = pDiagnostic->pItem != 0 ? pDiagnostic->pItem : "";
+    pSession->diagnostics.push_back(diagnostic);
+}
+
+static size_t CopyResult(const std::string& result, char* pBuffer, size_t size)
+{
+    if (pBuffer != 0 && size > 0)
+    {
+        size_t nCopy = result.size() < size ? result.size() : size - 1;
+        memcpy(pBuffer, result.c_str(), nCopy);
+        pBuffer[nCopy] = 0;
+    }
+    return result.size();
+}
+
+void openspin_default_options(openspin_options* options)
+{
+    CompilerConfig defaults;
+    memset(options, 0, sizeof(*options));
+    options->eeprom = defaults.bBinary ? 0 : 1;
+    options->eeprom_size = defaults.eeprom_size;
+    options->preprocessor = defaults.bUsePreprocessor ? 1 : 0;
+    options->threads = defaults.nThreads;
+}
+
+openspin_session* openspin_create(const openspin_options* options, openspin_read_func read, openspin_release_func release, void* user)
+{
+    if (read == 0 || release == 0)
+    {
+        return 0;
+    }
+    openspin_session* pSession = new openspin_session;
+    if (options != 0)
+    {
+        pSession->options = *options;
+    }
+    else
+    {
+        openspin_default_options(&pSession->options);
+    }
+    pSession->pRead = read;
+    pSession->pRelease = release;
+    pSession->pUser = user;
+
+    CompilerConfig compilerConfig;
+    compilerConfig.bBinary = (pSession->options.eeprom == 0);
+    compilerConfig.eeprom_size = pSession->options.eeprom_size;
+    compilerConfig.bDATonly = (pSession->options.dat_only != 0);
+    compilerConfig.bUnusedMethodElimination = (pSession->options.unused_method_elimination != 0);
+    compilerConfig.bUsePreprocessor = (pSession->options.preprocessor != 0);
+    compilerConfig.bAlternatePreprocessorMode = (pSession->options.alternate_preprocessor != 0);
+    compilerConfig.bSymbolsWithImage = (pSession->options.symbols != 0);
+    compilerConfig.bQuiet = (pSession->options.quiet != 0);
+    compilerConfig.nThreads = pSession->options.threads > 1 ? pSession->options.threads : 1;
+    compilerConfig.bKeepObjects = (pSession->options.keep_objects != 0);
+
+    pSession->pContext = InitCompiler(&compilerConfig, LoadSessionFile, FreeSessionFile);
+    SetCompilerOutput(pSession->pContext, PrintSessionOutput, AddSessionDiagnostic, pSession);
+    return pSession;
+}
+
+void openspin_destroy(openspin_session* session)
+{
+    if (session != 0)
+    {
+        ShutdownCompiler(session->pContext);
+        delete session;
+    }
+}
+
+void openspin_define(openspin_session* session, const char* name, const char* value)
+{
+    if (value == 0)
+    {
+        value = session->options.alternate_preprocessor ? "" : "1";
+    }
+    session->defines.push_back(std::make_pair(std::string(name), std::string(value)));
+}
+
+void openspin_clear_defines(openspin_session* session)
+{
+    session->defines.clear();
+}
+
+void openspin_file_changed(openspin_session* session, const char* full_path)
+{
+    if (full_path == 0)
+    {
+        ForgetKeptObjects(session->pContext);
+    }
+    else
+    {
+        ForgetKeptObjectsUsing(session->pContext, full_path);
+    }
+}
+
+int openspin_compile(openspin_session* session, const char* filename)
+{
+    session->image.clear();
+    session->listing.clear();
+    session->symbols.clear();
+    session->messages.clear();
+    session->diagnostics.clear();
+
+    // each compile starts from the defines given, as each top file does on the command line
+    if (session->options.preprocessor)
+    {
+        ClearDefines(session->pContext);
+        for (size_t i = 0; i < session->defines.size(); i++)
+        {
+            SetDefine(session->pContext, session->defines[i].first.c_str(), session->defines[i].second.c_str());
+        }
+        SetDefine(session->pContext, "__SPIN__", "1");
+        SetDefine(session->pContext, "__TARGET__", "P1");
+    }
+
+    // the listing request only lasts for one compile
+    SetCompilerContext(session->pContext);
+    AL_Request(session->options.listing ? amConsole : amNone, 0);
+
+    std::vector<char> name(filename, filename + strlen(filename) + 1);
+    int nLength = 0;
+    unsigned char* pImage = CompileSpin(session->pContext, &name[0], &nLength);
+    if (pImage == 0)
+    {
+        return 0;
+    }
+    session->image.assign(pImage, pImage + nLength);
+    return 1;
+}
+
+size_t openspin_get_image(openspin_session* session, unsigned char* buffer, size_t size)
+{
+    if (buffer != 0 && !session->image.empty())
+    {
+        memcpy(buffer, &session->image[0], session->image.size() < size ? session->image.size() : size);
+    }
+    return session->image.size();
+}
+
+size_t openspin_get_listing(openspin_session* session, char* buffer, size_t size)
+{
+    return CopyResult(session->listing, buffer, size);
+}
+
+size_t openspin_get_symbols(openspin_session* session, char* buffer, size_t size)
+{
+    return CopyResult(session->symbols, buffer, size);
+}
+
+size_t openspin_get_messages(openspin_session* session, char* buffer, size_t size)
+{
+    return CopyResult(session->messages, buffer, size);
+}
+
+int openspin_get_diagnostics(openspin_session* session, openspin_diagnostic* diagnostics, int count)
+{
+    int nDiagnostics = (int)session->diagnostics.size();
+    for (int i = 0; i < count && i < nDiagnostics; i++)
+    {
+        const SessionDiagnostic& diagnostic = session->diagnostics[i];
+        diagnostics[i].warning = diagnostic.bWarning ? 1 : 0;
+        diagnostics[i].file = diagnostic.bFile ? diagnostic.file.c_str() : 0;
+        diagnostics[i].line = diagnostic.nLine;
+        diagnostics[i].column = diagnostic.nColumn;
+        diagnostics[i].message = diagnostic.message.c_str();
+        diagnostics[i].source_line = diagnostic.bLine ? diagnostic.line.c_str() : 0;
+        diagnostics[i].item = diagnostic.bLine ? diagnostic.item.c_str() : 0;
+    }
+    return nDiagnostics;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
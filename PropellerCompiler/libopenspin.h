@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// libopenspin.h
+//
+// C API of the compiler, for embedding it in another program (built as libopenspin.so with "make shared").
+//
+// Sources are read through the caller's read function, so they can come from memory, and nothing is
+// written to stdout or stderr: the results of each compile are kept by its session and copied out into
+// the caller's buffers. Each session is independent, so different sessions can compile at the same time
+// on different threads, but a session must only be used by one thread at a time.
+//
+
+#ifndef _LIBOPENSPIN_H_
+#define _LIBOPENSPIN_H_
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#define OPENSPIN_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define OPENSPIN_API __attribute__((visibility("default")))
+#else
+#define OPENSPIN_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct openspin_session openspin_session;
+
+// returns the contents of a file (or 0 if there is no such file) and its length, with *full_path set to a
+// name that identifies it (or left 0 to use the name given); the name is as referenced in the source, or a
+// full path given before: with listing set, a source the listing shows may be requested again by its
+// full_path, and the compile fails ("cannot reload source for listing") if it isn't returned then
+// when threads > 1 it is also called from the worker threads of the session
+typedef const char* (*openspin_read_func)(void* user, const char* name, int* length, const char** full_path);
+// releases contents returned by the read function, once the compiler is done with them
+typedef void (*openspin_release_func)(void* user, const char* contents);
+
+typedef struct openspin_options
+{
+    int eeprom;                     // 1 for an eeprom image, 0 for a binary (ram) image
+    unsigned int eeprom_size;       // size of the eeprom image
+    int dat_only;                   // 1 for just the DAT sections of the top object
+    int unused_method_elimination;  // 1 to remove unused methods
+    int preprocessor;               // 1 to run the preprocessor on the sources
+    int alternate_preprocessor;     // 1 for the alternative preprocessor rules (as the command line's -a)
+    int listing;                    // 1 for the annotated listing
+    int symbols;                    // 1 for the symbols of the top object (as the command line's -s)
+    int quiet;                      // 1 to leave out the progress messages
+    int threads;                    // threads compiling sub-objects in parallel
+    int keep_objects;               // 1 to keep the objects compiled for the next compile (see openspin_file_changed())
+} openspin_options;
+
+typedef struct openspin_diagnostic
+{
+    int warning;                    // 1 for a preprocessor #warning or #info, 0 for an error
+    const char* file;               // name of the object (or file) it is in, or 0
+    int line;                       // 1 based line & column, or 0 when not known
+    int column;
+    const char* message;
+    const char* source_line;        // the offending source line & item in it, or 0 when not known
+    const char* item;
+} openspin_diagnostic;
+
+// sets the options to the defaults of the command line
+OPENSPIN_API void openspin_default_options(openspin_options* options);
+
+// returns a new session, or 0 if it can't be created (options may be 0 for the defaults)
+OPENSPIN_API openspin_session* openspin_create(const openspin_options* options, openspin_read_func read,
+                                               openspin_release_func release, void* user);
+OPENSPIN_API void openspin_destroy(openspin_session* session);
+
+// preprocessor defines for the compiles that follow, until cleared (a value of 0 defines the name as the
+// command line's -D does); each compile starts with just these, and __SPIN__ & __TARGET__ as on the command line
+OPENSPIN_API void openspin_define(openspin_session* session, const char* name, const char* value);
+OPENSPIN_API void openspin_clear_defines(openspin_session* session);
+
+// with keep_objects, the objects that read a file (by its full_path) are compiled again next time;
+// a full_path of 0 forgets them all, as is needed when a name could now be read as a different file
+OPENSPIN_API void openspin_file_changed(openspin_session* session, const char* full_path);
+
+// compiles a top file, returning 1 if it compiled or 0 if it failed
+OPENSPIN_API int openspin_compile(openspin_session* session, const char* filename);
+
+// the results of the last compile: each copies as much as fits in the buffer (which can be 0 to only get
+// the size), and returns the full size; the text ones are always terminated when size > 0, and their
+// size doesn't count the terminator
+OPENSPIN_API size_t openspin_get_image(openspin_session* session, unsigned char* buffer, size_t size);
+OPENSPIN_API size_t openspin_get_listing(openspin_session* session, char* buffer, size_t size);
+OPENSPIN_API size_t openspin_get_symbols(openspin_session* session, char* buffer, size_t size);
+// everything the command line would have printed for the compile (progress, the object tree & errors)
+OPENSPIN_API size_t openspin_get_messages(openspin_session* session, char* buffer, size_t size);
+
+// copies up to count diagnostics of the last compile, returning how many there are
+// their strings belong to the session and stay valid until its next compile
+OPENSPIN_API int openspin_get_diagnostics(openspin_session* session, openspin_diagnostic* diagnostics, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _LIBOPENSPIN_H_
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
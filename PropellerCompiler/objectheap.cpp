@@ -13,21 +13,17 @@
 
 #include "PropellerCompiler.h"
 #include "objectheap.h"
+#include "CompilerContext.h"
 #include "Annotate.h"
 
-// Object heap (compile-time objects)
-struct ObjHeap
+bool AddObjectToHeap(char* name, CompilerData* pCompilerData, const char* pDefineState)
 {
-    char*   ObjFilename;    // Full filename of object
-    char*   Obj;            // Object binary
-    int     ObjSize;        // Size of object
-};
-
-ObjHeap s_ObjHeap[MaxObjInHeap];
-int     s_nObjHeapIndex = 0;
+    return AddObjectBinaryToHeap(name, (char*)&(pCompilerData->obj[0]), pCompilerData->obj_ptr, pDefineState);
+}
 
-bool AddObjectToHeap(char* name, CompilerData* pCompilerData)
+bool AddObjectBinaryToHeap(char* name, char* pObj, int nObjSize, const char* pDefineState)
 {
+    CompilerContext* pContext = g_pCompilerContext;
     // see if it already exists in the heap
     if (IndexOfObjectInHeap(name) != -1)
     {
@@ -35,28 +31,30 @@ bool AddObjectToHeap(char* name, CompilerData* pCompilerData)
     }
 
     // add the object to the heap
-    if (s_nObjHeapIndex < MaxObjInHeap)
+    if (pContext->nObjHeapIndex < MaxObjInHeap)
     {
         int nNameBufferLength = (int)strlen(name)+1;
-        s_ObjHeap[s_nObjHeapIndex].ObjFilename = new char[nNameBufferLength];
-        strcpy(s_ObjHeap[s_nObjHeapIndex].ObjFilename, name);
-        s_ObjHeap[s_nObjHeapIndex].ObjSize = pCompilerData->obj_ptr;
-        s_ObjHeap[s_nObjHeapIndex].Obj = new char[pCompilerData->obj_ptr];
-        memcpy(s_ObjHeap[s_nObjHeapIndex].Obj, &(pCompilerData->obj[0]), pCompilerData->obj_ptr);
-        AL_AddToHeap (s_nObjHeapIndex);
-        s_nObjHeapIndex++;
+        pContext->objHeap[pContext->nObjHeapIndex].ObjFilename = new char[nNameBufferLength];
+        strcpy(pContext->objHeap[pContext->nObjHeapIndex].ObjFilename, name);
+        pContext->objHeap[pContext->nObjHeapIndex].ObjSize = nObjSize;
+        pContext->objHeap[pContext->nObjHeapIndex].Obj = new char[nObjSize];
+        memcpy(pContext->objHeap[pContext->nObjHeapIndex].Obj, pObj, nObjSize);
+        pContext->objHeap[pContext->nObjHeapIndex].ObjDefineState = new char[strlen(pDefineState)+1];
+        strcpy(pContext->objHeap[pContext->nObjHeapIndex].ObjDefineState, pDefineState);
+        AL_AddToHeap (pContext->nObjHeapIndex);
+        pContext->nObjHeapIndex++;
         return true;
     }
 
     return false;
 }
 
-// Returns index of object of Name in Object Heap.  Returns -1 if not found.
 int IndexOfObjectInHeap(char* name)
 {
-    for (int i = s_nObjHeapIndex-1; i >= 0; i--)
+    CompilerContext* pContext = g_pCompilerContext;
+    for (int i = pContext->nObjHeapIndex-1; i >= 0; i--)
     {
-        if (_stricmp(s_ObjHeap[i].ObjFilename, name) == 0)
+        if (_stricmp(pContext->objHeap[i].ObjFilename, name) == 0)
         {
             return i;
         }
@@ -64,34 +62,50 @@ int IndexOfObjectInHeap(char* name)
     return -1;
 }
 
+// Returns index of object of Name in Object Heap if it was compiled with the given define state.  Returns -1 if not found.
+int IndexOfCompiledObjectInHeap(char* name, const char* pDefineState)
+{
+    CompilerContext* pContext = g_pCompilerContext;
+    int nObjIdx = IndexOfObjectInHeap(name);
+    if (nObjIdx != -1 && strcmp(pContext->objHeap[nObjIdx].ObjDefineState, pDefineState) == 0)
+    {
+        return nObjIdx;
+    }
+    return -1;
+}
+
 void CleanObjectHeap()
 {
-    for (int i = 0; i < s_nObjHeapIndex; i++)
+    CompilerContext* pContext = g_pCompilerContext;
+    for (int i = 0; i < pContext->nObjHeapIndex; i++)
     {
-        delete [] s_ObjHeap[i].ObjFilename;
-        s_ObjHeap[i].ObjFilename = NULL;
-        delete [] s_ObjHeap[i].Obj;
-        s_ObjHeap[i].Obj = NULL;
-        s_ObjHeap[i].ObjSize = 0;
+        delete [] pContext->objHeap[i].ObjFilename;
+        pContext->objHeap[i].ObjFilename = NULL;
+        delete [] pContext->objHeap[i].Obj;
+        pContext->objHeap[i].Obj = NULL;
+        pContext->objHeap[i].ObjSize = 0;
+        delete [] pContext->objHeap[i].ObjDefineState;
+        pContext->objHeap[i].ObjDefineState = NULL;
     }
-    s_nObjHeapIndex = 0;
+    pContext->nObjHeapIndex = 0;
 }
 
 bool CopyObjectsFromHeap(CompilerData* pCompilerData, char* filenames)
 {
+    CompilerContext* pContext = g_pCompilerContext;
     // load sub-objects from heap into obj_data for Compile2()
     int p = 0;
     for (int i = 0; i < pCompilerData->obj_files; i++)
     {
         int nObjIdx = IndexOfObjectInHeap(&filenames[i<<8]);
-        if (p + s_ObjHeap[nObjIdx].ObjSize > data_limit)
+        if (p + pContext->objHeap[nObjIdx].ObjSize > data_limit)
         {
             return false;
         }
-        memcpy(&pCompilerData->obj_data[p], s_ObjHeap[nObjIdx].Obj, s_ObjHeap[nObjIdx].ObjSize);
+        memcpy(&pCompilerData->obj_data[p], pContext->objHeap[nObjIdx].Obj, pContext->objHeap[nObjIdx].ObjSize);
         pCompilerData->obj_offsets[i] = p;
-        pCompilerData->obj_lengths[i] = s_ObjHeap[nObjIdx].ObjSize;
-        p += s_ObjHeap[nObjIdx].ObjSize;
+        pCompilerData->obj_lengths[i] = pContext->objHeap[nObjIdx].ObjSize;
+        p += pContext->objHeap[nObjIdx].ObjSize;
         AL_CopyFromHeap (nObjIdx, i);
     }
 
@@ -15,8 +15,19 @@
 
 #define MaxObjInHeap        256
 
-bool AddObjectToHeap(char* name, CompilerData* pCompilerData);
+// Object heap (compile-time objects)
+struct ObjHeap
+{
+    char*   ObjFilename;    // Full filename of object
+    char*   Obj;            // Object binary
+    int     ObjSize;        // Size of object
+    char*   ObjDefineState; // Preprocessor define state the object was compiled with
+};
+
+bool AddObjectToHeap(char* name, CompilerData* pCompilerData, const char* pDefineState);
+bool AddObjectBinaryToHeap(char* name, char* pObj, int nObjSize, const char* pDefineState);
 int IndexOfObjectInHeap(char* name);
+int IndexOfCompiledObjectInHeap(char* name, const char* pDefineState);
 void CleanObjectHeap();
 bool CopyObjectsFromHeap(CompilerData* pCompilerData, char* filenames);
 
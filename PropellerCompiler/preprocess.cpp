@@ -42,16 +42,35 @@
 #define strdup _strdup
 #endif
 
-static PreprocessLoadFileFunc s_pLoadFileFunc = 0;
-static PreprocessFreeFileBufferFunc s_pFreeFileBufferFunc = 0;
+void pp_setFileFunctions(struct preprocess *pp, PreprocessLoadFileFunc pLoadFileFunc, PreprocessFreeFileBufferFunc pFreeFileBufferFunc)
+{
+    pp->loadfilefunc = pLoadFileFunc;
+    pp->freefilebufferfunc = pFreeFileBufferFunc;
+}
 
-void pp_setFileFunctions(PreprocessLoadFileFunc pLoadFileFunc, PreprocessFreeFileBufferFunc pFreeFileBufferFunc)
+/*
+ * note a file loaded by the include being recorded
+ */
+static void record_load(struct ppinclude *rec, const char *filename, memoryfile *f)
 {
-    s_pLoadFileFunc = pLoadFileFunc;
-    s_pFreeFileBufferFunc = pFreeFileBufferFunc;
+    struct incfile *F, **tail;
+
+    F = (struct incfile *)calloc(1, sizeof(*F));
+    F->name = strdup(filename);
+    F->path = f->filepath ? strdup(f->filepath) : NULL;
+    F->length = f->length;
+    if (f->buffer)
+    {
+        F->contents = (char *)malloc(f->length > 0 ? f->length : 1);
+        memcpy(F->contents, f->buffer, f->length);
+    }
+    for (tail = &rec->files; *tail; tail = &(*tail)->next)
+    {
+    }
+    *tail = F;
 }
 
-memoryfile* mopen(const char* filename)
+memoryfile* mopen(struct preprocess *pp, const char* filename)
 {
     memoryfile* f;
     f = (struct memoryfile *)calloc(1, sizeof(*f));
@@ -60,7 +79,11 @@ memoryfile* mopen(const char* filename)
         return 0;
     }
     f->readoffset = 0;
-    f->buffer = s_pLoadFileFunc(filename, &f->length, &f->filepath);
+    f->buffer = pp->loadfilefunc(filename, &f->length, &f->filepath);
+    if (pp->recording)
+    {
+        record_load(pp->recording, filename, f);
+    }
 
     return f;
 }
@@ -76,106 +99,134 @@ int mgetc(memoryfile* f)
 
 int mungetc(int c, memoryfile* f)
 {
-    f->readoffset--;
+    /* a file shorter than the encoding check mustn't be read from before its start */
+    if (f->readoffset > 0)
+    {
+        f->readoffset--;
+    }
     return c;
 }
 
-void mclose(memoryfile* f)
+void mclose(struct preprocess *pp, memoryfile* f)
 {
-    s_pFreeFileBufferFunc(f->buffer);
+    pp->freefilebufferfunc(f->buffer);
     free(f);
 }
 
 /*
- * function to read a single LATIN-1 character
- * from a file
- * returns number of bytes placed in buffer, or -1 on EOF
+ * find the rest of the line in a file, up to and including the \n
  */
-static int read_latin1(memoryfile *f, char buf[4])
-{
-  int c = mgetc(f);
-  if (c == EOF)
-  {
-    return -1;
-  }
-  if (c <= 127)
-  {
-    buf[0] = (char)c;
-    return 1;
-  }
-  buf[0] = 0xC0 + ((c>>6) & 0x1f);
-  buf[1] = 0x80 + ( c & 0x3f );
-  return 2;
-}
-
-/*
- * function to read a single UTF-8 character
- * from a file
- * returns number of bytes placed in buffer, or -1 on EOF
- */
-static int read_single(memoryfile *f, char buf[4])
+static size_t line_length(memoryfile *f)
 {
-    int c = mgetc(f);
-    if (c == EOF)
+    const char *start = f->buffer + f->readoffset;
+    const char *nl;
+
+    if (f->readoffset >= f->length)
     {
-        return -1;
+        return 0;
     }
-    buf[0] = (char)c;
-    return 1;
+    nl = (const char *)memchr(start, '\n', f->length - f->readoffset);
+    return nl ? (size_t)(nl - start) + 1 : (size_t)(f->length - f->readoffset);
 }
 
 /*
- * function to read a single UTF-16 character
- * from a file
- * returns number of bytes placed in buffer, or -1 on EOF
+ * functions to read the rest of a line from a file into a buffer,
+ * converting it to UTF-8
+ * return the number of bytes added to the buffer
  */
-static int read_utf16(memoryfile *f, char buf[4])
+static int read_line_latin1(memoryfile *f, struct flexbuf *line)
 {
-    int c, d;
-    int r;
-    c = mgetc(f);
-    if (c < 0)
-    {
-        return -1;
-    }
-    d = mgetc(f);
-    if (d < 0)
-    {
-        return -1;
-    }
+    const unsigned char *s = (const unsigned char *)f->buffer + f->readoffset;
+    size_t len = line_length(f);
+    size_t i, run;
+    char buf[2];
+    int count = 0;
 
-    c = c + (d<<8);
-    /* here we need to translate UTF-16 to UTF-8 */
-    /* FIXME: this code is not done properly; it does
-       not handle surrogate pairs (0xD800 - 0xDFFF)
-     */
-    if (c < 128)
+    f->readoffset += (int)len;
+    for (i = 0; i < len; )
     {
-        buf[0] = (char)c;
-        r = 1;
-    }
-    else if (c < 0x800)
-    {
-        buf[0] = 0xC0 + ((c>>6) &  0x1F);
-        buf[1] = 0x80 + ( c & 0x3F );
-        r = 2;
-    }
-    else if (c < 0x10000)
-    {
-        buf[0] = 0xE0 + ((c>>12) & 0x0F);
-        buf[1] = 0x80 + ((c>>6) & 0x3F);
-        buf[2] = 0x80 + (c & 0x3F);
-        r = 3;
+        /* ASCII is copied as it is, a run at a time */
+        for (run = i; run < len && s[run] <= 127; run++)
+        {
+        }
+        if (run > i)
+        {
+            flexbuf_addmem(line, (const char *)s + i, run - i);
+            count += (int)(run - i);
+            i = run;
+        }
+        if (i < len)
+        {
+            buf[0] = 0xC0 + ((s[i]>>6) & 0x1f);
+            buf[1] = 0x80 + ( s[i] & 0x3f );
+            flexbuf_addmem(line, buf, 2);
+            count += 2;
+            i++;
+        }
     }
-    else
+    return count;
+}
+
+static int read_line_utf8(memoryfile *f, struct flexbuf *line)
+{
+    size_t len = line_length(f);
+
+    flexbuf_addmem(line, f->buffer + f->readoffset, len);
+    f->readoffset += (int)len;
+    return (int)len;
+}
+
+static int read_line_utf16(memoryfile *f, struct flexbuf *line)
+{
+    const unsigned char *s = (const unsigned char *)f->buffer;
+    char buf[256];
+    int r = 0;
+    int count = 0;
+    int c;
+
+    while (f->readoffset < f->length)
     {
-        buf[0] = 0xF0 + ((c>>18) & 0x07);
-        buf[1] = 0x80 + ((c>>12) & 0x3F);
-        buf[2] = 0x80 + ((c>>6) & 0x3F);
-        buf[3] = 0x80 + (c & 0x3F);
-        r = 4;
+        /* a last odd byte is dropped */
+        if (f->readoffset + 1 >= f->length)
+        {
+            f->readoffset = f->length;
+            break;
+        }
+        c = s[f->readoffset] + (s[f->readoffset + 1]<<8);
+        f->readoffset += 2;
+
+        if (r > (int)sizeof(buf) - 4)
+        {
+            flexbuf_addmem(line, buf, r);
+            count += r;
+            r = 0;
+        }
+        /* here we need to translate UTF-16 to UTF-8 */
+        /* FIXME: this code is not done properly; it does
+           not handle surrogate pairs (0xD800 - 0xDFFF)
+         */
+        if (c < 128)
+        {
+            buf[r++] = (char)c;
+        }
+        else if (c < 0x800)
+        {
+            buf[r++] = 0xC0 + ((c>>6) &  0x1F);
+            buf[r++] = 0x80 + ( c & 0x3F );
+        }
+        else
+        {
+            buf[r++] = 0xE0 + ((c>>12) & 0x0F);
+            buf[r++] = 0x80 + ((c>>6) & 0x3F);
+            buf[r++] = 0x80 + (c & 0x3F);
+        }
+        if (c == '\n')
+        {
+            break;
+        }
     }
-    return r;
+    flexbuf_addmem(line, buf, r);
+    return count + r;
 }
 
 /*
@@ -184,10 +235,8 @@ static int read_utf16(memoryfile *f, char buf[4])
  */
 int pp_nextline(struct preprocess *pp)
 {
-    int r;
     int count = 0;
     memoryfile *f;
-    char buf[4];
     struct filestate *A;
 
     A = pp->fil;
@@ -199,7 +248,7 @@ int pp_nextline(struct preprocess *pp)
     A->lineno++;
 
     flexbuf_clear(&pp->line);
-    if (A->readfunc == NULL)
+    if (A->mode == MODE_UNKNOWN)
     {
         int c0, c1, c2;
         c0 = mgetc(f);
@@ -211,16 +260,16 @@ int pp_nextline(struct preprocess *pp)
         c2 = mgetc(f);
         if ((c0 == 0xff && c1 == 0xfe) || c1 == 0)
         {
-            A->readfunc = read_utf16;
+            A->mode = MODE_UTF16;
             mungetc(c2, f);
         }
         else if (c0 == 239 && c1 == 187 && c2 == 191)
         {
-            A->readfunc = read_single;
+            A->mode = MODE_UTF8;
         }
         else
         {
-            A->readfunc = read_latin1;
+            A->mode = MODE_LATIN1;
             mungetc(c2, f);
             mungetc(c1, f);
         }
@@ -228,7 +277,7 @@ int pp_nextline(struct preprocess *pp)
         flexbuf_addchar(&pp->line, 239);
         flexbuf_addchar(&pp->line, 187);
         flexbuf_addchar(&pp->line, 191);
-        if (A->readfunc == read_latin1)
+        if (A->mode == MODE_LATIN1)
         {
             flexbuf_addchar(&pp->line, c0);
         }
@@ -238,13 +287,17 @@ int pp_nextline(struct preprocess *pp)
             return 1;
         }
     }
-    for(;;)
+    if (A->mode == MODE_LATIN1)
     {
-        r = (*A->readfunc)(f, buf);
-        if (r <= 0) break;
-        count += r;
-        flexbuf_addmem(&pp->line, buf, r);
-        if (r == 1 && buf[0] == '\n') break;
+        count = read_line_latin1(f, &pp->line);
+    }
+    else if (A->mode == MODE_UTF8)
+    {
+        count = read_line_utf8(f, &pp->line);
+    }
+    else
+    {
+        count = read_line_utf16(f, &pp->line);
     }
     flexbuf_addchar(&pp->line, '\0');
     return count;
@@ -260,6 +313,38 @@ static void default_messagefunc(const char *level, const char *filename, int lin
     fprintf(stderr, "\n");
 }
 
+static void keep_message(struct flexbuf *buf, struct filestate *fil, const char *level, const char *msg)
+{
+    int line = fil ? fil->lineno : 0;
+    flexbuf_addmem(buf, (const char *)&line, sizeof(line));
+    flexbuf_addmem(buf, level, strlen(level) + 1);
+    flexbuf_addmem(buf, fil ? fil->name : "", strlen(fil ? fil->name : "") + 1);
+    flexbuf_addmem(buf, msg, strlen(msg) + 1);
+}
+
+void pp_repeat_messages(struct preprocess *pp, const char *messages, size_t len)
+{
+    const char *p = messages;
+    const char *end = p + len;
+    const char *level, *filename;
+    int line;
+
+    while (p < end)
+    {
+        memcpy(&line, p, sizeof(line));
+        level = p + sizeof(line);
+        filename = level + strlen(level) + 1;
+        p = filename + strlen(filename) + 1;
+        if (pp->messages)
+        {
+            flexbuf_addmem(pp->messages, (const char *)&line, sizeof(line));
+            flexbuf_addmem(pp->messages, level, p + strlen(p) + 1 - level);
+        }
+        (*pp->messagefunc)(level, filename, line, p);
+        p += strlen(p) + 1;
+    }
+}
+
 static void domessage(struct preprocess *pp, const char *level, const char *msg, ...)
 {
     va_list args;
@@ -271,6 +356,18 @@ static void domessage(struct preprocess *pp, const char *level, const char *msg,
     va_end(args);
 
     fil = pp->fil;
+    if (pp->recording)
+    {
+        keep_message(&pp->recording->messages, fil, level, tmpmsg);
+        if (!strcmp(level, "error"))
+        {
+            pp->recording->replayable = false;
+        }
+    }
+    if (pp->messages)
+    {
+        keep_message(pp->messages, fil, level, tmpmsg);
+    }
     if (fil)
     {
         (*pp->messagefunc)(level, pp->fil->name, pp->fil->lineno, tmpmsg);
@@ -288,10 +385,36 @@ void pp_init(struct preprocess *pp, bool alternate)
 {
     memset(pp, 0, sizeof(*pp));
     flexbuf_init(&pp->line, 128);
+    flexbuf_init(&pp->expanded, 128);
     flexbuf_init(&pp->whole, 102400);
 
     pp->messagefunc = default_messagefunc;
     pp->alternate = alternate;
+    pp->errorexit = true;
+}
+
+static void free_include(struct ppinclude *rec);
+
+void pp_free(struct preprocess *pp)
+{
+    struct ppinclude *rec;
+
+    flexbuf_delete(&pp->line);
+    flexbuf_delete(&pp->expanded);
+    flexbuf_delete(&pp->whole);
+    while (pp->includes)
+    {
+        rec = pp->includes;
+        pp->includes = rec->next;
+        free_include(rec);
+    }
+    if (pp->recording)
+    {
+        free_include(pp->recording);
+        pp->recording = NULL;
+    }
+    free(pp->includename);
+    pp->includename = NULL;
 }
 
 /*
@@ -322,7 +445,7 @@ void pp_push_file(struct preprocess *pp, const char *name)
 {
     memoryfile *f;
 
-    f = mopen(name);
+    f = mopen(pp, name);
     if (!f)
     {
         domessage(pp, "error", "Unable to open file %s", name);
@@ -332,6 +455,8 @@ void pp_push_file(struct preprocess *pp, const char *name)
     pp->fil->flags |= FILE_FLAGS_CLOSEFILE;
 }
 
+static void finish_recording(struct preprocess *pp);
+
 /*
  * pop the current file state off the stack
  * closes the file as a side effect
@@ -370,15 +495,93 @@ void pp_pop_file(struct preprocess *pp)
     A = pp->fil;
     if (A)
     {
+        bool recorded = pp->recording && pp->recording->fil == A;
         pp->fil = A->next;
         if (A->flags & FILE_FLAGS_CLOSEFILE)
         {
-            mclose(A->f);
+            mclose(pp, A->f);
         }
         free(A);
+        if (recorded)
+        {
+            finish_recording(pp);
+        }
     }
 }
 
+/*
+ * the defines are a list, newest first, indexed by a hash of the name
+ * a define is only ever removed when it is the newest one, so it is
+ * then also the first in its hash bucket, and removing it from the
+ * front of both undoes adding it
+ * they are also counted by first character and length, which rules
+ * out most words before hashing them
+ */
+static unsigned int define_hash(const char *name, size_t len)
+{
+    unsigned int hash = 2166136261u;
+    while (len--)
+    {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash & (PP_DEFINE_BUCKETS - 1);
+}
+
+static int define_filter(const char *name, size_t len)
+{
+    return (int)(((unsigned char)name[0] * 37 + len) & (PP_DEFINE_FILTER - 1));
+}
+
+static void add_define(struct preprocess *pp, struct predef *the)
+{
+    size_t len = strlen(the->name);
+    unsigned int hash = define_hash(the->name, len);
+    the->next = pp->defs;
+    pp->defs = the;
+    the->hashnext = pp->defhash[hash];
+    pp->defhash[hash] = the;
+    pp->deffilter[define_filter(the->name, len)]++;
+}
+
+static void remove_newest_define(struct preprocess *pp)
+{
+    struct predef *old = pp->defs;
+    size_t len = strlen(old->name);
+    pp->defs = old->next;
+    pp->defhash[define_hash(old->name, len)] = old->hashnext;
+    pp->deffilter[define_filter(old->name, len)]--;
+    if (old->flags & PREDEF_FLAG_FREEDEFS)
+    {
+        free((void *)old->name);
+        if (old->def)
+        {
+            free((void *)old->def);
+        }
+    }
+    free(old);
+}
+
+/*
+ * find the newest define of a name, which need not be terminated
+ */
+static struct predef *find_define(struct preprocess *pp, const char *name, size_t len)
+{
+    struct predef *X;
+
+    if (pp->deffilter[define_filter(name, len)] == 0)
+    {
+        return NULL;
+    }
+    for (X = pp->defhash[define_hash(name, len)]; X; X = X->hashnext)
+    {
+        if (!strncmp(X->name, name, len) && X->name[len] == 0)
+        {
+            return X;
+        }
+    }
+    return NULL;
+}
+
 /*
  * add a definition
  * "flags" indicates things like whether we must free the memory
@@ -392,8 +595,11 @@ static void pp_define_internal(struct preprocess *pp, const char *name, const ch
     the->name = name;
     the->def = def;
     the->flags = flags;
-    the->next = pp->defs;
-    pp->defs = the;
+    if (pp->recording)
+    {
+        the->flags |= PREDEF_FLAG_RECORDED;
+    }
+    add_define(pp, the);
 }
 
 /*
@@ -405,6 +611,40 @@ void pp_define(struct preprocess *pp, const char *name, const char *str)
     pp_define_internal(pp, name, str, 0);
 }
 
+/*
+ * note a lookup by the include being recorded; unless it found one of
+ * the include's own defines, what it found has to be the same for the
+ * include to be replayed
+ */
+static void record_lookup(struct ppinclude *rec, struct preprocess *pp, const char *name, struct predef *X)
+{
+    struct predef *C;
+    unsigned int hash;
+
+    flexbuf_addstr(&rec->lookups, name);
+    flexbuf_addchar(&rec->lookups, '\n');
+    if (X && (X->flags & PREDEF_FLAG_RECORDED))
+    {
+        return;
+    }
+    hash = define_hash(name, strlen(name));
+    for (C = pp->checkhash[hash]; C; C = C->hashnext)
+    {
+        if (!strcmp(C->name, name))
+        {
+            return;
+        }
+    }
+    C = (struct predef *)calloc(sizeof(*C), 1);
+    C->name = strdup(name);
+    C->def = (X && X->def) ? strdup(X->def) : NULL;
+    C->flags = PREDEF_FLAG_FREEDEFS;
+    C->next = rec->checks;
+    rec->checks = C;
+    C->hashnext = pp->checkhash[hash];
+    pp->checkhash[hash] = C;
+}
+
 /*
  * retrieive a definition
  * returns NULL if no definition exists (or if there was an
@@ -413,18 +653,17 @@ void pp_define(struct preprocess *pp, const char *name, const char *str)
 const char* pp_getdef(struct preprocess *pp, const char *name)
 {
     struct predef *X;
-    const char *def = NULL;
-    X = pp->defs;
-    while (X)
+    if (pp->lookups)
     {
-        if (!strcmp(X->name, name))
-        {
-            def = X->def;
-            break;
-        }
-        X = X->next;
+        flexbuf_addstr(pp->lookups, name);
+        flexbuf_addchar(pp->lookups, '\n');
+    }
+    X = find_define(pp, name, strlen(name));
+    if (pp->recording)
+    {
+        record_lookup(pp->recording, pp, name, X);
     }
-    return def;
+    return X ? X->def : NULL;
 }
 
 /* structure describing current parse state of a string */
@@ -678,6 +917,10 @@ static void handle_ifdef(struct preprocess *pp, ParseState *P, int invert)
         return;
     }
     I->next = pp->ifs;
+    if (pp->recording)
+    {
+        pp->recording->ifdepth++;
+    }
     if (pp->fil)
     {
         I->name = strdup(pp->fil->name);
@@ -724,6 +967,11 @@ static void handle_else(struct preprocess *pp, ParseState *P)
         domessage(pp, "error", "#else without matching #if");
         return;
     }
+    if (pp->recording && pp->recording->ifdepth == 0)
+    {
+        /* it belongs to the file doing the #include */
+        pp->recording->replayable = false;
+    }
     if (I->sawelse)
     {
         domessage(pp, "error", "multiple #else statements in #if");
@@ -752,6 +1000,10 @@ static void handle_elseifdef(struct preprocess *pp, ParseState *P, int invert)
         domessage(pp, "error", "#else without matching #if");
         return;
     }
+    if (pp->recording && pp->recording->ifdepth == 0)
+    {
+        pp->recording->replayable = false;
+    }
 
     if (I->skiprest)
     {
@@ -785,6 +1037,17 @@ static void handle_endif(struct preprocess *pp, ParseState *P)
         domessage(pp, "error", "#endif without matching #if");
         return;
     }
+    if (pp->recording)
+    {
+        if (pp->recording->ifdepth == 0)
+        {
+            pp->recording->replayable = false;
+        }
+        else
+        {
+            pp->recording->ifdepth--;
+        }
+    }
     pp->ifs = I->next;
     free(I);
 }
@@ -852,7 +1115,8 @@ static void handle_include(struct preprocess *pp, ParseState *P)
         domessage(pp, "error", "no string found for include");
         return;
     }
-    pp_push_file(pp, strdup(name));
+    /* pp_run() starts it once this line is done */
+    pp->includename = strdup(name);
 }
 
 /*
@@ -860,10 +1124,12 @@ static void handle_include(struct preprocess *pp, ParseState *P)
  */
 static int do_line(struct preprocess *pp)
 {
-    char *data = flexbuf_get(&pp->line);
+    char *data = flexbuf_peek(&pp->line);
     char *func;
     int r;
 
+    flexbuf_clear(&pp->expanded);
+
     // skip over utf-8 BOM character
     int dataOffset = 0;
     if (data[0] == -17 && data[1] == -69 && data[2] == -65)
@@ -873,7 +1139,7 @@ static int do_line(struct preprocess *pp)
 
     if (data[dataOffset] != '#' || pp->incomment)
     {
-        r = expand_macros(pp, &pp->line, data);
+        r = expand_macros(pp, &pp->expanded, data);
     }
     else
     {
@@ -908,10 +1174,22 @@ static int do_line(struct preprocess *pp)
         }
         else if (!strcmp(func, "error"))
         {
+            if (pp->recording)
+            {
+                /* under the alternate rules it can exit, or fail the compile */
+                pp->recording->replayable = false;
+            }
             handle_message(pp, &P, "error");
             if (pp->alternate)
             {
-                exit(1);
+                if (pp->errorexit)
+                {
+                    exit(1);
+                }
+                if (pp_active(pp))
+                {
+                    pp->errorfound = true;
+                }
             }
         }
         else if (!strcmp(func, "warning") || !strcmp(func, "warn"))
@@ -944,13 +1222,419 @@ static int do_line(struct preprocess *pp)
             {
                 *(P.save) = (char)(P.c);
             }
-            r = expand_macros(pp, &pp->line, data);
+            r = expand_macros(pp, &pp->expanded, data);
         }
     }
-    free(data);
     return r;
 }
 
+/*
+ * check for a directive after the # at the start of a line, as do_line()
+ * looks for one
+ */
+static const char *directives[] =
+{
+    "ifdef", "ifndef", "else", "elseifdef", "elseifndef", "endif", "error",
+    "warning", "warn", "info", "define", "undef", "include", NULL
+};
+
+static int is_directive(const unsigned char *s, const unsigned char *end)
+{
+    const unsigned char *word;
+    int i;
+
+    while (s < end && isspace(*s))
+    {
+        s++;
+    }
+    word = s;
+    while (s < end && classify_char(*s) == PARSE_IDCHAR)
+    {
+        s++;
+    }
+    for (i = 0; directives[i]; i++)
+    {
+        if (strlen(directives[i]) == (size_t)(s - word) && !memcmp(directives[i], word, s - word))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* strstr() for a word that is not terminated, and a string of length n */
+static int word_has(const unsigned char *word, size_t len, const char *str, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + n <= len; i++)
+    {
+        if (!memcmp(word + i, str, n))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * check whether running a file would only convert it to UTF-8, as it has
+ * no directives and no defined words to expand; most files don't, and
+ * this is much quicker than running them
+ * if so, the file's encoding is returned (MODE_LATIN1, or MODE_UTF8 for
+ * one with a BOM), and the comment nesting and lookups are left as
+ * pp_run() would have left them; otherwise it returns MODE_UNKNOWN, with
+ * the preprocessor as it was, and the file has to be run
+ * the file is split into lines and words just as pp_nextline() and
+ * expand_macros() split it
+ */
+int pp_check_plain(struct preprocess *pp, const char *buffer, int length)
+{
+    const unsigned char *s = (const unsigned char *)buffer;
+    const unsigned char *end = s + length;
+    const unsigned char *line, *word;
+    size_t lookupslen = pp->lookups ? flexbuf_curlen(pp->lookups) : 0;
+    int incomment = pp->incomment;
+    size_t startlen = pp->startcomment ? strlen(pp->startcomment) : 0;
+    size_t endlen = pp->endcomment ? strlen(pp->endcomment) : 0;
+    unsigned char classes[256];
+    int mode, state;
+    int i;
+    struct predef *X;
+
+    /* the encoding check of pp_nextline(), which gets very short files wrong */
+    if (length < 3 || !pp_active(pp) || memchr(buffer, 0, length))
+    {
+        return MODE_UNKNOWN;
+    }
+    if (s[0] == 239 && s[1] == 187 && s[2] == 191)
+    {
+        mode = MODE_UTF8;
+        /* the conversion to PASCII must not run off the end of the buffer */
+        for (i = (length > 6 ? length - 6 : 0); i < length; i++)
+        {
+            if ((s[i] >= 0xC0 && i + 2 > length) || (s[i] >= 0xE0 && i + 3 > length)
+                || (s[i] >= 0xF0 && i + 4 > length) || (s[i] >= 0xF8 && i + 5 > length)
+                || (s[i] >= 0xFC && i + 6 > length))
+            {
+                return MODE_UNKNOWN;
+            }
+        }
+    }
+    else if ((s[0] == 0xff && s[1] == 0xfe) || s[0] >= 0x80)
+    {
+        /* (pp_nextline() doesn't convert the first character of a LATIN-1 file) */
+        return MODE_UNKNOWN;
+    }
+    else
+    {
+        mode = MODE_LATIN1;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        classes[i] = (unsigned char)classify_char(i);
+    }
+
+    while (s < end)
+    {
+        line = s;
+        s = (const unsigned char *)memchr(line, '\n', end - line);
+        s = s ? s + 1 : end;
+
+        /* a UTF-8 BOM is skipped at the start of a line (as it is at the start of the file) */
+        if (mode == MODE_UTF8 && s - line >= 3 && line[0] == 239 && line[1] == 187 && line[2] == 191)
+        {
+            line += 3;
+        }
+        if (line < s && *line == '#' && !incomment && is_directive(line + 1, s))
+        {
+            goto notplain;
+        }
+
+        while (line < s)
+        {
+            word = line++;
+            state = classes[*word];
+            if (*word == '\"')
+            {
+                while (line < s && *line != '\"')
+                {
+                    line++;
+                }
+                if (line < s)
+                {
+                    line++;
+                }
+            }
+            else if (state != PARSE_OTHER)
+            {
+                while (line < s && classes[*line] == state)
+                {
+                    line++;
+                }
+            }
+
+            if (incomment)
+            {
+                if (word_has(word, line - word, pp->endcomment, endlen))
+                {
+                    --incomment;
+                }
+                else if (word_has(word, line - word, pp->startcomment, startlen))
+                {
+                    incomment++;
+                }
+            }
+            else if (state == PARSE_IDCHAR && isalpha(*word))
+            {
+                if (pp->lookups)
+                {
+                    flexbuf_addmem(pp->lookups, (const char *)word, line - word);
+                    flexbuf_addchar(pp->lookups, '\n');
+                }
+                X = find_define(pp, (const char *)word, line - word);
+                if (X && X->def && !(pp->alternate && X->def[0] == 0))
+                {
+                    goto notplain;
+                }
+            }
+            else if (pp->startcomment && word_has(word, line - word, pp->startcomment, startlen))
+            {
+                incomment++;
+            }
+        }
+    }
+    pp->incomment = incomment;
+    return mode;
+
+notplain:
+    if (pp->lookups)
+    {
+        pp->lookups->len = lookupslen;
+    }
+    return MODE_UNKNOWN;
+}
+
+/*
+ * pass on the text of a line
+ */
+static void pp_output(struct preprocess *pp, const char *text, size_t len)
+{
+    if (pp->recording)
+    {
+        flexbuf_addmem(&pp->recording->output, text, len);
+    }
+    if (pp->outputfunc)
+    {
+        (*pp->outputfunc)(pp->outputdata, text, len);
+    }
+    else
+    {
+        flexbuf_addmem(&pp->whole, text, len);
+    }
+}
+
+/*
+ * the include cache
+ * the first time a file is included (at a given comment nesting) what
+ * preprocessing it does is recorded: the files it loads, the defines it
+ * looks up other than its own, the defines it adds, its messages and its
+ * output; when the same name is included again and loads the same files,
+ * and those defines are still the same, the recording is replayed instead
+ * of preprocessing the file again
+ * includes within an include are part of its recording
+ */
+static void free_include(struct ppinclude *rec)
+{
+    struct incfile *F;
+
+    while (rec->files)
+    {
+        F = rec->files;
+        rec->files = F->next;
+        free(F->name);
+        free(F->path);
+        free(F->contents);
+        free(F);
+    }
+    pp_free_defines(rec->checks);
+    pp_free_defines(rec->defines);
+    flexbuf_delete(&rec->messages);
+    flexbuf_delete(&rec->lookups);
+    flexbuf_delete(&rec->output);
+    free(rec->name);
+    free(rec);
+}
+
+static void finish_recording(struct preprocess *pp)
+{
+    struct ppinclude *rec = pp->recording;
+    struct ppinclude **prev;
+    struct predef *X;
+    int variants;
+
+    pp->recording = NULL;
+    memset(pp->checkhash, 0, sizeof(pp->checkhash));
+    for (X = pp->defs; X && X != (struct predef *)rec->state; X = X->next)
+    {
+        X->flags &= ~PREDEF_FLAG_RECORDED;
+    }
+    rec->fil = NULL;
+    if (!rec->replayable || rec->ifdepth != 0)
+    {
+        free_include(rec);
+        return;
+    }
+    rec->endcomment = pp->incomment;
+    rec->defines = pp_copy_defines_since(pp, rec->state);
+    rec->next = pp->includes;
+    pp->includes = rec;
+
+    /* only the newest few variants of an include are kept */
+    variants = 0;
+    prev = &pp->includes;
+    while (*prev)
+    {
+        rec = *prev;
+        if (!strcmp(rec->name, pp->includes->name) && ++variants > PP_INCLUDE_VARIANTS)
+        {
+            *prev = rec->next;
+            free_include(rec);
+        }
+        else
+        {
+            prev = &rec->next;
+        }
+    }
+}
+
+static int same_file(struct incfile *F, memoryfile *f)
+{
+    if (!F->contents || !f->buffer)
+    {
+        return !F->contents && !f->buffer;
+    }
+    if (F->length != f->length)
+    {
+        return 0;
+    }
+    if (F->path || f->filepath)
+    {
+        if (!F->path || !f->filepath || strcmp(F->path, f->filepath) != 0)
+        {
+            return 0;
+        }
+    }
+    return memcmp(F->contents, f->buffer, f->length) == 0;
+}
+
+/*
+ * check whether a recording applies now, f being the included file as
+ * loaded this time
+ */
+static int can_replay(struct preprocess *pp, struct ppinclude *rec, memoryfile *f)
+{
+    struct incfile *F;
+    struct predef *C, *X;
+    memoryfile *g;
+    int same;
+
+    if (rec->incomment != pp->incomment || !same_file(rec->files, f))
+    {
+        return 0;
+    }
+    for (F = rec->files->next; F; F = F->next)
+    {
+        g = mopen(pp, F->name);
+        if (!g)
+        {
+            return 0;
+        }
+        same = same_file(F, g);
+        mclose(pp, g);
+        if (!same)
+        {
+            return 0;
+        }
+    }
+    for (C = rec->checks; C; C = C->next)
+    {
+        X = find_define(pp, C->name, strlen(C->name));
+        if (X && X->def)
+        {
+            if (!C->def || strcmp(C->def, X->def) != 0)
+            {
+                return 0;
+            }
+        }
+        else if (C->def)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void replay_include(struct preprocess *pp, struct ppinclude *rec)
+{
+    pp_repeat_messages(pp, flexbuf_peek(&rec->messages), flexbuf_curlen(&rec->messages));
+    if (flexbuf_curlen(&rec->output) > 0)
+    {
+        pp_output(pp, flexbuf_peek(&rec->output), flexbuf_curlen(&rec->output));
+    }
+    pp_apply_defines(pp, rec->defines);
+    if (pp->lookups)
+    {
+        flexbuf_addmem(pp->lookups, flexbuf_peek(&rec->lookups), flexbuf_curlen(&rec->lookups));
+    }
+    pp->incomment = rec->endcomment;
+}
+
+/*
+ * start an included file, or replay it
+ */
+static void start_include(struct preprocess *pp, char *name)
+{
+    struct ppinclude *rec;
+    memoryfile *f;
+
+    if (pp->recording)
+    {
+        pp_push_file(pp, name);
+        return;
+    }
+    f = mopen(pp, name);
+    if (!f)
+    {
+        domessage(pp, "error", "Unable to open file %s", name);
+        return;
+    }
+    for (rec = pp->includes; rec; rec = rec->next)
+    {
+        if (!strcmp(rec->name, name) && can_replay(pp, rec, f))
+        {
+            mclose(pp, f);
+            free(name);
+            replay_include(pp, rec);
+            return;
+        }
+    }
+
+    rec = (struct ppinclude *)calloc(1, sizeof(*rec));
+    rec->name = strdup(name);
+    rec->incomment = pp->incomment;
+    rec->state = pp_get_define_state(pp);
+    rec->replayable = true;
+    flexbuf_init(&rec->messages, 256);
+    flexbuf_init(&rec->lookups, 1024);
+    flexbuf_init(&rec->output, 4096);
+    record_load(rec, name, f);
+    pp_push_file_struct(pp, f, name);
+    pp->fil->flags |= FILE_FLAGS_CLOSEFILE;
+    rec->fil = pp->fil;
+    pp->recording = rec;
+}
+
 /*
  * main function
  */
@@ -970,13 +1654,17 @@ void pp_run(struct preprocess *pp)
             if (linelen == 0)
             {
                 /* add a newline so line number errors will be correct */
-                flexbuf_addchar(&pp->whole, '\n');
+                pp_output(pp, "\n", 1);
             }
             else
             {
-                char *line = flexbuf_get(&pp->line);
-                flexbuf_addstr(&pp->whole, line);
-                free(line);
+                pp_output(pp, flexbuf_peek(&pp->expanded), linelen);
+            }
+            if (pp->includename)
+            {
+                char *name = pp->includename;
+                pp->includename = NULL;
+                start_include(pp, name);
             }
         }
         pp_pop_file(pp);
@@ -987,6 +1675,7 @@ char* pp_finish(struct preprocess *pp)
 {
     flexbuf_addchar(&pp->whole, 0);
     flexbuf_delete(&pp->line);
+    flexbuf_delete(&pp->expanded);
     return flexbuf_get(&pp->whole);
 }
 
@@ -1013,46 +1702,129 @@ void* pp_get_define_state(struct preprocess *pp)
 void pp_restore_define_state(struct preprocess *pp, void *vp)
 {
     struct predef *where = (struct predef *)vp;
-    struct predef *x, *old;
 
-    x = pp->defs;
-    while (x && x != where)
+    while (pp->defs && pp->defs != where)
     {
-        old = x;
-        x = old->next;
-        if (old->flags & PREDEF_FLAG_FREEDEFS)
+        remove_newest_define(pp);
+    }
+}
+
+void pp_clear_define_state(struct preprocess *pp)
+{
+    pp_restore_define_state(pp, NULL);
+}
+
+void pp_reset_state(struct preprocess *pp)
+{
+    struct ifstate *I;
+
+    while (pp->ifs)
+    {
+        I = pp->ifs;
+        pp->ifs = I->next;
+        free(I);
+    }
+    free(pp->includename);
+    pp->includename = NULL;
+    pp->incomment = 0;
+    pp->errorfound = false;
+}
+
+/*
+ * describe the define state as a string of "name=value" lines
+ * (or just "name" for an #undef), newest define first
+ */
+char *pp_get_define_state_string(struct preprocess *pp)
+{
+    struct flexbuf state;
+    struct predef *X;
+
+    flexbuf_init(&state, 256);
+    for (X = pp->defs; X; X = X->next)
+    {
+        flexbuf_addstr(&state, X->name);
+        if (X->def)
         {
-            free((void *)old->name);
-            if (old->def)
-            {
-                free((void *)old->def);
-            }
+            flexbuf_addchar(&state, '=');
+            flexbuf_addstr(&state, X->def);
         }
-        free(old);
+        flexbuf_addchar(&state, '\n');
     }
-    pp->defs = x;
+    flexbuf_addchar(&state, 0);
+    return flexbuf_get(&state);
 }
 
-void pp_clear_define_state(struct preprocess *pp)
+/*
+ * copy/apply defines
+ * this may be used to repeat the effect a sub file had on the define
+ * state without preprocessing the sub file again
+ */
+void *pp_copy_defines_since(struct preprocess *pp, void *vp)
+{
+    struct predef *where = (struct predef *)vp;
+    struct predef *x, *the;
+    struct predef *copy = NULL;
+    struct predef **tail = &copy;
+
+    for (x = pp->defs; x && x != where; x = x->next)
+    {
+        the = (struct predef *)calloc(sizeof(*the), 1);
+        the->name = strdup(x->name);
+        the->def = x->def ? strdup(x->def) : NULL;
+        the->flags = PREDEF_FLAG_FREEDEFS;
+        *tail = the;
+        tail = &the->next;
+    }
+    return (void *)copy;
+}
+
+void *pp_duplicate_defines(void *vp)
+{
+    struct predef *x, *the;
+    struct predef *copy = NULL;
+    struct predef **tail = &copy;
+
+    for (x = (struct predef *)vp; x; x = x->next)
+    {
+        the = (struct predef *)calloc(sizeof(*the), 1);
+        the->name = strdup(x->name);
+        the->def = x->def ? strdup(x->def) : NULL;
+        the->flags = PREDEF_FLAG_FREEDEFS;
+        *tail = the;
+        tail = &the->next;
+    }
+    return (void *)copy;
+}
+
+void pp_apply_defines(struct preprocess *pp, void *vp)
+{
+    struct predef *x = (struct predef *)vp;
+
+    if (!x)
+    {
+        return;
+    }
+    /* the copy is newest first, so apply the older defines first */
+    pp_apply_defines(pp, (void *)x->next);
+    pp_define_internal(pp, strdup(x->name), x->def ? strdup(x->def) : NULL, PREDEF_FLAG_FREEDEFS);
+}
+
+void pp_free_defines(void *vp)
 {
     struct predef *x, *old;
 
-    x = pp->defs;
+    x = (struct predef *)vp;
     while (x)
     {
         old = x;
         x = old->next;
-        if (old->flags & PREDEF_FLAG_FREEDEFS)
+        free((void *)old->name);
+        if (old->def)
         {
-            free((void *)old->name);
-            if (old->def)
-            {
-                free((void *)old->def);
-            }
+            free((void *)old->def);
         }
         free(old);
     }
-    pp->defs = 0;
 }
 
 /*
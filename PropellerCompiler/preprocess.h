@@ -7,19 +7,26 @@
 struct predef
 {
     struct predef *next;
+    struct predef *hashnext;    /* the next older define in the same hash bucket */
     const char *name;
     const char *def;
     int  flags;
 };
 #define PREDEF_FLAG_FREEDEFS 0x01  /* if "name" and "def" should be freed */
+#define PREDEF_FLAG_RECORDED 0x02  /* added by the include being recorded */
+
+#define PP_DEFINE_BUCKETS 256   /* defines are indexed by a hash of their name */
+#define PP_DEFINE_FILTER 1024   /* and counted by their first character and length */
 
 
 #define MODE_UNKNOWN 0
 #define MODE_UTF8    1
 #define MODE_UTF16   2
+#define MODE_LATIN1  3
 
 typedef char* (*PreprocessLoadFileFunc)(const char* pFilename, int* pnLength, char** ppFilePath);
 typedef void (*PreprocessFreeFileBufferFunc)(char* buffer);
+typedef void (*PreprocessOutputFunc)(void *data, const char *text, size_t len);
 
 struct memoryfile
 {
@@ -35,11 +42,43 @@ struct filestate
     memoryfile *f;
     const char *name;
     int lineno;
-    int (*readfunc)(memoryfile *f, char *buf);
+    int mode;   /* the encoding, MODE_UNKNOWN until the first line is read */
     int flags;
 };
 #define FILE_FLAGS_CLOSEFILE 0x01
 
+/* a file loaded by an include, to tell whether loading it again gets the same file */
+struct incfile
+{
+    struct incfile *next;
+    char *name;
+    char *path;
+    char *contents;  /* a copy, or NULL if it couldn't be loaded */
+    int length;
+};
+
+/* what preprocessing an #include did, so including the same file again can repeat it instead,
+   as long as the files are the same and the defines it looked up (other than its own) are too */
+struct ppinclude
+{
+    struct ppinclude *next;
+    char *name;                 /* as given to #include */
+    int incomment;              /* the comment nesting it was included at */
+    int endcomment;             /* and left at */
+    struct incfile *files;      /* every file it loaded, itself first */
+    struct predef *checks;      /* the defines it looked up (other than its own), with what they were */
+    void *defines;              /* the defines it added, from pp_copy_defines_since */
+    struct flexbuf messages;    /* each message: level, file name & message strings after the line number */
+    struct flexbuf lookups;     /* the names it looked up, as added to the preprocessor's lookups */
+    struct flexbuf output;
+    /* only used while it is recorded */
+    struct filestate *fil;
+    void *state;                /* the define state it was included at */
+    int ifdepth;                /* #ifdefs it has open */
+    bool replayable;            /* cleared when it does something that can't be repeated */
+};
+#define PP_INCLUDE_VARIANTS 4   /* recordings kept of an include that preprocesses differently */
+
 struct ifstate
 {
     struct ifstate *next;
@@ -54,8 +93,11 @@ struct preprocess
 {
     struct filestate *fil;
     struct flexbuf line;
+    struct flexbuf expanded;    /* the line with its macros expanded */
     struct flexbuf whole;
-    struct predef *defs;
+    struct predef *defs;    /* every define, newest first, so restoring a define state undoes the newer ones */
+    struct predef *defhash[PP_DEFINE_BUCKETS];  /* the newest define in each bucket, older ones by hashnext */
+    int deffilter[PP_DEFINE_FILTER];            /* so most words can be passed over without a lookup */
 
     struct ifstate *ifs;
 
@@ -72,15 +114,41 @@ struct preprocess
     bool alternate; /* flag to enable alternate preprocessor rules -  */
                     /* affects #error handling, macro substitution of */
                     /* symbols that are "defined" but have no value.  */
+    bool errorexit;  /* under the alternate rules, #error exits the program */
+    bool errorfound; /* (set by pp_init), or when cleared sets errorfound */
+
+    /* file loading callbacks */
+    PreprocessLoadFileFunc loadfilefunc;
+    PreprocessFreeFileBufferFunc freefilebufferfunc;
+
+    /* if set, every name looked up in the defines is added to it, one per line */
+    struct flexbuf *lookups;
+    /* if set, every message is added to it too, as a recorded include keeps them (see pp_repeat_messages) */
+    struct flexbuf *messages;
+
+    /* if set, pp_run() passes the text to it as each line is done (with outputdata), instead of
+       collecting it for pp_finish() */
+    PreprocessOutputFunc outputfunc;
+    void *outputdata;
+
+    /* includes recorded so far, newest first, and the one being recorded */
+    struct ppinclude *includes;
+    struct ppinclude *recording;
+    struct predef *checkhash[PP_DEFINE_BUCKETS];  /* the recording's checks, by name */
+    char *includename;  /* an #include to start once its line is done */
 };
 
 #define pp_active(pp) (!((pp)->ifs && (pp)->ifs->skip))
 
-void pp_setFileFunctions(PreprocessLoadFileFunc pLoadFileFunc, PreprocessFreeFileBufferFunc pFreeFileBufferFunc);
-
 /* initialize for reading */
 void pp_init(struct preprocess *pp, bool alternate);
 
+/* free the buffers and recorded includes kept between runs (the defines are freed by pp_clear_define_state) */
+void pp_free(struct preprocess *pp);
+
+/* set the functions used to load files (call after pp_init) */
+void pp_setFileFunctions(struct preprocess *pp, PreprocessLoadFileFunc pLoadFileFunc, PreprocessFreeFileBufferFunc pFreeFileBufferFunc);
+
 /* push an opened FILE struct */
 void pp_push_file_struct(struct preprocess *pp, memoryfile *f, const char *name);
 
@@ -90,6 +158,10 @@ void pp_push_file(struct preprocess *pp, const char *filename);
 /* pop a file (finish processing it) */
 void pp_pop_file(struct preprocess *pp);
 
+/* check whether a file has nothing to preprocess, so running it would only convert it to UTF-8;
+   returns its encoding if so (having taken its effect on the comment nesting), or MODE_UNKNOWN */
+int pp_check_plain(struct preprocess *pp, const char *buffer, int length);
+
 /* set the strings that will be recognized to start line comments and start and end 
    multi-line comments; these nest */
 void pp_setcomments(struct preprocess *pp, const char *line, const char *s, const char *e);
@@ -106,6 +178,29 @@ void pp_restore_define_state(struct preprocess *pp, void *ptr);
 /* clear all the define state */
 void pp_clear_define_state(struct preprocess *pp);
 
+/* forget what running files left behind (the comment nesting, any #if still open, an error found), so the next
+   compile starts as pp_init left it; the defines and recorded includes stay */
+void pp_reset_state(struct preprocess *pp);
+
+/* get a string describing every define currently in effect; two define states
+   with equal strings preprocess identically. the caller must free() the string */
+char *pp_get_define_state_string(struct preprocess *pp);
+
+/* copy the defines added since a previous call to get_define_state */
+void *pp_copy_defines_since(struct preprocess *pp, void *ptr);
+
+/* duplicate defines copied by a previous call to pp_copy_defines_since */
+void *pp_duplicate_defines(void *copy);
+
+/* re-apply defines copied by a previous call to pp_copy_defines_since */
+void pp_apply_defines(struct preprocess *pp, void *copy);
+
+/* free defines copied by pp_copy_defines_since */
+void pp_free_defines(void *copy);
+
+/* pass messages collected in pp->messages to the message function again */
+void pp_repeat_messages(struct preprocess *pp, const char *messages, size_t len);
+
 /* actually perform the preprocessing on all files that have been pushed so far */
 void pp_run(struct preprocess *pp);
 
@@ -9,6 +9,9 @@
 // textconvert.h
 //
 
+#include <string.h>
+#include "textconvert.h"
+
 unsigned int DecodeUtf8(const char* pBuffer, int& nCharSize)
 {
     unsigned int nChar = (unsigned int)((unsigned char)(*pBuffer));
@@ -262,6 +265,167 @@ bool UnicodeToPASCII(char* pBuffer, int nBufferLength, char* pPASCIIBuffer, bool
 }
 
 
+// Translate Latin-1 source to PASCII, giving the same result as UnicodeToPASCII does once the preprocessor
+// has converted the source to UTF-8 (each byte is the Unicode character of the same value)
+void Latin1ToPASCII(const char* pBuffer, int nBufferLength, char* pPASCIIBuffer)
+{
+    int nDestOffset = 0;
+    unsigned char nPrevChar = 0;
+    for (int nSourceOffset = 0; nSourceOffset < nBufferLength; nSourceOffset++)
+    {
+        unsigned char nChar = (unsigned char)pBuffer[nSourceOffset];
+        if (nChar != 0x0A)
+        {
+            pPASCIIBuffer[nDestOffset] = s_aCharTxMap[nChar];
+            nDestOffset++;
+        }
+        else if (nPrevChar != 0x0D)
+        {
+            pPASCIIBuffer[nDestOffset] = 0x0D;
+            nDestOffset++;
+        }
+        nPrevChar = nChar;
+    }
+    pPASCIIBuffer[nDestOffset] = 0;
+}
+
+// the number of bytes DecodeUtf8 reads for a character starting with nChar
+static int Utf8Length(unsigned char nChar)
+{
+    if (nChar >= 192 && nChar <= 223)
+    {
+        return 2;
+    }
+    else if (nChar >= 224 && nChar <= 239)
+    {
+        return 3;
+    }
+    else if (nChar >= 240 && nChar <= 247)
+    {
+        return 4;
+    }
+    else if (nChar >= 248 && nChar <= 251)
+    {
+        return 5;
+    }
+    else if (nChar >= 252 && nChar <= 253)
+    {
+        return 6;
+    }
+    return 1;
+}
+
+PASCIIWriter::PASCIIWriter(int nSize)
+    : m_nLength(0)
+    , m_nSize(nSize > 0 ? nSize + 1 : 1)
+    , m_nPrevChar(0)
+    , m_nPending(0)
+    , m_nSkip(0)
+{
+    m_pBuffer = new char[m_nSize];
+}
+
+PASCIIWriter::~PASCIIWriter()
+{
+    delete [] m_pBuffer;
+}
+
+void PASCIIWriter::Reserve(int nLength)
+{
+    // room for nLength more characters and the terminator
+    if (m_nLength + nLength + 1 > m_nSize)
+    {
+        int nSize = m_nSize * 2;
+        if (nSize < m_nLength + nLength + 1)
+        {
+            nSize = m_nLength + nLength + 1;
+        }
+        char* pBuffer = new char[nSize];
+        memcpy(pBuffer, m_pBuffer, m_nLength);
+        delete [] m_pBuffer;
+        m_pBuffer = pBuffer;
+        m_nSize = nSize;
+    }
+}
+
+inline void PASCIIWriter::AddChar(unsigned short nChar)
+{
+    if (nChar != 0x000A && nChar != 0xFEFF)
+    {
+        m_pBuffer[m_nLength++] = s_aCharTxMap[(nChar | ((nChar >> 5) & ~(nChar >> 4) & 0x0100)) & 0x07FF];
+    }
+    else if (nChar == 0x000A && m_nPrevChar != 0x000D)
+    {
+        m_pBuffer[m_nLength++] = 0x0D;
+    }
+    m_nPrevChar = nChar;
+}
+
+void PASCIIWriter::AddUtf8(const char* pText, int nLength)
+{
+    const char* pEnd = pText + nLength;
+
+    // each byte gives at most one character, and there may be one more from a character already started
+    Reserve(nLength + 1);
+    while (m_nSkip > 0 && pText < pEnd)
+    {
+        pText++;
+        m_nSkip--;
+    }
+    while (m_nPending > 0 && pText < pEnd)
+    {
+        m_pending[m_nPending++] = *pText++;
+        if (m_nPending == Utf8Length((unsigned char)m_pending[0]))
+        {
+            int nCharSize = 2;
+            AddChar((unsigned short)DecodeUtf8(m_pending, nCharSize));
+            m_nPending = 0;
+        }
+    }
+
+    while (pText < pEnd)
+    {
+        if ((unsigned char)*pText < 128)
+        {
+            AddChar((unsigned char)*pText);
+            pText++;
+            continue;
+        }
+        int nBytes = Utf8Length((unsigned char)*pText);
+        if (pEnd - pText < nBytes)
+        {
+            memcpy(m_pending, pText, pEnd - pText);
+            m_nPending = (int)(pEnd - pText);
+            break;
+        }
+        int nCharSize = 2;
+        AddChar((unsigned short)DecodeUtf8(pText, nCharSize));
+        if (pEnd - pText < nCharSize)
+        {
+            m_nSkip = nCharSize - (int)(pEnd - pText);
+            break;
+        }
+        pText += nCharSize;
+    }
+}
+
+char* PASCIIWriter::Finish()
+{
+    if (m_nPending > 0)
+    {
+        // as UnicodeToPASCII reads the terminator after a character cut short by the end of the text
+        memset(&m_pending[m_nPending], 0, sizeof(m_pending) - m_nPending);
+        int nCharSize = 2;
+        Reserve(1);
+        AddChar((unsigned short)DecodeUtf8(m_pending, nCharSize));
+        m_nPending = 0;
+    }
+    m_pBuffer[m_nLength] = 0;
+    char* pBuffer = m_pBuffer;
+    m_pBuffer = 0;
+    return pBuffer;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 //                           TERMS OF USE: MIT License                                   //
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -15,6 +15,36 @@
 unsigned int DecodeUtf8(const char* pBuffer, int& nCharSize);
 void PASCIIToUnicode16(char* pPASCIIBuffer, int nPASCIIBufferLength, unsigned short* pUnicode16Buffer);
 bool UnicodeToPASCII(char* pBuffer, int nBufferLength, char* pPASCIIBuffer, bool bForceUTF8);
+void Latin1ToPASCII(const char* pBuffer, int nBufferLength, char* pPASCIIBuffer);
+
+//
+// Translates UTF-8 text to PASCII a piece at a time, exactly as UnicodeToPASCII (with bForceUTF8) translates
+// all of the pieces put together, so the preprocessor can pass on each line as it is done.  A character can
+// be split between pieces.  The PASCII goes in one buffer, grown by doubling when the size given is too small.
+//
+class PASCIIWriter
+{
+public:
+    PASCIIWriter(int nSize);
+    ~PASCIIWriter();
+
+    void AddUtf8(const char* pText, int nLength);
+
+    // returns the PASCII, terminated, for the caller to delete []
+    char* Finish();
+
+private:
+    void Reserve(int nLength);
+    void AddChar(unsigned short nChar);
+
+    char*           m_pBuffer;
+    int             m_nLength;
+    int             m_nSize;
+    unsigned short  m_nPrevChar;
+    char            m_pending[6];   // the start of a character whose bytes haven't all come yet
+    int             m_nPending;
+    int             m_nSkip;        // bytes still to skip after an invalid byte (which are skipped in pairs)
+};
 
 #endif // _TEXTCONVERT_H_
 
@@ -12,31 +12,210 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <direct.h>
+#define strtok_r strtok_s
+#else
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 #include "../PropellerCompiler/CompileSpin.h"
 #include "../PropellerCompiler/Annotate.h"
 #include "pathentry.h"
 
-#define MAX_FILES           2048
+#define PATH_BLOCK_SIZE     65536
+
+// The paths of the files opened, each one interned once, in blocks that never move (the compiler keeps pointers
+// to them), and listed in the order they were first opened
+static std::vector<char*> s_pathBlocks;
+static int s_nPathBlockUsed = PATH_BLOCK_SIZE;
+static std::vector<const char*> s_pathSlots;        // open addressing table of the paths
+static std::vector<const char*> s_filesAccessed;
+static std::mutex s_loadFileMutex;   // files are loaded by several threads when compiling with -j
+static bool s_bListDependencies = false;
+static std::vector<const char*> s_dependencies;     // the files loaded for the image being compiled, in the order first loaded
+static std::set<const char*> s_dependencySet;
+#ifndef WIN32
+static std::map<char*, size_t> s_mappedFiles;  // buffers LoadFile mapped instead of reading, and their sizes
+
+// The compiler reads the buffer in place and may look a few bytes past the end of the file (which the buffer
+// LoadFile reads ends with a 0 for), so a file is only mapped when the rest of its last page is at least that
+// much zero fill.  Returns 0 for files that have to be read.
+static char* MapFile(FILE* pFile, int nLength)
+{
+    const int nZeroFill = 8;
+    long nPageSize = sysconf(_SC_PAGESIZE);
+    if (nPageSize <= 0 || (nLength % nPageSize) == 0 || (nPageSize - (nLength % nPageSize)) < nZeroFill)
+    {
+        return 0;
+    }
+    void* pMapping = mmap(0, nLength, PROT_READ, MAP_PRIVATE, fileno(pFile), 0);
+    if (pMapping == MAP_FAILED)
+    {
+        return 0;
+    }
+    s_mappedFiles[(char*)pMapping] = (size_t)nLength;
+    return (char*)pMapping;
+}
+
+// --server keeps one context for its requests, with the objects compiled for earlier ones, as long as they are
+// compiled the same way
+static bool s_bServer = false;
+static bool s_bStampFiles = false;      // set for --server and --watch
+static CompilerContext* s_pServerContext = 0;
+static CompilerConfig s_serverConfig;
+static std::string s_serverCacheDir;
+static std::string s_serverPathKey;     // the directory and -I paths the include path was made for
+static std::map<const char*, struct stat> s_fileStamps;    // the files loaded, as they were when first loaded
+static int s_nServerConnection = -1;    // the --connect client being served, which is sent what the request prints
+                                        // and the files it writes, for the client to print and write (see ServeRequest)
+static bool s_bClientGone = false;      // set when the client stops taking the reply
+static std::string s_serverListFile;    // where the client writes the listing of the request, if anywhere
+
+static bool SameFileStamp(const struct stat& stamp1, const struct stat& stamp2)
+{
+#ifdef __APPLE__
+    long nsec1 = stamp1.st_mtimespec.tv_nsec;
+    long nsec2 = stamp2.st_mtimespec.tv_nsec;
+#else
+    long nsec1 = stamp1.st_mtim.tv_nsec;
+    long nsec2 = stamp2.st_mtim.tv_nsec;
+#endif
+    return stamp1.st_dev == stamp2.st_dev && stamp1.st_ino == stamp2.st_ino && stamp1.st_size == stamp2.st_size &&
+           stamp1.st_mtime == stamp2.st_mtime && nsec1 == nsec2;
+}
+#endif
+
+#ifndef WIN32
+// Sends a record of the reply to the client being served: its kind ('p' for text printed to stdout, 'e' for text
+// printed to stderr, 'f' for a file, as its name and a 0 before the contents, 's' for the exit status), the length
+// of the data (4 bytes, most significant first) and the data
+static void SendReplyRecord(char kind, const char* pData, size_t nLength, const char* pData2 = 0, size_t nLength2 = 0)
+{
+    if (s_bClientGone)
+    {
+        return;
+    }
+    size_t nTotal = nLength + nLength2;
+    unsigned char header[5] = { (unsigned char)kind, (unsigned char)(nTotal >> 24), (unsigned char)(nTotal >> 16),
+                                (unsigned char)(nTotal >> 8), (unsigned char)nTotal };
+    const char* pieces[3] = { (const char*)header, pData, pData2 };
+    size_t lengths[3] = { sizeof(header), nLength, nLength2 };
+    for (int i = 0; i < 3; i++)
+    {
+        for (size_t nSent = 0; nSent < lengths[i]; )
+        {
+            ssize_t nWritten = write(s_nServerConnection, pieces[i] + nSent, lengths[i] - nSent);
+            if (nWritten <= 0)
+            {
+                // the client has gone (or stopped reading), the request is finished anyway
+                s_bClientGone = true;
+                return;
+            }
+            nSent += nWritten;
+        }
+    }
+}
+
+// the compiler's PrintFunc for the server, sending everything to the client, and the listing as a file when it
+// goes to one
+static void PrintToClient(void* pUserData, CompilerOutputKind eKind, const char* pText)
+{
+    if (eKind == coListing && !s_serverListFile.empty())
+    {
+        SendReplyRecord('f', s_serverListFile.c_str(), s_serverListFile.size() + 1, pText, strlen(pText));
+    }
+    else if (eKind == coPreprocessor)
+    {
+        SendReplyRecord('e', pText, strlen(pText));
+    }
+    else
+    {
+        SendReplyRecord('p', pText, strlen(pText));
+    }
+}
+#endif
+
+// prints to the stream given, or to the client being served
+static void PrintTo(FILE* pStream, const char* pFormat, ...)
+{
+    va_list args;
+    va_start(args, pFormat);
+#ifndef WIN32
+    if (s_nServerConnection != -1)
+    {
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        int nLength = vsnprintf(NULL, 0, pFormat, argsCopy);
+        va_end(argsCopy);
+        std::vector<char> text(nLength + 1);
+        vsnprintf(&text[0], text.size(), pFormat, args);
+        SendReplyRecord(pStream == stderr ? 'e' : 'p', &text[0], nLength);
+        va_end(args);
+        return;
+    }
+#endif
+    vfprintf(pStream, pFormat, args);
+    va_end(args);
+}
 
-static int  s_nFilesAccessed = 0;
-static char s_filesAccessed[MAX_FILES][PATH_MAX];
+// a name the server opens itself (rather than through the include path) relative to the directory of the client
+static std::string ClientPath(const char* pName)
+{
+    const char* pBaseDirectory = GetBaseDirectory();
+    if (pBaseDirectory == NULL || pName[0] == DIR_SEP)
+    {
+        return pName;
+    }
+    return std::string(pBaseDirectory) + DIR_SEP_STR + pName;
+}
 
+// the path of a file the server loaded as the client named it, when it was found relative to the client's directory
+static const char* ClientRelativePath(const char* pPath)
+{
+    const char* pBaseDirectory = GetBaseDirectory();
+    if (pBaseDirectory != NULL)
+    {
+        size_t nBaseLength = strlen(pBaseDirectory);
+        if (strncmp(pPath, pBaseDirectory, nBaseLength) == 0 && pPath[nBaseLength] == DIR_SEP)
+        {
+            return pPath + nBaseLength + 1;
+        }
+    }
+    return pPath;
+}
 
 static void Banner(void)
 {
-    fprintf(stdout, "Propeller Spin/PASM Compiler \'OpenSpin\' (c)2012-2018 Parallax Inc. DBA Parallax Semiconductor.\n");
-    fprintf(stdout, "Fork by Memotech Bill to add \"Annotated Listing\" of generated binary.\n");
-    fprintf(stdout, "https://github.com/Memotech-Bill/OpenSpin\n");
-    fprintf(stdout, "Version 1.01.04 Compiled on %s %s\n",__DATE__, __TIME__);
+    PrintTo(stdout, "Propeller Spin/PASM Compiler \'OpenSpin\' (c)2012-2018 Parallax Inc. DBA Parallax Semiconductor.\n");
+    PrintTo(stdout, "Fork by Memotech Bill to add \"Annotated Listing\" of generated binary.\n");
+    PrintTo(stdout, "https://github.com/Memotech-Bill/OpenSpin\n");
+    PrintTo(stdout, "Version 1.01.04 Compiled on %s %s\n",__DATE__, __TIME__);
 }
 
 /* Usage - display a usage message and exit */
 static void Usage(void)
 {
     Banner();
-    fprintf(stderr, "\
+    PrintTo(stderr, "\
 usage: openspin\n\
          [ -h ]                 display this help\n\
          [ -L or -I <path> ]    add a directory to the include path\n\
@@ -47,6 +226,7 @@ usage: openspin\n\
          [ -d ]                 dump out doc mode\n\
          [ -t ]                 output just the object file tree\n\
          [ -f ]                 output a list of filenames for use in archiving\n\
+                                (-t and -f only scan the objects, so can't be used with -s or -l)\n\
          [ -lc ]                Annotated Listing of binary to console\n\
          [ -lf <list_file> ]    Annotated Listing of binary to named file\n\
          [ -lo ]                Annotated Listing of binary to <output>.lst\n\
@@ -56,62 +236,116 @@ usage: openspin\n\
          [ -a ]                 use alternative preprocessor rules\n\
          [ -D <define> ]        add a define\n\
          [ -M <size> ]          size of eeprom (up to 16777216 bytes)\n\
+         [ -MD ]                also write a make dependency file, <output> with a .d extension\n\
+         [ -MF <file> ]         write the make dependency file to this file (implies -MD)\n\
          [ -s ]                 dump PUB & CON symbol information for top object\n\
          [ -u ]                 enable unused method elimination\n\
-         <name.spin>            spin file to compile\n\
+         [ -j <threads> ]       compile sub-objects in parallel on this many threads\n\
+         [ --cache-dir <path> ] keep compiled sub-objects in this directory for later compiles\n\
+         [ --batch <manifest> ] also compile the files listed in the manifest, one per line as\n\
+                                <name.spin> [ -o <output> ] [ -D <define> ]...\n\
+         [ --watch ]            compile again whenever a file it loaded changes, reusing the\n\
+                                objects the change doesn't affect\n\
+         [ --config <name>=[<define>[,<define>]...] ]\n\
+                                compile for each configuration given, to <output>.<name>.binary\n\
+                                (objects not looking up any of its defines are compiled once)\n\
+         <name.spin>            spin file to compile (several are compiled in turn, sharing\n\
+                                their sub-objects, but without -o, -t, -f, -s or listings)\n\
+\n\
+       openspin --connect <socket> <options and spin files as above>\n\
+                                compile with the server on the socket (or without one, if\n\
+                                there is none)\n\
+       openspin --server <socket>\n\
+                                compile for clients until killed, keeping the objects compiled\n\
+                                for later requests until the files they loaded change\n\
 \n");
 }
 
-FILE* OpenFileInPath(const char *name, const char *mode)
+static unsigned int HashPath(const char* pPath)
 {
-    const char* pTryPath = NULL;
+    unsigned int hash = 2166136261u;
+    for (; *pPath != 0; pPath++)
+    {
+        hash = (hash ^ (unsigned char)*pPath) * 16777619u;
+    }
+    return hash;
+}
 
-    FILE* file = fopen(name, mode);
-    if (!file)
+static const char* InternPath(const char* pPath)
+{
+    if (s_pathSlots.size() < (s_filesAccessed.size() + 1) * 2)
     {
-        PathEntry* entry = NULL;
-        while(!file)
+        std::vector<const char*> slots(s_pathSlots.size() ? s_pathSlots.size() * 2 : 256, (const char*)0);
+        for (size_t i = 0; i < s_filesAccessed.size(); i++)
         {
-            pTryPath = MakeNextPath(&entry, name);
-            if (pTryPath)
+            size_t slot = HashPath(s_filesAccessed[i]) & (slots.size() - 1);
+            while (slots[slot] != 0)
             {
-                file = fopen(pTryPath, mode);
-                if (file != NULL)
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
+                slot = (slot + 1) & (slots.size() - 1);
             }
+            slots[slot] = s_filesAccessed[i];
         }
+        s_pathSlots.swap(slots);
     }
 
-    if (s_nFilesAccessed < MAX_FILES)
+    size_t slot = HashPath(pPath) & (s_pathSlots.size() - 1);
+    while (s_pathSlots[slot] != 0)
     {
-        if (!pTryPath)
+        if (strcmp(s_pathSlots[slot], pPath) == 0)
         {
+            return s_pathSlots[slot];
+        }
+        slot = (slot + 1) & (s_pathSlots.size() - 1);
+    }
+
+    int nLength = (int)strlen(pPath) + 1;
+    if (s_nPathBlockUsed + nLength > PATH_BLOCK_SIZE)
+    {
+        s_pathBlocks.push_back(new char[nLength > PATH_BLOCK_SIZE ? nLength : PATH_BLOCK_SIZE]);
+        s_nPathBlockUsed = 0;
+    }
+    char* pInterned = &s_pathBlocks.back()[s_nPathBlockUsed];
+    s_nPathBlockUsed += nLength;
+    memcpy(pInterned, pPath, nLength);
+    s_pathSlots[slot] = pInterned;
+    s_filesAccessed.push_back(pInterned);
+    return pInterned;
+}
+
+static void CleanupFilesAccessed()
+{
+    for (size_t i = 0; i < s_pathBlocks.size(); i++)
+    {
+        delete [] s_pathBlocks[i];
+    }
+    s_pathBlocks.clear();
+    s_nPathBlockUsed = PATH_BLOCK_SIZE;
+    s_pathSlots.clear();
+    s_filesAccessed.clear();
+}
+
+// opens a file, recording the full path it was opened with (or the name given, if it couldn't be)
+FILE* OpenFileInPath(const char *name, const char *mode, const char **ppFilePath)
+{
+    const char* pTryPath = NULL;
+    FILE* file = FindFileInPath(name, mode, &pTryPath);
+
+    if (!pTryPath)
+    {
+        char fullPath[PATH_MAX];
 #ifdef WIN32
-            if (_fullpath(s_filesAccessed[s_nFilesAccessed], name, PATH_MAX) == NULL)
+        if (_fullpath(fullPath, name, PATH_MAX) == NULL)
 #else
-            if (realpath(name, s_filesAccessed[s_nFilesAccessed]) == NULL)
+        if (realpath(name, fullPath) == NULL)
 #endif
-            {
-                strcpy(s_filesAccessed[s_nFilesAccessed], name);
-            }
-            s_nFilesAccessed++;
-        }
-        else
         {
-            strcpy(s_filesAccessed[s_nFilesAccessed++], pTryPath);
+            strcpy(fullPath, name);
         }
+        *ppFilePath = InternPath(fullPath);
     }
     else
     {
-        // should never hit this, but just in case
-        printf("Too many files!\n");
-        exit(-2);
+        *ppFilePath = InternPath(pTryPath);
     }
 
     return file;
@@ -120,15 +354,25 @@ FILE* OpenFileInPath(const char *name, const char *mode)
 // returns NULL if the file failed to open or is 0 length
 char* LoadFile(const char* pFilename, int* pnLength, char** ppFilePath)
 {
+    std::lock_guard<std::mutex> lock(s_loadFileMutex);
     char* pBuffer = 0;
-    FILE* pFile = OpenFileInPath(pFilename, "rb");
+    const char* pFilePath = 0;
+    FILE* pFile = OpenFileInPath(pFilename, "rb", &pFilePath);
     if (pFile != NULL)
     {
         // get the length of the file by seeking to the end and using ftell
         fseek(pFile, 0, SEEK_END);
         *pnLength = ftell(pFile);
 
-        if (*pnLength > 0)
+#ifndef WIN32
+        // mapped read-only, the compiler reads it where it is; but --server and --watch compile while the files
+        // are being edited, and a mapped file that is truncated or rewritten then raises SIGBUS, so they read it
+        if (*pnLength > 0 && !s_bStampFiles)
+        {
+            pBuffer = MapFile(pFile, *pnLength);
+        }
+#endif
+        if (*pnLength > 0 && pBuffer == 0)
         {
             pBuffer = (char*)malloc(*pnLength+1); // allocate a buffer that is the size of the file plus one char
             pBuffer[*pnLength] = 0; // set the end of the buffer to 0 (null)
@@ -138,9 +382,20 @@ char* LoadFile(const char* pFilename, int* pnLength, char** ppFilePath)
             fread(pBuffer, 1, *pnLength, pFile);
         }
 
+#ifndef WIN32
+        struct stat stamp;
+        if (s_bStampFiles && s_fileStamps.find(pFilePath) == s_fileStamps.end() && fstat(fileno(pFile), &stamp) == 0)
+        {
+            s_fileStamps[pFilePath] = stamp;
+        }
+#endif
+        if (s_bListDependencies && s_dependencySet.insert(pFilePath).second)
+        {
+            s_dependencies.push_back(pFilePath);
+        }
         fclose(pFile);
 
-        *ppFilePath = &(s_filesAccessed[s_nFilesAccessed-1][0]);
+        *ppFilePath = (char*)pFilePath;
     }
     else
     {
@@ -154,22 +409,503 @@ void FreeFileBuffer(char* pBuffer)
 {
     if (pBuffer != 0)
     {
+#ifndef WIN32
+        std::lock_guard<std::mutex> lock(s_loadFileMutex);
+        std::map<char*, size_t>::iterator it = s_mappedFiles.find(pBuffer);
+        if (it != s_mappedFiles.end())
+        {
+            munmap(pBuffer, it->second);
+            s_mappedFiles.erase(it);
+            return;
+        }
+#endif
         free(pBuffer);
     }
 }
 
-int main(int argc, char* argv[])
+// a top file to compile, one of several in batch mode
+struct BatchImage
+{
+    std::string input;
+    std::string output;                 // the name made from the input's when empty
+    std::vector<std::string> defines;   // in addition to the ones on the command line
+    std::string dependencyFile;         // make dependency file to write for it, if any
+};
+
+// Reads a batch manifest, skipping blank lines and ones starting with #
+static bool ReadManifest(const char* pManifest, bool bUsePreprocessor, std::vector<BatchImage>& images)
+{
+    FILE* pFile = fopen(ClientPath(pManifest).c_str(), "r");
+    if (pFile == NULL)
+    {
+        PrintTo(stdout, "ERROR: can not open manifest %s\n", pManifest);
+        return false;
+    }
+
+    char line[4096];
+    int lineNumber = 0;
+    bool bResult = true;
+    while (bResult && fgets(line, sizeof(line), pFile))
+    {
+        lineNumber++;
+        BatchImage image;
+        const char* pError = NULL;
+        char* pSaved = NULL;
+        if (line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
+        for (char* pToken = strtok_r(line, " \t\r\n", &pSaved); pToken && !pError; pToken = strtok_r(NULL, " \t\r\n", &pSaved))
+        {
+            if (pToken[0] == '-' && (pToken[1] == 'o' || pToken[1] == 'D'))
+            {
+                const char* pValue = pToken[2] ? &pToken[2] : strtok_r(NULL, " \t\r\n", &pSaved);
+                if (!pValue)
+                {
+                    pError = "missing option value";
+                }
+                else if (pToken[1] == 'o')
+                {
+                    image.output = pValue;
+                }
+                else if (!bUsePreprocessor)
+                {
+                    pError = "-D needs the preprocessor";
+                }
+                else
+                {
+                    image.defines.push_back(pValue);
+                }
+            }
+            else if (pToken[0] == '-' || !image.input.empty())
+            {
+                pError = "unexpected argument";
+            }
+            else
+            {
+                image.input = pToken;
+            }
+        }
+        if (!pError && image.input.empty() && (!image.output.empty() || !image.defines.empty()))
+        {
+            pError = "no spin file given";
+        }
+        if (pError)
+        {
+            PrintTo(stdout, "%s(%d) : error : %s\n", pManifest, lineNumber, pError);
+            bResult = false;
+        }
+        else if (!image.input.empty())
+        {
+            images.push_back(image);
+        }
+    }
+
+    fclose(pFile);
+    return bResult;
+}
+
+// a set of defines to compile for, in addition to the ones on the command line
+struct BuildConfig
+{
+    std::string name;
+    std::vector<std::string> defines;
+};
+
+// Parses a --config argument, <name>=<define>,<define>...
+static bool ParseConfig(const char* pArg, BuildConfig& config)
+{
+    const char* pEquals = strchr(pArg, '=');
+    if (!pEquals || pEquals == pArg)
+    {
+        return false;
+    }
+    config.name.assign(pArg, pEquals - pArg);
+    for (const char* pDefine = pEquals + 1; *pDefine; )
+    {
+        const char* pEnd = strchr(pDefine, ',');
+        if (!pEnd)
+        {
+            pEnd = pDefine + strlen(pDefine);
+        }
+        if (pEnd > pDefine)
+        {
+            config.defines.push_back(std::string(pDefine, pEnd - pDefine));
+        }
+        pDefine = *pEnd ? pEnd + 1 : pEnd;
+    }
+    return true;
+}
+
+// puts the configuration name before the extension of an output filename
+static std::string AddConfigName(const std::string& output, const std::string& name)
+{
+    size_t nameStart = output.rfind(DIR_SEP);
+    size_t extension = output.rfind('.');
+    if (extension == std::string::npos || (nameStart != std::string::npos && extension < nameStart))
+    {
+        return output + "." + name;
+    }
+    return output.substr(0, extension) + "." + name + output.substr(extension);
+}
+
+// replaces the extension of an output filename (or adds one)
+static std::string ReplaceExtension(const std::string& output, const char* pExtension)
+{
+    size_t nameStart = output.rfind(DIR_SEP);
+    size_t extension = output.rfind('.');
+    if (extension == std::string::npos || (nameStart != std::string::npos && extension < nameStart))
+    {
+        return output + pExtension;
+    }
+    return output.substr(0, extension) + pExtension;
+}
+
+// adds a filename the way make reads it in a rule
+static void AddMakeFilename(std::string& rules, const char* pFilename)
+{
+    for (const char* pChar = pFilename; *pChar != 0; pChar++)
+    {
+        if (*pChar == ' ' || *pChar == '#')
+        {
+            rules += '\\';
+        }
+        else if (*pChar == '$')
+        {
+            rules += '$';
+        }
+        rules += *pChar;
+    }
+}
+
+// Writes an output file, or has the client being served write it.  It is written to a temporary file renamed
+// over the output when bReplace is set, so that whatever loads the output never sees part of one.
+static bool WriteOutputFile(const std::string& output, const void* pData, size_t nLength, bool bReplace)
+{
+#ifndef WIN32
+    if (s_nServerConnection != -1)
+    {
+        SendReplyRecord('f', output.c_str(), output.size() + 1, (const char*)pData, nLength);
+        return true;
+    }
+#endif
+    std::string filename = bReplace ? output + ".tmp" : output;
+    FILE* pFile = fopen(filename.c_str(), "wb");
+    if (pFile == NULL)
+    {
+        return false;
+    }
+    bool bWritten = fwrite(pData, 1, nLength, pFile) == nLength;
+    bWritten = (fclose(pFile) == 0) && bWritten;
+    if (bReplace && (!bWritten || rename(filename.c_str(), output.c_str()) != 0))
+    {
+        remove(filename.c_str());
+        return false;
+    }
+    return bWritten;
+}
+
+// Writes the make dependency file of an image compiled: its output depends on every file loaded for it, and each
+// of those but the spin file itself has a rule of its own, so that make carries on when one is removed
+static void WriteDependencyFile(CompilerContext* pContext, const CompilerConfig& compilerConfig, const BatchImage& image)
+{
+    // objects kept from earlier compiles weren't loaded again
+    std::vector<const char*> files = s_dependencies;
+    if (compilerConfig.bKeepObjects)
+    {
+        char* pFilesLoaded = GetFilesLoaded(pContext);
+        char* pSaved = NULL;
+        for (char* pLine = strtok_r(pFilesLoaded, "\n", &pSaved); pLine != NULL; pLine = strtok_r(NULL, "\n", &pSaved))
+        {
+            const char* pFilePath = InternPath(pLine);
+            if (s_dependencySet.insert(pFilePath).second)
+            {
+                files.push_back(pFilePath);
+            }
+        }
+        free(pFilesLoaded);
+    }
+
+    std::string rules;
+    AddMakeFilename(rules, image.output.c_str());
+    rules += ':';
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        rules += " \\\n  ";
+        AddMakeFilename(rules, ClientRelativePath(files[i]));
+    }
+    rules += '\n';
+    for (size_t i = 1; i < files.size(); i++)
+    {
+        rules += '\n';
+        AddMakeFilename(rules, ClientRelativePath(files[i]));
+        rules += ":\n";
+    }
+    if (!WriteOutputFile(image.dependencyFile, rules.data(), rules.size(), false))
+    {
+        PrintTo(stdout, "ERROR: can not write dependency file %s\n", image.dependencyFile.c_str());
+    }
+}
+
+// makes the *.binary (or .eeprom or .dat) filename from the spin filename
+static bool MakeOutputFilename(const std::string& input, const CompilerConfig& compilerConfig, std::string& output)
+{
+    size_t offset = input.find(".spin");
+    if (offset == std::string::npos)
+    {
+        PrintTo(stdout, "ERROR: spinfile must have .spin extension. You passed in: %s\n", input.c_str());
+        return false;
+    }
+    output = input.substr(0, offset + 1);
+    if (compilerConfig.bDATonly)
+    {
+        output += "dat";
+    }
+    else if (compilerConfig.bBinary)
+    {
+        output += "binary";
+    }
+    else
+    {
+        output += "eeprom";
+    }
+    return true;
+}
+
+#ifndef WIN32
+static bool SameCompilerConfig(const CompilerConfig& config1, const CompilerConfig& config2)
+{
+    return config1.bVerbose == config2.bVerbose && config1.bQuiet == config2.bQuiet &&
+           config1.bFileTreeOutputOnly == config2.bFileTreeOutputOnly && config1.bFileListOutputOnly == config2.bFileListOutputOnly &&
+           config1.bDumpSymbols == config2.bDumpSymbols && config1.bUsePreprocessor == config2.bUsePreprocessor &&
+           config1.bAlternatePreprocessorMode == config2.bAlternatePreprocessorMode &&
+           config1.bUnusedMethodElimination == config2.bUnusedMethodElimination && config1.bDocMode == config2.bDocMode &&
+           config1.bDATonly == config2.bDATonly && config1.bBinary == config2.bBinary && config1.eeprom_size == config2.eeprom_size &&
+           config1.nThreads == config2.nThreads && config1.bKeepObjects == config2.bKeepObjects &&
+           strcmp(config1.pCacheDir ? config1.pCacheDir : "", config2.pCacheDir ? config2.pCacheDir : "") == 0;
+}
+
+// Forgets the kept objects that loaded a file which has changed since, or all of them if a name now finds another
+// file, returning true if anything changed
+static bool ForgetChangedObjects(CompilerContext* pContext)
+{
+    if (RecheckResolvedNames())
+    {
+        ForgetKeptObjects(pContext);
+        s_fileStamps.clear();
+        return true;
+    }
+    bool bChanged = false;
+    std::map<const char*, struct stat>::iterator it = s_fileStamps.begin();
+    while (it != s_fileStamps.end())
+    {
+        struct stat stamp;
+        if (stat(it->first, &stamp) != 0 || !SameFileStamp(it->second, stamp))
+        {
+            ForgetKeptObjectsUsing(pContext, it->first);
+            s_fileStamps.erase(it++);
+            bChanged = true;
+        }
+        else
+        {
+            it++;
+        }
+    }
+    return bChanged;
+}
+
+// Returns the server's context for a request, made again if the request is compiled another way, with the
+// include path set and the kept objects that may be out of date forgotten
+static CompilerContext* GetServerContext(CompilerConfig& compilerConfig, const std::vector<const char*>& includePaths)
+{
+    compilerConfig.bKeepObjects = true;
+    if (s_pServerContext == 0 || !SameCompilerConfig(compilerConfig, s_serverConfig))
+    {
+        if (s_pServerContext != 0)
+        {
+            ShutdownCompiler(s_pServerContext);
+        }
+        // the request's arguments are gone by the next one
+        s_serverCacheDir = compilerConfig.pCacheDir ? compilerConfig.pCacheDir : "";
+        s_serverConfig = compilerConfig;
+        s_serverConfig.pCacheDir = compilerConfig.pCacheDir ? s_serverCacheDir.c_str() : 0;
+        s_pServerContext = InitCompiler(&s_serverConfig, LoadFile, FreeFileBuffer);
+        // what the compiler prints goes to the client, and an #error fails the request rather than the server
+        SetCompilerOutput(s_pServerContext, PrintToClient, 0, 0);
+        s_fileStamps.clear();
+    }
+
+    std::string pathKey = GetBaseDirectory() ? GetBaseDirectory() : "";
+    for (size_t i = 0; i < includePaths.size(); i++)
+    {
+        pathKey += '\n';
+        pathKey += includePaths[i];
+    }
+    if (pathKey != s_serverPathKey)
+    {
+        CleanupPathEntries();
+        for (size_t i = 0; i < includePaths.size(); i++)
+        {
+            AddPath(includePaths[i]);
+        }
+        s_serverPathKey = pathKey;
+        ForgetKeptObjects(s_pServerContext);
+        s_fileStamps.clear();
+    }
+    else
+    {
+        ForgetChangedObjects(s_pServerContext);
+    }
+    return s_pServerContext;
+}
+#endif
+
+#ifdef __linux__
+// Waits for a file the compile loaded to change, or for a name it looked for to be found somewhere else,
+// forgetting the kept objects that are out of date.  Returns false if it can't watch the files.
+static bool WaitForChanges(CompilerContext* pContext)
+{
+    for (;;)
+    {
+        int watcher = inotify_init1(IN_CLOEXEC);
+        if (watcher == -1)
+        {
+            printf("ERROR: can not watch for changes\n");
+            return false;
+        }
+
+        // the directories names are looked for in, and the ones the files loaded are in
+        std::set<std::string> dirs;
+        dirs.insert(".");
+        for (const PathEntry* entry = GetPathEntries(); entry != NULL; entry = entry->next)
+        {
+            dirs.insert(entry->path);
+        }
+        for (std::map<const char*, struct stat>::iterator it = s_fileStamps.begin(); it != s_fileStamps.end(); it++)
+        {
+            const char* pEnd = strrchr(it->first, DIR_SEP);
+            dirs.insert(pEnd == NULL ? std::string(".") : std::string(it->first, pEnd == it->first ? 1 : pEnd - it->first));
+        }
+        for (std::set<std::string>::iterator it = dirs.begin(); it != dirs.end(); it++)
+        {
+            inotify_add_watch(watcher, it->c_str(), IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+        }
+
+        // anything changed before the watches were added is found here, and the events of the output files
+        // being written (or of files nothing loaded) don't count
+        if (ForgetChangedObjects(pContext))
+        {
+            close(watcher);
+            return true;
+        }
+
+        // an editor saving a file may change it several times, so the events are taken until they stop
+        char events[4096];
+        bool bEvents = read(watcher, events, sizeof(events)) > 0;
+        struct pollfd pollWatcher;
+        pollWatcher.fd = watcher;
+        pollWatcher.events = POLLIN;
+        while (bEvents && poll(&pollWatcher, 1, 100) > 0 && read(watcher, events, sizeof(events)) > 0)
+        {
+        }
+        close(watcher);
+        if (!bEvents)
+        {
+            printf("ERROR: can not watch for changes\n");
+            return false;
+        }
+    }
+}
+#endif
+
+// Compiles each image in turn, returning false if any of them failed
+static bool CompileImages(CompilerContext* pContext, const CompilerConfig& compilerConfig, const std::vector<BatchImage>& images,
+                          const std::vector<std::string>& defines, bool bReplaceOutput)
+{
+    bool bFailed = false;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        char* infile = (char*)images[i].input.c_str();
+
+        // finish the include path, objects kept from before may be found elsewhere if it changed
+        if (SetFilePath(infile))
+        {
+            ForgetKeptObjects(pContext);
+        }
+
+        if (!compilerConfig.bQuiet)
+        {
+            PrintTo(stdout, "Compiling...\n%s\n", infile);
+        }
+
+        if (compilerConfig.bUsePreprocessor)
+        {
+            ClearDefines(pContext);
+
+            // add any predefined symbols here - note that when using the
+            // "alternate" rules, these symbols have a null value - i.e.
+            // they are just "defined", but are not used in macro substitution
+            for (size_t j = 0; j < defines.size(); j++)
+            {
+                SetDefine(pContext, defines[j].c_str(), (compilerConfig.bAlternatePreprocessorMode ? "" : "1"));
+            }
+            for (size_t j = 0; j < images[i].defines.size(); j++)
+            {
+                SetDefine(pContext, images[i].defines[j].c_str(), (compilerConfig.bAlternatePreprocessorMode ? "" : "1"));
+            }
+
+            // add symbols with predefined values here
+            SetDefine(pContext, "__SPIN__", "1");
+            SetDefine(pContext, "__TARGET__", "P1");
+        }
+
+        if (!images[i].dependencyFile.empty())
+        {
+            std::lock_guard<std::mutex> lock(s_loadFileMutex);
+            s_bListDependencies = true;
+            s_dependencies.clear();
+            s_dependencySet.clear();
+        }
+
+        int nLength = 0;
+        unsigned char* pBuffer = CompileSpin(pContext, infile, &nLength);
+        s_bListDependencies = false;
+
+        if (pBuffer == 0)
+        {
+            // compiler put out an error, the other files are still compiled
+            bFailed = true;
+        }
+        else if (!compilerConfig.bFileTreeOutputOnly && !compilerConfig.bFileListOutputOnly && !compilerConfig.bDumpSymbols)
+        {
+            WriteOutputFile(images[i].output, pBuffer, nLength, bReplaceOutput);
+            if (!images[i].dependencyFile.empty())
+            {
+                WriteDependencyFile(pContext, compilerConfig, images[i]);
+            }
+        }
+    }
+    return !bFailed;
+}
+
+static int RunOpenSpin(int argc, char* argv[])
 {
     CompilerConfig compilerConfig;
 
-    char* infile = NULL;
+    std::vector<const char*> includePaths;
+    std::vector<BatchImage> images;
+    std::vector<std::string> defines;
+    std::vector<BuildConfig> configs;
+    const char* pManifest = NULL;
+    bool bWatch = false;
+    bool bDependencies = false;
+    const char* pDependencyFile = NULL;
     char* outfile = NULL;
     char* p = NULL;
-    s_nFilesAccessed = 0;
     AL_Mode mode = amNone;
     const char *psList = NULL;
 
-    // go through the command line arguments, skipping over any -D
+    // go through the command line arguments
     for(int i = 1; i < argc; i++)
     {
         // handle switches
@@ -190,13 +926,57 @@ int main(int argc, char* argv[])
                 else
                 {
                     Usage();
-                    CleanupPathEntries();
                     return 1;
                 }
-                AddPath(p);
+                includePaths.push_back(p);
+                break;
+
+            case 'M':
+                if (strcmp(argv[i], "-MD") == 0)
+                {
+                    bDependencies = true;
+                    break;
+                }
+                if (argv[i][2] == 'F')
+                {
+                    if (argv[i][3])
+                    {
+                        pDependencyFile = &argv[i][3];
+                    }
+                    else if(++i < argc)
+                    {
+                        pDependencyFile = argv[i];
+                    }
+                    else
+                    {
+                        Usage();
+                        return 1;
+                    }
+                    bDependencies = true;
+                    break;
+                }
+                if (argv[i][2])
+                {
+                    p = &argv[i][2];
+                }
+                else if(++i < argc)
+                {
+                    p = argv[i];
+                }
+                else
+                {
+                    Usage();
+                    return 1;
+                }
+                sscanf(p, "%d", &(compilerConfig.eeprom_size));
+                if (compilerConfig.eeprom_size > 16777216)
+                {
+                    Usage();
+                    return 1;
+                }
                 break;
 
-            case 'M':
+            case 'j':
                 if (argv[i][2])
                 {
                     p = &argv[i][2];
@@ -208,14 +988,12 @@ int main(int argc, char* argv[])
                 else
                 {
                     Usage();
-                    CleanupPathEntries();
                     return 1;
                 }
-                sscanf(p, "%d", &(compilerConfig.eeprom_size));
-                if (compilerConfig.eeprom_size > 16777216)
+                sscanf(p, "%d", &(compilerConfig.nThreads));
+                if (compilerConfig.nThreads < 1)
                 {
                     Usage();
-                    CleanupPathEntries();
                     return 1;
                 }
                 break;
@@ -232,7 +1010,6 @@ int main(int argc, char* argv[])
                 else
                 {
                     Usage();
-                    CleanupPathEntries();
                     return 1;
                 }
                 break;
@@ -259,15 +1036,13 @@ int main(int argc, char* argv[])
                     else
                     {
                         Usage();
-                        CleanupPathEntries();
                         return 1;
                     }
-                    // just skipping these for now
+                    defines.push_back(p);
                 }
                 else
                 {
                     Usage();
-                    CleanupPathEntries();
                     return 1;
                 }
                 break;
@@ -312,7 +1087,6 @@ int main(int argc, char* argv[])
                         else
                         {
                             Usage();
-                            CleanupPathEntries();
                             return 1;
                         }
                         break;
@@ -335,179 +1109,554 @@ int main(int argc, char* argv[])
                 compilerConfig.bUnusedMethodElimination = true;
                 break;
 
+            case '-':
+                if (strcmp(argv[i], "--cache-dir") == 0 && ++i < argc)
+                {
+                    compilerConfig.pCacheDir = argv[i];
+                }
+#ifdef __linux__
+                else if (strcmp(argv[i], "--watch") == 0 && !s_bServer)
+                {
+                    bWatch = true;
+                }
+#endif
+                else if (strcmp(argv[i], "--batch") == 0 && ++i < argc)
+                {
+                    pManifest = argv[i];
+                }
+                else if (strcmp(argv[i], "--config") == 0 && ++i < argc && compilerConfig.bUsePreprocessor)
+                {
+                    BuildConfig config;
+                    if (!ParseConfig(argv[i], config))
+                    {
+                        Usage();
+                        return 1;
+                    }
+                    configs.push_back(config);
+                }
+                else
+                {
+                    Usage();
+                    return 1;
+                }
+                break;
+
             case 'h':
             default:
                 Usage();
-                CleanupPathEntries();
                 return 1;
                 break;
             }
         }
-        else // handle the input filename
+        else // handle the input filenames
         {
-            if (infile)
-            {
-                Usage();
-                CleanupPathEntries();
-                return 1;
-            }
-            infile = argv[i];
+            BatchImage image;
+            image.input = argv[i];
+            images.push_back(image);
         }
     }
 
+    if (pManifest && !ReadManifest(pManifest, compilerConfig.bUsePreprocessor, images))
+    {
+        return 1;
+    }
+
     // must have input file
-    if (!infile)
+    if (images.empty())
+    {
+        Usage();
+        return 1;
+    }
+
+    if (outfile)
+    {
+        if (images.size() > 1 || pManifest)
+        {
+            Usage();
+            return 1;
+        }
+        images[0].output = outfile;
+    }
+
+#ifndef WIN32
+    if (s_bServer && compilerConfig.bFileListOutputOnly)
+    {
+        // the server has opened the files of its earlier requests too
+        PrintTo(stdout, "ERROR: -f can not be used with the server\n");
+        return 1;
+    }
+#endif
+
+    // the object tree and file list only scan the objects, which leaves no symbols or listing
+    if ((compilerConfig.bFileTreeOutputOnly || compilerConfig.bFileListOutputOnly) && (compilerConfig.bDumpSymbols || mode != amNone))
     {
         Usage();
-        CleanupPathEntries();
         return 1;
     }
 
+    // several files (or configurations) are compiled in turn, with the objects of each kept for the next
+    bool bBatch = (images.size() > 1 || pManifest || !configs.empty());
+    if (bBatch)
+    {
+        if (mode != amNone || compilerConfig.bFileTreeOutputOnly || compilerConfig.bFileListOutputOnly || compilerConfig.bDumpSymbols)
+        {
+            Usage();
+            return 1;
+        }
+        compilerConfig.bKeepObjects = true;
+    }
+
+#ifdef __linux__
+    if (bWatch)
+    {
+        // the file list would grow with every compile
+        if (compilerConfig.bFileListOutputOnly)
+        {
+            Usage();
+            return 1;
+        }
+        compilerConfig.bKeepObjects = true;
+        s_bStampFiles = true;
+    }
+#endif
+
     if ( mode == amOutput )
     {
         if (outfile) psList = outfile;
-        else psList = infile;
+        else psList = images[0].input.c_str();
     }
-    AL_Request (mode, psList);
-
     if (compilerConfig.bFileTreeOutputOnly || compilerConfig.bFileListOutputOnly || compilerConfig.bDumpSymbols)
     {
         compilerConfig.bQuiet = true;
     }
+    if (compilerConfig.bFileListOutputOnly)
+    {
+        // the file list is in the order the files were opened
+        compilerConfig.nThreads = 1;
+    }
+
+    std::string cacheDir;
+    if (compilerConfig.pCacheDir)
+    {
+        cacheDir = ClientPath(compilerConfig.pCacheDir);
+        compilerConfig.pCacheDir = cacheDir.c_str();
 
-    // finish the include path
-    AddFilePath(infile);
+        // entries are only written to a directory that exists
+#ifdef WIN32
+        _mkdir(compilerConfig.pCacheDir);
+#else
+        mkdir(compilerConfig.pCacheDir, 0777);
+#endif
+    }
 
-    char outputFilename[256];
-    if (!outfile)
+    for (size_t i = 0; i < images.size(); i++)
     {
-        // create *.binary filename from user passed in spin filename
-        strcpy(&outputFilename[0], infile);
-        const char* pTemp = strstr(&outputFilename[0], ".spin");
-        if (pTemp == 0)
+        if (images[i].output.empty() && !MakeOutputFilename(images[i].input, compilerConfig, images[i].output))
         {
-            printf("ERROR: spinfile must have .spin extension. You passed in: %s\n", infile);
             Usage();
-            CleanupPathEntries();
             return 1;
         }
-        else
+    }
+
+    // each file is compiled for every configuration in turn, so the objects a configuration doesn't
+    // affect are taken from the compile before
+    if (!configs.empty())
+    {
+        std::vector<BatchImage> configImages;
+        for (size_t i = 0; i < images.size(); i++)
         {
-            int offset = (int)(pTemp - &outputFilename[0]);
-            outputFilename[offset+1] = 0;
-            if (compilerConfig.bDATonly)
-            {
-                strcat(&outputFilename[0], "dat");
-            }
-            else if (compilerConfig.bBinary)
-            {
-                strcat(&outputFilename[0], "binary");
-            }
-            else 
+            for (size_t j = 0; j < configs.size(); j++)
             {
-                strcat(&outputFilename[0], "eeprom");
+                BatchImage image = images[i];
+                image.output = AddConfigName(images[i].output, configs[j].name);
+                image.defines.insert(image.defines.end(), configs[j].defines.begin(), configs[j].defines.end());
+                configImages.push_back(image);
             }
         }
+        images.swap(configImages);
     }
-    else // use filename specified with -o
+
+    if (bDependencies)
     {
-        strcpy(outputFilename, outfile);
+        // one file can't be named for several images
+        if (pDependencyFile && images.size() > 1)
+        {
+            Usage();
+            return 1;
+        }
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            images[i].dependencyFile = pDependencyFile ? pDependencyFile : ReplaceExtension(images[i].output, ".d");
+        }
     }
 
     if (!compilerConfig.bQuiet)
     {
         Banner();
-        printf("Compiling...\n%s\n", infile);
     }
 
-    InitCompiler(&compilerConfig, LoadFile, FreeFileBuffer);
+    CompilerContext* pContext = 0;
+#ifndef WIN32
+    if (s_bServer)
+    {
+        pContext = GetServerContext(compilerConfig, includePaths);
+    }
+    else
+#endif
+    {
+        pContext = InitCompiler(&compilerConfig, LoadFile, FreeFileBuffer);
+#ifdef __linux__
+        if (bWatch)
+        {
+            // an #error fails the compile rather than ending the watch
+            SetCompilerOutput(pContext, 0, 0, 0);
+        }
+#endif
+        for (size_t i = 0; i < includePaths.size(); i++)
+        {
+            AddPath(includePaths[i]);
+        }
+    }
+#ifndef WIN32
+    if (s_bServer && (mode == amOutput || mode == amFile))
+    {
+        // the listing is sent to the client to write, named as AL_Request() names it
+        const char* pExtension = strrchr(psList, '.');
+        s_serverListFile = (mode == amFile || pExtension == NULL) ? psList : std::string(psList, pExtension - psList);
+        if (mode == amOutput)
+        {
+            s_serverListFile += ".lst";
+        }
+        mode = amConsole;
+    }
+#endif
+    AL_Request (mode, psList);
+
+    bool bFailed = !CompileImages(pContext, compilerConfig, images, defines, bWatch);
+#ifdef __linux__
+    // after each change the images are compiled again, from the objects it didn't affect
+    while (bWatch)
+    {
+        if (!compilerConfig.bQuiet)
+        {
+            printf("Watching for changes...\n");
+        }
+        fflush(stdout);
+        if (!WaitForChanges(pContext))
+        {
+            bFailed = true;
+            break;
+        }
+        AL_Request (mode, psList);
+        bFailed = !CompileImages(pContext, compilerConfig, images, defines, bWatch);
+    }
+#endif
 
-    if (compilerConfig.bUsePreprocessor)
+    if (!bFailed && compilerConfig.bFileListOutputOnly)
     {
-        // go through the command line arguments again, this time only processing -D
-        for(int i = 1; i < argc; i++)
+        for (size_t i = 0; i < s_filesAccessed.size(); i++)
         {
-            // handle switches
-            if(argv[i][0] == '-')
-            {
-                if (argv[i][1] == 'D')
-                {
-                    if (argv[i][2])
-                    {
-                        p = &argv[i][2];
-                    }
-                    else if(++i < argc)
-                    {
-                        p = argv[i];
-                    }
-                    else
-                    {
-                        Usage();
-                        ShutdownCompiler();
-                        CleanupPathEntries();
-                        return 1;
-                    }
+            PrintTo(stdout, "%s\n", s_filesAccessed[i]);
+        }
+    }
 
-                    // add any predefined symbols here - note that when using the 
-                    // "alternate" rules, these symbols have a null value - i.e.
-                    // they are just "defined", but are not used in macro substitution
-                    SetDefine(p, (compilerConfig.bAlternatePreprocessorMode ? "" : "1"));
-                }
+#ifndef WIN32
+    if (s_bServer)
+    {
+        // the context, include path and file paths stay for the next request
+        return bFailed ? 1 : 0;
+    }
+#endif
+
+    ShutdownCompiler(pContext);
+    CleanupPathEntries();
+    CleanupFilesAccessed();
+
+    return bFailed ? 1 : 0;
+}
+
+#ifndef WIN32
+// the most a request can be, and how long a client has to send it or take each part of the reply
+#define SERVER_REQUEST_LIMIT        (1024 * 1024)
+#define SERVER_CLIENT_TIMEOUT       10
+
+// reads exactly nLength bytes, returning false if the connection ends (or times out) first
+static bool ReadFully(int connection, char* pBuffer, size_t nLength)
+{
+    for (size_t nDone = 0; nDone < nLength; )
+    {
+        ssize_t nRead = read(connection, pBuffer + nDone, nLength - nDone);
+        if (nRead <= 0)
+        {
+            if (nRead == -1 && errno == EINTR)
+            {
+                continue;
             }
+            return false;
         }
-
-        // add symbols with predefined values here
-        SetDefine("__SPIN__", "1");
-        SetDefine("__TARGET__", "P1");
+        nDone += nRead;
     }
+    return true;
+}
 
-    int nLength = 0;
-    unsigned char* pBuffer = CompileSpin(infile, &nLength);
+// Reads a request from a client (its length, 4 bytes most significant first, then its directory and arguments,
+// each ending with a 0) and compiles it with the names it gives taken from that directory, sending back what is
+// printed and the files written as they come (see SendReplyRecord), then the exit code.  The server's own directory
+// and output stay as they are.  A client that doesn't send its request, or stops taking the reply, is given up on
+// after SERVER_CLIENT_TIMEOUT seconds, so it can't hold up the clients after it.
+static void ServeRequest(int connection)
+{
+    struct timeval timeout;
+    timeout.tv_sec = SERVER_CLIENT_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 
-    if (pBuffer)
+    unsigned char header[4];
+    if (!ReadFully(connection, (char*)header, sizeof(header)))
+    {
+        return;
+    }
+    size_t nRequest = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | header[3];
+    if (nRequest > SERVER_REQUEST_LIMIT)
+    {
+        return;
+    }
+    std::string request(nRequest, '\0');
+    if (!ReadFully(connection, &request[0], nRequest))
+    {
+        return;
+    }
+    std::vector<std::string> args;
+    for (size_t start = 0; start < request.size(); )
     {
-        FILE* pFile = fopen(outputFilename, "wb");
-        if (pFile)
+        size_t end = request.find('\0', start);
+        if (end == std::string::npos)
         {
-            fwrite(pBuffer, nLength, 1, pFile);
-            fclose(pFile);
+            return;
         }
+        args.push_back(request.substr(start, end - start));
+        start = end + 1;
+    }
+    if (args.empty())
+    {
+        return;
+    }
+
+    s_nServerConnection = connection;
+    s_bClientGone = false;
+    int rc = 1;
+    if (args[0].empty() || args[0][0] != DIR_SEP)
+    {
+        PrintTo(stdout, "ERROR: can not compile in directory %s\n", args[0].c_str());
     }
     else
     {
-        // compiler put out an error
-        ShutdownCompiler();
-        CleanupPathEntries();
+        SetBaseDirectory(args[0].c_str());
+        std::vector<char*> argv;
+        argv.push_back((char*)"openspin");
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            argv.push_back(&args[i][0]);
+        }
+        argv.push_back(0);
+        rc = RunOpenSpin((int)argv.size() - 1, &argv[0]);
+    }
+
+    char status[16];
+    int nStatus = sprintf(status, "%d", rc);
+    SendReplyRecord('s', status, nStatus);
+    SetBaseDirectory(NULL);
+    s_nServerConnection = -1;
+    s_serverListFile.clear();
+}
+
+static bool SetSocketAddress(struct sockaddr_un& address, const char* pSocketPath)
+{
+    if (strlen(pSocketPath) >= sizeof(address.sun_path))
+    {
+        printf("ERROR: socket path too long: %s\n", pSocketPath);
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, pSocketPath);
+    return true;
+}
+
+// Compiles for --connect clients, one at a time, until killed
+static int RunServer(const char* pSocketPath)
+{
+    struct sockaddr_un address;
+    if (!SetSocketAddress(address, pSocketPath))
+    {
         return 1;
     }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(pSocketPath);
+    if (listener == -1 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        printf("ERROR: can not listen on %s\n", pSocketPath);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    s_bServer = true;
+    s_bStampFiles = true;
 
-    if (compilerConfig.bFileListOutputOnly)
+    for (;;)
     {
-        for (int i = 0; i < s_nFilesAccessed; i++)
+        int connection = accept(listener, 0, 0);
+        if (connection == -1)
         {
-            for (int j = i+1; j < s_nFilesAccessed; j++)
+            if (errno == EINTR)
             {
-                if (strcmp(s_filesAccessed[i], s_filesAccessed[j]) == 0)
-                {
-                    s_filesAccessed[j][0] = 0;
-                }
+                continue;
             }
+            break;
+        }
+        ServeRequest(connection);
+        close(connection);
+    }
+
+    close(listener);
+    return 1;
+}
+
+// Has the server on the socket compile with the arguments, printing what it sends back and writing the files it
+// sends.  Returns the exit code, or -1 if there is no server to connect to.
+static int RunClient(const char* pSocketPath, int argc, char* argv[])
+{
+    struct sockaddr_un address;
+    char cwd[PATH_MAX];
+    if (!SetSocketAddress(address, pSocketPath) || getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        return -1;
+    }
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection == -1)
+    {
+        return -1;
+    }
+    if (connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        close(connection);
+        return -1;
+    }
+
+    // the length of the request goes first, so the server doesn't wait for the end of the connection
+    std::string request(4, '\0');
+    request.append(cwd, strlen(cwd) + 1);
+    for (int i = 0; i < argc; i++)
+    {
+        request.append(argv[i], strlen(argv[i]) + 1);
+    }
+    size_t nRequest = request.size() - 4;
+    request[0] = (char)(nRequest >> 24);
+    request[1] = (char)(nRequest >> 16);
+    request[2] = (char)(nRequest >> 8);
+    request[3] = (char)nRequest;
+    for (size_t nSent = 0; nSent < request.size(); )
+    {
+        ssize_t nWritten = write(connection, request.data() + nSent, request.size() - nSent);
+        if (nWritten <= 0)
+        {
+            break;
         }
+        nSent += nWritten;
+    }
+    shutdown(connection, SHUT_WR);
 
-        for (int i = 0; i < s_nFilesAccessed; i++)
+    // the records of the reply, each taken as soon as it is all read
+    std::string reply;
+    size_t nReplyUsed = 0;
+    std::string status;
+    bool bStatus = false;
+    bool bWriteFailed = false;
+    char buffer[4096];
+    ssize_t nRead;
+    while (!bStatus && (nRead = read(connection, buffer, sizeof(buffer))) > 0)
+    {
+        reply.append(buffer, nRead);
+        while (!bStatus && reply.size() - nReplyUsed >= 5)
         {
-            if (s_filesAccessed[i][0] != 0)
+            const unsigned char* pHeader = (const unsigned char*)reply.data() + nReplyUsed;
+            size_t nLength = ((size_t)pHeader[1] << 24) | ((size_t)pHeader[2] << 16) | ((size_t)pHeader[3] << 8) | pHeader[4];
+            if (reply.size() - nReplyUsed - 5 < nLength)
+            {
+                break;
+            }
+            const char* pData = reply.data() + nReplyUsed + 5;
+            if (pHeader[0] == 'p')
+            {
+                fwrite(pData, 1, nLength, stdout);
+            }
+            else if (pHeader[0] == 'e')
+            {
+                fflush(stdout);
+                fwrite(pData, 1, nLength, stderr);
+            }
+            else if (pHeader[0] == 'f')
             {
-                printf("%s\n", s_filesAccessed[i]);
+                // the name comes first, ending with a 0
+                const char* pEndName = (const char*)memchr(pData, 0, nLength);
+                size_t nContents = pEndName ? nLength - (pEndName + 1 - pData) : 0;
+                FILE* pFile = pEndName ? fopen(pData, "wb") : NULL;
+                bool bWritten = pFile != NULL && fwrite(pEndName + 1, 1, nContents, pFile) == nContents;
+                if (pFile != NULL && fclose(pFile) != 0)
+                {
+                    bWritten = false;
+                }
+                if (!bWritten)
+                {
+                    printf("ERROR: can not write %s\n", pEndName ? pData : "a file");
+                    bWriteFailed = true;
+                }
             }
+            else if (pHeader[0] == 's')
+            {
+                status.assign(pData, nLength);
+                bStatus = true;
+            }
+            nReplyUsed += 5 + nLength;
+        }
+        if (nReplyUsed == reply.size())
+        {
+            reply.clear();
+            nReplyUsed = 0;
         }
     }
+    close(connection);
+    fflush(stdout);
 
+    if (!bStatus)
+    {
+        printf("ERROR: lost the connection to the server\n");
+        return 1;
+    }
+    int rc = atoi(status.c_str());
+    return (rc == 0 && bWriteFailed) ? 1 : rc;
+}
+#endif
 
-    ShutdownCompiler();
-    CleanupPathEntries();
-
-    return 0;
+int main(int argc, char* argv[])
+{
+#ifndef WIN32
+    if (argc == 3 && strcmp(argv[1], "--server") == 0)
+    {
+        return RunServer(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--connect") == 0)
+    {
+        int rc = RunClient(argv[2], argc - 3, &argv[3]);
+        if (rc != -1)
+        {
+            return rc;
+        }
+        // without a server it compiles by itself, argv[2] standing in for the program name
+        return RunOpenSpin(argc - 2, &argv[2]);
+    }
+#endif
+    return RunOpenSpin(argc, argv);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -11,79 +11,261 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <map>
+#include <string>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "pathentry.h"
 
 PathEntry *path = NULL;
 static PathEntry **pNextPathEntry = &path;
+static PathEntry *filePathEntry = NULL;    // the directory of the file being compiled
 
 static char lastfullpath[PATH_MAX];
+static std::string baseDirectory;          // relative names and paths are relative to it when set, not the current directory
 
-const char *MakeNextPath(PathEntry **entry, const char *name)
+// where a name was found
+struct ResolvedName
 {
-    if (!*entry)
+    bool bFound;
+    PathEntry *entry;   // the path it was found in, or NULL when it was found by its name
+};
+static std::map<std::string, ResolvedName> s_resolvedNames;
+
+static FILE *OpenInPath(PathEntry *entry, const char *name, const char *mode)
+{
+    FILE *file = NULL;
+#ifndef WIN32
+    if (name[0] != DIR_SEP)
+    {
+        if (entry->dirfd == -1)
+        {
+            char dir[PATH_MAX];
+            snprintf(dir, sizeof(dir), "%s%c", entry->path, DIR_SEP);
+            entry->dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+            if (entry->dirfd == -1)
+            {
+                entry->dirfd = -2;
+            }
+        }
+        if (entry->dirfd >= 0)
+        {
+            int fd = openat(entry->dirfd, name, O_RDONLY);
+            if (fd != -1)
+            {
+                file = fdopen(fd, mode);
+                if (!file)
+                {
+                    close(fd);
+                }
+            }
+        }
+        if (file)
+        {
+            snprintf(lastfullpath, sizeof(lastfullpath), "%s%c%s", entry->path, DIR_SEP, name);
+        }
+        return file;
+    }
+#endif
+    snprintf(lastfullpath, sizeof(lastfullpath), "%s%c%s", entry->path, DIR_SEP, name);
+    return fopen(lastfullpath, mode);
+}
+
+static bool IsRelative(const char *name)
+{
+#ifdef WIN32
+    return name[0] != '\\' && name[0] != '/' && !(name[0] != 0 && name[1] == ':');
+#else
+    return name[0] != DIR_SEP;
+#endif
+}
+
+// the name with the base directory in front when it is relative to it
+static std::string BasePath(const char *name)
+{
+    if (baseDirectory.empty() || !IsRelative(name))
+    {
+        return name;
+    }
+    return baseDirectory + DIR_SEP_STR + name;
+}
+
+// opens a file by its name, setting lastfullpath when that isn't the name itself
+static FILE *OpenByName(const char *name, const char *mode)
+{
+    if (baseDirectory.empty() || !IsRelative(name))
+    {
+        return fopen(name, mode);
+    }
+    snprintf(lastfullpath, sizeof(lastfullpath), "%s%c%s", baseDirectory.c_str(), DIR_SEP, name);
+    return fopen(lastfullpath, mode);
+}
+
+// looks for a name by itself and then in each path in turn
+static FILE *SearchPath(const char *name, const char *mode, ResolvedName *resolved)
+{
+    resolved->entry = NULL;
+    FILE *file = OpenByName(name, mode);
+    for (PathEntry *entry = path; !file && entry; entry = entry->next)
+    {
+        file = OpenInPath(entry, name, mode);
+        if (file)
+        {
+            resolved->entry = entry;
+        }
+    }
+    resolved->bFound = (file != NULL);
+    return file;
+}
+
+FILE *FindFileInPath(const char *name, const char *mode, const char **ppFoundPath)
+{
+    *ppFoundPath = NULL;
+    std::map<std::string, ResolvedName>::iterator it = s_resolvedNames.find(name);
+    if (it != s_resolvedNames.end())
     {
-        *entry = path;
+        if (!it->second.bFound)
+        {
+            return NULL;
+        }
+        FILE *file = it->second.entry ? OpenInPath(it->second.entry, name, mode) : OpenByName(name, mode);
+        if (file)
+        {
+            *ppFoundPath = (it->second.entry || BasePath(name) != name) ? lastfullpath : NULL;
+            return file;
+        }
+        // it has gone since, so look for it again
     }
-    else
+
+    ResolvedName resolved;
+    FILE *file = SearchPath(name, mode, &resolved);
+    if (resolved.entry || (file && BasePath(name) != name))
     {
-        *entry = (*entry)->next;
+        *ppFoundPath = lastfullpath;
     }
-    if (*entry)
+    s_resolvedNames[name] = resolved;
+    return file;
+}
+
+bool RecheckResolvedNames()
+{
+    for (std::map<std::string, ResolvedName>::iterator it = s_resolvedNames.begin(); it != s_resolvedNames.end(); it++)
     {
-        sprintf(lastfullpath, "%s%c%s", (*entry)->path, DIR_SEP, name);
-        return lastfullpath;
+        ResolvedName resolved;
+        FILE *file = SearchPath(it->first.c_str(), "rb", &resolved);
+        if (file)
+        {
+            fclose(file);
+        }
+        if (resolved.bFound != it->second.bFound || resolved.entry != it->second.entry)
+        {
+            s_resolvedNames.clear();
+            return true;
+        }
     }
-    return NULL;
+    return false;
 }
 
 bool AddPath(const char *newPath)
 {
-    PathEntry* entry = (PathEntry*)new char[(sizeof(PathEntry) + strlen(newPath))];
+    std::string fullPath = BasePath(newPath);
+    PathEntry* entry = (PathEntry*)new char[(sizeof(PathEntry) + fullPath.size())];
     if (!(entry))
     {
         return false;
     }
-    strcpy(entry->path, newPath);
+    strcpy(entry->path, fullPath.c_str());
+    entry->dirfd = -1;
     *pNextPathEntry = entry;
     pNextPathEntry = &entry->next;
     entry->next = NULL;
     return true;
 }
 
-bool AddFilePath(const char *name)
+const PathEntry *GetPathEntries()
+{
+    return path;
+}
+
+static void ClosePathEntry(PathEntry *entry)
 {
-    const char* end = strrchr(name, DIR_SEP);
-    if (!end)
+#ifndef WIN32
+    if (entry->dirfd >= 0)
     {
-        return false;
+        close(entry->dirfd);
     }
-    int len = (int)(end - name);
-    PathEntry *entry = (PathEntry*)new char[(sizeof(PathEntry) + len)];
-    if (!entry)
+#endif
+    delete [] entry;
+}
+
+bool SetFilePath(const char *name)
+{
+    std::string fullName = BasePath(name);
+    const char* end = strrchr(name, DIR_SEP) ? strrchr(fullName.c_str(), DIR_SEP) : NULL;
+    name = fullName.c_str();
+    int len = end ? (int)(end - name) : 0;
+    if (filePathEntry ? (end && (int)strlen(filePathEntry->path) == len && strncmp(filePathEntry->path, name, len) == 0) : !end)
     {
         return false;
     }
-    strncpy(entry->path, name, len);
-    entry->path[len] = '\0';
-    *pNextPathEntry = entry;
-    pNextPathEntry = &entry->next;
-    entry->next = NULL;
 
+    // it is the last path searched
+    if (filePathEntry)
+    {
+        PathEntry **ppEntry = &path;
+        while (*ppEntry != filePathEntry)
+        {
+            ppEntry = &(*ppEntry)->next;
+        }
+        *ppEntry = NULL;
+        pNextPathEntry = ppEntry;
+        ClosePathEntry(filePathEntry);
+        filePathEntry = NULL;
+    }
+    if (end)
+    {
+        PathEntry *entry = (PathEntry*)new char[(sizeof(PathEntry) + len)];
+        strncpy(entry->path, name, len);
+        entry->path[len] = '\0';
+        entry->dirfd = -1;
+        *pNextPathEntry = entry;
+        pNextPathEntry = &entry->next;
+        entry->next = NULL;
+        filePathEntry = entry;
+    }
+
+    // names may be found somewhere else now
+    s_resolvedNames.clear();
     return true;
 }
 
+void SetBaseDirectory(const char *dir)
+{
+    baseDirectory = dir ? dir : "";
+}
+
+const char *GetBaseDirectory()
+{
+    return baseDirectory.empty() ? NULL : baseDirectory.c_str();
+}
+
 void CleanupPathEntries()
 {
     PathEntry *entry = path;
     while (entry != NULL)
     {
         PathEntry *nextEntry = entry->next;
-        delete [] entry;
+        ClosePathEntry(entry);
         entry = nextEntry;
     }
     path = NULL;
+    filePathEntry = NULL;
+    pNextPathEntry = &path;
     lastfullpath[0] = 0;
+    s_resolvedNames.clear();
 }
 
 
@@ -13,6 +13,8 @@
 // code for handling directory paths (used with -I option)
 //
 
+#include <stdio.h>
+
 #ifndef PATH_MAX
 #define PATH_MAX 1024
 #endif
@@ -28,13 +30,28 @@
 struct PathEntry
 {
     PathEntry *next;
+    int dirfd;      // handle of the directory, opened the first time a file is looked for in it (-1 until then)
     char path[1];
 };
 
-const char *MakeNextPath(PathEntry **entry, const char *name); // pass the address of an entry that is NULL to get first path, keep calling with same entry to walk list
+// opens a file by its name, or else from the first path it is in, setting *ppFoundPath to that path (or NULL)
+// where each name was found, or that it wasn't, is remembered until CleanupPathEntries()
+FILE *FindFileInPath(const char *name, const char *mode, const char **ppFoundPath);
 bool AddPath(const char *path);
-bool AddFilePath(const char *name);
+// the include path, in the order it is searched
+const PathEntry *GetPathEntries();
+// sets the directory of the file being compiled as the last path searched, in place of the one set before,
+// returning true if that changed where names are looked for
+bool SetFilePath(const char *name);
+// looks for the names remembered again, returning true (and forgetting them) if one is now found somewhere else
+bool RecheckResolvedNames();
 void CleanupPathEntries();
+// sets the directory names that aren't absolute are relative to, in place of the current directory (for the
+// server, which opens them for clients in other directories), or NULL to go back to the current directory;
+// the paths added before are still relative to the one they were added with
+void SetBaseDirectory(const char *dir);
+// the directory set by SetBaseDirectory(), or NULL
+const char *GetBaseDirectory();
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 //                           TERMS OF USE: MIT License                                   //
@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// listing_loads.cpp
+//
+// Compiles an object tree through libopenspin with and without an annotated listing, and checks that the
+// listing loads no sources of its own: it takes them from the compile's source cache, by the key each object
+// was compiled under, even where the defines and comment nesting have changed since.  Also checks the listing
+// shows the side of an #ifdef the object was compiled from, not the one the defines end up selecting.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include "../PropellerCompiler/libopenspin.h"
+
+struct SourceFile
+{
+    const char* pName;
+    const char* pFullPath;
+    const char* pText;
+};
+
+// Pins is preprocessed twice, first without FAST for Top and then with Driver's define for its use there,
+// and the image keeps the first (as objects are reused by name), so the listing must show "return LED"
+// although FAST is defined by the end of the compile
+static const SourceFile s_files[] =
+{
+    { "Top.spin", "/src/Top.spin",
+      "#define LED 16\n"
+      "OBJ\n"
+      "  pins : \"Pins\"\n"
+      "  drv : \"Driver\"\n"
+      "PUB main\n"
+      "  drv.start(pins.led)\n"
+      "#undef LED\n"
+      "#define LED 17\n"
+      "OBJ\n"
+      "  pins2 : \"Pins\"\n"
+      "PUB second\n"
+      "  return pins2.led\n" },
+    { "Driver.spin", "/src/Driver.spin",
+      "#define FAST\n"
+      "OBJ\n"
+      "  pins : \"Pins\"\n"
+      "VAR\n"
+      "  long pin\n"
+      "PUB start(p)\n"
+      "  pin := p + pins.led\n" },
+    { "Pins.spin", "/src/Pins.spin",
+      "PUB led\n"
+      "#ifdef FAST\n"
+      "  return LED + 1\n"
+      "#else\n"
+      "  return LED\n"
+      "#endif\n" },
+};
+
+static std::map<std::string, int> s_loads;
+
+static const char* ReadSource(void* pUser, const char* pName, int* pnLength, const char** ppFullPath)
+{
+    for (size_t i = 0; i < sizeof(s_files) / sizeof(s_files[0]); i++)
+    {
+        if (strcmp(pName, s_files[i].pName) == 0 || strcmp(pName, s_files[i].pFullPath) == 0)
+        {
+            s_loads[s_files[i].pFullPath]++;
+            *pnLength = (int)strlen(s_files[i].pText);
+            *ppFullPath = s_files[i].pFullPath;
+            return s_files[i].pText;
+        }
+    }
+    return 0;
+}
+
+static void ReleaseSource(void* pUser, const char* pContents)
+{
+}
+
+// Compiles Top.spin, counting the sources loaded into s_loads, and sets listing to the listing if one is
+// wanted.  Returns false (having printed the messages) if the compile fails.
+static bool CompileTop(bool bListing, std::string& listing)
+{
+    s_loads.clear();
+    openspin_options options;
+    openspin_default_options(&options);
+    options.listing = bListing ? 1 : 0;
+    openspin_session* pSession = openspin_create(&options, ReadSource, ReleaseSource, 0);
+    if (pSession == 0)
+    {
+        return false;
+    }
+    bool bResult = openspin_compile(pSession, "Top.spin") != 0;
+    if (bResult && bListing)
+    {
+        size_t nSize = openspin_get_listing(pSession, 0, 0);
+        char* pListing = new char[nSize + 1];
+        openspin_get_listing(pSession, pListing, nSize + 1);
+        listing = pListing;
+        delete [] pListing;
+        bResult = nSize > 0;
+    }
+    if (!bResult)
+    {
+        char messages[4096];
+        openspin_get_messages(pSession, messages, sizeof(messages));
+        printf("%s", messages);
+    }
+    openspin_destroy(pSession);
+    return bResult;
+}
+
+// Returns whether the listing has a source line that is exactly pLine
+static bool HasSourceLine(const std::string& listing, const char* pLine)
+{
+    size_t nLength = strlen(pLine);
+    for (size_t nFound = listing.find(pLine); nFound != std::string::npos; nFound = listing.find(pLine, nFound + 1))
+    {
+        size_t nEnd = nFound + nLength;
+        if (nEnd == listing.size() || listing[nEnd] == '\r' || listing[nEnd] == '\n')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main()
+{
+    std::string listing;
+    if (!CompileTop(false, listing))
+    {
+        printf("listing_loads: FAILED, the tree didn't compile\n");
+        return 1;
+    }
+    std::map<std::string, int> compileLoads = s_loads;
+    if (!CompileTop(true, listing))
+    {
+        printf("listing_loads: FAILED, the listing didn't compile\n");
+        return 1;
+    }
+
+    int nFailed = 0;
+    for (size_t i = 0; i < sizeof(s_files) / sizeof(s_files[0]); i++)
+    {
+        int nLoads = s_loads[s_files[i].pFullPath];
+        int nCompileLoads = compileLoads[s_files[i].pFullPath];
+        if (nLoads != nCompileLoads)
+        {
+            printf("listing_loads: FAILED, %s was loaded %d times, but %d times without the listing\n",
+                   s_files[i].pFullPath, nLoads, nCompileLoads);
+            nFailed++;
+        }
+    }
+    if (compileLoads["/src/Pins.spin"] != 2)
+    {
+        printf("listing_loads: FAILED, /src/Pins.spin wasn't preprocessed under two define states\n");
+        nFailed++;
+    }
+    if (!HasSourceLine(listing, "  return 17") || HasSourceLine(listing, "  return 17 + 1"))
+    {
+        printf("listing_loads: FAILED, the listing doesn't show Pins.spin as it was compiled\n%s", listing.c_str());
+        nFailed++;
+    }
+    if (nFailed == 0)
+    {
+        printf("listing_loads: passed\n");
+    }
+    return nFailed == 0 ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////
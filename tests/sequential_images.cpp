@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////
+//                                                           //
+// Propeller Spin/PASM Compiler Command Line Tool 'OpenSpin' //
+// (c)2012-2016 Parallax Inc. DBA Parallax Semiconductor.    //
+// See end of file for terms of use.                         //
+//                                                           //
+///////////////////////////////////////////////////////////////
+//
+// sequential_images.cpp
+//
+// Compiles several images in turn on one libopenspin session, as batch mode, --config, --server and --watch
+// do, and checks that each compiles as it does on a session of its own: an image leaving the preprocessor
+// inside a comment (a "{" in a string, or an unclosed one) mustn't carry into the next.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "../PropellerCompiler/libopenspin.h"
+
+struct SourceFile
+{
+    const char* pName;
+    const char* pText;
+};
+
+static const SourceFile s_files[] =
+{
+    { "Brace.spin",
+      "PUB main\n"
+      "DAT\n"
+      "  byte \"{\", 0\n" },
+    { "Unclosed.spin",
+      "PUB main\n"
+      "{\n" },
+    { "Inc.spin",
+      "#include \"Pins.spinh\"\n"
+      "PUB main\n"
+      "  return LED\n" },
+    { "Pins.spinh",
+      "CON\n"
+      "  LED = 16\n" },
+};
+
+static const char* ReadSource(void* pUser, const char* pName, int* pnLength, const char** ppFullPath)
+{
+    for (size_t i = 0; i < sizeof(s_files) / sizeof(s_files[0]); i++)
+    {
+        if (strcmp(pName, s_files[i].pName) == 0)
+        {
+            *pnLength = (int)strlen(s_files[i].pText);
+            return s_files[i].pText;
+        }
+    }
+    return 0;
+}
+
+static void ReleaseSource(void* pUser, const char* pContents)
+{
+}
+
+// compiles each file in turn on one session, returning the number that didn't give the result expected
+static int CompileInTurn(const char* const* ppFiles, const int* pExpected, int nFiles)
+{
+    openspin_options options;
+    openspin_default_options(&options);
+    openspin_session* pSession = openspin_create(&options, ReadSource, ReleaseSource, 0);
+    if (pSession == 0)
+    {
+        printf("sequential_images: FAILED, no session\n");
+        return 1;
+    }
+    int nFailed = 0;
+    for (int i = 0; i < nFiles; i++)
+    {
+        int nResult = openspin_compile(pSession, ppFiles[i]);
+        if (nResult != pExpected[i])
+        {
+            char messages[4096];
+            openspin_get_messages(pSession, messages, sizeof(messages));
+            printf("%s", messages);
+            printf("sequential_images: FAILED, %s returned %d after %s\n", ppFiles[i], nResult, i > 0 ? ppFiles[i - 1] : "nothing");
+            nFailed++;
+        }
+    }
+    openspin_destroy(pSession);
+    return nFailed;
+}
+
+int main()
+{
+    static const char* const s_braceFirst[] = { "Brace.spin", "Inc.spin" };
+    static const int s_braceResults[] = { 1, 1 };
+    static const char* const s_unclosedFirst[] = { "Unclosed.spin", "Inc.spin", "Inc.spin" };
+    static const int s_unclosedResults[] = { 0, 1, 1 };
+
+    int nFailed = CompileInTurn(s_braceFirst, s_braceResults, 2);
+    nFailed += CompileInTurn(s_unclosedFirst, s_unclosedResults, 3);
+    if (nFailed == 0)
+    {
+        printf("sequential_images: passed\n");
+    }
+    return nFailed == 0 ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+//                           TERMS OF USE: MIT License                                   //
+///////////////////////////////////////////////////////////////////////////////////////////
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this  //
+// software and associated documentation files (the "Software"), to deal in the Software //
+// without restriction, including without limitation the rights to use, copy, modify,    //
+// merge, publish, distribute, sublicense, and/or sell copies of the Software, and to    //
+// permit persons to whom the Software is furnished to do so, subject to the following   //
+// conditions:                                                                           //
+//                                                                                       //
+// The above copyright notice and this permission notice shall be included in all copies //
+// or substantial portions of the Software.                                              //
+//                                                                                       //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,   //
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A         //
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT    //
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION     //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE        //
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+///////////////////////////////////////////////////////////////////////////////////////////